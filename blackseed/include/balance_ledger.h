@@ -0,0 +1,88 @@
+#ifndef BALANCE_LEDGER_H
+#define BALANCE_LEDGER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct Parameters;
+
+// Available leg1/leg2 balances of every exchange, kept in memory.
+// Spot fills are applied as they complete, and a background thread
+// re-reads the balances from the exchanges every 'interval', or sooner
+// for an exchange marked with requestReconcile().
+// getAvail returns NaN (unknownBalance()) when the exchange answers with
+// an error; the balances are then left as they were and read again later.
+// The currencies asked for are Leg1 and Leg2 in lower case, the adapters
+// only know "btc" and "usd" (main accepts no other pair).
+class BalanceLedger {
+public:
+  using getAvailFn =
+      std::function<double(Parameters &, std::string const &currency)>;
+
+  BalanceLedger(Parameters &params, std::vector<getAvailFn> getAvail,
+                std::chrono::seconds interval);
+  ~BalanceLedger();
+  BalanceLedger(const BalanceLedger &) = delete;
+  BalanceLedger &operator=(const BalanceLedger &) = delete;
+
+  // Reads the balances of one or all exchanges now, trying a few times
+  // with a growing delay. Returns false, and logs it, if some could not
+  // be read; the background thread then tries again.
+  bool reconcile(size_t exch);
+  bool reconcileAll();
+
+  // Starts the background reconciliation
+  void start();
+
+  double leg1(size_t exch) const;
+  double leg2(size_t exch) const;
+  // The balances of 'exch' were read at least once
+  bool known(size_t exch) const;
+  // The balances of 'exch' were read since the last requestReconcile()
+  bool reconciled(size_t exch) const;
+
+  // Books a filled spot order at its limit price, the fee being taken
+  // from leg2.
+  void applyFill(size_t exch, std::string const &direction, double quantity,
+                 double price);
+
+  // Balances of 'exch' changed in a way the ledger cannot compute (e.g. a
+  // margin order), the background thread re-reads them first.
+  void requestReconcile(size_t exch);
+
+private:
+  struct Account {
+    double leg1 = 0.0;
+    double leg2 = 0.0;
+    // Bumped by every local change, so a fetch that overlapped a fill
+    // does not overwrite it
+    unsigned version = 0;
+    bool dirty = false;
+    bool known = false;
+  };
+
+  void run();
+  // Fetches the balances of 'exch', returns false if the exchange answered
+  // with an error, or if a fill was applied meanwhile and the result was
+  // dropped
+  bool fetch(size_t exch);
+
+  Parameters &params;
+  const std::string leg1Currency;
+  const std::string leg2Currency;
+  const std::vector<getAvailFn> getAvail;
+  const std::chrono::seconds interval;
+
+  mutable std::mutex mtx;
+  std::condition_variable wake;
+  std::vector<Account> accounts;
+  bool stopping = false;
+  std::thread worker;
+};
+
+#endif
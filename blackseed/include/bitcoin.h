@@ -2,6 +2,7 @@
 #define BITCOIN_H
 
 #include "quote_t.h"
+#include <cstdint>
 #include <string>
 
 // Contains all the information for a given exchange, 
@@ -16,14 +17,22 @@ class Bitcoin {
     bool hasShort;
     bool isImplemented;
     double bid, ask;
+    // When the quote was received, see Clock::monoNs()
+    int64_t quoteTime;
+    // See VenueHealth, 1 until set
+    double health;
 
   public:
     Bitcoin(unsigned id, std::string n, double f, bool h, bool m);
-    void updateData(quote_t quote);
+    void updateData(quote_t quote, int64_t received);
     unsigned getId() const;
     double getAsk() const;
     double getBid() const;
     double getMidPrice() const;
+    // Nanoseconds since the quote was received
+    int64_t getQuoteAge() const;
+    void setHealth(double score);
+    double getHealth() const;
     std::string getExchName() const;
     double getFees() const;
     bool getHasShort() const;
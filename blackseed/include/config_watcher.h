@@ -0,0 +1,41 @@
+#ifndef CONFIG_WATCHER_H
+#define CONFIG_WATCHER_H
+
+#include <atomic>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct Parameters;
+
+// Reads the configuration file again whenever it is saved and, if it is
+// valid, publishes its strategy settings (see StrategyParams), exchange
+// fees and switches, and log level to the running bot. An invalid file is
+// logged and ignored, the current settings stay. The other parameters,
+// and exchanges that were not running at startup, need a restart.
+// Changes are seen through inotify on Linux, by checking the file's
+// modification time every second elsewhere.
+class ConfigWatcher {
+public:
+  // The exchanges must be added to params (enabledExchanges) first
+  explicit ConfigWatcher(Parameters &params);
+  ~ConfigWatcher();
+  ConfigWatcher(const ConfigWatcher &) = delete;
+  ConfigWatcher &operator=(const ConfigWatcher &) = delete;
+
+private:
+  void run();
+  // Blocks until the file changed, returns false when stopping
+  bool waitForChange();
+  void reload();
+
+  Parameters &params;
+  // The file as last applied, to log what changed
+  std::map<std::string, std::string> current;
+  std::vector<std::string> notRunning;
+  std::atomic<bool> stopping{false};
+  std::thread worker;
+};
+
+#endif
@@ -0,0 +1,517 @@
+#ifndef EXCHANGE_REGISTRY_H
+#define EXCHANGE_REGISTRY_H
+
+#include "order_type.h"
+#include "paper_trading.h"
+#include "parameters.h"
+#include "quote_t.h"
+#include "utils/task.h"
+#include "exchanges/bitfinex.h"
+#include "exchanges/okcoin.h"
+#include "exchanges/bitstamp.h"
+#include "exchanges/gemini.h"
+#include "exchanges/kraken.h"
+#include "exchanges/itbit.h"
+#include "exchanges/wex.h"
+#include "exchanges/poloniex.h"
+#include "exchanges/coinbase.h"
+#include "exchanges/exmo.h"
+#include "exchanges/cexio.h"
+#include "exchanges/bittrex.h"
+#include "exchanges/binance.h"
+
+#include <string>
+#include <type_traits>
+#include <variant>
+#include <vector>
+
+// One type per exchange adapter: its name, database table, whether it can
+// short and whether its trading functions are implemented, the keys that
+// enable it in the configuration, and its functions. An adapter without
+// short orders, or without orders at all, simply has no such member.
+// Orders are good till canceled, unless the adapter lists the other types
+// it can send in orderTypes; it then takes the type as the last argument
+// of its send functions. getOrderStatus reads an order's fills back and
+// cancelOrder cancels it; ItBit, which takes no order, has neither.
+namespace Registry {
+
+struct BitfinexEntry {
+  static constexpr const char *name = "Bitfinex";
+  static constexpr const char *dbTable = "bitfinex";
+  static constexpr bool canShort = true;
+  static constexpr bool isImplemented = true;
+  static constexpr auto enable = &Parameters::bitfinexEnable;
+  static constexpr auto apiKey = &Parameters::bitfinexApi;
+  static constexpr auto fees = &Parameters::bitfinexFees;
+  static constexpr auto getQuote = Bitfinex::getQuote;
+  static constexpr auto getAvail = Bitfinex::getAvail;
+  static constexpr auto sendLongOrder = Bitfinex::sendLongOrder;
+  static constexpr auto sendShortOrder = Bitfinex::sendShortOrder;
+  static constexpr auto isOrderComplete = Bitfinex::isOrderComplete;
+  static constexpr unsigned orderTypes =
+      orderTypeBit(OrderType::fok) | orderTypeBit(OrderType::postOnly);
+  static constexpr auto getOrderStatus = Bitfinex::getOrderStatus;
+  static constexpr auto cancelOrder = Bitfinex::cancelOrder;
+  static constexpr auto getActivePos = Bitfinex::getActivePos;
+  static constexpr auto getLimitPrice = Bitfinex::getLimitPrice;
+};
+
+struct OKCoinEntry {
+  static constexpr const char *name = "OKCoin";
+  static constexpr const char *dbTable = "okcoin";
+  static constexpr bool canShort = false;
+  static constexpr bool isImplemented = true;
+  static constexpr auto enable = &Parameters::okcoinEnable;
+  static constexpr auto apiKey = &Parameters::okcoinApi;
+  static constexpr auto fees = &Parameters::okcoinFees;
+  static constexpr auto getQuote = OKCoin::getQuote;
+  static constexpr auto getAvail = OKCoin::getAvail;
+  static constexpr auto sendLongOrder = OKCoin::sendLongOrder;
+  static constexpr auto sendShortOrder = OKCoin::sendShortOrder;
+  static constexpr auto isOrderComplete = OKCoin::isOrderComplete;
+  static constexpr auto getOrderStatus = OKCoin::getOrderStatus;
+  static constexpr auto cancelOrder = OKCoin::cancelOrder;
+  static constexpr auto getActivePos = OKCoin::getActivePos;
+  static constexpr auto getLimitPrice = OKCoin::getLimitPrice;
+};
+
+struct BitstampEntry {
+  static constexpr const char *name = "Bitstamp";
+  static constexpr const char *dbTable = "bitstamp";
+  static constexpr bool canShort = false;
+  static constexpr bool isImplemented = true;
+  static constexpr auto enable = &Parameters::bitstampEnable;
+  static constexpr auto apiKey = &Parameters::bitstampClientId;
+  static constexpr auto fees = &Parameters::bitstampFees;
+  static constexpr auto getQuote = Bitstamp::getQuote;
+  static constexpr auto getAvail = Bitstamp::getAvail;
+  static constexpr auto sendLongOrder = Bitstamp::sendLongOrder;
+  static constexpr auto isOrderComplete = Bitstamp::isOrderComplete;
+  static constexpr auto getOrderStatus = Bitstamp::getOrderStatus;
+  static constexpr auto cancelOrder = Bitstamp::cancelOrder;
+  static constexpr auto getActivePos = Bitstamp::getActivePos;
+  static constexpr auto getLimitPrice = Bitstamp::getLimitPrice;
+};
+
+struct GeminiEntry {
+  static constexpr const char *name = "Gemini";
+  static constexpr const char *dbTable = "gemini";
+  static constexpr bool canShort = false;
+  static constexpr bool isImplemented = true;
+  static constexpr auto enable = &Parameters::geminiEnable;
+  static constexpr auto apiKey = &Parameters::geminiApi;
+  static constexpr auto fees = &Parameters::geminiFees;
+  static constexpr auto getQuote = Gemini::getQuote;
+  static constexpr auto getAvail = Gemini::getAvail;
+  static constexpr auto sendLongOrder = Gemini::sendLongOrder;
+  static constexpr auto isOrderComplete = Gemini::isOrderComplete;
+  static constexpr auto getOrderStatus = Gemini::getOrderStatus;
+  static constexpr auto cancelOrder = Gemini::cancelOrder;
+  static constexpr auto getActivePos = Gemini::getActivePos;
+  static constexpr auto getLimitPrice = Gemini::getLimitPrice;
+};
+
+struct KrakenEntry {
+  static constexpr const char *name = "Kraken";
+  static constexpr const char *dbTable = "kraken";
+  static constexpr bool canShort = false;
+  static constexpr bool isImplemented = true;
+  static constexpr auto enable = &Parameters::krakenEnable;
+  static constexpr auto apiKey = &Parameters::krakenApi;
+  static constexpr auto fees = &Parameters::krakenFees;
+  static constexpr auto getQuote = Kraken::getQuote;
+  static constexpr auto getAvail = Kraken::getAvail;
+  static constexpr auto sendLongOrder = Kraken::sendLongOrder;
+  static constexpr auto sendShortOrder = Kraken::sendShortOrder;
+  static constexpr auto isOrderComplete = Kraken::isOrderComplete;
+  static constexpr unsigned orderTypes =
+      orderTypeBit(OrderType::ioc) | orderTypeBit(OrderType::postOnly);
+  static constexpr auto getOrderStatus = Kraken::getOrderStatus;
+  static constexpr auto cancelOrder = Kraken::cancelOrder;
+  static constexpr auto getActivePos = Kraken::getActivePos;
+  static constexpr auto getLimitPrice = Kraken::getLimitPrice;
+};
+
+struct ItBitEntry {
+  static constexpr const char *name = "ItBit";
+  static constexpr const char *dbTable = "itbit";
+  static constexpr bool canShort = false;
+  static constexpr bool isImplemented = false;
+  static constexpr auto enable = &Parameters::itbitEnable;
+  static constexpr auto apiKey = &Parameters::itbitApi;
+  static constexpr auto fees = &Parameters::itbitFees;
+  static constexpr auto getQuote = ItBit::getQuote;
+  static constexpr auto getAvail = ItBit::getAvail;
+  static constexpr auto getActivePos = ItBit::getActivePos;
+  static constexpr auto getLimitPrice = ItBit::getLimitPrice;
+};
+
+struct WEXEntry {
+  static constexpr const char *name = "WEX";
+  static constexpr const char *dbTable = "wex";
+  static constexpr bool canShort = false;
+  static constexpr bool isImplemented = true;
+  static constexpr auto enable = &Parameters::wexEnable;
+  static constexpr auto apiKey = &Parameters::wexApi;
+  static constexpr auto fees = &Parameters::wexFees;
+  static constexpr auto getQuote = WEX::getQuote;
+  static constexpr auto getAvail = WEX::getAvail;
+  static constexpr auto sendLongOrder = WEX::sendLongOrder;
+  static constexpr auto isOrderComplete = WEX::isOrderComplete;
+  static constexpr auto getOrderStatus = WEX::getOrderStatus;
+  static constexpr auto cancelOrder = WEX::cancelOrder;
+  static constexpr auto getActivePos = WEX::getActivePos;
+  static constexpr auto getLimitPrice = WEX::getLimitPrice;
+};
+
+struct PoloniexEntry {
+  static constexpr const char *name = "Poloniex";
+  static constexpr const char *dbTable = "poloniex";
+  static constexpr bool canShort = true;
+  static constexpr bool isImplemented = false;
+  static constexpr auto enable = &Parameters::poloniexEnable;
+  static constexpr auto apiKey = &Parameters::poloniexApi;
+  static constexpr auto fees = &Parameters::poloniexFees;
+  static constexpr auto getQuote = Poloniex::getQuote;
+  static constexpr auto getAvail = Poloniex::getAvail;
+  static constexpr auto sendLongOrder = Poloniex::sendLongOrder;
+  static constexpr auto sendShortOrder = Poloniex::sendShortOrder;
+  static constexpr auto isOrderComplete = Poloniex::isOrderComplete;
+  static constexpr auto getOrderStatus = Poloniex::getOrderStatus;
+  static constexpr auto cancelOrder = Poloniex::cancelOrder;
+  static constexpr auto getActivePos = Poloniex::getActivePos;
+  static constexpr auto getLimitPrice = Poloniex::getLimitPrice;
+};
+
+struct CoinbaseEntry {
+  static constexpr const char *name = "CoinBasePro";
+  static constexpr const char *dbTable = "CoinbasePro";
+  static constexpr bool canShort = false;
+  static constexpr bool isImplemented = true;
+  static constexpr auto enable = &Parameters::coinbaseEnable;
+  static constexpr auto apiKey = &Parameters::coinbaseApi;
+  static constexpr auto fees = &Parameters::coinbaseFees;
+  static constexpr auto getQuote = coinbase::getQuote;
+  static constexpr auto getAvail = coinbase::getAvail;
+  static constexpr auto sendLongOrder = coinbase::sendLongOrder;
+  static constexpr auto isOrderComplete = coinbase::isOrderComplete;
+  static constexpr unsigned orderTypes = orderTypeBit(OrderType::ioc) |
+                                         orderTypeBit(OrderType::fok) |
+                                         orderTypeBit(OrderType::postOnly);
+  static constexpr auto getOrderStatus = coinbase::getOrderStatus;
+  static constexpr auto cancelOrder = coinbase::cancelOrder;
+  static constexpr auto getActivePos = coinbase::getActivePos;
+  static constexpr auto getLimitPrice = coinbase::getLimitPrice;
+};
+
+struct ExmoEntry {
+  static constexpr const char *name = "Exmo";
+  static constexpr const char *dbTable = "exmo";
+  static constexpr bool canShort = false;
+  static constexpr bool isImplemented = true;
+  static constexpr auto enable = &Parameters::exmoEnable;
+  static constexpr auto apiKey = &Parameters::exmoApi;
+  static constexpr auto fees = &Parameters::exmoFees;
+  static constexpr auto getQuote = Exmo::getQuote;
+  static constexpr auto getAvail = Exmo::getAvail;
+  static constexpr auto sendLongOrder = Exmo::sendLongOrder;
+  static constexpr auto isOrderComplete = Exmo::isOrderComplete;
+  static constexpr auto getOrderStatus = Exmo::getOrderStatus;
+  static constexpr auto cancelOrder = Exmo::cancelOrder;
+  static constexpr auto getActivePos = Exmo::getActivePos;
+  static constexpr auto getLimitPrice = Exmo::getLimitPrice;
+};
+
+struct CexioEntry {
+  static constexpr const char *name = "Cexio";
+  static constexpr const char *dbTable = "cexio";
+  static constexpr bool canShort = false;
+  static constexpr bool isImplemented = true;
+  static constexpr auto enable = &Parameters::cexioEnable;
+  static constexpr auto apiKey = &Parameters::cexioApi;
+  static constexpr auto fees = &Parameters::cexioFees;
+  static constexpr auto getQuote = Cexio::getQuote;
+  static constexpr auto getAvail = Cexio::getAvail;
+  static constexpr auto sendLongOrder = Cexio::sendLongOrder;
+  static constexpr auto sendShortOrder = Cexio::sendShortOrder;
+  static constexpr auto isOrderComplete = Cexio::isOrderComplete;
+  static constexpr auto getOrderStatus = Cexio::getOrderStatus;
+  static constexpr auto cancelOrder = Cexio::cancelOrder;
+  static constexpr auto getActivePos = Cexio::getActivePos;
+  static constexpr auto getLimitPrice = Cexio::getLimitPrice;
+};
+
+struct BittrexEntry {
+  static constexpr const char *name = "Bittrex";
+  static constexpr const char *dbTable = "bittrex";
+  static constexpr bool canShort = false;
+  static constexpr bool isImplemented = true;
+  static constexpr auto enable = &Parameters::bittrexEnable;
+  static constexpr auto apiKey = &Parameters::bittrexApi;
+  static constexpr auto fees = &Parameters::bittrexFees;
+  static constexpr auto getQuote = Bittrex::getQuote;
+  static constexpr auto getAvail = Bittrex::getAvail;
+  static constexpr auto sendLongOrder = Bittrex::sendLongOrder;
+  static constexpr auto sendShortOrder = Bittrex::sendShortOrder;
+  static constexpr auto isOrderComplete = Bittrex::isOrderComplete;
+  static constexpr auto getOrderStatus = Bittrex::getOrderStatus;
+  static constexpr auto cancelOrder = Bittrex::cancelOrder;
+  static constexpr auto getActivePos = Bittrex::getActivePos;
+  static constexpr auto getLimitPrice = Bittrex::getLimitPrice;
+};
+
+struct BinanceEntry {
+  static constexpr const char *name = "Binance";
+  static constexpr const char *dbTable = "binance";
+  static constexpr bool canShort = false;
+  static constexpr bool isImplemented = true;
+  static constexpr auto enable = &Parameters::binanceEnable;
+  static constexpr auto apiKey = &Parameters::binanceApi;
+  static constexpr auto fees = &Parameters::binanceFees;
+  static constexpr auto getQuote = Binance::getQuote;
+  static constexpr auto getAvail = Binance::getAvail;
+  static constexpr auto sendLongOrder = Binance::sendLongOrder;
+  static constexpr auto sendShortOrder = Binance::sendShortOrder;
+  static constexpr auto isOrderComplete = Binance::isOrderComplete;
+  static constexpr unsigned orderTypes = orderTypeBit(OrderType::ioc) |
+                                         orderTypeBit(OrderType::fok) |
+                                         orderTypeBit(OrderType::postOnly);
+  static constexpr auto getOrderStatus = Binance::getOrderStatus;
+  static constexpr auto cancelOrder = Binance::cancelOrder;
+  static constexpr auto getActivePos = Binance::getActivePos;
+  static constexpr auto getLimitPrice = Binance::getLimitPrice;
+};
+
+// All the adapters, in the order they are enabled and shown
+using Entry =
+    std::variant<BitfinexEntry, OKCoinEntry, BitstampEntry, GeminiEntry,
+                 KrakenEntry, ItBitEntry, WEXEntry, PoloniexEntry,
+                 CoinbaseEntry, ExmoEntry, CexioEntry, BittrexEntry,
+                 BinanceEntry>;
+
+// The adapters' functions are coroutines, but for placeholders that send
+// no request (ItBit); the blocking calls wait for either
+template <typename T> T wait(T value) { return value; }
+template <typename T> T wait(task<T> t) { return syncWait(std::move(t)); }
+
+template <typename E, typename = void> struct hasOrders : std::false_type {};
+template <typename E>
+struct hasOrders<E, std::void_t<decltype(E::sendLongOrder),
+                                decltype(E::isOrderComplete)>>
+    : std::true_type {};
+
+template <typename E, typename = void>
+struct hasShortOrders : std::false_type {};
+template <typename E>
+struct hasShortOrders<E, std::void_t<decltype(E::sendShortOrder)>>
+    : std::true_type {};
+
+template <typename E, typename = void>
+struct hasOrderTypes : std::false_type {};
+template <typename E>
+struct hasOrderTypes<E, std::void_t<decltype(E::orderTypes)>>
+    : std::true_type {};
+
+// getOrderStatus and cancelOrder come together
+template <typename E, typename = void>
+struct hasCancel : std::false_type {};
+template <typename E>
+struct hasCancel<E, std::void_t<decltype(E::cancelOrder)>> : std::true_type {};
+
+} // namespace Registry
+
+// One enabled exchange. Calls are a std::visit on its registry entry, i.e.
+// a jump table of direct calls the optimizer can inline, instead of
+// function pointers. With paper trading, orders and balances go to
+// PaperTrading. Calling a function the adapter lacks returns "0", true or
+// 0.0, as checkEntry never picks such an exchange for it; an order type it
+// lacks is sent good till canceled. getQuote is a coroutine, for the event
+// loop; the others block their thread, not the event loop, until the
+// adapter's coroutine is done.
+class ExchangeApi {
+public:
+  template <typename E>
+  explicit ExchangeApi(E entry) : entry(entry), dbTable(E::dbTable) {}
+
+  std::string const &dbTableName() const { return dbTable; }
+
+  // The orders and balances of this exchange are now the ones of
+  // 'engine', under index 'exch'
+  void usePaperTrading(PaperTrading *engine, size_t exch) {
+    paper = engine;
+    paperIndex = exch;
+  }
+
+  task<quote_t> getQuote(Parameters &params) const {
+    return std::visit([&](auto e) { return decltype(e)::getQuote(params); },
+                      entry);
+  }
+
+  double getAvail(Parameters &params, std::string const &currency) const {
+    if (paper)
+      return paper->getAvail(paperIndex, currency);
+    return std::visit(
+        [&](auto e) {
+          return Registry::wait(decltype(e)::getAvail(params, currency));
+        },
+        entry);
+  }
+
+  // Whether the exchange takes orders of 'type'; paper trading follows the
+  // exchange
+  bool supports(OrderType type) const {
+    if (type == OrderType::gtc)
+      return true;
+    return std::visit(
+        [&](auto e) {
+          using E = decltype(e);
+          if constexpr (Registry::hasOrderTypes<E>::value)
+            return (E::orderTypes & orderTypeBit(type)) != 0;
+          else
+            return false;
+        },
+        entry);
+  }
+
+  std::string sendLongOrder(Parameters &params, std::string const &direction,
+                            double quantity, double price,
+                            OrderType type = OrderType::gtc) const {
+    if (paper)
+      return paper->sendOrder(paperIndex, direction, quantity, price,
+                              supports(type) ? type : OrderType::gtc);
+    return std::visit(
+        [&](auto e) -> std::string {
+          using E = decltype(e);
+          if constexpr (Registry::hasOrderTypes<E>::value)
+            return Registry::wait(E::sendLongOrder(
+                params, direction, quantity, price,
+                supports(type) ? type : OrderType::gtc));
+          else if constexpr (Registry::hasOrders<E>::value)
+            return Registry::wait(
+                E::sendLongOrder(params, direction, quantity, price));
+          else
+            return "0";
+        },
+        entry);
+  }
+
+  std::string sendShortOrder(Parameters &params, std::string const &direction,
+                             double quantity, double price,
+                             OrderType type = OrderType::gtc) const {
+    if (paper)
+      return paper->sendOrder(paperIndex, direction, quantity, price,
+                              supports(type) ? type : OrderType::gtc);
+    return std::visit(
+        [&](auto e) -> std::string {
+          using E = decltype(e);
+          if constexpr (Registry::hasShortOrders<E>::value &&
+                        Registry::hasOrderTypes<E>::value)
+            return Registry::wait(E::sendShortOrder(
+                params, direction, quantity, price,
+                supports(type) ? type : OrderType::gtc));
+          else if constexpr (Registry::hasShortOrders<E>::value)
+            return Registry::wait(
+                E::sendShortOrder(params, direction, quantity, price));
+          else
+            return "0";
+        },
+        entry);
+  }
+
+  bool isOrderComplete(Parameters &params, std::string const &orderId) const {
+    if (paper)
+      return paper->isOrderComplete(paperIndex, orderId);
+    return std::visit(
+        [&](auto e) {
+          using E = decltype(e);
+          if constexpr (Registry::hasOrders<E>::value)
+            return Registry::wait(E::isOrderComplete(params, orderId));
+          else
+            return true;
+        },
+        entry);
+  }
+
+  // Whether the exchange can cancel an order and tell its fills; paper
+  // trading follows the exchange
+  bool canCancel() const {
+    return std::visit(
+        [](auto e) { return Registry::hasCancel<decltype(e)>::value; },
+        entry);
+  }
+
+  // Without getOrderStatus in the adapter, only whether the order is open
+  // is known, not its fills
+  OrderStatus getOrderStatus(Parameters &params,
+                             std::string const &orderId) const {
+    if (paper)
+      return paper->getOrderStatus(paperIndex, orderId);
+    return std::visit(
+        [&](auto e) {
+          using E = decltype(e);
+          if constexpr (Registry::hasCancel<E>::value) {
+            return Registry::wait(E::getOrderStatus(params, orderId));
+          } else {
+            OrderStatus status;
+            status.known = true;
+            status.open = !isOrderComplete(params, orderId);
+            return status;
+          }
+        },
+        entry);
+  }
+
+  // False if the order could not be canceled, e.g. it was filled already
+  bool cancelOrder(Parameters &params, std::string const &orderId) const {
+    if (paper)
+      return paper->cancelOrder(paperIndex, orderId);
+    return std::visit(
+        [&](auto e) {
+          using E = decltype(e);
+          if constexpr (Registry::hasCancel<E>::value)
+            return Registry::wait(E::cancelOrder(params, orderId));
+          else
+            return false;
+        },
+        entry);
+  }
+
+  double getActivePos(Parameters &params) const {
+    if (paper)
+      return paper->getActivePos(paperIndex);
+    return std::visit(
+        [&](auto e) {
+          return Registry::wait(decltype(e)::getActivePos(params));
+        },
+        entry);
+  }
+
+  double getLimitPrice(Parameters &params, double volume, bool isBid) const {
+    return std::visit(
+        [&](auto e) {
+          return Registry::wait(
+              decltype(e)::getLimitPrice(params, volume, isBid));
+        },
+        entry);
+  }
+
+private:
+  Registry::Entry entry;
+  std::string dbTable;
+  PaperTrading *paper = nullptr;
+  size_t paperIndex = 0;
+};
+
+// The exchanges enabled in the configuration, in registry order: those
+// with an API key, or all the enabled ones when 'keyless'. Each one is
+// added to params (addExchange) and gets its database table.
+std::vector<ExchangeApi> enabledExchanges(Parameters &params, bool keyless);
+
+// The strategy settings of 'loaded', the configuration read again, with
+// its fees and switches of the exchanges params trades on. The exchanges
+// 'loaded' enables but params does not trade on are put in 'notRunning'.
+StrategyParams reloadedStrategy(Parameters const &params,
+                                Parameters const &loaded,
+                                std::vector<std::string> &notRunning);
+
+#endif
@@ -1,7 +1,9 @@
 #ifndef BITFINEX_H
 #define BITFINEX_H
 
+#include "order_type.h"
 #include "quote_t.h"
+#include "utils/task.h"
 #include <string>
 
 struct json_t;
@@ -9,27 +11,35 @@ struct Parameters;
 
 namespace Bitfinex {
 
-quote_t getQuote(Parameters &params);
+task<quote_t> getQuote(Parameters &params);
 
-double getAvail(Parameters &params, std::string const &currency);
+task<double> getAvail(Parameters &params, std::string currency);
 
-std::string sendLongOrder(Parameters &params, std::string const &direction,
-                          double const quantity, double const price);
+task<std::string> sendLongOrder(Parameters &params, std::string direction,
+                                double const quantity, double const price,
+                                OrderType type);
 
-std::string sendShortOrder(Parameters &params, std::string const &direction,
-                           double const quantity, double const price);
+task<std::string> sendShortOrder(Parameters &params, std::string direction,
+                                 double const quantity, double const price,
+                                 OrderType type);
 
-std::string sendOrder(Parameters &params, std::string const &direction,
-                      double const quantity, double const price);
+task<std::string> sendOrder(Parameters &params, std::string direction,
+                            double const quantity, double const price,
+                            OrderType type);
 
-bool isOrderComplete(Parameters &params, std::string const &orderId);
+task<bool> isOrderComplete(Parameters &params, std::string orderId);
 
-double getActivePos(Parameters &params);
+task<OrderStatus> getOrderStatus(Parameters &params, std::string orderId);
 
-double getLimitPrice(Parameters &params, double const volume, bool const isBid);
+task<bool> cancelOrder(Parameters &params, std::string orderId);
 
-json_t *authRequest(Parameters &params, std::string const &request,
-                    std::string const &options);
+task<double> getActivePos(Parameters &params);
+
+task<double> getLimitPrice(Parameters &params, double const volume,
+                           bool const isBid);
+
+task<json_t *> authRequest(Parameters &params, std::string request,
+                           std::string options);
 
 } // namespace Bitfinex
 
@@ -1,7 +1,9 @@
 #ifndef BITSTAMP_H
 #define BITSTAMP_H
 
+#include "order_type.h"
 #include "quote_t.h"
+#include "utils/task.h"
 
 #include <string>
 
@@ -10,18 +12,23 @@ struct Parameters;
 
 namespace Bitstamp {
 
-quote_t getQuote(Parameters &params);
+task<quote_t> getQuote(Parameters &params);
 
-double getAvail(Parameters &params, std::string const &currency);
+task<double> getAvail(Parameters &params, std::string currency);
 
-std::string sendLongOrder(Parameters &params, std::string const &direction,
-                          double const quantity, double const price);
+task<std::string> sendLongOrder(Parameters &params, std::string direction,
+                                double const quantity, double const price);
 
-bool isOrderComplete(Parameters &params, std::string const &orderId);
+task<bool> isOrderComplete(Parameters &params, std::string orderId);
 
-double getActivePos(Parameters &params);
+task<OrderStatus> getOrderStatus(Parameters &params, std::string orderId);
 
-double getLimitPrice(Parameters &params, double const volume, bool const isBid);
+task<bool> cancelOrder(Parameters &params, std::string orderId);
+
+task<double> getActivePos(Parameters &params);
+
+task<double> getLimitPrice(Parameters &params, double const volume,
+                           bool const isBid);
 
 } // namespace Bitstamp
 
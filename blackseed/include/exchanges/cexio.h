@@ -1,7 +1,9 @@
 #ifndef CEXIO_H
 #define CEXIO_H
 
+#include "order_type.h"
 #include "quote_t.h"
+#include "utils/task.h"
 #include <sstream>
 #include <string>
 
@@ -10,29 +12,34 @@ struct Parameters;
 
 namespace Cexio {
 
-quote_t getQuote(Parameters &params);
+task<quote_t> getQuote(Parameters &params);
 
-double getAvail(Parameters &params, std::string const &currency);
+task<double> getAvail(Parameters &params, std::string currency);
 
-std::string sendLongOrder(Parameters &params, std::string const &direction,
-                          double const quantity, double const price);
+task<std::string> sendLongOrder(Parameters &params, std::string direction,
+                                double const quantity, double const price);
 
-std::string sendShortOrder(Parameters &params, std::string const &direction,
-                           double const quantity, double const price);
+task<std::string> sendShortOrder(Parameters &params, std::string direction,
+                                 double const quantity, double const price);
 
-std::string sendOrder(Parameters &params, std::string const &direction,
-                      double const quantity, double const price);
+task<std::string> sendOrder(Parameters &params, std::string direction,
+                            double const quantity, double const price);
 
-std::string openPosition(Parameters &params, std::string const &direction,
-                         double const quantity, double const price);
+task<std::string> openPosition(Parameters &params, std::string direction,
+                               double const quantity, double const price);
 
-std::string closePosition(Parameters &params);
+task<std::string> closePosition(Parameters &params);
 
-bool isOrderComplete(Parameters &params, std::string const &orderId);
+task<bool> isOrderComplete(Parameters &params, std::string orderId);
 
-double getActivePos(Parameters &params);
+task<OrderStatus> getOrderStatus(Parameters &params, std::string orderId);
 
-double getLimitPrice(Parameters &params, double const volume, bool const isBid);
+task<bool> cancelOrder(Parameters &params, std::string orderId);
+
+task<double> getActivePos(Parameters &params);
+
+task<double> getLimitPrice(Parameters &params, double const volume,
+                           bool const isBid);
 
 void testCexio();
 
@@ -1,7 +1,9 @@
 #ifndef GDAX_H
 #define GDAX_H
 
+#include "order_type.h"
 #include "quote_t.h"
+#include "utils/task.h"
 #include <string>
 
 struct json_t;
@@ -9,21 +11,27 @@ struct Parameters;
 
 namespace coinbase {
 
-quote_t getQuote(Parameters &params);
+task<quote_t> getQuote(Parameters &params);
 
-double getAvail(Parameters &params, std::string const &currency);
+task<double> getAvail(Parameters &params, std::string currency);
 
-double getActivePos(Parameters &params);
+task<double> getActivePos(Parameters &params);
 
-double getLimitPrice(Parameters &params, double const volume, bool const isBid);
+task<double> getLimitPrice(Parameters &params, double const volume,
+                           bool const isBid);
 
-std::string sendLongOrder(Parameters &params, std::string const &direction,
-                          double const quantity, double const price);
+task<std::string> sendLongOrder(Parameters &params, std::string direction,
+                                double const quantity, double const price,
+                                OrderType type);
 
-bool isOrderComplete(Parameters &params, std::string const &orderId);
+task<bool> isOrderComplete(Parameters &params, std::string orderId);
 
-json_t *authRequest(Parameters &params, std::string const &method,
-                    std::string const &request, std::string const &options);
+task<OrderStatus> getOrderStatus(Parameters &params, std::string orderId);
+
+task<bool> cancelOrder(Parameters &params, std::string orderId);
+
+task<json_t *> authRequest(Parameters &params, std::string method,
+                           std::string request, std::string options);
 
 std::string gettime();
 
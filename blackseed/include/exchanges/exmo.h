@@ -1,7 +1,9 @@
 #ifndef EXMO_H
 #define EXMO_H
 
+#include "order_type.h"
 #include "quote_t.h"
+#include "utils/task.h"
 #include <string>
 
 struct json_t;
@@ -9,21 +11,26 @@ struct Parameters;
 
 namespace Exmo {
 
-quote_t getQuote(Parameters &params);
+task<quote_t> getQuote(Parameters &params);
 
-double getAvail(Parameters &params, std::string const &currency);
+task<double> getAvail(Parameters &params, std::string currency);
 
-std::string sendLongOrder(Parameters &params, std::string const &direction,
-                          double const quantity, double const price);
+task<std::string> sendLongOrder(Parameters &params, std::string direction,
+                                double const quantity, double const price);
 // TODO multi currency support
 // std::string sendLongOrder(Parameters& params, std::string direction, double
 // quantity, double price, std::string pair = "btc_usd");
 
-bool isOrderComplete(Parameters &params, std::string const &orderId);
+task<bool> isOrderComplete(Parameters &params, std::string orderId);
 
-double getActivePos(Parameters &params);
+task<OrderStatus> getOrderStatus(Parameters &params, std::string orderId);
 
-double getLimitPrice(Parameters &params, double const volume, bool const isBid);
+task<bool> cancelOrder(Parameters &params, std::string orderId);
+
+task<double> getActivePos(Parameters &params);
+
+task<double> getLimitPrice(Parameters &params, double const volume,
+                           bool const isBid);
 
 void testExmo();
 
@@ -2,6 +2,7 @@
 #define ITBIT_H
 
 #include "quote_t.h"
+#include "utils/task.h"
 #include <string>
 
 struct json_t;
@@ -9,7 +10,7 @@ struct Parameters;
 
 namespace ItBit {
 
-quote_t getQuote(Parameters& params);
+task<quote_t> getQuote(Parameters& params);
 
 double getAvail(Parameters& params, std::string const& currency);
 
@@ -1,7 +1,9 @@
 #ifndef OKCOIN_H
 #define OKCOIN_H
 
+#include "order_type.h"
 #include "quote_t.h"
+#include "utils/task.h"
 #include <string>
 
 struct json_t;
@@ -9,30 +11,35 @@ struct Parameters;
 
 namespace OKCoin {
 
-quote_t getQuote(Parameters &params);
+task<quote_t> getQuote(Parameters &params);
 
-double getAvail(Parameters &params, std::string const &currency);
+task<double> getAvail(Parameters &params, std::string currency);
 
-std::string sendLongOrder(Parameters &params, std::string const &direction,
-                          double const quantity, double const price);
+task<std::string> sendLongOrder(Parameters &params, std::string direction,
+                                double quantity, double price);
 
-std::string sendShortOrder(Parameters &params, std::string const &direction,
-                           double const quantity, double const price);
+task<std::string> sendShortOrder(Parameters &params, std::string direction,
+                                 double const quantity, double const price);
 
-bool isOrderComplete(Parameters &params, std::string const &orderId);
+task<bool> isOrderComplete(Parameters &params, std::string orderId);
 
-double getActivePos(Parameters &params);
+task<OrderStatus> getOrderStatus(Parameters &params, std::string orderId);
 
-double getLimitPrice(Parameters &params, double const volume, bool const isBid);
+task<bool> cancelOrder(Parameters &params, std::string orderId);
 
-json_t *authRequest(Parameters &params, std::string const &url,
-                    std::string const &signature, std::string const &content);
+task<double> getActivePos(Parameters &params);
 
-void getBorrowInfo(Parameters &params);
+task<double> getLimitPrice(Parameters &params, double const volume,
+                           bool const isBid);
 
-int borrowBtc(Parameters &params, double const amount);
+task<json_t *> authRequest(Parameters &params, std::string uri,
+                           std::string signature, std::string content);
 
-void repayBtc(Parameters &params, int const borrowId);
+task<void> getBorrowInfo(Parameters &params);
+
+task<int> borrowBtc(Parameters &params, double amount);
+
+task<void> repayBtc(Parameters &params, int borrowId);
 
 } // namespace OKCoin
 
@@ -2,6 +2,7 @@
 #define QUADRIGACX_H
 
 #include "quote_t.h"
+#include "utils/task.h"
 #include <string>
 #include <sstream>
 
@@ -10,7 +11,7 @@ struct Parameters;
 
 namespace QuadrigaCX {
 
-quote_t getQuote(Parameters& params);
+task<quote_t> getQuote(Parameters& params);
 
 double getAvail(Parameters& params, std::string currency);
 
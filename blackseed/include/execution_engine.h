@@ -0,0 +1,133 @@
+#ifndef EXECUTION_ENGINE_H
+#define EXECUTION_ENGINE_H
+
+#include "order_type.h"
+#include "utils/clock.h"
+#include "utils/spsc_queue.h"
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct Parameters;
+class ExchangeApi;
+
+// Sends the two orders of an entry or an exit and waits for their fills on
+// its own thread, so the strategy thread keeps reading quotes meanwhile.
+// Jobs come in through one SPSC queue and go back through another, once
+// when both orders are sent, once per order re-sent and once when both
+// legs are done.
+//
+// Orders are of the OrderType setting where the exchange has it. What an
+// order leaves unfilled is sent again at the price of the book: at once
+// for an order that closed (immediate-or-cancel, fill-or-kill, a post-only
+// order that would have traded), after canceling it for one that rests
+// past MaxOrderWait or that the book moved MaxPriceDrift away from. An
+// entry leg not filled MaxHedgeTime after its first order is given up on,
+// and the leg that executed more is unwound down to the other, for up to
+// MaxHedgeTime too; one whose order can still not be canceled or read
+// MaxHedgeTime later is left open. Exit legs are followed until filled.
+// Orders on an exchange that cannot cancel them are waited for as they
+// are, within the same bounds for an entry.
+class ExecutionEngine {
+public:
+  struct Leg {
+    unsigned exch = 0;
+    bool isShort = false;
+    std::string direction;
+    double quantity = 0.0;
+    double price = 0.0;   // of the last order
+    std::string orderId;  // last order, set once sent
+    // When the first and the last order were sent and the leg seen done,
+    // see Clock::monoNs()
+    int64_t sent = 0;
+    int64_t lastSent = 0;
+    int64_t filled = 0;
+    OrderType type = OrderType::gtc;
+    double orderQuantity = 0.0;  // of the last order
+    // Orders sent before the last one, closed with part of the leg unfilled
+    std::vector<std::string> replaced;
+    // Traded by all the closed orders, and its value in leg2
+    double executed = 0.0;
+    double executedValue = 0.0;
+
+    Leg() = default;
+    // An order to send
+    Leg(unsigned exch, bool isShort, std::string direction, double quantity,
+        double price)
+        : exch(exch), isShort(isShort), direction(std::move(direction)),
+          quantity(quantity), price(price) {}
+
+    double averagePrice() const {
+      return executed > 0.0 ? executedValue / executed : price;
+    }
+  };
+  struct Job {
+    enum Stage { pending, sent, resent, filled };
+    Stage stage = pending;
+    unsigned tradeId = 0;
+    bool isExit = false;
+    Leg legs[2];  // long leg, then short leg
+    // Opposite orders on the leg of an entry that executed more than the
+    // other, if any
+    Leg unwind;
+    unsigned resentLeg = 0;  // for 'resent', 2 for the unwind
+    Clock::Stamp decided;  // from Result::decided
+
+    Leg &leg(unsigned index) { return index < 2 ? legs[index] : unwind; }
+    Leg const &leg(unsigned index) const {
+      return index < 2 ? legs[index] : unwind;
+    }
+  };
+  // Called on the execution thread right after each order is sent, to
+  // persist its id before anything else happens
+  using SentHook = std::function<void(Job const &job, Leg const &leg)>;
+
+  ExecutionEngine(Parameters &params, std::vector<ExchangeApi> const &exchanges,
+                  SentHook onSent);
+  ~ExecutionEngine();
+  ExecutionEngine(const ExecutionEngine &) = delete;
+  ExecutionEngine &operator=(const ExecutionEngine &) = delete;
+
+  // Strategy thread. submit() returns false if the queue is full; poll()
+  // returns the jobs that moved to 'sent' or 'filled', in order.
+  bool submit(Job job);
+  bool poll(Job &job) { return reports.pop(job); }
+
+private:
+  void run();
+  void execute(Job &job);
+  // Looks at a leg once, canceling and re-pricing what it left if it is
+  // time; true once the leg is done. 'deadline' is cleared once an exit leg
+  // is warned about. An order is replaced by a cancel, a status request and
+  // a send: not all the exchanges that replace one in a single request tell
+  // what it filled before.
+  bool follow(Job &job, unsigned index, int64_t &deadline);
+  // Why an open order should be canceled, nullptr if it should not
+  const char *overdue(Leg const &leg, double left) const;
+  // Sends 'left' of a leg at the price of the book; false if the book has
+  // no price for it
+  bool resend(Job &job, unsigned index, double left);
+  void unwind(Job &job);
+  int64_t hedgeTime() const;  // MaxHedgeTime in nanoseconds
+  // Reports what a leg given up on may leave to hedge
+  void unhedged(Leg const &leg, double left);
+  void done(Leg &leg);
+  std::string send(Leg const &leg);
+  void report(Job const &job);
+
+  Parameters &params;
+  std::vector<ExchangeApi> const &exchanges;
+  const SentHook onSent;
+  SpscQueue<Job> jobs{16};
+  SpscQueue<Job> reports{64};
+  std::mutex mtx;  // only for sleeping, the queues need no lock
+  std::condition_variable wake;
+  bool stopping = false;
+  std::thread worker;
+};
+
+#endif
@@ -1,30 +1,85 @@
 #ifndef HEX_STR_HPP
 #define HEX_STR_HPP
 
+#include <array>
+#include <cstddef>
+#include <iosfwd>
+#include <iterator>
 #include <string>
+#include <type_traits>
 
 enum {
   upperhex,
   lowerhex
 };
 
+// Maps every byte value to its two hex digits
+template <bool Caps>
+struct hex_table {
+  static constexpr std::array<char, 512> make() {
+    constexpr const char *bytemap = Caps ?
+                                    "0123456789abcdef" :
+                                    "0123456789ABCDEF";
+    std::array<char, 512> t{};
+    for (int i = 0; i < 256; ++i) {
+      t[2 * i]     = bytemap[i >> 4];
+      t[2 * i + 1] = bytemap[i & 0xF];
+    }
+    return t;
+  }
+  static constexpr std::array<char, 512> digits = make();
+};
+
+// Encodes the leading whole 16/32 byte blocks of [first, first + len) with
+// SSSE3/AVX2 when available, returns the number of bytes it consumed.
+std::size_t hex_encode_blocks(const unsigned char *first, std::size_t len,
+                              char *out, bool lower);
+
+// Writes the 2 * len hex digits of [first, first + len) to 'out'
+// and returns the end of the written range.
+template <bool Caps = lowerhex>
+char *hex_encode(const unsigned char *first, std::size_t len, char *out) {
+  std::size_t done = hex_encode_blocks(first, len, out, Caps);
+  first += done;
+  len -= done;
+  out += 2 * done;
+
+  const char *digits = hex_table<Caps>::digits.data();
+  for (std::size_t i = 0; i < len; ++i) {
+    const char *pair = digits + 2 * first[i];
+    *out++ = pair[0];
+    *out++ = pair[1];
+  }
+  return out;
+}
+
 template <bool Caps = lowerhex, typename FwdIt>
 std::string hex_str(FwdIt first, FwdIt last) {
   static_assert(sizeof(typename std::iterator_traits<FwdIt>::value_type) == 1,
                 "value_type must be 1 byte.");
-  constexpr const char *bytemap = Caps ?
-                                  "0123456789abcdef" :
-                                  "0123456789ABCDEF";
-
   std::string result(std::distance(first, last) * 2, '0');
 
-  auto pos = begin(result);
-  while (first != last) {
-    *pos++ = bytemap[ *first >> 4 & 0xF ];
-    *pos++ = bytemap[ *first++ & 0xF ];
+  if constexpr (std::is_pointer<FwdIt>::value) {
+    hex_encode<Caps>(reinterpret_cast<const unsigned char *>(first),
+                     result.size() / 2, &result[0]);
+  } else {
+    const char *digits = hex_table<Caps>::digits.data();
+    auto pos = begin(result);
+    while (first != last) {
+      const char *pair = digits + 2 * static_cast<unsigned char>(*first++);
+      *pos++ = pair[0];
+      *pos++ = pair[1];
+    }
   }
 
   return result;
 }
 
+// Checks hex_encode against the plain table lookup for every length up to
+// a few blocks. Prints the result, false on mismatch.
+bool testHexEncode(std::ostream &out);
+
+// Prints hex_encode throughput with and without the vectorized blocks.
+void benchHexEncode(std::ostream &out);
+
 #endif
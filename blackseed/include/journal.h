@@ -0,0 +1,127 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "utils/clock.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+enum class JournalEvent : uint16_t {
+  venue = 1, // exchange index -> name, written at startup
+  quote,
+  decision,
+  order,
+  fill,
+  balance
+};
+
+enum class JournalDecision : uint8_t { entry, exit, canceled };
+
+// Append-only binary record of what the bot saw and did.
+// The file starts with an 8 bytes magic, then every record is:
+//   uint32 size | uint16 event | int64 time (ns since epoch) | payload |
+//   uint32 CRC-32 of event, time and payload
+// in the byte order of the machine that wrote it. A record cut by a
+// crash fails its size or CRC check and ends the replay there; opening
+// the file again to append cuts it after its last whole record.
+// Records are buffered and written by sync(), which the orders, fills and
+// balances trigger themselves; quotes wait for the next one.
+class Journal {
+public:
+  explicit Journal(std::string const &fileName);
+  ~Journal();
+  Journal(const Journal &) = delete;
+  Journal &operator=(const Journal &) = delete;
+
+  bool isOpen() const { return file != nullptr; }
+
+  void venue(unsigned exch, std::string const &name, double fees);
+  // 'time' is when the quote was received, see Clock::wallNs()
+  void quote(unsigned exch, double bid, double ask, int64_t time);
+  // 'reason' tells why a canceled opportunity was not traded
+  void decision(JournalDecision kind, unsigned exchLong, unsigned exchShort,
+                double spread, double exposure,
+                std::string const &reason = "");
+  void order(unsigned exch, std::string const &direction, bool isShort,
+             double quantity, double price, std::string const &orderId);
+  void fill(unsigned exch, std::string const &orderId, double quantity,
+            double price);
+  void balance(unsigned exch, double leg1, double leg2);
+
+  // Writes the buffered records and flushes the file
+  void sync();
+
+private:
+  void begin(JournalEvent event, int64_t time = Clock::wallNs());
+  void end(bool flush);
+  template <typename T> void put(T value);
+  void put(std::string const &s);
+  void write();
+
+  std::FILE *file;
+  std::mutex mtx;
+  std::vector<char> buffer;
+  size_t recordStart = 0;
+};
+
+// One decoded record, only the fields of its event are set:
+//   venue:    exch, text (name), fees
+//   quote:    exch, bid, ask
+//   decision: kind, exch (long), exchShort, spread, exposure, text (reason)
+//   order:    exch, kind (1 = buy, 0 = sell), isShort, quantity, price,
+//             text (order id)
+//   fill:     exch, text (order id), quantity, price
+//   balance:  exch, leg1, leg2
+struct JournalEntry {
+  JournalEvent event;
+  int64_t time = 0;
+  unsigned exch = 0;
+  unsigned exchShort = 0;
+  uint8_t kind = 0;
+  bool isShort = false;
+  double bid = 0.0;
+  double ask = 0.0;
+  double spread = 0.0;
+  double exposure = 0.0;
+  double quantity = 0.0;
+  double price = 0.0;
+  double leg1 = 0.0;
+  double leg2 = 0.0;
+  double fees = 0.0;
+  std::string text;
+};
+
+// Reads a journal back record by record
+class JournalReader {
+public:
+  explicit JournalReader(std::string const &fileName);
+  ~JournalReader();
+  JournalReader(const JournalReader &) = delete;
+  JournalReader &operator=(const JournalReader &) = delete;
+
+  // False at the end of the file, or at the first damaged record
+  bool next(JournalEntry &entry);
+  // Whether the reading stopped on a bad magic, size or CRC rather than
+  // at the end of the file
+  bool damaged() const { return bad; }
+  // Bytes up to the end of the last record read whole, 0 if the magic is
+  // bad
+  long wholeSize() const { return whole; }
+  bool isOpen() const { return file != nullptr; }
+
+private:
+  std::FILE *file;
+  std::vector<char> record;
+  bool bad = false;
+  long whole = 0;
+};
+
+// Prints every record of a journal as text, one line each.
+// Returns 0 if the whole file was read, 1 otherwise.
+int replayJournal(std::string const &fileName, std::ostream &out);
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef MARKET_FEED_H
+#define MARKET_FEED_H
+
+#include "utils/clock.h"
+#include "utils/spsc_queue.h"
+#include "utils/task.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+struct Parameters;
+class ExchangeApi;
+class Counter;
+
+struct QuoteEvent {
+  unsigned exch = 0;
+  double bid = 0.0;
+  double ask = 0.0;
+  Clock::Stamp received;
+  int64_t latency = 0;  // of the request, in nanoseconds
+};
+
+// One coroutine per exchange, on the event loop, reads its quote every
+// FeedInterval milliseconds and hands it to the strategy thread through
+// the exchange's own SPSC ring. A slow exchange only delays its own
+// quotes. When a ring is full the new quote is dropped and counted, the
+// strategy keeps the latest one of each exchange anyway.
+class MarketFeed {
+public:
+  MarketFeed(Parameters &params, std::vector<ExchangeApi> const &exchanges);
+  ~MarketFeed();
+  MarketFeed(const MarketFeed &) = delete;
+  MarketFeed &operator=(const MarketFeed &) = delete;
+
+  // Strategy thread: calls f(event) for every quote received since the
+  // last call, exchange by exchange, and returns their number
+  template <typename F> size_t drain(F &&f) {
+    size_t count = 0;
+    QuoteEvent event;
+    for (auto &venue : venues) {
+      while (venue->ring.pop(event)) {
+        f(event);
+        ++count;
+      }
+    }
+    return count;
+  }
+
+private:
+  struct Venue {
+    SpscQueue<QuoteEvent> ring{256};
+    Counter *dropped = nullptr;
+  };
+
+  task<void> poll(unsigned exch);
+
+  Parameters &params;
+  std::vector<ExchangeApi> const &exchanges;
+  const std::chrono::milliseconds interval;
+  std::vector<std::unique_ptr<Venue>> venues;
+  std::atomic<bool> stopping{false};
+  // Coroutines not finished yet, the destructor waits for them
+  std::mutex mtx;
+  std::condition_variable finished;
+  size_t running = 0;
+};
+
+#endif
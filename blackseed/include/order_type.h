@@ -0,0 +1,63 @@
+#ifndef ORDER_TYPE_H
+#define ORDER_TYPE_H
+
+#include <limits>
+#include <string>
+
+// How long a limit order may wait for the rest of its quantity
+enum class OrderType {
+  gtc,       // good till canceled, rests in the book
+  ioc,       // immediate or cancel: what does not trade at once is canceled
+  fok,       // fill or kill: trades in full at once, or not at all
+  postOnly,  // canceled instead of taking liquidity, rests otherwise
+};
+
+// Set of order types, as an exchange supports them
+constexpr unsigned orderTypeBit(OrderType type) {
+  return 1u << static_cast<unsigned>(type);
+}
+
+// "gtc", "ioc", "fok" or "post-only"
+inline const char *orderTypeName(OrderType type) {
+  switch (type) {
+  case OrderType::ioc:
+    return "ioc";
+  case OrderType::fok:
+    return "fok";
+  case OrderType::postOnly:
+    return "post-only";
+  default:
+    return "gtc";
+  }
+}
+
+// The reverse of orderTypeName, false for an unknown name
+inline bool parseOrderType(std::string const &name, OrderType &type) {
+  for (auto t : {OrderType::gtc, OrderType::ioc, OrderType::fok,
+                 OrderType::postOnly}) {
+    if (name == orderTypeName(t)) {
+      type = t;
+      return true;
+    }
+  }
+  return false;
+}
+
+// What an exchange tells of one of our orders
+struct OrderStatus {
+  // The exchange answered about the order, if only that it does not know
+  // it. An error or rate-limit reply leaves it false, and the rest unset.
+  bool known = false;
+  bool open = false;      // can still trade
+  double filled = 0.0;    // leg1 traded so far
+  double avgPrice = 0.0;  // of the trades, 0.0 without any
+};
+
+// What getAvail and getActivePos return when the exchange answers with an
+// error instead of the balance, which 0.0 would pass for an empty account.
+// Callers test it with std::isnan.
+inline double unknownBalance() {
+  return std::numeric_limits<double>::quiet_NaN();
+}
+
+#endif
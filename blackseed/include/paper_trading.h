@@ -0,0 +1,102 @@
+#ifndef PAPER_TRADING_H
+#define PAPER_TRADING_H
+
+#include "order_type.h"
+#include "quote_t.h"
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct Parameters;
+
+// Stands in for the order functions of the exchanges when PaperTrading is
+// set: orders are filled against the live books, read with the real
+// getQuote and getLimitPrice, and balances are virtual (PaperBalanceUsd of
+// leg2 and no leg1 on every exchange).
+//
+// An order reaches the book PaperLatency milliseconds after it is sent,
+// which is when sendOrder returns. The part of it that crosses the book
+// then fills at once, assuming the depth grows linearly from the best
+// price to the one getLimitPrice finds for the whole quantity. The rest is
+// a resting order behind PaperQueueAhead of leg1 at its price: while the
+// price is the best of its side, PaperQueueRate of leg1 per second trades
+// there, first the queue ahead and then the order. An opposite price
+// reaching the order fills it. Immediate-or-cancel and fill-or-kill orders
+// never rest, and a post-only order that would cross the book is canceled
+// instead.
+class PaperTrading {
+public:
+  using getQuoteFn = std::function<quote_t(Parameters &)>;
+  using getLimitPriceFn =
+      std::function<double(Parameters &, double volume, bool isBid)>;
+
+  explicit PaperTrading(Parameters &params);
+  PaperTrading(const PaperTrading &) = delete;
+  PaperTrading &operator=(const PaperTrading &) = delete;
+
+  // Index of the new exchange, the order of params.exchangeNames
+  size_t addExchange(getQuoteFn getQuote, getLimitPriceFn getLimitPrice);
+
+  // Same contracts as the functions of the exchanges. Order ids are
+  // "paper-<n>"; ids left by a previous run are reported complete.
+  std::string sendOrder(size_t exch, std::string const &direction,
+                        double quantity, double price,
+                        OrderType type = OrderType::gtc);
+  bool isOrderComplete(size_t exch, std::string const &orderId);
+  OrderStatus getOrderStatus(size_t exch, std::string const &orderId);
+  bool cancelOrder(size_t exch, std::string const &orderId);
+  double getAvail(size_t exch, std::string const &currency) const;
+  double getActivePos(size_t exch) const;
+
+private:
+  using clock = std::chrono::steady_clock;
+
+  struct Order {
+    bool isBuy;
+    double quantity;
+    double price;
+    double touch;  // best opposite price when sent
+    double filled = 0.0;
+    double filledValue = 0.0;
+    clock::time_point sentAt;
+    double queueAhead = 0.0;
+    clock::time_point lastSeen;
+    bool closed = false;  // canceled, what is not filled never will be
+
+    double remaining() const { return quantity - filled; }
+  };
+  struct Exchange {
+    getQuoteFn getQuote;
+    getLimitPriceFn getLimitPrice;
+    double leg1 = 0.0;
+    double leg2 = 0.0;
+    std::map<std::string, Order> orders;
+  };
+
+  // Fills the part of a new 'order' that crosses the book, as 'type' allows
+  void arrive(size_t exch, Order &order, OrderType type);
+  // Fills what the book allows of a resting 'order' by now
+  void advance(size_t exch, Order &order);
+  void fill(size_t exch, Order &order, double quantity, double price);
+  // Logs the fill and records its latency and slippage, if anything filled
+  void report(size_t exch, Order const &order);
+
+  Parameters &params;
+  const std::chrono::milliseconds orderLatency;
+  const double queueAhead;
+  const double queueRate;
+  const double startBalance;
+
+  // Orders are only used by the trading thread, the balances are also
+  // read by the ledger's
+  mutable std::mutex mtx;  // guards leg1 and leg2
+  std::vector<std::unique_ptr<Exchange>> exchanges;
+  unsigned long lastId = 0;
+};
+
+#endif
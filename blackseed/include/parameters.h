@@ -1,12 +1,52 @@
 #pragma once
 
+#include "order_type.h"
 #include "unique_sqlite.hpp"
+#include "utils/async_log.h"
+#include <atomic>
+#include <chrono>
 #include <curl/curl.h>
 #include <fstream>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
+// A configuration file that cannot be read, or a parameter that is
+// missing or not a valid value
+struct ConfigError : std::runtime_error {
+  using std::runtime_error::runtime_error;
+};
+
+// The settings the strategy reads every iteration, the per-exchange ones
+// by exchange index. A snapshot is never modified once published, so a
+// reload of the configuration (see ConfigWatcher) replaces it under the
+// strategy thread without a lock.
+struct StrategyParams {
+  double spreadEntry = 0.0;
+  double spreadTarget = 0.0;
+  unsigned maxLength = 0;
+  double priceDeltaLim = 0.0;
+  double trailingLim = 0.0;
+  unsigned trailingCount = 0;
+  bool useFullExposure = false;
+  double testedExposure = 0.0;
+  double maxExposure = 0.0;
+  // Milliseconds after which a quote is too old to enter on, 0 for no limit
+  unsigned maxQuoteAge = 0;
+  // Limits of a healthy exchange (see VenueHealth), 0 for no limit: how
+  // long its quote may stay unchanged and its quote requests may take
+  // (p99), in milliseconds, and the share of its quotes that may be invalid
+  unsigned frozenQuoteAge = 0;
+  unsigned maxQuoteLatency = 0;
+  double maxQuoteErrorRate = 0.0;
+  std::vector<double> fees;
+  // A disabled exchange takes no new position, an open one is still closed
+  std::vector<bool> enabled;
+};
+
 // Stores all the parameters defined
 // in the configuration file.
 struct Parameters {
@@ -29,15 +69,73 @@ struct Parameters {
   std::string leg1;
   std::string leg2;
   bool verbose;
-  std::ofstream *logFile;
+  // Text log, and the same log for structured records (see AsyncLog)
+  LogStream logFile;
+  AsyncLog *log;
+  std::string logLevel;
   unsigned interval;
   unsigned debugMaxIteration;
   bool useFullExposure;
   double testedExposure;
   double maxExposure;
+  unsigned maxQuoteAge;
+  unsigned frozenQuoteAge;
+  unsigned maxQuoteLatency;
+  double maxQuoteErrorRate;
   bool useVolatility;
   unsigned volatilityPeriod;
   std::string cacert;
+  // Milliseconds public ticker and order book responses are reused for
+  unsigned tickerCacheTtl;
+  unsigned orderBookCacheTtl;
+  // Seconds between two reads of all the balances by the ledger
+  unsigned reconcileInterval;
+  // Seconds between two dumps of the latency histograms, 0 to only
+  // write them at exit
+  unsigned latencyDumpInterval;
+  // Local port of the metrics endpoint, 0 for none
+  unsigned metricsPort;
+  // Local exchange simulator: first port, whether we trade on it, and
+  // its settings (see ExchangeSimulator)
+  unsigned simulatorPort;
+  bool useSimulator;
+  unsigned simLatency;
+  unsigned simJitter;
+  double simErrorRate;
+  double simStallRate;
+  unsigned simStallTime;
+  unsigned simSeed;
+  double simBalanceUsd;
+  double simBalanceBtc;
+  // Paper trading: orders are filled against the live books by
+  // PaperTrading instead of being sent
+  bool paperTrading;
+  unsigned paperLatency;
+  double paperQueueAhead;
+  double paperQueueRate;
+  double paperBalanceUsd;
+  // Threads: milliseconds between two quotes of an exchange, whether
+  // the strategy thread spins instead of sleeping, and the CPU each kind
+  // of thread is pinned to (-1 for none)
+  unsigned feedInterval;
+  bool strategyBusyPoll;
+  int strategyCpu;
+  int feedCpu;
+  int executionCpu;
+  // Whether the strategy settings follow the configuration file while
+  // running (see ConfigWatcher)
+  bool configReload;
+  // Orders: their type where the exchange has it (good till canceled
+  // elsewhere), then the milliseconds between two re-prices of what an
+  // immediate order left, and after which an entry leg is given up on.
+  // A resting order is canceled and re-priced once open for maxOrderWait
+  // milliseconds, or once the book is maxPriceDrift (a fraction of its
+  // price) away from it.
+  OrderType orderType;
+  unsigned repriceInterval;
+  unsigned maxHedgeTime;
+  unsigned maxOrderWait;
+  double maxPriceDrift;
 
   std::string bitfinexApi;
   std::string bitfinexSecret;
@@ -110,8 +208,13 @@ struct Parameters {
 
   std::string dbFile;
   unique_sqlite dbConn;
+  // Path of the file the parameters were read from, empty if not read
+  // from a file
+  std::string configFile;
 
+  // Throw ConfigError
   Parameters(std::string fileName);
+  explicit Parameters(std::map<std::string, std::string> const &dataMap);
 
   void addExchange(std::string const &exchangeName, double const fee,
                    bool const shorting, bool const featureImplemented);
@@ -119,9 +222,37 @@ struct Parameters {
   std::vector<std::string>::size_type nbExch() const {
     return exchangeNames.size();
   }
+
+  std::chrono::milliseconds tickerTtl() const {
+    return std::chrono::milliseconds(tickerCacheTtl);
+  }
+  std::chrono::milliseconds orderBookTtl() const {
+    return std::chrono::milliseconds(orderBookCacheTtl);
+  }
+
+  // Current strategy settings, read without a lock. The snapshot returned
+  // stays valid and unchanged until exit.
+  StrategyParams const &strategy() const {
+    return *currentStrategy.load(std::memory_order_acquire);
+  }
+  // Makes 'next' the current strategy settings
+  void publishStrategy(StrategyParams next);
+
+private:
+  void load(std::map<std::string, std::string> const &dataMap);
+
+  // Every snapshot published, kept until exit as the strategy thread may
+  // still be reading an old one; reloads are rare
+  std::mutex strategyMtx;
+  std::vector<std::unique_ptr<const StrategyParams>> strategies;
+  std::atomic<const StrategyParams *> currentStrategy{nullptr};
 };
 
 // Copies the parameters from the configuration file
 // to the Parameter structure.
 void readAllParameters(std::ifstream &configFile,
                        std::map<std::string, std::string> &dataMap);
+
+// All the parameters of the file at 'path'. Throws ConfigError if it
+// cannot be read or has none.
+std::map<std::string, std::string> readConfigFile(std::string const &path);
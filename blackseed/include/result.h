@@ -1,6 +1,7 @@
 #ifndef RESULT_H
 #define RESULT_H
 
+#include "utils/clock.h"
 #include <ostream>
 #include <ctime>
 #include <string>
@@ -18,6 +19,8 @@ struct Result {
   double feesShort;
   std::time_t entryTime;
   std::time_t exitTime;
+  // When checkEntry or checkExit took the opportunity, not saved
+  Clock::Stamp decided;
   std::string exchNameLong;
   std::string exchNameShort;
   double priceLongIn;
@@ -49,13 +52,13 @@ struct Result {
   // Resets the structures
   void reset();
   
-  // Tries to load the state from a previous position
-  // from the restore.txt file.
+  // Tries to load the state from a previous position, as written
+  // by savePartialResult() or in an old restore.txt file.
+  bool loadPartialResult(std::istream &in);
   bool loadPartialResult(std::string filename);
   
-  // Saves the state from a previous position
-  // into the restore.txt file.
-  void savePartialResult(std::string filename);
+  // Saves the state of an open position on one line
+  void savePartialResult(std::ostream &out) const;
 };
 
 #endif
@@ -0,0 +1,65 @@
+#ifndef EXCHANGE_SIMULATOR_H
+#define EXCHANGE_SIMULATOR_H
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <random>
+#include <vector>
+
+struct Parameters;
+struct SimVenue;
+class HttpServer;
+
+// Local stand-ins of Binance, Kraken, Bitfinex, CoinBasePro and Bitstamp,
+// each on its own port from params.simulatorPort, in that order. Every
+// venue has a matching engine whose book is refilled around a shared
+// random walk, with a venue-specific drift so spreads open and close
+// between them. Requests are delayed by SimLatency plus up to SimJitter
+// milliseconds; SimErrorRate of them get an error and SimStallRate of them
+// are held for SimStallTime.
+// Nothing depends on the wall clock, so that a run can be replayed: the
+// market takes its steps as requests are served, on any venue, and the
+// delay and failure of a request are drawn from SimSeed, the venue and
+// the number of the request on that venue.
+class ExchangeSimulator {
+public:
+  explicit ExchangeSimulator(Parameters &params);
+  ~ExchangeSimulator();
+  ExchangeSimulator(const ExchangeSimulator &) = delete;
+  ExchangeSimulator &operator=(const ExchangeSimulator &) = delete;
+
+  // False if a port could not be opened
+  bool isRunning() const;
+  // One line per venue: name, URL, best bid/ask and our balances
+  void report(std::ostream &out) const;
+
+private:
+  struct Venue;
+
+  // Moves the market of every venue by the steps of one request
+  void step();
+  HttpServer *serve(Venue &venue, unsigned short port);
+
+  const uint64_t seed;
+  const unsigned latency;
+  const unsigned jitter;
+  const double errorRate;
+  const double stallRate;
+  const unsigned stallTime;
+  std::mutex marketMtx;
+  std::mt19937_64 marketRng;  // under marketMtx, like the reference
+  double reference;
+  // Last, the servers stop before the market they use goes
+  std::vector<std::unique_ptr<Venue>> venues;
+};
+
+// Sends the requests of the adapters of the simulated exchanges to a
+// simulator listening from 'basePort'
+void useSimulator(unsigned short basePort);
+
+// 'blackbird --simulator': serves until interrupted
+int runSimulator(Parameters &params, std::ostream &out);
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef MATCHING_ENGINE_H
+#define MATCHING_ENGINE_H
+
+#include "order_type.h"
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// One BTC/USD limit order book with price-time priority, and the account
+// of the trader being simulated. Orders are either ours (sent through the
+// REST API) or the market's (the liquidity the simulator keeps in the
+// book); only ours move the account. Not thread-safe.
+class MatchingEngine {
+public:
+  struct Order {
+    uint64_t id;
+    bool isBuy;
+    double price;
+    double quantity;       // as sent
+    double filled = 0.0;
+    double filledValue = 0.0;  // sum of price * quantity of the fills
+    bool ours;
+    bool open = true;      // false once filled or canceled
+
+    double remaining() const { return quantity - filled; }
+  };
+  using Level = std::pair<double, double>;  // price, quantity
+
+  explicit MatchingEngine(double fee, double usd = 0.0, double btc = 0.0);
+
+  // Matches a limit order against the book, then leaves the rest in it, as
+  // 'type' allows: an immediate-or-cancel order drops it, a fill-or-kill
+  // order closes unfilled unless the book has all of it, and a post-only
+  // order that would trade closes unfilled. Returns the id of the order.
+  uint64_t submit(bool isBuy, double price, double quantity, bool ours,
+                  OrderType type = OrderType::gtc);
+  // False if the order is unknown or no longer open
+  bool cancel(uint64_t id);
+  // Removes all the market's orders, ours stay
+  void clearMarket();
+
+  // nullptr if unknown; our orders are kept after they close
+  Order const *order(uint64_t id) const;
+  std::vector<Order> openOrders() const;
+
+  // Aggregated levels, best first
+  std::vector<Level> bids(size_t depth) const;
+  std::vector<Level> asks(size_t depth) const;
+  double bestBid() const;
+  double bestAsk() const;
+
+  double usd() const { return usdBalance; }
+  double btc() const { return btcBalance; }
+
+private:
+  // Resting order ids by price, in arrival order
+  using Side = std::map<double, std::deque<uint64_t>,
+                        std::function<bool(double, double)>>;
+
+  void fill(Order &order, double price, double quantity);
+  std::vector<Level> levels(Side const &side, size_t depth) const;
+
+  const double fee;
+  double usdBalance;
+  double btcBalance;
+  uint64_t nextId = 1;
+  Side bidSide{std::greater<double>()};
+  Side askSide{std::less<double>()};
+  std::unordered_map<uint64_t, Order> orders;
+};
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef SIM_VENUE_H
+#define SIM_VENUE_H
+
+#include "matching_engine.h"
+#include "utils/http_server.h"
+
+#include <map>
+#include <mutex>
+#include <string>
+
+// One simulated exchange: its book and our account, behind the REST API of
+// the real one.
+struct SimVenue {
+  using Handler = HttpServer::Response (*)(SimVenue &venue,
+                                           HttpServer::Request const &req);
+  using ErrorBody = std::string (*)(std::string const &message);
+
+  SimVenue(const char *name, Handler handle, ErrorBody error, bool margin,
+           double fee, double usd, double btc)
+      : name(name), handle(handle), error(error), margin(margin),
+        engine(fee, usd, btc) {}
+
+  const char *name;
+  const Handler handle;
+  const ErrorBody error;
+  // Shorts allowed: the BTC balance can go below zero
+  const bool margin;
+
+  std::mutex mtx;  // guards engine
+  MatchingEngine engine;
+
+  // Sends our order to the engine unless the account cannot pay for it;
+  // returns 0 and sets 'reason' when it is rejected. Locks mtx.
+  uint64_t placeOrder(bool isBuy, double price, double quantity,
+                      OrderType type, std::string &reason);
+  // False unless it is one of our open orders. Locks mtx.
+  bool cancelOrder(uint64_t id);
+};
+
+// Request arguments, from a query string or a form body
+std::map<std::string, std::string> parseForm(std::string const &form);
+
+// The REST dialect of each simulated exchange: the endpoints the adapter
+// of that exchange uses, with responses in the exchange's format.
+// Signatures are not checked.
+namespace SimDialect {
+HttpServer::Response binance(SimVenue &venue, HttpServer::Request const &req);
+std::string binanceError(std::string const &message);
+
+HttpServer::Response kraken(SimVenue &venue, HttpServer::Request const &req);
+std::string krakenError(std::string const &message);
+
+HttpServer::Response bitfinex(SimVenue &venue, HttpServer::Request const &req);
+std::string bitfinexError(std::string const &message);
+
+HttpServer::Response coinbase(SimVenue &venue, HttpServer::Request const &req);
+std::string coinbaseError(std::string const &message);
+
+HttpServer::Response bitstamp(SimVenue &venue, HttpServer::Request const &req);
+std::string bitstampError(std::string const &message);
+} // namespace SimDialect
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef STATE_STORE_H
+#define STATE_STORE_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+struct Result;
+
+// An order sent but not known to be filled yet
+struct PendingOrder {
+  unsigned exch;
+  std::string orderId;
+  std::string direction;
+  bool isShort;
+  double quantity;
+  double price;
+  // Id of the position the order opens or closes
+  unsigned positionId;
+};
+
+// Open positions and pending orders, saved so that a restarted
+// Blackbird can pick them up again.
+// Changes are kept in memory until commit(), which writes the whole state
+// to a temporary file, syncs it to disk and renames it over the state file:
+// after a crash the file holds either the previous or the new state, never
+// a mix of both.
+class StateStore {
+public:
+  explicit StateStore(std::string fileName);
+
+  // Reads the state left by the previous run. An old restore.txt is
+  // imported (and removed) when there is no state file yet.
+  // Returns false if the state file is damaged, in which case it is
+  // left untouched and the store starts empty.
+  bool load();
+
+  void savePosition(Result const &res);
+  void removePosition(unsigned id);
+  std::vector<unsigned> positionIds() const;
+  bool restorePosition(unsigned id, Result &res) const;
+
+  void addOrder(PendingOrder const &order);
+  void removeOrder(unsigned exch, std::string const &orderId);
+  std::vector<PendingOrder> const &pendingOrders() const { return orders; }
+
+  // Persists the changes made since the last commit, returns false if
+  // they could not be written (the previous state is still on disk)
+  bool commit();
+
+private:
+  std::string fileName;
+  // Position id -> Result::savePartialResult() line
+  std::map<unsigned, std::string> positions;
+  std::vector<PendingOrder> orders;
+};
+
+#endif
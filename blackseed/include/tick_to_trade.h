@@ -0,0 +1,17 @@
+#ifndef TICK_TO_TRADE_H
+#define TICK_TO_TRADE_H
+
+#include <ostream>
+#include <string>
+
+// Runs the path from the quotes to the orders of a trade 'rounds' times,
+// with Binance as the long and Bitfinex as the short exchange, against
+// local servers that answer with the responses stored in 'fixtureDir'
+// (one file per endpoint: <dir>/<host><path>.json, e.g. a capture made
+// with curl). Writes the p50/p99/p99.9 latency and the JSON values
+// allocated by every stage, then the per-endpoint request stages.
+// Returns EXIT_FAILURE when a fixture is missing.
+int benchTickToTrade(std::string const &fixtureDir, unsigned rounds,
+                     std::ostream &out);
+
+#endif
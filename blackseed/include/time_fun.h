@@ -1,11 +1,16 @@
 #ifndef TIME_FUN_H
 #define TIME_FUN_H
 
+#include <chrono>
 #include <string>
 #include <ctime>
 
 time_t getTime_t(int y, int m, int d, int h, int n, int s);
 
+// The date and time functions below are thread-safe. Each thread formats
+// a given second once per format, the following calls in the same
+// second only copy it.
+
 // Returns 'yyyy-mm-dd_hh:nn:ss'
 extern std::string (*const printDateTimeCsv)(const time_t &t);
 
@@ -21,4 +26,18 @@ std::string printDateTime(time_t t);
 // Returns current 'mm/dd/yyyy hh:mm:ss'
 std::string printDateTime();
 
+// Decimals of the seconds
+enum class SubSecond { none = 0, millis = 3, micros = 6 };
+
+// Writes 'mm/dd/yyyy hh:nn:ss', followed by the milli or microseconds
+// if asked, to 'out' (no terminating null) and returns its length.
+// 'out' needs room for maxDateTimeSize characters.
+constexpr size_t maxDateTimeSize = 32;
+size_t formatDateTime(char *out, std::chrono::system_clock::time_point t,
+                      SubSecond precision);
+
+// Returns 'mm/dd/yyyy hh:nn:ss.fff' or 'mm/dd/yyyy hh:nn:ss.ffffff'
+std::string printDateTime(std::chrono::system_clock::time_point t,
+                          SubSecond precision);
+
 #endif
@@ -0,0 +1,203 @@
+#ifndef ASYNC_LOG_H
+#define ASYNC_LOG_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+
+enum class LogLevel : uint8_t { debug, info, warning, error };
+
+// "debug", "info", "warning" or "error", anything else gives info
+LogLevel parseLogLevel(std::string const &name);
+
+// One log line as it travels from the logging thread to the writer: the
+// format strings and raw argument values, formatted by the writer only.
+struct LogRecord {
+  static constexpr int maxPieces = 4;
+  static constexpr int maxArgs = 16;
+  static constexpr int textSize = 128;
+
+  enum ArgType : uint8_t { f64, i64, u64, str };
+  union Value {
+    double f;
+    int64_t i;
+    uint64_t u;
+    uint32_t str;  // offset in 'text'
+  };
+
+  // Format strings must outlive the record, i.e. be literals.
+  // No piece means 'text' (or 'longText') is a line written as is.
+  const char *pieces[maxPieces];
+  std::string *longText;
+  Value values[maxArgs];
+  uint32_t suppressed;
+  uint16_t textLen;
+  LogLevel level;
+  uint8_t nPieces;
+  uint8_t nArgs;
+  ArgType types[maxArgs];
+  char text[textSize];
+};
+
+class AsyncLog;
+
+// Builds one record from one or more format pieces and pushes it when
+// destroyed. In the format, {} prints an argument (doubles with 2
+// decimals), {.N} a double with N decimals and {%} a ratio as ' 1.23%'.
+class LogLine {
+  AsyncLog *log;
+  LogRecord rec;
+
+  void add(double v);
+  void add(int64_t v);
+  void add(uint64_t v);
+  void add(std::string_view v);
+
+  template <typename T>
+  void arg(T const &v) {
+    if constexpr (std::is_floating_point<T>::value)
+      add(static_cast<double>(v));
+    else if constexpr (std::is_integral<T>::value && std::is_signed<T>::value)
+      add(static_cast<int64_t>(v));
+    else if constexpr (std::is_integral<T>::value)
+      add(static_cast<uint64_t>(v));
+    else
+      add(std::string_view(v));
+  }
+
+public:
+  LogLine(AsyncLog *log, LogLevel level, uint32_t suppressed = 0);
+  LogLine(const LogLine &) = delete;
+  LogLine &operator=(const LogLine &) = delete;
+  ~LogLine();
+
+  template <typename... Args>
+  LogLine &operator()(const char *fmt, Args const &... args) {
+    if (log && rec.nPieces < LogRecord::maxPieces) {
+      rec.pieces[rec.nPieces++] = fmt;
+      (arg(args), ...);
+    }
+    return *this;
+  }
+};
+
+// Log file writer running on its own thread.
+// Callers push records into a lock-free ring buffer and return; the writer
+// thread formats them and writes them to 'sink', flushing it whenever it
+// runs out of records. A full ring makes callers wait for room, nothing
+// is dropped.
+// Besides the structured records, stream() returns an std::ostream for
+// existing code, one per thread: every thread's text is collected in its
+// own buffer and handed over line by line, and its precision and flags
+// are its own, starting as those of 'sink'. std::endl no longer flushes
+// to disk.
+// Lines written through stream() are always kept, whatever the level.
+class AsyncLog {
+public:
+  AsyncLog(std::ostream &sink, LogLevel level = LogLevel::info,
+           size_t capacity = 4096);
+  ~AsyncLog();
+  AsyncLog(const AsyncLog &) = delete;
+  AsyncLog &operator=(const AsyncLog &) = delete;
+
+  bool enabled(LogLevel level) const { return level >= minLevel; }
+  void setLevel(LogLevel level) { minLevel = level; }
+
+  LogLine line(LogLevel level) {
+    return LogLine(enabled(level) ? this : nullptr, level);
+  }
+
+  template <typename... Args>
+  void log(LogLevel level, const char *fmt, Args const &... args) {
+    if (enabled(level))
+      LogLine(this, level)(fmt, args...);
+  }
+
+  // Same as log(), but lets through at most one record per 'period' for
+  // the format and 'id' (e.g. an exchange index). The next record that
+  // goes through tells how many were dropped in between.
+  template <typename... Args>
+  void logEvery(std::chrono::milliseconds period, unsigned id, LogLevel level,
+                const char *fmt, Args const &... args) {
+    uint32_t suppressed;
+    if (enabled(level) && admit(fmt, id, period, suppressed))
+      LogLine(this, level, suppressed)(fmt, args...);
+  }
+
+  // The calling thread's stream
+  std::ostream &stream();
+
+  // Waits until everything logged so far by any thread is on disk
+  void flush();
+
+private:
+  friend class LogLine;
+  class LineBuf : public std::streambuf {
+    AsyncLog &log;
+  public:
+    explicit LineBuf(AsyncLog &log) : log(log) {}
+  protected:
+    int_type overflow(int_type c) override;
+    std::streamsize xsputn(const char *s, std::streamsize n) override;
+    int sync() override;
+  };
+
+  struct alignas(64) Cell {
+    std::atomic<size_t> seq;
+    LogRecord rec;
+  };
+
+  struct RateSlot {
+    std::atomic<int64_t> next{0};
+    std::atomic<uint32_t> suppressed{0};
+  };
+
+  void push(LogRecord const &rec);
+  void pushText(const char *s, size_t n);
+  bool admit(const char *fmt, unsigned id, std::chrono::milliseconds period,
+             uint32_t &suppressed);
+  void run();
+  void write(LogRecord const &rec);
+  void stop();
+
+  std::ostream &sink;
+  std::atomic<LogLevel> minLevel;
+  const size_t mask;
+  std::unique_ptr<Cell[]> cells;
+  alignas(64) std::atomic<size_t> enqueuePos{0};
+  alignas(64) std::atomic<size_t> flushedPos{0};
+  std::atomic<bool> stopping{false};
+  RateSlot rates[64];
+
+  LineBuf buf;
+  // Writer thread only
+  std::string formatted;
+  std::ostringstream number;
+  std::thread writer;
+};
+
+// What Parameters::logFile holds: *logFile is the stream of the calling
+// thread, so that a thread setting its precision does not change the
+// numbers of another. A plain std::ostream is shared as is, for the
+// single-threaded tests of the adapters.
+class LogStream {
+  AsyncLog *log = nullptr;
+  std::ostream *plain = nullptr;
+
+public:
+  LogStream() = default;
+  LogStream(AsyncLog &log) : log(&log) {}
+  LogStream(std::ostream *plain) : plain(plain) {}
+
+  std::ostream &operator*() const { return log ? log->stream() : *plain; }
+  std::ostream *operator->() const { return &**this; }
+};
+
+#endif
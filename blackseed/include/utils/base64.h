@@ -1,9 +1,17 @@
 #ifndef BASE64_H
 #define BASE64_H
 
+#include <iosfwd>
 #include <string>
 
 std::string base64_encode(unsigned char const* , unsigned int len);
 std::string base64_decode(std::string const& s);
 
+// Compares every code path the CPU supports with the original coder on
+// random and malformed input. Prints a line per path, false on mismatch.
+bool testBase64(std::ostream &out);
+
+// Prints encode/decode throughput of the original coder and of each path.
+void benchBase64(std::ostream &out);
+
 #endif
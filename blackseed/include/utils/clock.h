@@ -0,0 +1,43 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <chrono>
+#include <cstdint>
+
+// The two clocks of the bot, in nanoseconds.
+// The monotonic one never goes back: it times latencies and ages and
+// orders the events of a run, but means nothing outside the process.
+// The wall clock counts from the Unix epoch (UTC) and dates the records
+// (journal, state, log); it can jump when the system clock is set.
+namespace Clock {
+
+inline int64_t monoNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+inline int64_t wallNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+inline std::chrono::system_clock::time_point wallTime(int64_t ns) {
+  return std::chrono::system_clock::time_point(
+      std::chrono::duration_cast<std::chrono::system_clock::duration>(
+          std::chrono::nanoseconds(ns)));
+}
+
+// Both clocks read at the same moment
+struct Stamp {
+  int64_t mono = 0;
+  int64_t wall = 0;
+
+  static Stamp now() { return {monoNs(), wallNs()}; }
+  // Nanoseconds since the stamp, 0 for an unset one
+  int64_t age() const { return mono ? monoNs() - mono : 0; }
+};
+}
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef CPU_FEATURES_H
+#define CPU_FEATURES_H
+
+// SIMD code paths are only compiled on x86. Functions using them are
+// tagged with the matching target attribute so the rest of the program
+// keeps the default instruction set, and are only called after checking
+// the CPU at run time.
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define BLACKBIRD_X86 1
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#define TARGET_AVX2  __attribute__((target("avx2")))
+#else
+#define TARGET_SSSE3
+#define TARGET_AVX2
+#endif
+
+bool cpuHasSSSE3();
+bool cpuHasAVX2();
+
+#endif
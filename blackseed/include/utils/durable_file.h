@@ -0,0 +1,18 @@
+#ifndef DURABLE_FILE_H
+#define DURABLE_FILE_H
+
+#include <string>
+
+// Writes 'data' to 'fileName' and makes sure it reached the disk. A
+// 'secret' file is made readable by its owner only (POSIX).
+bool writeDurably(std::string const &fileName, std::string const &data,
+                  bool secret = false);
+
+// Atomically replaces 'to' by 'from': a reader finds either file whole,
+// never none. Durable once this returns true.
+bool replaceFile(std::string const &from, std::string const &to);
+
+// Cuts 'fileName' to its first 'size' bytes
+bool truncateFile(std::string const &fileName, long size);
+
+#endif
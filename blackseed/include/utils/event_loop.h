@@ -0,0 +1,103 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include "task.h"
+
+#include "curl/curl.h"
+#include <chrono>
+#include <coroutine>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// One thread running the curl transfers of every coroutine, through curl's
+// multi interface: on Linux the sockets are watched with epoll, elsewhere
+// with curl_multi_poll. A coroutine waiting for a transfer or a sleep
+// holds no thread; it is resumed on the loop thread, where it should not
+// block.
+class EventLoop {
+public:
+  using clock = std::chrono::steady_clock;
+
+  EventLoop();
+  ~EventLoop();
+  EventLoop(const EventLoop &) = delete;
+  EventLoop &operator=(const EventLoop &) = delete;
+
+  // co_await loop.transfer(C) performs the request set up on the easy
+  // handle C and returns curl's result
+  struct TransferAwaiter {
+    EventLoop &loop;
+    CURL *easy;
+    std::coroutine_handle<> waiter{};
+    CURLcode result = CURLE_OK;
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> h);
+    CURLcode await_resume() const noexcept { return result; }
+  };
+  TransferAwaiter transfer(CURL *easy) { return {*this, easy}; }
+
+  // co_await loop.sleep(d) resumes after 'd' on the loop thread
+  struct SleepAwaiter {
+    EventLoop &loop;
+    clock::time_point until;
+
+    bool await_ready() const noexcept { return clock::now() >= until; }
+    void await_suspend(std::coroutine_handle<> h);
+    void await_resume() const noexcept {}
+  };
+  SleepAwaiter sleep(clock::duration d) { return {*this, clock::now() + d}; }
+  SleepAwaiter sleepUntil(clock::time_point t) { return {*this, t}; }
+
+  // co_await loop.schedule() moves the coroutine onto the loop thread
+  struct ScheduleAwaiter {
+    EventLoop &loop;
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> h);
+    void await_resume() const noexcept {}
+  };
+  ScheduleAwaiter schedule() { return {*this}; }
+
+  // Runs 'work' on the loop thread
+  void post(std::function<void()> work);
+  // Starts 't' on the loop thread; nobody awaits it, it should catch its
+  // own exceptions
+  void spawn(task<void> t);
+
+private:
+  void run();
+  void wakeup();
+  // Loop thread only
+  bool runPosted();  // false once stopping
+  void finishTransfers();
+  void fireTimers();
+  int waitTimeoutMs() const;
+
+  CURLM *multi;
+  std::mutex mtx;
+  std::vector<std::function<void()>> posted;
+  bool stopping = false;
+
+  // Loop thread only
+  std::multimap<clock::time_point, std::coroutine_handle<>> timers;
+#if defined(__linux__)
+  static int onSocket(CURL *easy, curl_socket_t s, int what, void *loop,
+                      void *socketp);
+  static int onTimer(CURLM *multi, long timeoutMs, void *loop);
+
+  int epollFd;
+  int wakeFd;  // eventfd
+  clock::time_point curlDeadline = clock::time_point::max();
+#endif
+
+  std::thread worker;
+};
+
+// The loop of the process, started on first use
+EventLoop &eventLoop();
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef HMAC_SIGNER_H
+#define HMAC_SIGNER_H
+
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/opensslv.h>
+#include <initializer_list>
+#include <iosfwd>
+#include <string>
+#include <string_view>
+
+class LatencyHistogram;
+
+// Digest produced by HmacSigner, kept on the stack.
+struct Signature {
+  unsigned char bytes[EVP_MAX_MD_SIZE];
+  unsigned int size = 0;
+
+  std::string hex() const;
+  std::string upperHex() const;
+  std::string base64() const;
+};
+
+// Signs messages with HMAC for one API secret.
+// The keyed inner/outer pad state is computed once at construction, so
+// signing a message only copies that state and hashes the message itself.
+// A signer can be shared between threads. OpenSSL 3 keeps the state in an
+// EVP_MAC context, the HMAC_CTX functions being deprecated there.
+class HmacSigner {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  EVP_MAC_CTX *keyed;
+#else
+  HMAC_CTX *keyed;
+#endif
+  LatencyHistogram *timing;
+
+public:
+  // Signing times go to 'timing' when given
+  HmacSigner(EVP_MD const *md, std::string const &key,
+             LatencyHistogram *timing = nullptr);
+  ~HmacSigner();
+  HmacSigner(const HmacSigner &) = delete;
+  HmacSigner &operator=(const HmacSigner &) = delete;
+
+  // Signs the concatenation of 'parts', without building it first.
+  Signature sign(std::initializer_list<std::string_view> parts) const;
+  Signature sign(std::string_view msg) const { return sign({msg}); }
+};
+
+// Prints the number of signatures per second with a cached signer and with
+// OpenSSL's one-shot HMAC(), for the digests used by the exchanges.
+void benchHmacSigner(std::ostream &out);
+
+#endif
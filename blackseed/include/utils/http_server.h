@@ -0,0 +1,66 @@
+#ifndef HTTP_SERVER_H
+#define HTTP_SERVER_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <string>
+#include <thread>
+
+// Minimal HTTP/1.1 server on 127.0.0.1 for local stand-ins of the
+// exchanges and the metrics. Each connection gets its own thread and is
+// kept alive, like the ones curl keeps to the real APIs; the thread is
+// joined once its client is gone. Not meant to face a network.
+class HttpServer {
+public:
+  struct Request {
+    std::string method;
+    std::string uri;    // with its query string
+    std::string path;   // without it
+    std::string headers;
+    std::string body;
+
+    // Value of header 'name', any case, empty if missing
+    std::string header(std::string const &name) const;
+  };
+  struct Response {
+    int status = 200;
+    std::string body;
+    std::string contentType = "application/json";
+  };
+  using Handler = std::function<Response(Request const &)>;
+
+  // Port 0 picks a free port, see port()
+  HttpServer(unsigned short port, Handler handler);
+  ~HttpServer();
+  HttpServer(const HttpServer &) = delete;
+  HttpServer &operator=(const HttpServer &) = delete;
+
+  // False if the port could not be opened
+  bool isRunning() const { return acceptor.joinable(); }
+  unsigned short port() const { return boundPort; }
+  // "http://127.0.0.1:<port>"
+  std::string url() const;
+
+private:
+  struct Connection {
+    std::thread thread;
+    std::atomic<bool> done{false};
+  };
+
+  void accept();
+  // Joins the connections whose client is gone
+  void reap();
+  void serve(Connection &connection, intptr_t client);
+
+  Handler handler;
+  intptr_t listener;
+  unsigned short boundPort = 0;
+  std::atomic<bool> stopping{false};
+  std::thread acceptor;
+  // Acceptor thread only, until it is joined
+  std::list<Connection> connections;
+};
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <tuple>
+
+// Histogram of durations in nanoseconds, HdrHistogram style: values are
+// counted in buckets whose width grows with the value, which keeps every
+// value within 1/64 (1.6%) of its bucket up to 2^36 ns (about 68 s).
+// Recording is a few relaxed atomic increments, from any thread.
+class LatencyHistogram {
+public:
+  static constexpr int subBucketBits = 7;
+  static constexpr int maxBits = 36;
+  static constexpr int bucketCount =
+      (1 << subBucketBits) + (maxBits - subBucketBits) * (1 << (subBucketBits - 1));
+
+  LatencyHistogram();
+  LatencyHistogram(const LatencyHistogram &) = delete;
+  LatencyHistogram &operator=(const LatencyHistogram &) = delete;
+
+  void record(uint64_t ns);
+  void record(std::chrono::nanoseconds d) {
+    record(d.count() > 0 ? static_cast<uint64_t>(d.count()) : 0);
+  }
+
+  uint64_t count() const { return total.load(std::memory_order_relaxed); }
+  uint64_t max() const { return maxNs.load(std::memory_order_relaxed); }
+  uint64_t sum() const { return sumNs.load(std::memory_order_relaxed); }
+  // Upper bound of the bucket holding the 'p' percentile (0 to 100)
+  uint64_t percentile(double p) const;
+  // Number of values up to 'ns', for cumulative exports
+  uint64_t countUpTo(uint64_t ns) const;
+
+  static int bucketOf(uint64_t ns);
+  static uint64_t bucketLimit(int bucket);
+
+private:
+  std::unique_ptr<std::atomic<uint64_t>[]> counts;
+  std::atomic<uint64_t> total{0};
+  std::atomic<uint64_t> sumNs{0};
+  std::atomic<uint64_t> maxNs{0};
+};
+
+// Records the time spent in its scope
+class LatencyTimer {
+  LatencyHistogram &histogram;
+  std::chrono::steady_clock::time_point start;
+
+public:
+  explicit LatencyTimer(LatencyHistogram &histogram)
+      : histogram(histogram), start(std::chrono::steady_clock::now()) {}
+  ~LatencyTimer() { histogram.record(std::chrono::steady_clock::now() - start); }
+  LatencyTimer(const LatencyTimer &) = delete;
+  LatencyTimer &operator=(const LatencyTimer &) = delete;
+};
+
+// All the histograms of the process, by source (an exchange name or an
+// API host), endpoint and stage (dns, connect, tls, first_byte, transfer,
+// total, parse, sign, order_ack...).
+// Looking a histogram up takes a lock, callers on a hot path keep the
+// reference, which stays valid for the life of the process.
+class LatencyRegistry {
+public:
+  using Key = std::tuple<std::string, std::string, std::string>;
+
+  LatencyHistogram &histogram(std::string const &source,
+                              std::string const &endpoint,
+                              std::string const &stage);
+
+  // Calls f(key, histogram) for every histogram, in key order
+  template <typename F> void forEach(F f) const {
+    std::lock_guard<std::mutex> lock(mtx);
+    for (auto const &entry : table)
+      f(entry.first, *entry.second);
+  }
+
+  // Writes a table of the count and percentiles in microseconds
+  void dump(std::ostream &out) const;
+  // Same as dump(), into 'fileName' replaced as a whole
+  void dumpToFile(std::string const &fileName) const;
+
+private:
+  mutable std::mutex mtx;
+  std::map<Key, std::unique_ptr<LatencyHistogram>> table;
+};
+
+LatencyRegistry &latency();
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "http_server.h"
+
+#include <atomic>
+#include <cstdint>
+#include <initializer_list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Counters, gauges and histograms in the Prometheus text format.
+// Updating a metric never takes a lock: counters are split in per-thread
+// cells that are only added up when scraped, gauges and histograms are
+// plain atomics. Looking a metric up locks the registry, so hot paths
+// keep the reference, which stays valid for the life of the process.
+
+class Metric {
+public:
+  virtual ~Metric() = default;
+  // Appends the sample lines of the metric
+  virtual void render(std::string &out, std::string const &name,
+                      std::string const &labels) const = 0;
+};
+
+class Counter : public Metric {
+  static constexpr int cellCount = 8;
+  struct alignas(64) Cell {
+    std::atomic<uint64_t> value{0};
+  };
+  Cell cells[cellCount];
+
+public:
+  void inc(uint64_t n = 1);
+  uint64_t value() const;
+  void render(std::string &out, std::string const &name,
+              std::string const &labels) const override;
+};
+
+class Gauge : public Metric {
+  std::atomic<uint64_t> bits{0};  // the double's bits
+
+public:
+  void set(double v);
+  void add(double v);
+  double value() const;
+  void render(std::string &out, std::string const &name,
+              std::string const &labels) const override;
+};
+
+class Histogram : public Metric {
+  const std::vector<double> bounds;
+  // One count per bound, then the +Inf one
+  std::unique_ptr<std::atomic<uint64_t>[]> counts;
+  Gauge total;
+
+public:
+  explicit Histogram(std::vector<double> bounds);
+  void observe(double v);
+  void render(std::string &out, std::string const &name,
+              std::string const &labels) const override;
+};
+
+class MetricsRegistry {
+public:
+  using Labels = std::initializer_list<std::pair<const char *, std::string>>;
+
+  Counter &counter(std::string const &name, std::string const &help,
+                   Labels labels = {});
+  Gauge &gauge(std::string const &name, std::string const &help,
+               Labels labels = {});
+  Histogram &histogram(std::string const &name, std::string const &help,
+                       std::vector<double> const &bounds, Labels labels = {});
+
+  // All the metrics in the text exposition format, the latency()
+  // histograms included
+  std::string render() const;
+
+private:
+  struct Family {
+    std::string help;
+    const char *type;
+    std::vector<std::pair<std::string, std::unique_ptr<Metric>>> metrics;
+  };
+
+  template <typename T, typename... Args>
+  T &get(std::string const &name, std::string const &help, const char *type,
+         Labels labels, Args &&... args);
+
+  mutable std::mutex mtx;
+  std::map<std::string, Family> families;
+};
+
+MetricsRegistry &metrics();
+
+// Serves GET requests for the metrics of 'registry' on 127.0.0.1:'port',
+// through an HttpServer.
+class MetricsServer {
+public:
+  MetricsServer(MetricsRegistry &registry, unsigned short port);
+  MetricsServer(const MetricsServer &) = delete;
+  MetricsServer &operator=(const MetricsServer &) = delete;
+
+  // False if the port could not be opened
+  bool isRunning() const { return server.isRunning(); }
+
+private:
+  HttpServer::Response serve(HttpServer::Request const &request) const;
+
+  MetricsRegistry &registry;
+  HttpServer server;
+};
+
+#endif
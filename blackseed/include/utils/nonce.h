@@ -0,0 +1,58 @@
+#ifndef NONCE_H
+#define NONCE_H
+
+#include <coroutine>
+#include <cstdint>
+#include <string>
+
+struct NonceSlot;
+
+// Hands out the nonces of a namespace, one request at a time. Authenticated
+// adapters use their exchange name, a colon and their API key as namespace,
+// so two keys never share a counter.
+// Nonces are strictly increasing within a namespace and never lower than
+// 'floor' (e.g. a time based value some exchanges expect). A high-water mark
+// is persisted to 'nonce.dat' ahead of use, so a restart within the same
+// second never reuses a nonce. The file only has a hash of the API keys,
+// and only its owner can read it.
+// The namespace stays locked as long as the NonceLock lives: an adapter
+// keeps it until its request is sent, so that requests from several
+// threads reach the exchange in the order of their nonces.
+class NonceLock {
+public:
+  // Waits until the namespace is free
+  NonceLock(std::string const &ns, uint64_t floor = 0);
+  NonceLock(NonceLock &&other) noexcept;
+  NonceLock(const NonceLock &) = delete;
+  NonceLock &operator=(const NonceLock &) = delete;
+  ~NonceLock();
+
+  uint64_t nonce() const { return value; }
+
+  // co_await NonceLock::async(ns, floor) waits for the namespace without
+  // holding a thread, for the coroutine adapters; it resumes on the event
+  // loop thread if it had to wait.
+  struct Awaiter {
+    NonceSlot &slot;
+    uint64_t floor;
+
+    bool await_ready();
+    bool await_suspend(std::coroutine_handle<> h);
+    NonceLock await_resume() { return NonceLock(slot, floor); }
+  };
+  static Awaiter async(std::string const &ns, uint64_t floor = 0);
+
+private:
+  // Takes the nonce of a namespace already locked for us
+  NonceLock(NonceSlot &slot, uint64_t floor);
+
+  NonceSlot *slot;
+  uint64_t value;
+};
+
+// Keeps the high-water marks in 'fileName' instead of 'nonce.dat', e.g. for
+// a run whose nonces never reach an exchange. Only effective before the
+// first nonce is handed out.
+void useNonceFile(std::string const &fileName);
+
+#endif
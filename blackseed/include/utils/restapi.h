@@ -1,12 +1,39 @@
 #ifndef RESTAPI_H
 #define RESTAPI_H
 
+#include "async_log.h"
 #include "curl/curl.h"
+#include "latency.h"
+#include "task.h"
+#include <chrono>
+#include <exception>
 #include <iostream>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 
 struct json_t;
+class Counter;
+
+// Histograms of the stages of the requests to one endpoint
+struct RequestTimings {
+  LatencyHistogram *dns;
+  LatencyHistogram *connect;
+  LatencyHistogram *tls;
+  LatencyHistogram *firstByte;
+  LatencyHistogram *transfer;
+  LatencyHistogram *total;
+  LatencyHistogram *parse;
+};
+
+// Failures of the requests to one host
+struct RequestCounters {
+  Counter *curlErrors;
+  Counter *jsonErrors;
+  Counter *retries;
+};
+
 class RestApi
 {
   struct CURL_deleter
@@ -18,15 +45,40 @@ class RestApi
   typedef std::unique_ptr<CURL, CURL_deleter> unique_curl;
   typedef std::string string;
 
+  // Response of one cached URI, shared by the requests that arrive while
+  // it is being fetched and until it expires
+  struct CacheEntry;
+  struct CacheWaiter;
+
   unique_curl C;
+  const string cacert;
   const string host;
-  std::ostream &log;
+  const string source;  // name of the original host, for the metrics
+  // Looked up at each use: a static RestApi outlives the thread that
+  // happened to create it, and with it that thread's log stream
+  LogStream log;
+  std::mutex curlMtx;   // one transfer at a time on C
+  // By URI without its query string, under curlMtx
+  std::map<string, RequestTimings> timings;
+  RequestCounters counters;
+
+  std::mutex cacheMtx;
+  std::map<string, std::shared_ptr<CacheEntry>> cache;
+
+  RequestTimings &timingsOf(const string &uri);
+  unique_curl newHandle() const;
+  // The entry of 'uri'; 'fetching' if it is new and the caller must fetch
+  // the response, then publish() it (nullptr and the exception on failure)
+  std::shared_ptr<CacheEntry> cacheEntry(const string &uri, bool &fetching);
+  void publish(const string &uri, std::shared_ptr<CacheEntry> const &entry,
+               json_t *root, std::exception_ptr error,
+               std::chrono::milliseconds ttl);
 
 public:
   using unique_slist = std::unique_ptr<curl_slist, CURL_deleter>;
 
   RestApi              (string host, const char *cacert = nullptr,
-                        std::ostream &log = std::cerr);
+                        LogStream log = &std::cerr);
   RestApi              (const RestApi &) = delete;
   RestApi& operator =  (const RestApi &) = delete;
 
@@ -34,6 +86,37 @@ public:
   json_t* postRequest  (const string &uri, unique_slist headers = nullptr,
                         const string &post_data = "");
   json_t* postRequest  (const string &uri, const string &post_data);
+  json_t* deleteRequest(const string &uri, unique_slist headers = nullptr);
+
+  // GET for public, idempotent endpoints. The response is reused for 'ttl'
+  // after it arrives, and concurrent callers for the same URI wait for a
+  // single request instead of sending their own. The returned reference
+  // belongs to the caller; the JSON must not be modified.
+  json_t* cachedGet    (const string &uri, std::chrono::milliseconds ttl);
+
+  // Same requests for coroutines, on the event loop. Each one has its own
+  // handle, so any number of them can be in flight at once; failures are
+  // retried like the blocking ones, without holding a thread.
+  task<json_t*> getAsync     (string uri, unique_slist headers = nullptr);
+  task<json_t*> postAsync    (string uri, unique_slist headers,
+                              string post_data);
+  task<json_t*> deleteAsync  (string uri, unique_slist headers = nullptr);
+  // Shares the responses of cachedGet. A response still being fetched,
+  // by either, is waited for without holding a thread.
+  task<json_t*> cachedGetAsync (string uri, std::chrono::milliseconds ttl);
+
+  // Sends what is meant for 'host' to 'replacement' instead, e.g. a local
+  // stand-in of the exchange. Applies to the RestApi created afterwards;
+  // their metrics keep the original host name.
+  static void overrideHost(const string &host, const string &replacement);
+
+  // By host name, how far ahead of ours the server's clock is, as far as
+  // the Date headers of its responses tell (within about half a second).
+  // Only the hosts that answered with a Date header are there.
+  static std::map<string, std::chrono::milliseconds> clockOffsets();
+
+private:
+  task<json_t*> requestAsync (unique_curl C, string uri, unique_slist headers);
 };
 
 template <typename T>
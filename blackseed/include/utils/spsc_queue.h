@@ -0,0 +1,70 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+// Bounded lock-free queue between exactly one producer thread and one
+// consumer thread. Each side owns one index and reads the other's, so a
+// push or a pop is a few loads and one release store. The capacity is
+// rounded up to a power of 2.
+template <typename T> class SpscQueue {
+public:
+  explicit SpscQueue(size_t capacity)
+      : mask(roundUp(capacity) - 1), slots(new T[mask + 1]) {}
+  SpscQueue(const SpscQueue &) = delete;
+  SpscQueue &operator=(const SpscQueue &) = delete;
+
+  // Producer only. False when the queue is full, 'value' is then unused.
+  bool push(T value) {
+    auto t = tail.load(std::memory_order_relaxed);
+    if (t - headCache > mask) {
+      headCache = head.load(std::memory_order_acquire);
+      if (t - headCache > mask)
+        return false;
+    }
+    slots[t & mask] = std::move(value);
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer only. False when the queue is empty.
+  bool pop(T &value) {
+    auto h = head.load(std::memory_order_relaxed);
+    if (h == tailCache) {
+      tailCache = tail.load(std::memory_order_acquire);
+      if (h == tailCache)
+        return false;
+    }
+    value = std::move(slots[h & mask]);
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Either side, only a hint while the other one runs
+  bool empty() const {
+    return head.load(std::memory_order_acquire) ==
+           tail.load(std::memory_order_acquire);
+  }
+
+private:
+  static size_t roundUp(size_t n) {
+    size_t p = 1;
+    while (p < n)
+      p <<= 1;
+    return p;
+  }
+
+  const size_t mask;
+  std::unique_ptr<T[]> slots;
+  // Consumer's line: its index and its last view of the producer's
+  alignas(64) std::atomic<size_t> head{0};
+  size_t tailCache = 0;
+  // Producer's line
+  alignas(64) std::atomic<size_t> tail{0};
+  size_t headCache = 0;
+};
+
+#endif
@@ -0,0 +1,167 @@
+#ifndef TASK_H
+#define TASK_H
+
+#include <condition_variable>
+#include <coroutine>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+// Result of a coroutine, e.g. 'task<quote_t> getQuote(Parameters &)'. The
+// coroutine starts when the task is awaited and, once done, resumes its
+// awaiter on the thread that finished it. Blocking code gets the result
+// with syncWait().
+template <typename T = void> class task;
+
+namespace detail {
+
+struct TaskPromiseBase {
+  std::coroutine_handle<> continuation;
+  std::exception_ptr error;
+
+  // Hands the thread over to the awaiter instead of returning to whoever
+  // resumed us last, so long await chains don't grow the stack
+  struct FinalAwaiter {
+    bool await_ready() noexcept { return false; }
+    template <typename P>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+      auto next = h.promise().continuation;
+      return next ? next : std::noop_coroutine();
+    }
+    void await_resume() noexcept {}
+  };
+
+  std::suspend_always initial_suspend() noexcept { return {}; }
+  FinalAwaiter final_suspend() noexcept { return {}; }
+  void unhandled_exception() { error = std::current_exception(); }
+};
+
+template <typename T> struct TaskPromise : TaskPromiseBase {
+  std::optional<T> value;
+
+  task<T> get_return_object();
+  template <typename U> void return_value(U &&v) {
+    value.emplace(std::forward<U>(v));
+  }
+  T result() {
+    if (error)
+      std::rethrow_exception(error);
+    return std::move(*value);
+  }
+};
+
+template <> struct TaskPromise<void> : TaskPromiseBase {
+  task<void> get_return_object();
+  void return_void() {}
+  void result() {
+    if (error)
+      std::rethrow_exception(error);
+  }
+};
+
+// Coroutine nobody awaits, its frame is freed when it ends
+struct Detached {
+  struct promise_type {
+    Detached get_return_object() noexcept { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() noexcept {}
+    void unhandled_exception() noexcept { std::terminate(); }
+  };
+};
+
+} // namespace detail
+
+template <typename T> class task {
+public:
+  using promise_type = detail::TaskPromise<T>;
+  using handle = std::coroutine_handle<promise_type>;
+
+  explicit task(handle h) : h(h) {}
+  task(task &&other) noexcept : h(std::exchange(other.h, {})) {}
+  task &operator=(task &&other) noexcept {
+    if (this != &other) {
+      if (h)
+        h.destroy();
+      h = std::exchange(other.h, {});
+    }
+    return *this;
+  }
+  task(const task &) = delete;
+  task &operator=(const task &) = delete;
+  ~task() {
+    if (h)
+      h.destroy();
+  }
+
+  bool await_ready() const noexcept { return false; }
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) {
+    h.promise().continuation = awaiter;
+    return h;
+  }
+  T await_resume() { return h.promise().result(); }
+
+  // Awaits the end of the coroutine, leaving its result in the task
+  auto finished() {
+    struct Awaiter {
+      handle h;
+      bool await_ready() const noexcept { return false; }
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) {
+        h.promise().continuation = awaiter;
+        return h;
+      }
+      void await_resume() noexcept {}
+    };
+    return Awaiter{h};
+  }
+  T result() { return h.promise().result(); }
+
+private:
+  handle h;
+};
+
+namespace detail {
+
+template <typename T> task<T> TaskPromise<T>::get_return_object() {
+  return task<T>(task<T>::handle::from_promise(*this));
+}
+
+inline task<void> TaskPromise<void>::get_return_object() {
+  return task<void>(task<void>::handle::from_promise(*this));
+}
+
+struct SyncEvent {
+  std::mutex mtx;
+  std::condition_variable cv;
+  bool done = false;
+
+  // Notifies under the lock, the waiter may destroy us as soon as it wakes
+  void set() {
+    std::lock_guard<std::mutex> lock(mtx);
+    done = true;
+    cv.notify_one();
+  }
+  void wait() {
+    std::unique_lock<std::mutex> lock(mtx);
+    cv.wait(lock, [this] { return done; });
+  }
+};
+
+template <typename T> Detached signalWhenFinished(task<T> &t, SyncEvent &event) {
+  co_await t.finished();
+  event.set();
+}
+
+} // namespace detail
+
+// Runs 't' and blocks the calling thread until it is done. Must not be
+// called on the event loop thread, which would wait for itself.
+template <typename T> T syncWait(task<T> t) {
+  detail::SyncEvent event;
+  detail::signalWhenFinished(t, event);
+  event.wait();
+  return t.result();
+}
+
+#endif
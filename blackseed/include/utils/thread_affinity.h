@@ -0,0 +1,9 @@
+#ifndef THREAD_AFFINITY_H
+#define THREAD_AFFINITY_H
+
+// Binds the calling thread to logical CPU 'cpu'. Returns false if the
+// system refused it; a negative 'cpu' leaves the thread free and returns
+// true.
+bool pinThisThread(int cpu);
+
+#endif
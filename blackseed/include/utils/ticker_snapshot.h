@@ -0,0 +1,54 @@
+#ifndef TICKER_SNAPSHOT_H
+#define TICKER_SNAPSHOT_H
+
+#include "quote_t.h"
+#include "task.h"
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+
+struct json_t;
+class RestApi;
+
+// Quotes of every market of one exchange, read from a single all-markets
+// ticker request. The snapshot is shared by all callers and fetched again
+// once it is older than 'ttl'; callers arriving during a fetch wait for it
+// instead of sending their own request (RestApi::cachedGet).
+class TickerSnapshot {
+public:
+  // Fills 'quotes' from the response, keyed by the exchange's market name
+  using Parser = void (*)(json_t *root, std::map<std::string, quote_t> &quotes);
+
+  TickerSnapshot(RestApi &api, std::string uri, Parser parse,
+                 std::chrono::milliseconds ttl);
+  TickerSnapshot(const TickerSnapshot &) = delete;
+  TickerSnapshot &operator=(const TickerSnapshot &) = delete;
+
+  // Bid and ask of 'market', 0.0 when the exchange did not list it.
+  quote_t quote(std::string const &market);
+  // Same for coroutines. A stale snapshot is fetched on the event loop; a
+  // caller arriving meanwhile waits for the same request.
+  task<quote_t> quoteAsync(std::string market);
+  // Copy of the whole snapshot.
+  std::map<std::string, quote_t> quotes();
+
+private:
+  void refresh();
+  bool isFresh() const;
+  void store(json_t *root);
+  quote_t find(std::string const &market) const;
+
+  RestApi &api;
+  const std::string uri;
+  const Parser parse;
+  const std::chrono::milliseconds ttl;
+
+  std::mutex mtx;
+  std::chrono::steady_clock::time_point fetched;
+  bool valid = false;
+  std::map<std::string, quote_t> table;
+};
+
+#endif
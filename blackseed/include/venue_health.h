@@ -0,0 +1,65 @@
+#ifndef VENUE_HEALTH_H
+#define VENUE_HEALTH_H
+
+#include "market_feed.h"
+
+#include <cstdint>
+#include <vector>
+
+struct Parameters;
+class Gauge;
+
+// Health of every exchange's quote feed, from the quotes the strategy
+// thread takes from the MarketFeed:
+//  - quote age: since the bid or ask last moved, a feed repeating the
+//    same quote (a frozen or cached ticker) ages like a silent one
+//  - update rate: quotes that moved, per second
+//  - error rate: share of the recent quotes with a null bid or ask, or a
+//    bid above the ask
+//  - latency: median and 99th percentile of the recent quote requests
+// Each one is scored against its limit in the strategy settings
+// (FrozenQuoteAge, MaxQuoteErrorRate, MaxQuoteLatency), 1 far from it
+// and 0 at it; the venue's score is the lowest of them, and it takes no
+// new position while that is 0. Everything is exported as metrics.
+// Only used from the strategy thread.
+class VenueHealth {
+public:
+  explicit VenueHealth(Parameters &params);
+  VenueHealth(const VenueHealth &) = delete;
+  VenueHealth &operator=(const VenueHealth &) = delete;
+
+  void onQuote(QuoteEvent const &event);
+  // Scores every venue as of now, updates the metrics and logs the venues
+  // that became unhealthy or recovered
+  void update();
+
+  double score(unsigned exch) const { return venues[exch].score; }
+
+private:
+  struct Venue {
+    double bid = 0.0;
+    double ask = 0.0;
+    int64_t lastMove = 0;  // Clock::monoNs(), 0 before the first quote
+    unsigned moves = 0;    // since lastUpdate
+    double updateRate = 0.0;
+    double errorRate = 0.0;
+    // Latencies of the last requests, in nanoseconds
+    std::vector<int64_t> latencies;
+    size_t nextLatency = 0;
+    double score = 0.0;
+    bool warned = false;  // logged as unhealthy, not recovered yet
+
+    Gauge *scoreGauge;
+    Gauge *ageGauge;
+    Gauge *rateGauge;
+    Gauge *errorGauge;
+    Gauge *p50Gauge;
+    Gauge *p99Gauge;
+  };
+
+  Parameters &params;
+  std::vector<Venue> venues;
+  int64_t lastUpdate;  // when the update rates were last computed
+};
+
+#endif
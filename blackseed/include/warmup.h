@@ -0,0 +1,36 @@
+#ifndef WARMUP_H
+#define WARMUP_H
+
+#include <chrono>
+#include <iosfwd>
+#include <vector>
+
+struct Parameters;
+class ExchangeApi;
+class BalanceLedger;
+
+// What the first requests to one exchange gave
+struct VenueReadiness {
+  bool quote = false;  // a bid and an ask
+  bool book = false;   // a limit price
+  std::chrono::milliseconds quoteTime{0};
+  std::chrono::milliseconds bookTime{0};
+};
+
+// The first requests to every exchange, all at once: its quote on the
+// event loop and its order book on a thread of its own, while 'ledger'
+// (null for none) reads the balances. Besides telling which exchanges
+// answer, this opens their connections, fills the caches the first
+// iteration reads and gets the clock offsets of their servers. Returns
+// once every request answered, the time of the slowest one.
+std::vector<VenueReadiness> warmUp(Parameters &params,
+                                   std::vector<ExchangeApi> const &exchanges,
+                                   BalanceLedger *ledger);
+
+// Writes the readiness of every exchange and the clock offset of every
+// server, with a warning for those whose clock is more than a second off
+void logReadiness(std::ostream &log, Parameters const &params,
+                  std::vector<VenueReadiness> const &venues,
+                  std::chrono::milliseconds elapsed);
+
+#endif
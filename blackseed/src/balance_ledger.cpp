@@ -0,0 +1,197 @@
+#include "balance_ledger.h"
+#include "parameters.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <future>
+
+namespace {
+// reconcile() tries this many times, waiting 'firstRetry' then twice as
+// long each time. A failed read of the background thread is tried again
+// after the same growing delay, up to 'interval'.
+const int maxAttempts = 6;
+const std::chrono::milliseconds firstRetry(250);
+
+// The currency of a leg as the adapters name it
+std::string currency(std::string leg) {
+  std::transform(leg.begin(), leg.end(), leg.begin(), [](unsigned char c) {
+    return static_cast<char>(std::tolower(c));
+  });
+  return leg;
+}
+}
+
+BalanceLedger::BalanceLedger(Parameters &params,
+                             std::vector<getAvailFn> getAvail,
+                             std::chrono::seconds interval)
+    : params(params), leg1Currency(currency(params.leg1)),
+      leg2Currency(currency(params.leg2)), getAvail(std::move(getAvail)),
+      interval(interval), accounts(this->getAvail.size()) {}
+
+BalanceLedger::~BalanceLedger() {
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    stopping = true;
+  }
+  wake.notify_all();
+  if (worker.joinable())
+    worker.join();
+}
+
+bool BalanceLedger::fetch(size_t exch) {
+  unsigned version;
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    version = accounts[exch].version;
+  }
+  // The requests run without the lock, fills can still be booked
+  double leg1 = getAvail[exch](params, leg1Currency);
+  if (std::isnan(leg1))
+    return false;
+  double leg2 = getAvail[exch](params, leg2Currency);
+  if (std::isnan(leg2))
+    return false;
+
+  std::lock_guard<std::mutex> lock(mtx);
+  auto &account = accounts[exch];
+  if (account.version != version)
+    return false;
+  account.leg1 = leg1;
+  account.leg2 = leg2;
+  account.dirty = false;
+  account.known = true;
+  return true;
+}
+
+bool BalanceLedger::reconcile(size_t exch) {
+  auto delay = firstRetry;
+  for (int attempt = 1; !fetch(exch); ++attempt) {
+    if (attempt == maxAttempts) {
+      *params.logFile << "WARNING: cannot read the balances of "
+                      << params.exchangeNames[exch] << " after "
+                      << maxAttempts << " attempts" << std::endl;
+      {
+        std::lock_guard<std::mutex> lock(mtx);
+        accounts[exch].dirty = true;
+      }
+      wake.notify_all();
+      return false;
+    }
+    std::this_thread::sleep_for(delay);
+    delay *= 2;
+  }
+  return true;
+}
+
+// One thread per exchange, the requests of different exchanges overlap
+bool BalanceLedger::reconcileAll() {
+  std::vector<std::future<bool>> done;
+  for (size_t i = 0; i < accounts.size(); ++i)
+    done.push_back(
+        std::async(std::launch::async, [this, i] { return reconcile(i); }));
+  bool all = true;
+  for (auto &d : done)
+    all = d.get() && all;
+  return all;
+}
+
+void BalanceLedger::start() {
+  if (!worker.joinable())
+    worker = std::thread(&BalanceLedger::run, this);
+}
+
+void BalanceLedger::run() {
+  using clock = std::chrono::steady_clock;
+  auto nextFull = clock::now() + interval;
+  // Dirty accounts wait until then after a failed round
+  auto nextRetry = clock::now();
+  std::chrono::milliseconds retryDelay(0);
+  auto dirty = [this] {
+    return std::any_of(accounts.begin(), accounts.end(),
+                       [](Account const &a) { return a.dirty; });
+  };
+  std::unique_lock<std::mutex> lock(mtx);
+  while (!stopping) {
+    auto until = nextRetry > clock::now() ? (std::min)(nextFull, nextRetry)
+                                          : nextFull;
+    wake.wait_until(lock, until, [&] {
+      return stopping || (dirty() && clock::now() >= nextRetry);
+    });
+    if (stopping)
+      break;
+
+    bool full = clock::now() >= nextFull;
+    if (full)
+      nextFull = clock::now() + interval;
+    bool failed = false;
+    for (size_t i = 0; i < accounts.size() && !stopping; ++i) {
+      if (!full && !accounts[i].dirty)
+        continue;
+      lock.unlock();
+      // A failed or dropped fetch leaves the account dirty, it is tried
+      // again after the retry delay
+      if (!fetch(i)) {
+        lock.lock();
+        accounts[i].dirty = true;
+        failed = true;
+        continue;
+      }
+      lock.lock();
+    }
+    if (failed) {
+      retryDelay = retryDelay.count() == 0
+                       ? firstRetry
+                       : (std::min)(retryDelay * 2,
+                                    std::chrono::milliseconds(interval));
+      nextRetry = clock::now() + retryDelay;
+    } else {
+      retryDelay = std::chrono::milliseconds(0);
+    }
+  }
+}
+
+double BalanceLedger::leg1(size_t exch) const {
+  std::lock_guard<std::mutex> lock(mtx);
+  return accounts[exch].leg1;
+}
+
+double BalanceLedger::leg2(size_t exch) const {
+  std::lock_guard<std::mutex> lock(mtx);
+  return accounts[exch].leg2;
+}
+
+bool BalanceLedger::known(size_t exch) const {
+  std::lock_guard<std::mutex> lock(mtx);
+  return accounts[exch].known;
+}
+
+bool BalanceLedger::reconciled(size_t exch) const {
+  std::lock_guard<std::mutex> lock(mtx);
+  return !accounts[exch].dirty;
+}
+
+void BalanceLedger::applyFill(size_t exch, std::string const &direction,
+                              double quantity, double price) {
+  double value = quantity * price;
+  double fee = value * params.strategy().fees[exch];
+  std::lock_guard<std::mutex> lock(mtx);
+  auto &account = accounts[exch];
+  if (direction == "buy") {
+    account.leg1 += quantity;
+    account.leg2 -= value + fee;
+  } else {
+    account.leg1 -= quantity;
+    account.leg2 += value - fee;
+  }
+  ++account.version;
+}
+
+void BalanceLedger::requestReconcile(size_t exch) {
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    accounts[exch].dirty = true;
+    ++accounts[exch].version;
+  }
+  wake.notify_all();
+}
@@ -1,4 +1,5 @@
 #include "bitcoin.h"
+#include "utils/clock.h"
 #include <cmath>
 
 Bitcoin::Bitcoin(unsigned i, std::string n, double f, bool h, bool m) {
@@ -9,11 +10,14 @@ Bitcoin::Bitcoin(unsigned i, std::string n, double f, bool h, bool m) {
   isImplemented = m;
   bid = 0.0;
   ask = 0.0;
+  quoteTime = 0;
+  health = 1.0;
 }
 
-void Bitcoin::updateData(quote_t quote) {
+void Bitcoin::updateData(quote_t quote, int64_t received) {
   bid = quote.bid();
   ask = quote.ask();
+  quoteTime = received;
 }
 
 unsigned Bitcoin::getId() const { return id; }
@@ -30,6 +34,14 @@ double Bitcoin::getMidPrice() const {
   }
 }
 
+int64_t Bitcoin::getQuoteAge() const {
+  return quoteTime ? Clock::monoNs() - quoteTime : 0;
+}
+
+void Bitcoin::setHealth(double score) { health = score; }
+
+double Bitcoin::getHealth() const { return health; }
+
 std::string Bitcoin::getExchName()  const { return exchName; }
 
 double Bitcoin::getFees()           const { return fees; }
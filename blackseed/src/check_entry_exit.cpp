@@ -2,6 +2,8 @@
 #include "bitcoin.h"
 #include "result.h"
 #include "parameters.h"
+#include "utils/latency.h"
+#include "utils/metrics.h"
 #include <sstream>
 #include <iomanip>
 #include <iterator>
@@ -22,6 +24,36 @@ static typename std::iterator_traits<T>::value_type compute_sd(T first, const T
   return sqrt(squareSum / n - mu * mu);
 }
 
+// Gauge of the current spread of a pair, registered on first use
+static Gauge &spreadGauge(Bitcoin* btcLong, Bitcoin* btcShort) {
+  static Gauge* gauges[13][13] = {};
+  auto &gauge = gauges[btcLong->getId()][btcShort->getId()];
+  if (!gauge)
+    gauge = &metrics().gauge("blackbird_spread_ratio", "Current spread of a long/short pair",
+                             {{"long", btcLong->getExchName()}, {"short", btcShort->getExchName()}});
+  return *gauge;
+}
+
+// Quotes too old to enter on, by exchange
+static Counter &staleCounter(Bitcoin* btc) {
+  static Counter* counters[13] = {};
+  auto &counter = counters[btc->getId()];
+  if (!counter)
+    counter = &metrics().counter("blackbird_stale_quotes_total", "Entries skipped on a quote older than MaxQuoteAge",
+                                 {{"exchange", btc->getExchName()}});
+  return *counter;
+}
+
+// Entries skipped on an unhealthy exchange, by exchange
+static Counter &unhealthyCounter(Bitcoin* btc) {
+  static Counter* counters[13] = {};
+  auto &counter = counters[btc->getId()];
+  if (!counter)
+    counter = &metrics().counter("blackbird_unhealthy_skips_total", "Entries skipped on an unhealthy exchange",
+                                 {{"exchange", btc->getExchName()}});
+  return *counter;
+}
+
 // Returns a double as a string '##.##%'
 std::string percToStr(double perc) {
   std::ostringstream s;
@@ -34,6 +66,11 @@ bool checkEntry(Bitcoin* btcLong, Bitcoin* btcShort, Result& res, Parameters& pa
   
   if (!btcShort->getHasShort()) return false;
 
+  static auto &decisionTime = latency().histogram("blackbird", "checkEntry", "decision");
+  LatencyTimer timer(decisionTime);
+  // One snapshot for the whole decision, a reload may publish another
+  auto const &strategy = params.strategy();
+
   // Gets the prices and computes the spread
   double priceLong = btcLong->getAsk();
   double priceShort = btcShort->getBid();
@@ -50,34 +87,34 @@ bool checkEntry(Bitcoin* btcLong, Bitcoin* btcShort, Result& res, Parameters& pa
   // We update the max and min spread if necessary
   res.maxSpread[longId][shortId] = (std::max)(res.spreadIn, res.maxSpread[longId][shortId]);
   res.minSpread[longId][shortId] = (std::min)(res.spreadIn, res.minSpread[longId][shortId]);
+  spreadGauge(btcLong, btcShort).set(res.spreadIn);
 
   if (params.verbose) {
-    params.logFile->precision(2);
-    *params.logFile << "   " << btcLong->getExchName() << "/" << btcShort->getExchName() << ":\t" << percToStr(res.spreadIn);
-    *params.logFile << " [target " << percToStr(params.spreadEntry) << ", min " << percToStr(res.minSpread[longId][shortId]) << ", max " << percToStr(res.maxSpread[longId][shortId]) << "]";
+    // One record per pair, formatted by the log thread
+    auto line = params.log->line(LogLevel::info);
+    line("   {}/{}:\t{%} [target {%}, min {%}, max {%}]", btcLong->getExchName(), btcShort->getExchName(),
+         res.spreadIn, strategy.spreadEntry, res.minSpread[longId][shortId], res.maxSpread[longId][shortId]);
     // The short-term volatility is computed and
     // displayed. No other action with it for
     // the moment.
     if (params.useVolatility) {
       if (res.volatility[longId][shortId].size() >= params.volatilityPeriod) {
         auto stdev = compute_sd(begin(res.volatility[longId][shortId]), end(res.volatility[longId][shortId]));
-        *params.logFile << "  volat. " << stdev * 100.0 << "%";
+        line("  volat. {}%", stdev * 100.0);
       } else {
-        *params.logFile << "  volat. n/a " << res.volatility[longId][shortId].size() << "<" << params.volatilityPeriod << " ";
+        line("  volat. n/a {}<{} ", res.volatility[longId][shortId].size(), params.volatilityPeriod);
       }
     }
     // Updates the trailing spread
     // TODO: explain what a trailing spread is.
     // See #12 on GitHub for the moment
     if (res.trailing[longId][shortId] != -1.0) {
-      *params.logFile << "   trailing " << percToStr(res.trailing[longId][shortId]) << "  " << res.trailingWaitCount[longId][shortId] << "/" << params.trailingCount;
+      line("   trailing {%}  {}/{}", res.trailing[longId][shortId], res.trailingWaitCount[longId][shortId], strategy.trailingCount);
     }
     // If one of the exchanges (or both) hasn't been implemented,
     // we mention in the log file that this spread is for info only.
     if ((!btcLong->getIsImplemented() || !btcShort->getIsImplemented()) && !params.isDemoMode)
-      *params.logFile << "   info only";
-
-    *params.logFile << std::endl;
+      line("   info only");
   }
   // We need both exchanges to be implemented,
   // otherwise we return False regardless of
@@ -87,20 +124,47 @@ bool checkEntry(Bitcoin* btcLong, Bitcoin* btcShort, Result& res, Parameters& pa
       res.spreadIn == 0.0)
     return false;
 
+  // The older quote of the two, an opportunity on a quote that may be gone
+  // is not taken
+  static auto &quoteAges = latency().histogram("blackbird", "checkEntry", "quote_age");
+  auto quoteAge = (std::max)(btcLong->getQuoteAge(), btcShort->getQuoteAge());
+  quoteAges.record(std::chrono::nanoseconds(quoteAge));
+  auto maxAge = int64_t(strategy.maxQuoteAge) * 1000000;
+  if (maxAge != 0 && quoteAge > maxAge) {
+    for (auto btc : {btcLong, btcShort})
+      if (btc->getQuoteAge() > maxAge)
+        staleCounter(btc).inc();
+    if (params.verbose)
+      params.log->log(LogLevel::info, "   stale quote ({} ms), no entry", quoteAge / 1000000);
+    return false;
+  }
+  // A frozen, failing or slow feed makes phantom spreads, see VenueHealth
+  bool healthy = true;
+  for (auto btc : {btcLong, btcShort})
+    if (btc->getHealth() <= 0.0) {
+      unhealthyCounter(btc).inc();
+      healthy = false;
+    }
+  if (!healthy) {
+    if (params.verbose)
+      params.log->log(LogLevel::info, "   unhealthy exchange, no entry");
+    return false;
+  }
+
   // the trailing spread is reset for this pair,
   // because once the spread is *below*
   // SpreadEndtry. Again, see #12 on GitHub for
   // more details.
-  if (res.spreadIn < params.spreadEntry) {
+  if (res.spreadIn < strategy.spreadEntry) {
     res.trailing[longId][shortId] = -1.0;
     res.trailingWaitCount[longId][shortId] = 0;
     return false;
   }
 
   // Updates the trailingSpread with the new value
-  double newTrailValue = res.spreadIn - params.trailingLim;
+  double newTrailValue = res.spreadIn - strategy.trailingLim;
   if (res.trailing[longId][shortId] == -1.0) {
-    res.trailing[longId][shortId] = (std::max)(newTrailValue, params.spreadEntry);
+    res.trailing[longId][shortId] = (std::max)(newTrailValue, strategy.spreadEntry);
     return false;
   }
 
@@ -113,7 +177,7 @@ bool checkEntry(Bitcoin* btcLong, Bitcoin* btcShort, Result& res, Parameters& pa
     return false;
   }
 
-  if (res.trailingWaitCount[longId][shortId] < params.trailingCount) {
+  if (res.trailingWaitCount[longId][shortId] < strategy.trailingCount) {
     res.trailingWaitCount[longId][shortId]++;
     return false;
   }
@@ -123,18 +187,25 @@ bool checkEntry(Bitcoin* btcLong, Bitcoin* btcShort, Result& res, Parameters& pa
   // was found).
   res.idExchLong = longId;
   res.idExchShort = shortId;
-  res.feesLong = btcLong->getFees();
-  res.feesShort = btcShort->getFees();
+  res.feesLong = strategy.fees[longId];
+  res.feesShort = strategy.fees[shortId];
   res.exchNameLong = btcLong->getExchName();
   res.exchNameShort = btcShort->getExchName();
   res.priceLongIn = priceLong;
   res.priceShortIn = priceShort;
-  res.exitTarget = res.spreadIn - params.spreadTarget - 2.0*(res.feesLong + res.feesShort);
+  res.exitTarget = res.spreadIn - strategy.spreadTarget - 2.0*(res.feesLong + res.feesShort);
+  static auto &entrySpreads = metrics().histogram("blackbird_entry_spread_ratio", "Spreads of the entry opportunities",
+                                                  {0.002, 0.004, 0.006, 0.008, 0.01, 0.015, 0.02, 0.03, 0.05});
+  entrySpreads.observe(res.spreadIn);
   res.trailingWaitCount[longId][shortId] = 0;
+  res.decided = Clock::Stamp::now();
   return true;
 }
 
 bool checkExit(Bitcoin* btcLong, Bitcoin* btcShort, Result& res, Parameters& params, time_t period) {
+  static auto &decisionTime = latency().histogram("blackbird", "checkExit", "decision");
+  LatencyTimer timer(decisionTime);
+  auto const &strategy = params.strategy();
   double priceLong  = btcLong->getBid();
   double priceShort = btcShort->getAsk();
   if (priceLong > 0.0 && priceShort > 0.0) {
@@ -147,30 +218,33 @@ bool checkExit(Bitcoin* btcLong, Bitcoin* btcShort, Result& res, Parameters& par
 
   res.maxSpread[longId][shortId] = (std::max)(res.spreadOut, res.maxSpread[longId][shortId]);
   res.minSpread[longId][shortId] = (std::min)(res.spreadOut, res.minSpread[longId][shortId]);
+  spreadGauge(btcLong, btcShort).set(res.spreadOut);
 
   if (params.verbose) {
-    params.logFile->precision(2);
-    *params.logFile << "   " << btcLong->getExchName() << "/" << btcShort->getExchName() << ":\t" << percToStr(res.spreadOut);
-    *params.logFile << " [target " << percToStr(res.exitTarget) << ", min " << percToStr(res.minSpread[longId][shortId]) << ", max " << percToStr(res.maxSpread[longId][shortId]) << "]";
+    auto line = params.log->line(LogLevel::info);
+    line("   {}/{}:\t{%} [target {%}, min {%}, max {%}]", btcLong->getExchName(), btcShort->getExchName(),
+         res.spreadOut, res.exitTarget, res.minSpread[longId][shortId], res.maxSpread[longId][shortId]);
     // The short-term volatility is computed and
     // displayed. No other action with it for
     // the moment.
     if (params.useVolatility) {
       if (res.volatility[longId][shortId].size() >= params.volatilityPeriod) {
         auto stdev = compute_sd(begin(res.volatility[longId][shortId]), end(res.volatility[longId][shortId]));
-        *params.logFile << "  volat. " << stdev * 100.0 << "%";
+        line("  volat. {}%", stdev * 100.0);
       } else {
-        *params.logFile << "  volat. n/a " << res.volatility[longId][shortId].size() << "<" << params.volatilityPeriod << " ";
+        line("  volat. n/a {}<{} ", res.volatility[longId][shortId].size(), params.volatilityPeriod);
       }
     }
     if (res.trailing[longId][shortId] != 1.0) {
-      *params.logFile << "   trailing " << percToStr(res.trailing[longId][shortId]) << "  " << res.trailingWaitCount[longId][shortId] << "/" << params.trailingCount;
+      line("   trailing {%}  {}/{}", res.trailing[longId][shortId], res.trailingWaitCount[longId][shortId], strategy.trailingCount);
     }
+  } else {
+    *params.logFile << '\n';
   }
-  *params.logFile << std::endl;
-  if (period - res.entryTime >= int(params.maxLength)) {
+  if (period - res.entryTime >= int(strategy.maxLength)) {
     res.priceLongOut  = priceLong;
     res.priceShortOut = priceShort;
+    res.decided = Clock::Stamp::now();
     return true;
   }
   if (res.spreadOut == 0.0) return false;
@@ -180,7 +254,7 @@ bool checkExit(Bitcoin* btcLong, Bitcoin* btcShort, Result& res, Parameters& par
     return false;
   }
 
-  double newTrailValue = res.spreadOut + params.trailingLim;
+  double newTrailValue = res.spreadOut + strategy.trailingLim;
   if (res.trailing[longId][shortId] == 1.0) {
     res.trailing[longId][shortId] = (std::min)(newTrailValue, res.exitTarget);
     return false;
@@ -193,7 +267,7 @@ bool checkExit(Bitcoin* btcLong, Bitcoin* btcShort, Result& res, Parameters& par
     res.trailingWaitCount[longId][shortId] = 0;
     return false;
   }
-  if (res.trailingWaitCount[longId][shortId] < params.trailingCount) {
+  if (res.trailingWaitCount[longId][shortId] < strategy.trailingCount) {
     res.trailingWaitCount[longId][shortId]++;
     return false;
   }
@@ -201,5 +275,6 @@ bool checkExit(Bitcoin* btcLong, Bitcoin* btcShort, Result& res, Parameters& par
   res.priceLongOut  = priceLong;
   res.priceShortOut = priceShort;
   res.trailingWaitCount[longId][shortId] = 0;
+  res.decided = Clock::Stamp::now();
   return true;
 }
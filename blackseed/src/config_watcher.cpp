@@ -0,0 +1,206 @@
+#include "config_watcher.h"
+#include "exchange_registry.h"
+#include "parameters.h"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <set>
+#include <sstream>
+
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// Keys whose new value is used at once, besides the exchange fees and
+// switches
+const std::set<std::string> reloadableKeys = {
+    "SpreadEntry",       "SpreadTarget",        "MaxLength",
+    "PriceDeltaLimit",   "TrailingSpreadLim",   "TrailingSpreadCount",
+    "UseFullExposure",   "TestedExposure",      "MaxExposure",
+    "MaxQuoteAge",       "FrozenQuoteAge",      "MaxQuoteLatency",
+    "MaxQuoteErrorRate", "LogLevel"};
+
+bool endsWith(std::string const &s, std::string const &suffix) {
+  return s.size() >= suffix.size() &&
+         s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+bool isReloadable(std::string const &key) {
+  return reloadableKeys.count(key) || endsWith(key, "Fees") ||
+         endsWith(key, "Enable");
+}
+
+// Why the bot cannot trade with 'strategy', empty if it can
+std::string invalid(StrategyParams const &strategy,
+                    std::vector<std::string> const &exchangeNames) {
+  if (strategy.maxLength == 0)
+    return "MaxLength must be positive";
+  if (strategy.priceDeltaLim < 0.0)
+    return "PriceDeltaLimit cannot be negative";
+  if (strategy.trailingLim < 0.0)
+    return "TrailingSpreadLim cannot be negative";
+  if (strategy.maxQuoteErrorRate < 0.0 || strategy.maxQuoteErrorRate > 1.0)
+    return "MaxQuoteErrorRate must be between 0 and 1";
+  if (!strategy.useFullExposure) {
+    if (strategy.testedExposure <= 0.0)
+      return "TestedExposure must be positive";
+    if (strategy.testedExposure > strategy.maxExposure)
+      return "TestedExposure is above MaxExposure";
+  }
+  for (size_t i = 0; i < strategy.fees.size(); ++i)
+    if (strategy.fees[i] < 0.0 || strategy.fees[i] >= 1.0)
+      return exchangeNames[i] + " fees must be between 0 and 1";
+  return "";
+}
+
+std::string valueOf(std::map<std::string, std::string> const &dataMap,
+                    std::string const &key) {
+  auto it = dataMap.find(key);
+  return it == dataMap.end() ? "(none)" : it->second;
+}
+}
+
+ConfigWatcher::ConfigWatcher(Parameters &params) : params(params) {
+  if (params.configFile.empty())
+    return;
+  try {
+    current = readConfigFile(params.configFile);
+    Parameters loaded(current);
+    reloadedStrategy(params, loaded, notRunning);
+  } catch (ConfigError const &e) {
+    *params.logFile << "WARNING: " << e.what()
+                    << ", the configuration will not be reloaded" << std::endl;
+    return;
+  }
+  worker = std::thread(&ConfigWatcher::run, this);
+}
+
+// Returns within a second
+ConfigWatcher::~ConfigWatcher() {
+  stopping = true;
+  if (worker.joinable())
+    worker.join();
+}
+
+#if defined(__linux__)
+
+// The directory is watched rather than the file, editors often replace
+// the file with a new one
+void ConfigWatcher::run() {
+  std::filesystem::path file(params.configFile);
+  auto dir = file.has_parent_path() ? file.parent_path().string() : ".";
+  auto name = file.filename().string();
+  int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd < 0 ||
+      inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+    *params.logFile << "WARNING: cannot watch " << params.configFile
+                    << ", the configuration will not be reloaded"
+                    << std::endl;
+    if (fd >= 0)
+      close(fd);
+    return;
+  }
+  alignas(inotify_event) char buffer[4096];
+  bool changed = false;
+  while (!stopping) {
+    pollfd ready = {fd, POLLIN, 0};
+    // A file saved in several writes is read once they stopped for 200ms
+    int n = poll(&ready, 1, changed ? 200 : 500);
+    if (n == 0 && changed) {
+      changed = false;
+      reload();
+    }
+    if (n <= 0)
+      continue;
+    ssize_t len;
+    while ((len = read(fd, buffer, sizeof(buffer))) > 0) {
+      for (char *p = buffer; p < buffer + len;) {
+        auto *event = reinterpret_cast<inotify_event *>(p);
+        if (event->len && name == event->name)
+          changed = true;
+        p += sizeof(inotify_event) + event->len;
+      }
+    }
+  }
+  close(fd);
+}
+
+#else
+
+void ConfigWatcher::run() {
+  std::error_code ec;
+  auto written = std::filesystem::last_write_time(params.configFile, ec);
+  while (!stopping) {
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    auto now = std::filesystem::last_write_time(params.configFile, ec);
+    if (!ec && now != written) {
+      written = now;
+      reload();
+    }
+  }
+}
+
+#endif
+
+void ConfigWatcher::reload() {
+  auto &logFile = *params.logFile;
+  std::map<std::string, std::string> next;
+  std::vector<std::string> nextNotRunning;
+  StrategyParams strategy;
+  try {
+    next = readConfigFile(params.configFile);
+    Parameters loaded(next);
+    strategy = reloadedStrategy(params, loaded, nextNotRunning);
+  } catch (ConfigError const &e) {
+    logFile << "WARNING: configuration not reloaded, " << e.what()
+            << std::endl;
+    return;
+  }
+  auto error = invalid(strategy, params.exchangeNames);
+  if (!error.empty()) {
+    logFile << "WARNING: configuration not reloaded, " << error << std::endl;
+    return;
+  }
+
+  std::set<std::string> keys;
+  for (auto const &kv : current)
+    keys.insert(kv.first);
+  for (auto const &kv : next)
+    keys.insert(kv.first);
+  std::ostringstream applied, ignored;
+  for (auto const &key : keys) {
+    auto before = valueOf(current, key);
+    auto after = valueOf(next, key);
+    if (before == after)
+      continue;
+    if (isReloadable(key))
+      applied << "\n   " << key << ": " << before << " -> " << after;
+    else
+      ignored << " " << key;
+  }
+
+  params.publishStrategy(std::move(strategy));
+  params.log->setLevel(
+      parseLogLevel(next.count("LogLevel") ? next["LogLevel"] : "info"));
+  logFile << "Configuration reloaded" << applied.str() << std::endl;
+  // Allowed, as at startup
+  if (params.strategy().spreadEntry <= 0.0)
+    logFile << "WARNING: Spread Entry should be positive" << std::endl;
+  if (params.strategy().spreadTarget <= 0.0)
+    logFile << "WARNING: Spread Target should be positive" << std::endl;
+  if (!ignored.str().empty())
+    logFile << "WARNING: restart Blackbird to apply" << ignored.str()
+            << std::endl;
+  for (auto const &name : nextNotRunning)
+    if (std::find(notRunning.begin(), notRunning.end(), name) ==
+        notRunning.end())
+      logFile << "WARNING: restart Blackbird to trade on " << name
+              << std::endl;
+  current = std::move(next);
+  notRunning = std::move(nextNotRunning);
+}
@@ -0,0 +1,65 @@
+#include "exchange_registry.h"
+#include "db_fun.h"
+
+#include <algorithm>
+
+namespace {
+
+template <typename E>
+void addIfEnabled(Parameters &params, bool keyless,
+                  std::vector<ExchangeApi> &exchanges) {
+  if (!(params.*E::enable) || ((params.*E::apiKey).empty() && !keyless))
+    return;
+  params.addExchange(E::name, params.*E::fees, E::canShort, E::isImplemented);
+  createTable(E::dbTable, params);
+  exchanges.emplace_back(E{});
+}
+
+template <typename... E>
+void addAllEnabled(Parameters &params, bool keyless,
+                   std::vector<ExchangeApi> &exchanges, std::variant<E...> *) {
+  (addIfEnabled<E>(params, keyless, exchanges), ...);
+}
+
+template <typename E>
+void reloadExchange(Parameters const &params, Parameters const &loaded,
+                    StrategyParams &strategy,
+                    std::vector<std::string> &notRunning) {
+  auto &names = params.exchangeNames;
+  auto it = std::find(names.begin(), names.end(), E::name);
+  if (it == names.end()) {
+    if (loaded.*E::enable)
+      notRunning.push_back(E::name);
+    return;
+  }
+  auto i = it - names.begin();
+  strategy.fees[i] = loaded.*E::fees;
+  strategy.enabled[i] = loaded.*E::enable;
+}
+
+template <typename... E>
+void reloadAll(Parameters const &params, Parameters const &loaded,
+               StrategyParams &strategy, std::vector<std::string> &notRunning,
+               std::variant<E...> *) {
+  (reloadExchange<E>(params, loaded, strategy, notRunning), ...);
+}
+}
+
+std::vector<ExchangeApi> enabledExchanges(Parameters &params, bool keyless) {
+  std::vector<ExchangeApi> exchanges;
+  addAllEnabled(params, keyless, exchanges,
+                static_cast<Registry::Entry *>(nullptr));
+  return exchanges;
+}
+
+StrategyParams reloadedStrategy(Parameters const &params,
+                                Parameters const &loaded,
+                                std::vector<std::string> &notRunning) {
+  auto strategy = loaded.strategy();
+  strategy.fees = params.strategy().fees;
+  strategy.enabled = params.strategy().enabled;
+  notRunning.clear();
+  reloadAll(params, loaded, strategy, notRunning,
+            static_cast<Registry::Entry *>(nullptr));
+  return strategy;
+}
@@ -1,11 +1,11 @@
 #include "binance.h"
-#include "hex_str.hpp"
-#include "openssl/hmac.h"
-#include "openssl/sha.h"
 #include "parameters.h"
 #include "time_fun.h"
 #include "unique_json.hpp"
+#include "utils/hmac_signer.h"
+#include "utils/latency.h"
 #include "utils/restapi.h"
+#include "utils/ticker_snapshot.h"
 #include <algorithm>
 #include <array>
 #include <cctype>
@@ -15,35 +15,48 @@
 
 namespace Binance {
 
-static json_t *authRequest(Parameters &, std::string const &,
-                           std::string const &, std::string const &);
+static task<json_t *> authRequest(Parameters &, std::string, std::string,
+                                  std::string);
 
 static std::string getSignature(Parameters &params, std::string const &payload);
 
 static RestApi &queryHandle(Parameters &params) {
   static RestApi query("https://api.binance.com", params.cacert.c_str(),
-                       *params.logFile);
+                       params.logFile);
   return query;
 }
 
-quote_t getQuote(Parameters &params) {
-  auto &exchange = queryHandle(params);
-  std::string x;
-  // TODO: build real currency string
-  x += "/api/v3/ticker/bookTicker?symbol=";
-  x += "BTCUSDT";
-  // params.leg2.c_str();
-  unique_json root{exchange.getRequest(x)};
-  double quote =
-      atof(json_string_value(json_object_get(root.get(), "bidPrice")));
-  auto bidValue = quote ? quote : 0.0;
-  quote = atof(json_string_value(json_object_get(root.get(), "askPrice")));
-  auto askValue = quote ? quote : 0.0;
+static HmacSigner &signer(Parameters &params) {
+  static HmacSigner signer(EVP_sha256(), params.binanceSecret,
+                           &latency().histogram("Binance", "hmac", "sign"));
+  return signer;
+}
+
+static void parseTickers(json_t *root, std::map<std::string, quote_t> &quotes) {
+  for (size_t i = 0; i < json_array_size(root); i++) {
+    auto ticker = json_array_get(root, i);
+    auto symbol = json_string_value(json_object_get(ticker, "symbol"));
+    auto bid = json_string_value(json_object_get(ticker, "bidPrice"));
+    auto ask = json_string_value(json_object_get(ticker, "askPrice"));
+    if (symbol)
+      quotes.emplace(symbol, quote_t(bid ? atof(bid) : 0.0, ask ? atof(ask) : 0.0));
+  }
+}
 
-  return std::make_pair(bidValue, askValue);
+// bookTicker without a symbol returns the best bid/ask of all symbols
+static TickerSnapshot &tickers(Parameters &params) {
+  static TickerSnapshot tickers(queryHandle(params),
+                                "/api/v3/ticker/bookTicker", parseTickers,
+                                params.tickerTtl());
+  return tickers;
 }
 
-double getAvail(Parameters &params, std::string const &currency) {
+task<quote_t> getQuote(Parameters &params) {
+  // TODO: build real currency string
+  co_return co_await tickers(params).quoteAsync("BTCUSDT");
+}
+
+task<double> getAvail(Parameters &params, std::string currency) {
   std::string cur_str;
   // cur_str += "symbol=BTCUSDT";
   if (currency.compare("USD") == 0) {
@@ -52,7 +65,10 @@ double getAvail(Parameters &params, std::string const &currency) {
     cur_str += currency.c_str();
   }
 
-  unique_json root{authRequest(params, "GET", "/api/v3/account", "")};
+  unique_json root{co_await authRequest(params, "GET", "/api/v3/account", "")};
+  // An error reply has no balances
+  if (!json_is_array(json_object_get(root.get(), "balances")))
+    co_return unknownBalance();
   size_t arraySize = json_array_size(json_object_get(root.get(), "balances"));
   double available = 0.0;
   const char *currstr;
@@ -71,97 +87,154 @@ double getAvail(Parameters &params, std::string const &currency) {
       }
     }
   }
-  return available;
+  co_return available;
 }
 // TODO: Currency String here
-std::string sendLongOrder(Parameters &params, std::string const &tempDirection,
-                          double const quantity, double const price) {
+task<std::string> sendLongOrder(Parameters &params, std::string tempDirection,
+                                double const quantity, double const price,
+                                OrderType orderType) {
   std::string direction = tempDirection;
   std::transform(direction.begin(), direction.end(), direction.begin(),
     tolower);
   if (direction.compare("buy") != 0 && direction.compare("sell") != 0) {
     *params.logFile << "<Binance> Error: Neither \"buy\" nor \"sell\" selected"
                     << std::endl;
-    return "0";
+    co_return "0";
   }
-  *params.logFile << "<Binance> Trying to send a \"" << direction
-                  << "\" limit order: " << std::setprecision(8) << quantity
+  *params.logFile << "<Binance> Trying to send a \"" << direction << "\" "
+                  << orderTypeName(orderType)
+                  << " limit order: " << std::setprecision(8) << quantity
                   << " @ $" << std::setprecision(8) << price << "...\n";
   std::string symbol = "BTCUSDT";
   std::transform(direction.begin(), direction.end(), direction.begin(),
                  toupper);
+  // A post-only order is a LIMIT_MAKER, which takes no time in force
   std::string type = "LIMIT";
-  std::string tif = "GTC";
+  std::string tif = "&timeInForce=GTC";
+  if (orderType == OrderType::ioc)
+    tif = "&timeInForce=IOC";
+  else if (orderType == OrderType::fok)
+    tif = "&timeInForce=FOK";
+  else if (orderType == OrderType::postOnly) {
+    type = "LIMIT_MAKER";
+    tif.clear();
+  }
   std::string pricelimit = std::to_string(price);
   std::string volume = std::to_string(quantity);
   std::string options = "symbol=" + symbol + "&side=" + direction +
-                        "&type=" + type + "&timeInForce=" + tif +
-                        "&price=" + pricelimit + "&quantity=" + volume;
-  unique_json root{authRequest(params, "POST", "/api/v3/order", options)};
+                        "&type=" + type + tif + "&price=" + pricelimit +
+                        "&quantity=" + volume;
+  unique_json root{
+      co_await authRequest(params, "POST", "/api/v3/order", options)};
   long txid = json_integer_value(json_object_get(root.get(), "orderId"));
   std::string order = std::to_string(txid);
   *params.logFile << "<Binance> Done (transaction ID: " << order << ")\n"
                   << std::endl;
-  return order;
+  co_return order;
 }
 
 // TODO: probably not necessary
-std::string sendShortOrder(Parameters &params, std::string const &direction,
-                           double const quantity, double const price) {
-  return "0";
+task<std::string> sendShortOrder(Parameters &, std::string, double, double,
+                                 OrderType) {
+  co_return "0";
 }
 
-bool isOrderComplete(Parameters &params, std::string const &orderId) {
-  unique_json root{authRequest(params, "GET", "/api/v3/openOrders", "")};
-  size_t arraySize = json_array_size(root.get());
-  bool complete = true;
-  const char *idstr;
-  for (size_t i = 0; i < arraySize; i++) {
-    // SUGGEST: this is sort of messy
-    long tmpInt = json_integer_value(
-        json_object_get(json_array_get(root.get(), i), "orderId"));
-    std::string tmpId = std::to_string(tmpInt);
-    if (tmpId.compare(orderId.c_str()) == 0) {
-      idstr = json_string_value(
-          json_object_get(json_array_get(root.get(), i), "status"));
-      *params.logFile << "<Binance> Order still open (Status:" << idstr << ")"
-                      << std::endl;
-      complete = false;
-    }
+task<bool> isOrderComplete(Parameters &params, std::string orderId) {
+  // The order alone is looked up, not the list of all the open ones
+  auto status = co_await getOrderStatus(params, orderId);
+  // A failed lookup is logged, and done again the next time
+  if (!status.known)
+    co_return false;
+  if (!status.open)
+    co_return true;
+  *params.logFile << "<Binance> Order " << orderId << " still open"
+                  << std::endl;
+  co_return false;
+}
+task<OrderStatus> getOrderStatus(Parameters &params, std::string orderId) {
+  OrderStatus status;
+  // "0" for an order that could not be sent
+  if (orderId == "0") {
+    status.known = true;
+    co_return status;
   }
-  return complete;
+
+  unique_json root{co_await authRequest(params, "GET", "/api/v3/order",
+                                        "symbol=BTCUSDT&orderId=" + orderId)};
+  auto state = json_string_value(json_object_get(root.get(), "status"));
+  if (!state) {
+    auto msg = json_string_value(json_object_get(root.get(), "msg"));
+    // A rejected order
+    status.known = msg && std::string(msg) == "Order does not exist.";
+    *params.logFile << "<Binance> Order " << orderId
+                    << (status.known ? " not found" : " unknown, ")
+                    << (status.known || !msg ? "" : msg) << std::endl;
+    co_return status;
+  }
+  status.known = true;
+  status.open = std::string(state) == "NEW" ||
+                std::string(state) == "PARTIALLY_FILLED";
+  auto executed = json_string_value(json_object_get(root.get(), "executedQty"));
+  auto value =
+      json_string_value(json_object_get(root.get(), "cummulativeQuoteQty"));
+  status.filled = executed ? atof(executed) : 0.0;
+  if (status.filled > 0.0 && value)
+    status.avgPrice = atof(value) / status.filled;
+  co_return status;
 }
+
+task<bool> cancelOrder(Parameters &params, std::string orderId) {
+  if (orderId == "0")
+    co_return false;
+  unique_json root{co_await authRequest(params, "DELETE", "/api/v3/order",
+                                        "symbol=BTCUSDT&orderId=" + orderId)};
+  auto status = json_string_value(json_object_get(root.get(), "status"));
+  if (!status || std::string(status) != "CANCELED") {
+    // Already filled or canceled, the order is unknown then
+    auto msg = json_string_value(json_object_get(root.get(), "msg"));
+    *params.logFile << "<Binance> Order " << orderId << " not canceled: "
+                    << (msg ? msg : "no status") << std::endl;
+    co_return false;
+  }
+  *params.logFile << "<Binance> Order " << orderId << " canceled" << std::endl;
+  co_return true;
+}
+
 // TODO: Currency
-double getActivePos(Parameters &params) { return getAvail(params, "BTC"); }
+task<double> getActivePos(Parameters &params) {
+  co_return co_await getAvail(params, "BTC");
+}
 
-double getLimitPrice(Parameters &params, double const volume,
-                     bool const isBid) {
+task<double> getLimitPrice(Parameters &params, double const volume,
+                           bool const isBid) {
   auto &exchange = queryHandle(params);
   // TODO build a real URI string here
-  unique_json root{exchange.getRequest("/api/v1/depth?symbol=BTCUSDT")};
+  unique_json root{co_await exchange.cachedGetAsync(
+      "/api/v1/depth?symbol=BTCUSDT", params.orderBookTtl())};
   auto bidask = json_object_get(root.get(), isBid ? "bids" : "asks");
   *params.logFile << "<Binance Looking for a limit price to fill "
                   << std::setprecision(8) << fabs(volume) << " Legx...\n";
   double tmpVol = 0.0;
   double p = 0.0;
   double v;
-  int i = 0;
-  while (tmpVol < fabs(volume) * params.orderBookFactor) {
+  // An error reply has no book, 0.0 is returned
+  for (size_t i = 0; i < json_array_size(bidask) &&
+                     tmpVol < fabs(volume) * params.orderBookFactor;
+       ++i) {
     p = atof(json_string_value(json_array_get(json_array_get(bidask, i), 0)));
     v = atof(json_string_value(json_array_get(json_array_get(bidask, i), 1)));
-    *params.logFile << "<Binance> order book: " << std::setprecision(8) << v
-                    << "@$" << std::setprecision(8) << p << std::endl;
+    params.log->log(LogLevel::debug, "<Binance> order book: {.8}@${.8}",
+                    v, p);
     tmpVol += v;
-    i++;
   }
-  return p;
+  co_return p;
 }
 
-json_t *authRequest(Parameters &params, std::string const &method,
-                    std::string const &request, std::string const &options) {
+task<json_t *> authRequest(Parameters &params, std::string method,
+                           std::string request, std::string options) {
   // create timestamp Binance is annoying and requires their servertime
   auto &exchange = queryHandle(params);
-  unique_json stamper{exchange.getRequest("/api/v1/time")};
+  unique_json stamper{co_await exchange.getAsync("/api/v1/time")};
   long stamp = json_integer_value(json_object_get(stamper.get(), "serverTime"));
   std::string timestamp = std::to_string(stamp);
   // create empty payload
@@ -177,8 +250,8 @@ json_t *authRequest(Parameters &params, std::string const &method,
     sig += getSignature(params, payload);
     uri += request + "?" + options + "&timestamp=" + timestamp +
            "&signature=" + sig;
-    return exchange.postRequest(
-        uri, make_slist(std::begin(headers), std::end(headers)));
+    co_return co_await exchange.postAsync(
+        uri, make_slist(std::begin(headers), std::end(headers)), "");
   } else {
     if (options.empty()) {
       payload += "timestamp=" + timestamp;
@@ -190,20 +263,17 @@ json_t *authRequest(Parameters &params, std::string const &method,
       uri += request + "?" + options + "&timestamp=" + timestamp +
              "&signature=" + sig;
     }
-    return exchange.getRequest(
+    if (method.compare("DELETE") == 0)
+      co_return co_await exchange.deleteAsync(
+          uri, make_slist(std::begin(headers), std::end(headers)));
+    co_return co_await exchange.getAsync(
         uri, make_slist(std::begin(headers), std::end(headers)));
   }
 }
 
 static std::string getSignature(Parameters &params,
                                 std::string const &payload) {
-  uint8_t *hmac_digest = HMAC(EVP_sha256(), params.binanceSecret.c_str(),
-                              params.binanceSecret.size(),
-                              reinterpret_cast<const uint8_t *>(payload.data()),
-                              payload.size(), NULL, NULL);
-  std::string api_sign_header =
-      hex_str(hmac_digest, hmac_digest + SHA256_DIGEST_LENGTH);
-  return api_sign_header;
+  return signer(params).sign(payload).hex();
 }
 
 void testBinance() {
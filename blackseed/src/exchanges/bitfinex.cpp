@@ -1,12 +1,12 @@
 #include "bitfinex.h"
-#include "hex_str.hpp"
 #include "parameters.h"
 #include "unique_json.hpp"
 #include "utils/base64.h"
+#include "utils/hmac_signer.h"
+#include "utils/latency.h"
+#include "utils/nonce.h"
 #include "utils/restapi.h"
 
-#include "openssl/hmac.h"
-#include "openssl/sha.h"
 #include <array>
 #include <cmath>
 #include <ctime>
@@ -18,10 +18,16 @@ namespace Bitfinex {
 static RestApi &queryHandle(Parameters &params) {
   static RestApi query("https://api.bitfinex.com",
                        params.cacert.empty() ? nullptr : params.cacert.c_str(),
-                       *params.logFile);
+                       params.logFile);
   return query;
 }
 
+static HmacSigner &signer(Parameters &params) {
+  static HmacSigner signer(EVP_sha384(), params.bitfinexSecret,
+                           &latency().histogram("Bitfinex", "hmac", "sign"));
+  return signer;
+}
+
 static json_t *checkResponse(std::ostream &logFile, json_t *root) {
   auto msg = json_object_get(root, "message");
   if (!msg)
@@ -34,13 +40,14 @@ static json_t *checkResponse(std::ostream &logFile, json_t *root) {
   return root;
 }
 
-quote_t getQuote(Parameters &params) {
+task<quote_t> getQuote(Parameters &params) {
   auto &exchange = queryHandle(params);
 
   std::string url;
   url = "/v1/ticker/btcusd";
 
-  unique_json root{exchange.getRequest(url)};
+  unique_json root{
+      co_await exchange.cachedGetAsync(url, params.tickerTtl())};
 
   const char *quote = json_string_value(json_object_get(root.get(), "bid"));
   double bidValue = quote ? std::stod(quote) : 0.0;
@@ -48,12 +55,14 @@ quote_t getQuote(Parameters &params) {
   quote = json_string_value(json_object_get(root.get(), "ask"));
   double askValue = quote ? std::stod(quote) : 0.0;
 
-  return std::make_pair(bidValue, askValue);
+  co_return std::make_pair(bidValue, askValue);
 }
 
-double getAvail(Parameters &params, std::string const &currency) {
-  unique_json root{authRequest(params, "/v1/balances", "")};
-
+task<double> getAvail(Parameters &params, std::string currency) {
+  unique_json root{co_await authRequest(params, "/v1/balances", "")};
+  // An error reply is an object, not the list of the wallets
+  if (!json_is_array(root.get()))
+    co_return unknownBalance();
   double availability = 0.0;
   for (size_t i = json_array_size(root.get()); i--;) {
     const char *each_type, *each_currency, *each_amount;
@@ -66,52 +75,109 @@ double getAvail(Parameters &params, std::string const &currency) {
                       << std::endl;
     } else if (each_type == std::string("trading") &&
                each_currency == currency) {
-      return std::stod(each_amount);
+      co_return std::stod(each_amount);
     }
   }
-  return 0.0;
+  co_return 0.0;
 }
 
-std::string sendLongOrder(Parameters &params, std::string const &direction,
-                          double quantity, double price) {
-  return sendOrder(params, direction, quantity, price);
+task<std::string> sendLongOrder(Parameters &params, std::string direction,
+                                double quantity, double price, OrderType type) {
+  co_return co_await sendOrder(params, direction, quantity, price, type);
 }
 
-std::string sendShortOrder(Parameters &params, std::string const &direction,
-                           double const quantity, double const price) {
-  return sendOrder(params, direction, quantity, price);
+task<std::string> sendShortOrder(Parameters &params, std::string direction,
+                                 double const quantity, double const price,
+                                 OrderType type) {
+  co_return co_await sendOrder(params, direction, quantity, price, type);
 }
 
-std::string sendOrder(Parameters &params, std::string const &direction,
-                      double const quantity, double const price) {
-  *params.logFile << "<Bitfinex> Trying to send a \"" << direction
-                  << "\" limit order: " << std::setprecision(6) << quantity
+// The v1 API has fill-or-kill and post-only limit orders, but no
+// immediate-or-cancel one
+task<std::string> sendOrder(Parameters &params, std::string direction,
+                            double const quantity, double const price,
+                            OrderType type) {
+  *params.logFile << "<Bitfinex> Trying to send a \"" << direction << "\" "
+                  << orderTypeName(type)
+                  << " limit order: " << std::setprecision(6) << quantity
                   << "@$" << std::setprecision(2) << price << "...\n";
   std::ostringstream oss;
   oss << "\"symbol\":\"btcusd\", \"amount\":\"" << quantity
       << "\", \"price\":\"" << price
       << "\", \"exchange\":\"bitfinex\", \"side\":\"" << direction
-      << "\", \"type\":\"limit\"";
+      << "\", \"type\":\""
+      << (type == OrderType::fok ? "fill-or-kill" : "limit") << "\"";
+  if (type == OrderType::postOnly)
+    oss << ", \"is_postonly\":true";
   std::string options = oss.str();
-  unique_json root{authRequest(params, "/v1/order/new", options)};
+  unique_json root{co_await authRequest(params, "/v1/order/new", options)};
   auto orderId = std::to_string(
       json_integer_value(json_object_get(root.get(), "order_id")));
   *params.logFile << "<Bitfinex> Done (order ID: " << orderId << ")\n"
                   << std::endl;
-  return orderId;
+  co_return orderId;
 }
 
-bool isOrderComplete(Parameters &params, std::string const &orderId) {
+task<bool> isOrderComplete(Parameters &params, std::string orderId) {
   if (orderId == "0")
-    return true;
+    co_return true;
 
   auto options = "\"order_id\":" + orderId;
-  unique_json root{authRequest(params, "/v1/order/status", options)};
-  return json_is_false(json_object_get(root.get(), "is_live"));
+  unique_json root{co_await authRequest(params, "/v1/order/status", options)};
+  co_return json_is_false(json_object_get(root.get(), "is_live"));
+}
+
+task<OrderStatus> getOrderStatus(Parameters &params, std::string orderId) {
+  OrderStatus status;
+  // "0" for an order that could not be sent
+  if (orderId == "0") {
+    status.known = true;
+    co_return status;
+  }
+
+  auto options = "\"order_id\":" + orderId;
+  unique_json root{co_await authRequest(params, "/v1/order/status", options)};
+  auto live = json_object_get(root.get(), "is_live");
+  if (!live) {
+    auto message = json_string_value(json_object_get(root.get(), "message"));
+    status.known = message && std::string(message) == "No such order found.";
+    *params.logFile << "<Bitfinex> Order " << orderId
+                    << (status.known ? " not found" : " unknown, ")
+                    << (status.known || !message ? "" : message) << std::endl;
+    co_return status;
+  }
+  status.known = true;
+  auto executed =
+      json_string_value(json_object_get(root.get(), "executed_amount"));
+  auto average =
+      json_string_value(json_object_get(root.get(), "avg_execution_price"));
+  status.open = json_is_true(live);
+  status.filled = executed ? atof(executed) : 0.0;
+  status.avgPrice = average ? atof(average) : 0.0;
+  co_return status;
 }
 
-double getActivePos(Parameters &params) {
-  unique_json root{authRequest(params, "/v1/positions", "")};
+task<bool> cancelOrder(Parameters &params, std::string orderId) {
+  if (orderId == "0")
+    co_return false;
+
+  auto options = "\"order_id\":" + orderId;
+  unique_json root{co_await authRequest(params, "/v1/order/cancel", options)};
+  auto message = json_string_value(json_object_get(root.get(), "message"));
+  if (message) {
+    *params.logFile << "<Bitfinex> Order " << orderId
+                    << " not canceled: " << message << std::endl;
+    co_return false;
+  }
+  *params.logFile << "<Bitfinex> Order " << orderId << " canceled"
+                  << std::endl;
+  co_return true;
+}
+
+task<double> getActivePos(Parameters &params) {
+  unique_json root{co_await authRequest(params, "/v1/positions", "")};
+  if (!json_is_array(root.get()))
+    co_return unknownBalance();
   double position;
   if (json_array_size(root.get()) == 0) {
     *params.logFile
@@ -122,13 +188,14 @@ double getActivePos(Parameters &params) {
     position = atof(json_string_value(
         json_object_get(json_array_get(root.get(), 0), "amount")));
   }
-  return position;
+  co_return position;
 }
 
-double getLimitPrice(Parameters &params, double const volume,
-                     bool const isBid) {
+task<double> getLimitPrice(Parameters &params, double const volume,
+                           bool const isBid) {
   auto &exchange = queryHandle(params);
-  unique_json root{exchange.getRequest("/v1/book/btcusd")};
+  unique_json root{co_await exchange.cachedGetAsync("/v1/book/btcusd",
+                                                    params.orderBookTtl())};
   json_t *bidask = json_object_get(root.get(), isBid ? "bids" : "asks");
 
   *params.logFile << "<Bitfinex> Looking for a limit price to fill "
@@ -143,24 +210,27 @@ double getLimitPrice(Parameters &params, double const volume,
         json_string_value(json_object_get(json_array_get(bidask, i), "price")));
     v = atof(json_string_value(
         json_object_get(json_array_get(bidask, i), "amount")));
-    *params.logFile << "<Bitfinex> order book: " << std::setprecision(6) << v
-                    << "@$" << std::setprecision(2) << p << std::endl;
+    params.log->log(LogLevel::debug, "<Bitfinex> order book: {.6}@${.2}",
+                    v, p);
     tmpVol += v;
     if (tmpVol >= fabs(volume) * params.orderBookFactor)
       break;
   }
 
-  return p;
+  co_return p;
 }
 
-json_t *authRequest(Parameters &params, std::string const &request,
-                    std::string const &options) {
+task<json_t *> authRequest(Parameters &params, std::string request,
+                           std::string options) {
   using namespace std;
 
-  static uint64_t nonce = time(nullptr) * 4;
+  // Held until the request is sent
+  auto sending = co_await NonceLock::async("Bitfinex:" + params.bitfinexApi,
+                                           time(nullptr) * 4);
+  auto nonce = sending.nonce();
 
   string payload =
-      "{\"request\":\"" + request + "\",\"nonce\":\"" + to_string(++nonce);
+      "{\"request\":\"" + request + "\",\"nonce\":\"" + to_string(nonce);
   if (options.empty()) {
     payload += "\"}";
   } else {
@@ -170,21 +240,15 @@ json_t *authRequest(Parameters &params, std::string const &request,
   payload = base64_encode(reinterpret_cast<const uint8_t *>(payload.c_str()),
                           payload.length());
 
-  // signature
-  uint8_t *digest = HMAC(EVP_sha384(), params.bitfinexSecret.c_str(),
-                         params.bitfinexSecret.length(),
-                         reinterpret_cast<const uint8_t *>(payload.data()),
-                         payload.size(), NULL, NULL);
-
   array<string, 3> headers{
       "X-BFX-APIKEY:" + params.bitfinexApi,
-      "X-BFX-SIGNATURE:" + hex_str(digest, digest + SHA384_DIGEST_LENGTH),
+      "X-BFX-SIGNATURE:" + signer(params).sign(payload).hex(),
       "X-BFX-PAYLOAD:" + payload,
   };
   auto &exchange = queryHandle(params);
-  auto root =
-      exchange.postRequest(request, make_slist(begin(headers), end(headers)));
-  return checkResponse(*params.logFile, root);
+  auto root = co_await exchange.postAsync(
+      request, make_slist(begin(headers), end(headers)), "");
+  co_return checkResponse(*params.logFile, root);
 }
 
 } // namespace Bitfinex
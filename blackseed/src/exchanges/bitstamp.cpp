@@ -1,30 +1,34 @@
 #include "bitstamp.h"
-#include "hex_str.hpp"
 #include "parameters.h"
 #include "unique_json.hpp"
 #include "utils/base64.h"
+#include "utils/hmac_signer.h"
+#include "utils/latency.h"
+#include "utils/nonce.h"
 #include "utils/restapi.h"
 
-#include "openssl/hmac.h"
-#include "openssl/sha.h"
 #include <chrono>
 #include <cmath>
 #include <ctime>
 #include <iomanip>
 #include <sstream>
-#include <thread>
 
 namespace Bitstamp {
 
-static json_t *authRequest(Parameters &, std::string const &,
-                           std::string const &);
+static task<json_t *> authRequest(Parameters &, std::string, std::string);
 
 static RestApi &queryHandle(Parameters &params) {
   static RestApi query("https://www.bitstamp.net", params.cacert.c_str(),
-                       *params.logFile);
+                       params.logFile);
   return query;
 }
 
+static HmacSigner &signer(Parameters &params) {
+  static HmacSigner signer(EVP_sha256(), params.bitstampSecret,
+                           &latency().histogram("Bitstamp", "hmac", "sign"));
+  return signer;
+}
+
 static json_t *checkResponse(std::ostream &logFile, json_t *root) {
   auto errstatus = json_object_get(root, "error");
   if (errstatus) {
@@ -38,9 +42,10 @@ static json_t *checkResponse(std::ostream &logFile, json_t *root) {
   return root;
 }
 
-quote_t getQuote(Parameters &params) {
+task<quote_t> getQuote(Parameters &params) {
   auto &exchange = queryHandle(params);
-  unique_json root{exchange.getRequest("/api/ticker")};
+  unique_json root{
+      co_await exchange.cachedGetAsync("/api/ticker", params.tickerTtl())};
 
   const char *quote = json_string_value(json_object_get(root.get(), "bid"));
   auto bidValue = quote ? atof(quote) : 0.0;
@@ -48,18 +53,17 @@ quote_t getQuote(Parameters &params) {
   quote = json_string_value(json_object_get(root.get(), "ask"));
   auto askValue = quote ? atof(quote) : 0.0;
 
-  return std::make_pair(bidValue, askValue);
+  co_return std::make_pair(bidValue, askValue);
 }
 
-double getAvail(Parameters &params, std::string const &currency) {
-  unique_json root{authRequest(params, "/api/balance/", "")};
-  while (json_object_get(root.get(), "message") != NULL) {
-    std::this_thread::sleep_for(std::chrono::seconds(1));
+task<double> getAvail(Parameters &params, std::string currency) {
+  unique_json root{co_await authRequest(params, "/api/balance/", "")};
+  // An error reply, the ledger reads the balances again later
+  if (json_object_get(root.get(), "message") != NULL) {
     auto dump = json_dumps(root.get(), 0);
-    *params.logFile << "<Bitstamp> Error with JSON: " << dump << ". Retrying..."
-                    << std::endl;
+    *params.logFile << "<Bitstamp> Error with JSON: " << dump << std::endl;
     free(dump);
-    root.reset(authRequest(params, "/api/balance/", ""));
+    co_return unknownBalance();
   }
   double availability = 0.0;
   const char *returnedText = NULL;
@@ -74,14 +78,14 @@ double getAvail(Parameters &params, std::string const &currency) {
     availability = atof(returnedText);
   } else {
     *params.logFile << "<Bitstamp> Error with the credentials." << std::endl;
-    availability = 0.0;
+    availability = unknownBalance();
   }
 
-  return availability;
+  co_return availability;
 }
 
-std::string sendLongOrder(Parameters &params, std::string const &direction,
-                          double const quantity, double const price) {
+task<std::string> sendLongOrder(Parameters &params, std::string direction,
+                                double const quantity, double const price) {
   *params.logFile << "<Bitstamp> Trying to send a \"" << direction
                   << "\" limit order: " << std::setprecision(6) << quantity
                   << "@$" << std::setprecision(2) << price << "...\n";
@@ -91,7 +95,7 @@ std::string sendLongOrder(Parameters &params, std::string const &direction,
   oss << "amount=" << quantity << "&price=" << std::fixed
       << std::setprecision(2) << price;
   std::string options = oss.str();
-  unique_json root{authRequest(params, url, options)};
+  unique_json root{co_await authRequest(params, url, options)};
   auto orderId =
       std::to_string(json_integer_value(json_object_get(root.get(), "id")));
   if (orderId == "0") {
@@ -102,25 +106,78 @@ std::string sendLongOrder(Parameters &params, std::string const &direction,
   *params.logFile << "<Bitstamp> Done (order ID: " << orderId << ")\n"
                   << std::endl;
 
-  return orderId;
+  co_return orderId;
 }
 
-bool isOrderComplete(Parameters &params, std::string const &orderId) {
+task<bool> isOrderComplete(Parameters &params, std::string orderId) {
   if (orderId == "0")
-    return true;
+    co_return true;
 
   auto options = "id=" + orderId;
-  unique_json root{authRequest(params, "/api/order_status/", options)};
+  unique_json root{co_await authRequest(params, "/api/order_status/", options)};
   auto status = json_string_value(json_object_get(root.get(), "status"));
-  return status && status == std::string("Finished");
+  co_return status && status == std::string("Finished");
 }
 
-double getActivePos(Parameters &params) { return getAvail(params, "btc"); }
+task<OrderStatus> getOrderStatus(Parameters &params, std::string orderId) {
+  OrderStatus status;
+  status.known = true;
+  if (orderId == "0")
+    co_return status;
+
+  auto options = "id=" + orderId;
+  unique_json root{co_await authRequest(params, "/api/order_status/", options)};
+  auto state = json_string_value(json_object_get(root.get(), "status"));
+  // Errors come with status "error" and a reason, or only an error
+  if (!state || state == std::string("error")) {
+    auto reason = json_string_value(json_object_get(root.get(), "reason"));
+    if (!reason)
+      reason = json_string_value(json_object_get(root.get(), "error"));
+    status.known = reason && (reason == std::string("Order not found") ||
+                              reason == std::string("Invalid order id"));
+    *params.logFile << "<Bitstamp> Order " << orderId
+                    << (status.known ? " not found" : " unknown, ")
+                    << (status.known || !reason ? "" : reason) << std::endl;
+    co_return status;
+  }
+  status.open = state != std::string("Finished");
+  // The fills come as transactions
+  double value = 0.0;
+  auto transactions = json_object_get(root.get(), "transactions");
+  for (size_t i = 0; i < json_array_size(transactions); ++i) {
+    auto transaction = json_array_get(transactions, i);
+    auto btc = json_string_value(json_object_get(transaction, "btc"));
+    auto usd = json_string_value(json_object_get(transaction, "usd"));
+    status.filled += btc ? atof(btc) : 0.0;
+    value += usd ? atof(usd) : 0.0;
+  }
+  if (status.filled > 0.0)
+    status.avgPrice = value / status.filled;
+  co_return status;
+}
+
+task<bool> cancelOrder(Parameters &params, std::string orderId) {
+  if (orderId == "0")
+    co_return false;
+
+  auto options = "id=" + orderId;
+  unique_json root{co_await authRequest(params, "/api/cancel_order/", options)};
+  // true, or an error already logged by checkResponse
+  bool canceled = json_is_true(root.get());
+  *params.logFile << "<Bitstamp> Order " << orderId
+                  << (canceled ? " canceled" : " not canceled") << std::endl;
+  co_return canceled;
+}
+
+task<double> getActivePos(Parameters &params) {
+  co_return co_await getAvail(params, "btc");
+}
 
-double getLimitPrice(Parameters &params, double const volume,
-                     bool const isBid) {
+task<double> getLimitPrice(Parameters &params, double const volume,
+                           bool const isBid) {
   auto &exchange = queryHandle(params);
-  unique_json root{exchange.getRequest("/api/order_book")};
+  unique_json root{co_await exchange.cachedGetAsync("/api/order_book",
+                                                    params.orderBookTtl())};
   auto orderbook = json_object_get(root.get(), isBid ? "bids" : "asks");
 
   // loop on volume
@@ -129,33 +186,33 @@ double getLimitPrice(Parameters &params, double const volume,
   double tmpVol = 0.0;
   double p = 0.0;
   double v;
-  int i = 0;
-  while (tmpVol < fabs(volume) * params.orderBookFactor) {
+  // An error reply has no book, 0.0 is returned
+  for (size_t i = 0; i < json_array_size(orderbook) &&
+                     tmpVol < fabs(volume) * params.orderBookFactor;
+       ++i) {
     p = atof(
         json_string_value(json_array_get(json_array_get(orderbook, i), 0)));
     v = atof(
         json_string_value(json_array_get(json_array_get(orderbook, i), 1)));
-    *params.logFile << "<Bitstamp> order book: " << std::setprecision(6) << v
-                    << "@$" << std::setprecision(2) << p << std::endl;
+    params.log->log(LogLevel::debug, "<Bitstamp> order book: {.6}@${.2}",
+                    v, p);
     tmpVol += v;
-    i++;
   }
-  return p;
+  co_return p;
 }
 
-json_t *authRequest(Parameters &params, std::string const &request,
-                    std::string const &options) {
-  static uint64_t nonce = time(nullptr) * 4;
+task<json_t *> authRequest(Parameters &params, std::string request,
+                           std::string options) {
+  // Held until the request is sent
+  auto sending = co_await NonceLock::async("Bitstamp:" + params.bitstampApi,
+                                           time(nullptr) * 4);
+  auto nonce = sending.nonce();
   auto msg =
-      std::to_string(++nonce) + params.bitstampClientId + params.bitstampApi;
-  uint8_t *digest = HMAC(EVP_sha256(), params.bitstampSecret.c_str(),
-                         params.bitstampSecret.size(),
-                         reinterpret_cast<const uint8_t *>(msg.data()),
-                         msg.size(), nullptr, nullptr);
+      std::to_string(nonce) + params.bitstampClientId + params.bitstampApi;
 
   std::string postParams =
       "key=" + params.bitstampApi +
-      "&signature=" + hex_str<upperhex>(digest, digest + SHA256_DIGEST_LENGTH) +
+      "&signature=" + signer(params).sign(msg).upperHex() +
       "&nonce=" + std::to_string(nonce);
   if (!options.empty()) {
     postParams += "&";
@@ -163,8 +220,8 @@ json_t *authRequest(Parameters &params, std::string const &request,
   }
 
   auto &exchange = queryHandle(params);
-  return checkResponse(*params.logFile,
-                       exchange.postRequest(request, postParams));
+  auto root = co_await exchange.postAsync(request, nullptr, postParams);
+  co_return checkResponse(*params.logFile, root);
 }
 
 } // namespace Bitstamp
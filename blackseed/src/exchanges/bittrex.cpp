@@ -1,11 +1,11 @@
 #include "bittrex.h"
-#include "hex_str.hpp"
 #include "parameters.h"
 #include "unique_json.hpp"
+#include "utils/hmac_signer.h"
+#include "utils/latency.h"
+#include "utils/nonce.h"
 #include "utils/restapi.h"
 
-#include "openssl/hmac.h"
-#include "openssl/sha.h"
 #include <algorithm>
 #include <array>
 #include <cctype>
@@ -14,14 +14,19 @@
 #include <sstream>
 
 namespace Bittrex {
-static json_t *authRequest(Parameters &, std::string const &,
-                           std::string const &);
+static task<json_t *> authRequest(Parameters &, std::string, std::string);
 static RestApi &queryHandle(Parameters &params) {
   static RestApi query("https://bittrex.com", params.cacert.c_str(),
-                       *params.logFile);
+                       params.logFile);
   return query;
 }
 
+static HmacSigner &signer(Parameters &params) {
+  static HmacSigner signer(EVP_sha512(), params.bittrexSecret,
+                           &latency().histogram("Bittrex", "hmac", "sign"));
+  return signer;
+}
+
 static json_t *checkResponse(std::ostream &logFile, json_t *root) {
   auto errmsg = json_object_get(root, "error");
   if (errmsg)
@@ -31,7 +36,7 @@ static json_t *checkResponse(std::ostream &logFile, json_t *root) {
   return root;
 }
 
-quote_t getQuote(Parameters &params) {
+task<quote_t> getQuote(Parameters &params) {
   auto &exchange = queryHandle(params);
   std::string x;
 
@@ -39,7 +44,7 @@ quote_t getQuote(Parameters &params) {
   x += "USDT-BTC";
   // params.leg2.c_str();
 
-  unique_json root{exchange.getRequest(x)};
+  unique_json root{co_await exchange.cachedGetAsync(x, params.tickerTtl())};
 
   double quote = json_number_value(
       json_object_get(json_object_get(root.get(), "result"), "Bid"));
@@ -49,10 +54,10 @@ quote_t getQuote(Parameters &params) {
       json_object_get(json_object_get(root.get(), "result"), "Ask"));
   auto askValue = quote ? quote : 0.0;
 
-  return std::make_pair(bidValue, askValue);
+  co_return std::make_pair(bidValue, askValue);
 }
 
-double getAvail(Parameters &params, std::string const &currency) {
+task<double> getAvail(Parameters &params, std::string currency) {
   std::string cur_str;
   cur_str += "currency=";
   if (currency.compare("USD") == 0) {
@@ -61,20 +66,21 @@ double getAvail(Parameters &params, std::string const &currency) {
     cur_str += currency.c_str();
   }
   unique_json root{
-      authRequest(params, "/api/v1.1/account/getbalance", cur_str)};
-
+      co_await authRequest(params, "/api/v1.1/account/getbalance", cur_str)};
+  if (!json_is_true(json_object_get(root.get(), "success")))
+    co_return unknownBalance();
   double available = json_number_value(
       json_object_get(json_object_get(root.get(), "result"), "Available"));
-  return available;
+  co_return available;
 }
 // this function name is misleading it is not a "long" order but a non margin
 // order.
-std::string sendLongOrder(Parameters &params, std::string const &direction,
-                          double const quantity, double const price) {
+task<std::string> sendLongOrder(Parameters &params, std::string direction,
+                                double const quantity, double const price) {
   if (direction.compare("buy") != 0 && direction.compare("sell") != 0) {
     *params.logFile << "<Bittrex> Error: Neither \"buy\" nor \"sell\" selected"
                     << std::endl;
-    return "0";
+    co_return "0";
   }
   *params.logFile << "<Bittrex> Trying to send a \"" << direction
                   << "\" limit order: " << std::setprecision(8) << quantity
@@ -86,22 +92,22 @@ std::string sendLongOrder(Parameters &params, std::string const &direction,
   std::string options =
       "market=" + pair + "&quantity=" + volume + "&rate=" + pricelimit;
   std::string url = "/api/v1.1/market/" + direction + "limit";
-  unique_json root{authRequest(params, url, options)};
+  unique_json root{co_await authRequest(params, url, options)};
   // theres some problem here that can produce a seg fault.
   auto txid = json_string_value(
       json_object_get(json_object_get(root.get(), "result"), "uuid"));
 
   *params.logFile << "<Bittrex> Done (transaction ID: " << txid << ")\n"
                   << std::endl;
-  return txid;
+  co_return txid;
 }
 // SUGGEST: probably not necessary
-std::string sendShortOrder(Parameters &params, std::string const &direction,
-                           double const quantity, double const price) {
+task<std::string> sendShortOrder(Parameters &params, std::string direction,
+                                 double const quantity, double const price) {
   if (direction.compare("buy") != 0 && direction.compare("sell") != 0) {
     *params.logFile << "<Bittrex> Error: Neither \"buy\" nor \"sell\" selected"
                     << std::endl;
-    return "0";
+    co_return "0";
   }
   *params.logFile << "<Bittrex> Trying to send a \"" << direction
                   << "\" limit order: " << std::setprecision(8) << quantity
@@ -111,19 +117,20 @@ std::string sendShortOrder(Parameters &params, std::string const &direction,
   std::string volume = std::to_string(quantity);
   std::string options =
       "market=" + pair + "&quantity=" + volume + "&rate=" + pricelimit;
-  unique_json root{authRequest(params, "/api/v1.1/market/selllimit", options)};
+  unique_json root{
+      co_await authRequest(params, "/api/v1.1/market/selllimit", options)};
   // theres so
   auto txid = json_string_value(
       json_object_get(json_object_get(root.get(), "result"), "uuid"));
 
   *params.logFile << "<Bittrex> Done (transaction ID: " << txid << ")\n"
                   << std::endl;
-  return txid;
+  co_return txid;
 }
 // This is not used at the moment, but could pull out send long/short order.
 // Leaving as is for now
-std::string sendOrder(Parameters &params, std::string const &direction,
-                      double const quantity, double const price) {
+task<std::string> sendOrder(Parameters &params, std::string direction,
+                            double const quantity, double const price) {
   *params.logFile << "<Bittrex> Trying to send a \"" << direction
                   << "\" limit order: " << std::setprecision(6) << quantity
                   << "@$" << std::setprecision(2) << price << "...\n";
@@ -133,53 +140,77 @@ std::string sendOrder(Parameters &params, std::string const &direction,
       << "\", \"exchange\":\"bitfinex\", \"side\":\"" << direction
       << "\", \"type\":\"limit\"";
   std::string options = oss.str();
-  unique_json root{authRequest(params, "/v1/order/new", options)};
+  unique_json root{co_await authRequest(params, "/v1/order/new", options)};
 
   auto orderId = std::to_string(
       json_integer_value(json_object_get(root.get(), "order_id")));
   *params.logFile << "<Bittrex> Done (order ID: " << orderId << ")\n"
                   << std::endl;
-  return orderId;
+  co_return orderId;
 }
 
-bool isOrderComplete(Parameters &params, std::string const &orderId) {
-  // TODO Build a real currency string for options here (or outside?)
-  unique_json root{
-      authRequest(params, "/api/v1.1/market/getopenorders", "market=USDT-BTC")};
-  auto res = json_object_get(root.get(), "result");
-  // loop through the array to check orders
-  std::string uuid;
-  int size = json_array_size(res);
-  if (json_array_size(res) == 0) {
-    *params.logFile << "<Bittrex> No orders exist" << std::endl;
-    return true;
-  }
-  bool isOrderStillOpen = true;
-  for (int i = 0; i < size; i++) {
-    uuid =
-        json_string_value(json_object_get(json_array_get(res, i), "OrderUuid"));
-    if (uuid.compare(orderId.c_str()) == 0) {
-      *params.logFile << "<Bittrex> Order " << orderId << " still exists"
-                      << std::endl;
-      isOrderStillOpen = false;
-    }
+task<bool> isOrderComplete(Parameters &params, std::string orderId) {
+  // The order alone is looked up, not the list of all the open ones
+  auto status = co_await getOrderStatus(params, orderId);
+  // A failed lookup is logged, and done again the next time
+  if (!status.known)
+    co_return false;
+  if (!status.open)
+    co_return true;
+  *params.logFile << "<Bittrex> Order " << orderId << " still exists"
+                  << std::endl;
+  co_return false;
+}
+
+task<OrderStatus> getOrderStatus(Parameters &params, std::string orderId) {
+  OrderStatus status;
+  // "0" for an order that could not be sent
+  if (orderId == "0") {
+    status.known = true;
+    co_return status;
   }
-  if (isOrderStillOpen) {
-    *params.logFile << "<Bittrex> Order " << orderId << " does not exist"
-                    << std::endl;
+  unique_json root{co_await authRequest(params, "/api/v1.1/account/getorder",
+                                        "uuid=" + orderId)};
+  auto order = json_object_get(root.get(), "result");
+  if (!json_is_true(json_object_get(root.get(), "success")) ||
+      !json_is_object(order)) {
+    auto message = json_string_value(json_object_get(root.get(), "message"));
+    status.known = message && std::string(message) == "INVALID_ORDER";
+    *params.logFile << "<Bittrex> Order " << orderId
+                    << (status.known ? " not found" : " unknown, ")
+                    << (status.known || !message ? "" : message) << std::endl;
+    co_return status;
   }
-  return isOrderStillOpen;
+  status.known = true;
+  status.open = json_is_true(json_object_get(order, "IsOpen"));
+  status.filled =
+      json_number_value(json_object_get(order, "Quantity")) -
+      json_number_value(json_object_get(order, "QuantityRemaining"));
+  // null until the order trades
+  status.avgPrice = json_number_value(json_object_get(order, "PricePerUnit"));
+  co_return status;
 }
 
-double getActivePos(Parameters &params) { return getAvail(params, "BTC"); }
+task<bool> cancelOrder(Parameters &params, std::string orderId) {
+  if (orderId == "0")
+    co_return false;
+  unique_json root{co_await authRequest(params, "/api/v1.1/market/cancel",
+                                        "uuid=" + orderId)};
+  co_return json_is_true(json_object_get(root.get(), "success"));
+}
+
+task<double> getActivePos(Parameters &params) {
+  co_return co_await getAvail(params, "BTC");
+}
 
-double getLimitPrice(Parameters &params, double const volume,
-                     bool const isBid) {
+task<double> getLimitPrice(Parameters &params, double const volume,
+                           bool const isBid) {
   // takes a quantity we want and if its a bid or not
   auto &exchange = queryHandle(params);
   // TODO build a real URI string here
-  unique_json root{exchange.getRequest(
-      "/api/v1.1/public/getorderbook?market=USDT-BTC&type=both")};
+  unique_json root{co_await exchange.cachedGetAsync(
+      "/api/v1.1/public/getorderbook?market=USDT-BTC&type=both",
+      params.orderBookTtl())};
   auto bidask = json_object_get(json_object_get(root.get(), "result"),
                                 isBid ? "buy" : "sell");
   // loop on volume
@@ -193,27 +224,29 @@ double getLimitPrice(Parameters &params, double const volume,
     p = json_number_value(json_object_get(json_array_get(bidask, i), "Rate"));
     v = json_number_value(
         json_object_get(json_array_get(bidask, i), "Quantity"));
-    *params.logFile << "<Bittrex> order book: " << std::setprecision(8) << v
-                    << "@$" << std::setprecision(8) << p << std::endl;
+    params.log->log(LogLevel::debug, "<Bittrex> order book: {.8}@${.8}",
+                    v, p);
     tmpVol += v;
     i++;
   }
 
-  return p;
+  co_return p;
 }
 
 // build auth request - needs to append apikey, nonce, and calculate HMAC 512
 // hash and include it under api sign header
-json_t *authRequest(Parameters &params, std::string const &request,
-                    std::string const &options) {
-  // TODO: create nonce NOT respected right now so not calculating but could be
-  // added with  std::to_string(++nonce) static uint64_t nonce = time(nullptr) *
-  // 4;
+task<json_t *> authRequest(Parameters &params, std::string request,
+                           std::string options) {
+  // Held until the request is sent
+  auto sending = co_await NonceLock::async("Bittrex:" + params.bittrexApi,
+                                           time(nullptr) * 4);
+  auto nonce = std::to_string(sending.nonce());
   // this message is the full uri for sig signing.
   auto msg = "https://bittrex.com" + request +
-             "?apikey=" + params.bittrexApi.c_str() + "&nonce=0";
+             "?apikey=" + params.bittrexApi.c_str() + "&nonce=" + nonce;
   // append options to full uri and partial URI
-  std::string uri = request + "?apikey=" + params.bittrexApi + "&nonce=0";
+  std::string uri =
+      request + "?apikey=" + params.bittrexApi + "&nonce=" + nonce;
   if (!options.empty()) {
     msg += "&";
     msg += options;
@@ -223,14 +256,10 @@ json_t *authRequest(Parameters &params, std::string const &request,
   // SHA512 of URI and API SECRET
   // this function grabs the HMAC hash (using sha512) of the secret and the full
   // URI
-  uint8_t *hmac_digest = HMAC(
-      EVP_sha512(), params.bittrexSecret.c_str(), params.bittrexSecret.size(),
-      reinterpret_cast<const uint8_t *>(msg.data()), msg.size(), NULL, NULL);
-  // creates a hex string of the hmac hash
-  std::string api_sign_header =
-      hex_str(hmac_digest, hmac_digest + SHA512_DIGEST_LENGTH);
+  // and creates a hex string of it
+  std::string api_sign_header = signer(params).sign(msg).hex();
   // create a base for appending the initial request domain
-  std::string postParams = "?apikey=" + params.bittrexApi + "&nonce=0";
+  std::string postParams = "?apikey=" + params.bittrexApi + "&nonce=" + nonce;
   // once again append the extra options
   if (!options.empty()) {
     postParams += "&";
@@ -239,10 +268,9 @@ json_t *authRequest(Parameters &params, std::string const &request,
   std::array<std::string, 1> headers{"apisign:" + api_sign_header};
   // curl the request
   auto &exchange = queryHandle(params);
-  return checkResponse(
-      *params.logFile,
-      exchange.postRequest(
-          uri, make_slist(std::begin(headers), std::end(headers)), postParams));
+  auto root = co_await exchange.postAsync(
+      uri, make_slist(std::begin(headers), std::end(headers)), postParams);
+  co_return checkResponse(*params.logFile, root);
 }
 
 void testBittrex() {
@@ -1,12 +1,12 @@
 #include "cexio.h"
-#include "hex_str.hpp"
 #include "parameters.h"
 #include "unique_json.hpp"
 #include "utils/base64.h"
+#include "utils/hmac_signer.h"
+#include "utils/latency.h"
+#include "utils/nonce.h"
 #include "utils/restapi.h"
 
-#include "openssl/hmac.h"
-#include "openssl/sha.h"
 #include <algorithm>
 #include <array>
 #include <chrono>
@@ -16,18 +16,23 @@
 
 namespace Cexio {
 
-static json_t *authRequest(Parameters &, std::string const &,
-                           std::string const &);
+static task<json_t *> authRequest(Parameters &, std::string, std::string);
 
 static bool g_bShort = false;
 static std::string g_strOpenId = "0";
 
 static RestApi &queryHandle(Parameters &params) {
   static RestApi query("https://cex.io/api", params.cacert.c_str(),
-                       *params.logFile);
+                       params.logFile);
   return query;
 }
 
+static HmacSigner &signer(Parameters &params) {
+  static HmacSigner signer(EVP_sha256(), params.cexioSecret,
+                           &latency().histogram("Cexio", "hmac", "sign"));
+  return signer;
+}
+
 static json_t *checkResponse(std::ostream &logFile, json_t *root) {
   auto errstatus = json_object_get(root, "error");
 
@@ -40,56 +45,58 @@ static json_t *checkResponse(std::ostream &logFile, json_t *root) {
   return root;
 }
 
-quote_t getQuote(Parameters &params) {
+task<quote_t> getQuote(Parameters &params) {
   auto &exchange = queryHandle(params);
-  unique_json root{exchange.getRequest("/ticker/BTC/USD")};
+  unique_json root{
+      co_await exchange.cachedGetAsync("/ticker/BTC/USD", params.tickerTtl())};
 
   double bidValue = json_number_value(json_object_get(root.get(), "bid"));
   double askValue = json_number_value(json_object_get(root.get(), "ask"));
 
-  return std::make_pair(bidValue, askValue);
+  co_return std::make_pair(bidValue, askValue);
 }
 
-double getAvail(Parameters &params, std::string const &tempCurrency) {
+task<double> getAvail(Parameters &params, std::string tempCurrency) {
   double available = 0.0;
   std::string currency = tempCurrency;
   std::transform(currency.begin(), currency.end(), currency.begin(), ::toupper);
   const char *curr_ = currency.c_str();
 
-  unique_json root{authRequest(params, "/balance/", "")};
-
+  unique_json root{co_await authRequest(params, "/balance/", "")};
+  if (json_object_get(root.get(), "error"))
+    co_return unknownBalance();
   const char *avail_str = json_string_value(
       json_object_get(json_object_get(root.get(), curr_), "available"));
   available = avail_str ? atof(avail_str) : 0.0;
 
-  return available;
+  co_return available;
 }
 
-std::string sendLongOrder(Parameters &params, std::string const &direction,
-                          double const quantity, double const price) {
+task<std::string> sendLongOrder(Parameters &params, std::string direction,
+                                double const quantity, double const price) {
   g_bShort = false;
-  return sendOrder(params, direction, quantity, price);
+  co_return co_await sendOrder(params, direction, quantity, price);
 }
 
-std::string sendShortOrder(Parameters &params, std::string const &direction,
-                           double const quantity, double const price) {
+task<std::string> sendShortOrder(Parameters &params, std::string direction,
+                                 double const quantity, double const price) {
   // return sendOrder(params, direction, quantity, price);
 
   g_bShort = true;
 
   if (direction.compare("sell") == 0) {
-    return openPosition(params, direction, quantity, price);
+    co_return co_await openPosition(params, direction, quantity, price);
 
   } else if (direction.compare("buy") == 0) {
 
-    return closePosition(params);
+    co_return co_await closePosition(params);
   }
 
-  return "0";
+  co_return "0";
 }
 
-std::string openPosition(Parameters &params, std::string const &direction,
-                         double const quantity, double const price) {
+task<std::string> openPosition(Parameters &params, std::string direction,
+                               double const quantity, double const price) {
   using namespace std;
   string pair = "btc_usd";
   string orderId = "";
@@ -120,7 +127,8 @@ std::string openPosition(Parameters &params, std::string const &direction,
 
   string options = oss.str();
 
-  unique_json root{authRequest(params, "/open_position/BTC/USD/", options)};
+  unique_json root{
+      co_await authRequest(params, "/open_position/BTC/USD/", options)};
   auto error = json_string_value(json_object_get(root.get(), "error"));
 
   ostringstream oss1;
@@ -142,13 +150,13 @@ std::string openPosition(Parameters &params, std::string const &direction,
 
   g_strOpenId = orderId;
 
-  return orderId;
+  co_return orderId;
 }
 
-std::string closePosition(Parameters &params) {
+task<std::string> closePosition(Parameters &params) {
 
   if (g_strOpenId == "0")
-    return "0";
+    co_return "0";
 
   using namespace std;
   string orderId = "0";
@@ -157,7 +165,8 @@ std::string closePosition(Parameters &params) {
   oss << "id=" << tmpId;
   string options = oss.str();
 
-  unique_json root{authRequest(params, "/close_position/BTC/USD/", options)};
+  unique_json root{
+      co_await authRequest(params, "/close_position/BTC/USD/", options)};
   auto error = json_string_value(json_object_get(root.get(), "error"));
 
   ostringstream oss1;
@@ -172,7 +181,7 @@ std::string closePosition(Parameters &params) {
     orderId = oss1.str();
   }
 
-  return orderId;
+  co_return orderId;
 
   /*
 
@@ -205,8 +214,8 @@ std::string closePosition(Parameters &params) {
   */
 }
 
-std::string sendOrder(Parameters &params, std::string const &direction,
-                      double const quantity, double const price) {
+task<std::string> sendOrder(Parameters &params, std::string direction,
+                            double const quantity, double const price) {
   using namespace std;
   string pair = "btc_usd";
   string orderId = "";
@@ -218,7 +227,8 @@ std::string sendOrder(Parameters &params, std::string const &direction,
       << setprecision(2) << price;
   string options = oss.str();
 
-  unique_json root{authRequest(params, "/place_order/BTC/USD/", options)};
+  unique_json root{
+      co_await authRequest(params, "/place_order/BTC/USD/", options)};
   auto error = json_string_value(json_object_get(root.get(), "error"));
   if (error) {
     // auto dump = json_dumps(root.get(), 0);
@@ -229,14 +239,14 @@ std::string sendOrder(Parameters &params, std::string const &direction,
     orderId = json_string_value(json_object_get(root.get(), "id"));
     *params.logFile << "<Cexio> Done (order ID): " << orderId << ")\n" << endl;
   }
-  return orderId;
+  co_return orderId;
 }
 
-bool isOrderComplete(Parameters &params, std::string const &orderId) {
+task<bool> isOrderComplete(Parameters &params, std::string orderId) {
 
   using namespace std;
   if (orderId == "0")
-    return false;
+    co_return false;
 
   auto oId = stol(orderId);
   ostringstream oss;
@@ -244,43 +254,109 @@ bool isOrderComplete(Parameters &params, std::string const &orderId) {
   string options = oss.str();
 
   if (g_bShort) {
-    unique_json root{authRequest(params, "/get_position/", options)};
+    unique_json root{co_await authRequest(params, "/get_position/", options)};
 
     string status = json_string_value(
         json_object_get(json_object_get(root.get(), "data"), "status"));
     if (status.compare("a") == 0) {
-      return true;
+      co_return true;
     } else {
       // auto dump = json_dumps(root.get(), 0);
       // *params.logFile << "<Cexio> Position Order Not Complete: " << dump <<
       // ")\n" << endl; free(dump); cout << "REMAINS:" << remains << endl;
-      return false;
+      co_return false;
     }
 
   } else {
 
-    unique_json root{authRequest(params, "/get_order/", options)};
+    unique_json root{co_await authRequest(params, "/get_order/", options)};
     auto remains =
         atof(json_string_value(json_object_get(root.get(), "remains")));
     if (remains == 0) {
-      return true;
+      co_return true;
     } else {
       auto dump = json_dumps(root.get(), 0);
       *params.logFile << "<Cexio> Order Not Complete: " << dump << ")\n"
                       << endl;
       free(dump);
       // cout << "REMAINS:" << remains << endl;
-      return false;
+      co_return false;
+    }
+  }
+}
+
+task<OrderStatus> getOrderStatus(Parameters &params, std::string orderId) {
+  using namespace std;
+  OrderStatus status;
+  // "0" for an order that could not be sent
+  if (orderId == "0") {
+    status.known = true;
+    co_return status;
+  }
+
+  string options = "id=" + orderId;
+  if (g_bShort) {
+    // A position is opened in full at once, status "a" when it is
+    unique_json root{co_await authRequest(params, "/get_position/", options)};
+    auto data = json_object_get(root.get(), "data");
+    auto state = json_string_value(json_object_get(data, "status"));
+    if (!state) {
+      *params.logFile << "<Cexio> Position " << orderId << " unknown" << endl;
+      co_return status;
+    }
+    status.known = true;
+    status.open = state != string("a");
+    if (!status.open) {
+      auto amount = json_string_value(json_object_get(data, "amount"));
+      auto price = json_string_value(json_object_get(data, "oprice"));
+      status.filled = amount ? atof(amount) : 0.0;
+      status.avgPrice = price ? atof(price) : 0.0;
     }
+    co_return status;
   }
+
+  unique_json root{co_await authRequest(params, "/get_order/", options)};
+  // "a" active, "d" done, "c" canceled, "cd" canceled after a partial fill
+  auto state = json_string_value(json_object_get(root.get(), "status"));
+  if (!state) {
+    auto error = json_string_value(json_object_get(root.get(), "error"));
+    status.known = error && error == string("Error: Order not found");
+    *params.logFile << "<Cexio> Order " << orderId
+                    << (status.known ? " not found" : " unknown, ")
+                    << (status.known || !error ? "" : error) << endl;
+    co_return status;
+  }
+  status.known = true;
+  auto amount = json_string_value(json_object_get(root.get(), "amount"));
+  auto remains = json_string_value(json_object_get(root.get(), "remains"));
+  auto price = json_string_value(json_object_get(root.get(), "price"));
+  status.open = state == string("a");
+  if (amount && remains)
+    status.filled = atof(amount) - atof(remains);
+  // Fills are at the limit price or better, which Cexio does not detail
+  if (status.filled > 0.0 && price)
+    status.avgPrice = atof(price);
+  co_return status;
 }
 
-double getActivePos(Parameters &params) { return getAvail(params, "btc"); }
+task<bool> cancelOrder(Parameters &params, std::string orderId) {
+  // A short position is closed, not canceled
+  if (orderId == "0" || g_bShort)
+    co_return false;
+  unique_json root{
+      co_await authRequest(params, "/cancel_order/", "id=" + orderId)};
+  co_return json_is_true(root.get());
+}
+
+task<double> getActivePos(Parameters &params) {
+  co_return co_await getAvail(params, "btc");
+}
 
-double getLimitPrice(Parameters &params, double const volume,
-                     bool const isBid) {
+task<double> getLimitPrice(Parameters &params, double const volume,
+                           bool const isBid) {
   auto &exchange = queryHandle(params);
-  auto root = unique_json(exchange.getRequest("/order_book/BTC/USD/"));
+  auto root = unique_json(co_await exchange.cachedGetAsync(
+      "/order_book/BTC/USD/", params.orderBookTtl()));
   auto branch = json_object_get(root.get(), isBid ? "bids" : "asks");
 
   // loop on volume
@@ -299,21 +375,20 @@ double getLimitPrice(Parameters &params, double const volume,
     }
   }
 
-  return currPrice;
+  co_return currPrice;
 }
 
-json_t *authRequest(Parameters &params, std::string const &request,
-                    std::string const &options) {
-  static uint64_t nonce = std::time(nullptr) * 4;
-  auto msg = std::to_string(++nonce) + params.cexioClientId + params.cexioApi;
-  uint8_t *digest =
-      HMAC(EVP_sha256(), params.cexioSecret.c_str(), params.cexioSecret.size(),
-           reinterpret_cast<const uint8_t *>(msg.data()), msg.size(), nullptr,
-           nullptr);
+task<json_t *> authRequest(Parameters &params, std::string request,
+                           std::string options) {
+  // Held until the request is sent
+  auto sending = co_await NonceLock::async("Cexio:" + params.cexioApi,
+                                           std::time(nullptr) * 4);
+  auto nonce = sending.nonce();
+  auto msg = std::to_string(nonce) + params.cexioClientId + params.cexioApi;
 
   std::string postParams =
       "key=" + params.cexioApi +
-      "&signature=" + hex_str<upperhex>(digest, digest + SHA256_DIGEST_LENGTH) +
+      "&signature=" + signer(params).sign(msg).upperHex() +
       "&nonce=" + std::to_string(nonce);
 
   if (!options.empty()) {
@@ -322,8 +397,8 @@ json_t *authRequest(Parameters &params, std::string const &request,
   }
 
   auto &exchange = queryHandle(params);
-  return checkResponse(*params.logFile,
-                       exchange.postRequest(request, postParams));
+  auto root = co_await exchange.postAsync(request, nullptr, postParams);
+  co_return checkResponse(*params.logFile, root);
 }
 
 void testCexio() {
@@ -335,23 +410,34 @@ void testCexio() {
   using std::cout;
   using std::endl;
 
-  cout << "Current value BTC_USD bid: " << getQuote(params).bid() << endl;
-  cout << "Current value BTC_USD ask: " << getQuote(params).ask() << endl;
-  cout << "Current balance BTC: " << getAvail(params, "BTC") << endl;
-  cout << "Current balance BCH: " << getAvail(params, "BCH") << endl;
-  cout << "Current balance ETH: " << getAvail(params, "ETH") << endl;
-  cout << "Current balance LTC: " << getAvail(params, "LTC") << endl;
-  cout << "Current balance DASH: " << getAvail(params, "DASH") << endl;
-  cout << "Current balance ZEC: " << getAvail(params, "ZEC") << endl;
-  cout << "Current balance USD: " << getAvail(params, "USD") << endl;
-  cout << "Current balance EUR: " << getAvail(params, "EUR") << endl;
-  cout << "Current balance GBP: " << getAvail(params, "GBP") << endl;
-  cout << "Current balance RUB: " << getAvail(params, "RUB") << endl;
-  cout << "Current balance GHS: " << getAvail(params, "GHS") << endl;
+  cout << "Current value BTC_USD bid: " << syncWait(getQuote(params)).bid() << endl;
+  cout << "Current value BTC_USD ask: " << syncWait(getQuote(params)).ask() << endl;
+  cout << "Current balance BTC: " << syncWait(getAvail(params, "BTC"))
+       << endl;
+  cout << "Current balance BCH: " << syncWait(getAvail(params, "BCH"))
+       << endl;
+  cout << "Current balance ETH: " << syncWait(getAvail(params, "ETH"))
+       << endl;
+  cout << "Current balance LTC: " << syncWait(getAvail(params, "LTC"))
+       << endl;
+  cout << "Current balance DASH: " << syncWait(getAvail(params, "DASH"))
+       << endl;
+  cout << "Current balance ZEC: " << syncWait(getAvail(params, "ZEC"))
+       << endl;
+  cout << "Current balance USD: " << syncWait(getAvail(params, "USD"))
+       << endl;
+  cout << "Current balance EUR: " << syncWait(getAvail(params, "EUR"))
+       << endl;
+  cout << "Current balance GBP: " << syncWait(getAvail(params, "GBP"))
+       << endl;
+  cout << "Current balance RUB: " << syncWait(getAvail(params, "RUB"))
+       << endl;
+  cout << "Current balance GHS: " << syncWait(getAvail(params, "GHS"))
+       << endl;
   cout << "Current bid limit price for 10 units: "
-       << getLimitPrice(params, 10.0, true) << endl;
+       << syncWait(getLimitPrice(params, 10.0, true)) << endl;
   cout << "Current ask limit price for 10 units: "
-       << getLimitPrice(params, 10.0, false) << endl;
+       << syncWait(getLimitPrice(params, 10.0, false)) << endl;
 
   // cout << "Sending buy order - TXID: " ;
   // orderId = sendLongOrder(params, "buy", 0.002, 9510);
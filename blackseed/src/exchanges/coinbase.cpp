@@ -1,10 +1,10 @@
 #include "coinbase.h"
-#include "openssl/hmac.h"
-#include "openssl/sha.h"
 #include "parameters.h"
 #include "unique_json.hpp"
 #include "utils/base64.h"
-#include "utils/gettime.hpp"
+#include "utils/clock.h"
+#include "utils/hmac_signer.h"
+#include "utils/latency.h"
 #include "utils/restapi.h"
 #include <array>
 #include <cmath>
@@ -16,11 +16,17 @@ namespace coinbase {
 
 static RestApi &queryHandle(Parameters &params) {
   static RestApi query("https://api.exchange.coinbase.com",
-                       params.cacert.c_str(), *params.logFile);
+                       params.cacert.c_str(), params.logFile);
   return query;
 }
 
-quote_t getQuote(Parameters &params) {
+static HmacSigner &signer(Parameters &params) {
+  static HmacSigner signer(EVP_sha256(), base64_decode(params.coinbaseSecret),
+                           &latency().histogram("CoinBasePro", "hmac", "sign"));
+  return signer;
+}
+
+task<quote_t> getQuote(Parameters &params) {
   auto &exchange = queryHandle(params);
   std::string pair;
   pair = "/products/";
@@ -31,7 +37,7 @@ quote_t getQuote(Parameters &params) {
   curl_slist *headerList = nullptr;
   headerList = curl_slist_append(headerList, "Content-Type: application/json");
   RestApi::unique_slist sheaderList(headerList);
-  unique_json root{exchange.getRequest(pair, std::move(sheaderList))};
+  unique_json root{co_await exchange.getAsync(pair, std::move(sheaderList))};
   const char *bid = nullptr;
   char const *ask = nullptr;
   int unpack_fail =
@@ -41,12 +47,15 @@ quote_t getQuote(Parameters &params) {
     ask = "0";
   }
   if (bid && ask)
-    return std::make_pair(std::stod(bid), std::stod(ask));
-  return std::make_pair(0.0, 0.0);
+    co_return std::make_pair(std::stod(bid), std::stod(ask));
+  co_return std::make_pair(0.0, 0.0);
 }
 
-double getAvail(Parameters &params, std::string const &currency) {
-  unique_json root{authRequest(params, "GET", "/accounts", "")};
+task<double> getAvail(Parameters &params, std::string currency) {
+  unique_json root{co_await authRequest(params, "GET", "/accounts", "")};
+  // An error reply is an object with a message
+  if (!json_is_array(root.get()))
+    co_return unknownBalance();
   size_t arraySize = json_array_size(root.get());
   double available = 0.0;
   const char *currstr;
@@ -64,86 +73,138 @@ double getAvail(Parameters &params, std::string const &currency) {
       }
     }
   }
-  return available;
+  co_return available;
 }
 
-double getActivePos(Parameters &params) {
+task<double> getActivePos(Parameters &params) {
   // TODO: this is not really a good way to get active positions
-  return getAvail(params, "BTC");
+  co_return co_await getAvail(params, "BTC");
 }
 
-double getLimitPrice(Parameters &params, double const volume,
-                     bool const isBid) {
+task<double> getLimitPrice(Parameters &params, double const volume,
+                           bool const isBid) {
   auto &exchange = queryHandle(params);
   // TODO: Build a real URL with leg1 leg2 and auth post it
   // FIXME: using level 2 order book - has aggregated data but should be
   // sufficient for now.
-  unique_json root{exchange.getRequest("/products/BTC-USD/book?level=2")};
+  unique_json root{co_await exchange.cachedGetAsync(
+      "/products/BTC-USD/book?level=2", params.orderBookTtl())};
   auto bidask = json_object_get(root.get(), isBid ? "bids" : "asks");
   *params.logFile << "<coinbase> Looking for a limit price to fill "
                   << std::setprecision(8) << fabs(volume) << " Legx...\n";
   double tmpVol = 0.0;
   double p = 0.0;
   double v;
-  int i = 0;
-  while (tmpVol < fabs(volume) * params.orderBookFactor) {
+  // An error reply has no book, 0.0 is returned
+  for (size_t i = 0; i < json_array_size(bidask) &&
+                     tmpVol < fabs(volume) * params.orderBookFactor;
+       ++i) {
     p = atof(json_string_value(json_array_get(json_array_get(bidask, i), 0)));
     v = atof(json_string_value(json_array_get(json_array_get(bidask, i), 1)));
-    *params.logFile << "<coinbase> order book: " << std::setprecision(8) << v
-                    << " @$" << std::setprecision(8) << p << std::endl;
+    params.log->log(LogLevel::debug, "<coinbase> order book: {.8} @${.8}",
+                    v, p);
     tmpVol += v;
-    i++;
   }
-  return p;
+  co_return p;
 }
 
-std::string sendLongOrder(Parameters &params, std::string const &direction,
-                          double const quantity, double const price) {
+task<std::string> sendLongOrder(Parameters &params, std::string direction,
+                                double const quantity, double const price,
+                                OrderType orderType) {
   if (direction.compare("buy") != 0 && direction.compare("sell") != 0) {
     *params.logFile << "<coinbase> Error: Neither \"buy\" nor \"sell\" selected"
                     << std::endl;
-    return "0";
+    co_return "0";
   }
-  *params.logFile << "<coinbase> Trying to send a \"" << direction
-                  << "\" limit order: " << std::setprecision(8) << quantity
+  *params.logFile << "<coinbase> Trying to send a \"" << direction << "\" "
+                  << orderTypeName(orderType)
+                  << " limit order: " << std::setprecision(8) << quantity
                   << " @ $" << std::setprecision(8) << price << "...\n";
   std::string pair = "BTC-USD";
   std::string type = direction;
+  // post_only only applies to good till canceled orders
+  const char *tif = orderType == OrderType::ioc   ? "IOC"
+                    : orderType == OrderType::fok ? "FOK"
+                                                  : "GTC";
   char buff[300];
   snprintf(buff, 300,
            "{\"size\":\"%.8f\",\"price\":\"%.8f\",\"side\":\"%s\",\"product_"
-           "id\": \"%s\"}",
-           quantity, price, type.c_str(), pair.c_str());
-  unique_json root{authRequest(params, "POST", "/orders", buff)};
-  auto txid = json_string_value(json_object_get(root.get(), "id"));
+           "id\": \"%s\",\"time_in_force\":\"%s\",\"post_only\":%s}",
+           quantity, price, type.c_str(), pair.c_str(), tif,
+           orderType == OrderType::postOnly ? "true" : "false");
+  unique_json root{co_await authRequest(params, "POST", "/orders", buff)};
+  auto id = json_string_value(json_object_get(root.get(), "id"));
+  // A rejected order, e.g. a post-only one that would have traded
+  std::string txid = id ? id : "0";
 
   *params.logFile << "<coinbase> Done (transaction ID: " << txid << ")\n"
                   << std::endl;
-  return txid;
+  co_return txid;
 }
 
-bool isOrderComplete(Parameters &params, std::string const &orderId) {
+task<bool> isOrderComplete(Parameters &params, std::string orderId) {
+  // The order alone is looked up, not the list of all the open ones
+  auto status = co_await getOrderStatus(params, orderId);
+  // A failed lookup is logged, and done again the next time
+  if (!status.known)
+    co_return false;
+  if (!status.open)
+    co_return true;
+  *params.logFile << "<coinbase> Order " << orderId << " still open"
+                  << std::endl;
+  co_return false;
+}
 
-  unique_json root{authRequest(params, "GET", "/orders", "")};
-  size_t arraySize = json_array_size(root.get());
-  bool complete = true;
-  const char *idstr;
-  for (size_t i = 0; i < arraySize; i++) {
-    std::string tmpId =
-        json_string_value(json_object_get(json_array_get(root.get(), i), "id"));
-    if (tmpId.compare(orderId.c_str()) == 0) {
-      idstr = json_string_value(
-          json_object_get(json_array_get(root.get(), i), "status"));
-      *params.logFile << "<coinbase> Order still open (Status:" << idstr << ")"
-                      << std::endl;
-      complete = false;
-    }
+task<OrderStatus> getOrderStatus(Parameters &params, std::string orderId) {
+  OrderStatus status;
+  // "0" for an order that could not be sent
+  if (orderId == "0") {
+    status.known = true;
+    co_return status;
+  }
+
+  unique_json root{
+      co_await authRequest(params, "GET", "/orders/" + orderId, "")};
+  auto state = json_string_value(json_object_get(root.get(), "status"));
+  if (!state) {
+    auto message = json_string_value(json_object_get(root.get(), "message"));
+    // A rejected order
+    status.known = message && std::string(message) == "NotFound";
+    *params.logFile << "<coinbase> Order " << orderId
+                    << (status.known ? " not found" : " unknown, ")
+                    << (status.known || !message ? "" : message) << std::endl;
+    co_return status;
   }
-  return complete;
+  status.known = true;
+  status.open = std::string(state) != "done";
+  auto size = json_string_value(json_object_get(root.get(), "filled_size"));
+  auto value =
+      json_string_value(json_object_get(root.get(), "executed_value"));
+  status.filled = size ? atof(size) : 0.0;
+  if (status.filled > 0.0 && value)
+    status.avgPrice = atof(value) / status.filled;
+  co_return status;
 }
 
-json_t *authRequest(Parameters &params, std::string const &method,
-                    std::string const &request, std::string const &options) {
+task<bool> cancelOrder(Parameters &params, std::string orderId) {
+  if (orderId == "0")
+    co_return false;
+  // The id of the canceled order, or a message
+  unique_json root{
+      co_await authRequest(params, "DELETE", "/orders/" + orderId, "")};
+  auto message = json_string_value(json_object_get(root.get(), "message"));
+  if (message) {
+    *params.logFile << "<coinbase> Order " << orderId
+                    << " not canceled: " << message << std::endl;
+    co_return false;
+  }
+  *params.logFile << "<coinbase> Order " << orderId << " canceled"
+                  << std::endl;
+  co_return true;
+}
+
+task<json_t *> authRequest(Parameters &params, std::string method,
+                           std::string request, std::string options) {
   // create timestamp
 
   // static uint64_t nonce = time(nullptr);
@@ -155,20 +216,9 @@ json_t *authRequest(Parameters &params, std::string const &method,
   // if (!options.empty())
   //  post_data += options;
 
-  // create decoded key
-
-  std::string decoded_key = base64_decode(params.coinbaseSecret);
-
   // Message Signature using HMAC-SHA256 of (NONCE+ METHOD??? + PATH + body)
-
-  uint8_t *hmac_digest =
-      HMAC(EVP_sha256(), decoded_key.c_str(), decoded_key.length(),
-           reinterpret_cast<const uint8_t *>(post_data.data()),
-           post_data.size(), NULL, NULL);
-
-  // encode the HMAC to base64
-  std::string api_sign_header =
-      base64_encode(hmac_digest, SHA256_DIGEST_LENGTH);
+  // with the decoded key, encoded to base64
+  std::string api_sign_header = signer(params).sign(post_data).base64();
 
   // cURL header
 
@@ -185,38 +235,28 @@ json_t *authRequest(Parameters &params, std::string const &method,
 
   // TODO: this sucks please do something better
   if (method.compare("GET") == 0) {
-    return exchange.getRequest(
+    co_return co_await exchange.getAsync(
         request, make_slist(std::begin(headers), std::end(headers)));
   } else if (method.compare("POST") == 0) {
-    return exchange.postRequest(
+    co_return co_await exchange.postAsync(
         request, make_slist(std::begin(headers), std::end(headers)), options);
+  } else if (method.compare("DELETE") == 0) {
+    co_return co_await exchange.deleteAsync(
+        request, make_slist(std::begin(headers), std::end(headers)));
   } else {
     std::cout << "Error With Auth method. Exiting with code 0" << std::endl;
     exit(0);
   }
 }
 
+// Seconds since the epoch with milliseconds, as CB-ACCESS-TIMESTAMP
 std::string gettime() {
-  timeval curTime;
-  time_t &tv_sec = *reinterpret_cast<time_t *>(&curTime.tv_sec);
-  cgettimeofday(&curTime, NULL);
-  int milli = curTime.tv_usec / 1000;
-  char buffer[80]{};
-  strftime(buffer, 80, "%Y-%m-%dT%H:%M:%S", gmtime(&tv_sec));
-  char time_buffer2[200]{};
-  snprintf(time_buffer2, 200, "%s.%d000Z", buffer, milli);
-  snprintf(time_buffer2, 200, "%sZ", buffer);
-
-  // return time_buffer2;
-
-  time_t result = time(NULL);
-  long long result2 = result;
-  char buff4[40]{};
-  snprintf(buff4, 40, "%lld", result2);
-
-  char buff5[40]{};
-  snprintf(buff5, 40, "%lld.%d000", result2, milli);
-  return buff5;
+  auto millis = Clock::wallNs() / 1000000;
+  char buffer[40]{};
+  snprintf(buffer, sizeof(buffer), "%lld.%03d000",
+           static_cast<long long>(millis / 1000),
+           static_cast<int>(millis % 1000));
+  return buffer;
 }
 
 void testcoinbase() {
@@ -1,9 +1,10 @@
 #include "exmo.h"
-#include "hex_str.hpp"
 #include "parameters.h"
 #include "unique_json.hpp"
 #include "utils/base64.h"
-#include "utils/hmac_sha512.hpp"
+#include "utils/hmac_signer.h"
+#include "utils/latency.h"
+#include "utils/nonce.h"
 #include "utils/restapi.h"
 
 #include <algorithm>
@@ -15,19 +16,26 @@
 
 namespace Exmo {
 // Forward declarations
-static json_t *authRequest(Parameters &, const char *URL_Request,
-                           std::string const &URL_Options = "");
+static task<json_t *> authRequest(Parameters &, std::string URL_Request,
+                                  std::string URL_Options = "");
 static std::string getSignature(Parameters &, std::string const &);
 
 static RestApi &queryHandle(Parameters &params) {
   static RestApi query("https://api.exmo.com/v1", params.cacert.c_str(),
-                       *params.logFile);
+                       params.logFile);
   return query;
 }
 
-quote_t getQuote(Parameters &params) {
+static HmacSigner &signer(Parameters &params) {
+  static HmacSigner signer(EVP_sha512(), params.exmoSecret,
+                           &latency().histogram("Exmo", "hmac", "sign"));
+  return signer;
+}
+
+task<quote_t> getQuote(Parameters &params) {
   auto &exchange = queryHandle(params);
-  auto root = unique_json(exchange.getRequest("/order_book/?pair=BTC_USDT"));
+  auto root = unique_json(co_await exchange.cachedGetAsync(
+      "/order_book/?pair=BTC_USDT", params.tickerTtl()));
 
   auto quote = json_string_value(
       json_object_get(json_object_get(root.get(), "BTC_USDT"), "bid_top"));
@@ -37,27 +45,29 @@ quote_t getQuote(Parameters &params) {
       json_object_get(json_object_get(root.get(), "BTC_USDT"), "ask_top"));
   auto askValue = quote ? std::stod(quote) : 0.0;
 
-  return std::make_pair(bidValue, askValue);
+  co_return std::make_pair(bidValue, askValue);
 }
 
-double getAvail(Parameters &params, std::string const &tempCurrency) {
+task<double> getAvail(Parameters &params, std::string tempCurrency) {
   double available = 0.0;
   std::string currency = tempCurrency;
   transform(currency.begin(), currency.end(), currency.begin(), ::toupper);
   const char *curr_ = currency.c_str();
 
-  unique_json root{authRequest(params, "/user_info")};
-  const char *avail_str = json_string_value(
-      json_object_get(json_object_get(root.get(), "balances"), curr_));
+  unique_json root{co_await authRequest(params, "/user_info")};
+  auto balances = json_object_get(root.get(), "balances");
+  if (!balances)
+    co_return unknownBalance();
+  const char *avail_str = json_string_value(json_object_get(balances, curr_));
   available = avail_str ? atof(avail_str) : 0.0;
-  return available;
+  co_return available;
 }
 
 // TODO multi currency support
 // std::string sendLongOrder(Parameters& params, std::string direction, double
 // quantity, double price, std::string pair) {
-std::string sendLongOrder(Parameters &params, std::string const &direction,
-                          double const quantity, double const price) {
+task<std::string> sendLongOrder(Parameters &params, std::string direction,
+                                double const quantity, double const price) {
   using namespace std;
   string pair = "btc_usd"; // TODO remove when multi currency support
   *params.logFile << "<Exmo> Trying to send a " << pair << " " << direction
@@ -70,7 +80,7 @@ std::string sendLongOrder(Parameters &params, std::string const &direction,
   options += "&price=" + to_string(price);
   options += "&type=" + direction;
 
-  unique_json root{authRequest(params, "/order_create", options)};
+  unique_json root{co_await authRequest(params, "/order_create", options)};
   string orderId =
       to_string(json_integer_value(json_object_get(root.get(), "order_id")));
   if (orderId == "0") {
@@ -80,54 +90,82 @@ std::string sendLongOrder(Parameters &params, std::string const &direction,
   } else {
     *params.logFile << "<Exmo> Done, order ID: " << orderId << endl;
   }
-  return orderId;
+  co_return orderId;
 }
 
 // TODO multi currency support
 // bool isOrderComplete(Parameters& params, std::string orderId, std::string
 // pair)
-bool isOrderComplete(Parameters &params, std::string const &orderId) {
-  using namespace std;
-  string pair = "btc_usd"; // TODO remove when multi currency support
-  transform(pair.begin(), pair.end(), pair.begin(), ::toupper);
-
-  unique_json rootOrd{authRequest(params, "/user_open_orders")};
+task<bool> isOrderComplete(Parameters &params, std::string orderId) {
+  auto status = co_await getOrderStatus(params, orderId);
+  co_return status.known && !status.open;
+}
 
-  int orders = json_array_size(json_object_get(rootOrd.get(), pair.c_str()));
-  string order_id;
+task<OrderStatus> getOrderStatus(Parameters &params, std::string orderId) {
+  using namespace std;
+  OrderStatus status;
+  // "0" for an order that could not be sent
+  if (orderId == "0") {
+    status.known = true;
+    co_return status;
+  }
 
-  for (int i = 0; i < orders; i++) {
-    order_id = json_string_value(json_object_get(
-        json_array_get(json_object_get(rootOrd.get(), pair.c_str()), i),
-        "order_id"));
-    if (orderId.compare(order_id) == 0)
-      return false;
+  // Exmo tells whether an order is open only in the list of open orders
+  unique_json rootOrd{co_await authRequest(params, "/user_open_orders")};
+  if (!json_is_object(rootOrd.get()) ||
+      json_object_get(rootOrd.get(), "error")) {
+    *params.logFile << "<Exmo> Open orders unknown" << endl;
+    co_return status;
+  }
+  auto orders = json_object_get(rootOrd.get(), "BTC_USD");
+  for (size_t i = 0; i < json_array_size(orders); ++i) {
+    auto id = json_string_value(
+        json_object_get(json_array_get(orders, i), "order_id"));
+    if (id && orderId == id)
+      status.open = true;
   }
 
-  string options;
-  options = "pair=" + pair;
-  options += "&limit=1";
-
-  unique_json rootTr{authRequest(params, "/user_trades", options)};
-  order_id = to_string(json_integer_value(json_object_get(
-      json_array_get(json_object_get(rootTr.get(), pair.c_str()), 0),
-      "order_id")));
-  if (orderId.compare(order_id) == 0)
-    return true;
-  else {
-    auto dump = json_dumps(rootTr.get(), 0);
-    *params.logFile << "<Exmo> Failed, Server Return Message: " << dump << endl;
-    free(dump);
-    return false;
+  // "Error 50304: Order was not found" without any trade
+  unique_json rootTr{
+      co_await authRequest(params, "/order_trades", "order_id=" + orderId)};
+  auto trades = json_object_get(rootTr.get(), "trades");
+  auto error = json_string_value(json_object_get(rootTr.get(), "error"));
+  if (!trades && !(error && string(error).find("50304") != string::npos)) {
+    *params.logFile << "<Exmo> Trades of order " << orderId << " unknown, "
+                    << (error ? error : "no trades") << endl;
+    co_return status;
+  }
+  status.known = true;
+  double value = 0.0;
+  for (size_t i = 0; i < json_array_size(trades); ++i) {
+    auto trade = json_array_get(trades, i);
+    auto quantity = json_string_value(json_object_get(trade, "quantity"));
+    auto amount = json_string_value(json_object_get(trade, "amount"));
+    status.filled += quantity ? atof(quantity) : 0.0;
+    value += amount ? atof(amount) : 0.0;
   }
+  if (status.filled > 0.0)
+    status.avgPrice = value / status.filled;
+  co_return status;
 }
 
-double getActivePos(Parameters &params) { return getAvail(params, "btc"); }
+task<bool> cancelOrder(Parameters &params, std::string orderId) {
+  if (orderId == "0")
+    co_return false;
+  unique_json root{
+      co_await authRequest(params, "/order_cancel", "order_id=" + orderId)};
+  co_return json_is_true(json_object_get(root.get(), "result"));
+}
+
+task<double> getActivePos(Parameters &params) {
+  co_return co_await getAvail(params, "btc");
+}
 
-double getLimitPrice(Parameters &params, double const volume,
-                     bool const isBid) {
+task<double> getLimitPrice(Parameters &params, double const volume,
+                           bool const isBid) {
   auto &exchange = queryHandle(params);
-  auto root = unique_json(exchange.getRequest("/order_book?pair=BTC_USD"));
+  auto root = unique_json(co_await exchange.cachedGetAsync(
+      "/order_book?pair=BTC_USD", params.orderBookTtl()));
   auto branch = json_object_get(json_object_get(root.get(), "BTC_USD"),
                                 isBid ? "bid" : "ask");
 
@@ -149,14 +187,16 @@ double getLimitPrice(Parameters &params, double const volume,
     }
   }
 
-  return currPrice;
+  co_return currPrice;
 }
 
-json_t *authRequest(Parameters &params, const char *request,
-                    std::string const &options) {
+task<json_t *> authRequest(Parameters &params, std::string request,
+                           std::string options) {
   using namespace std;
-  static unsigned long nonce = time(nullptr);
-  nonce++;
+  // Held until the request is sent
+  auto sending =
+      co_await NonceLock::async("Exmo:" + params.exmoApi, time(nullptr));
+  auto nonce = sending.nonce();
 
   string req = request;
   req += "?nonce=" + to_string(nonce);
@@ -175,20 +215,19 @@ json_t *authRequest(Parameters &params, const char *request,
 
   // cURL request
   auto &exchange = queryHandle(params);
-  auto ret =
-      exchange.postRequest(req, make_slist(begin(headers), end(headers)));
+  auto ret = co_await exchange.postAsync(
+      req, make_slist(begin(headers), end(headers)), "");
   // debug
   // auto dump = json_dumps(ret, 0);
   //*params.logFile << "<Exmo> Debug, Server Return Message: " << dump <<
   // std::endl << std::endl; free(dump);
 
-  return ret;
+  co_return ret;
 }
 
 std::string getSignature(Parameters &params, std::string const &msg) {
 
-  HMAC_SHA512 hmac_sha512(params.exmoSecret.c_str(), msg);
-  return hmac_sha512.hex_digest();
+  return signer(params).sign(msg).hex();
 }
 
 void testExmo() {
@@ -202,16 +241,20 @@ void testExmo() {
 
   string orderId;
 
-  cout << "Current value BTC_USD bid: " << getQuote(params).bid() << endl;
-  cout << "Current value BTC_USD ask: " << getQuote(params).ask() << endl;
-  cout << "Current balance BTC: " << getAvail(params, "btc") << endl;
-  cout << "Current balance USD: " << getAvail(params, "usd") << endl;
-  cout << "Current balance XMR: " << getAvail(params, "xmr") << endl;
-  cout << "Current balance EUR: " << getAvail(params, "eur") << endl;
+  cout << "Current value BTC_USD bid: " << syncWait(getQuote(params)).bid() << endl;
+  cout << "Current value BTC_USD ask: " << syncWait(getQuote(params)).ask() << endl;
+  cout << "Current balance BTC: " << syncWait(getAvail(params, "btc"))
+       << endl;
+  cout << "Current balance USD: " << syncWait(getAvail(params, "usd"))
+       << endl;
+  cout << "Current balance XMR: " << syncWait(getAvail(params, "xmr"))
+       << endl;
+  cout << "Current balance EUR: " << syncWait(getAvail(params, "eur"))
+       << endl;
   cout << "Current bid limit price for 10 units: "
-       << getLimitPrice(params, 10.0, true) << endl;
+       << syncWait(getLimitPrice(params, 10.0, true)) << endl;
   cout << "Current ask limit price for 10 units: "
-       << getLimitPrice(params, 10.0, false) << endl;
+       << syncWait(getLimitPrice(params, 10.0, false)) << endl;
 
   // cout << "Sending buy order - TXID: " ;
   // orderId = sendLongOrder(params, "buy", 0.005, 1000);
@@ -226,8 +269,8 @@ void testExmo() {
   //}
   // else {
   //  cout << orderId << endl;
-  cout << "Sell order is complete: " << isOrderComplete(params, "404591373")
-       << endl;
+  cout << "Sell order is complete: "
+       << syncWait(isOrderComplete(params, "404591373")) << endl;
   //}
 }
 
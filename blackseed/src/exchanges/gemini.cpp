@@ -1,33 +1,40 @@
 #include "gemini.h"
-#include "curl_fun.h"
 #include "parameters.h"
 #include "unique_json.hpp"
 #include "utils/base64.h"
+#include "utils/hmac_signer.h"
+#include "utils/latency.h"
+#include "utils/nonce.h"
 #include "utils/restapi.h"
 
-#include "openssl/hmac.h"
-#include "openssl/sha.h"
+#include <array>
 #include <chrono>
 #include <cmath>
 #include <ctime>
 #include <iomanip>
 #include <sstream>
-#include <thread>
 
 namespace Gemini {
 
 static RestApi &queryHandle(Parameters &params) {
   static RestApi query("https://api.gemini.com", params.cacert.c_str(),
-                       *params.logFile);
+                       params.logFile);
   return query;
 }
 
-quote_t getQuote(Parameters &params) {
+static HmacSigner &signer(Parameters &params) {
+  static HmacSigner signer(EVP_sha384(), params.geminiSecret,
+                           &latency().histogram("Gemini", "hmac", "sign"));
+  return signer;
+}
+
+task<quote_t> getQuote(Parameters &params) {
   auto &exchange = queryHandle(params);
   std::string url;
   url = "/v1/book/BTCUSD";
 
-  unique_json root{exchange.getRequest(url)};
+  unique_json root{
+      co_await exchange.cachedGetAsync(url, params.tickerTtl())};
   const char *quote = json_string_value(json_object_get(
       json_array_get(json_object_get(root.get(), "bids"), 0), "price"));
   auto bidValue = quote ? std::stod(quote) : 0.0;
@@ -36,21 +43,20 @@ quote_t getQuote(Parameters &params) {
       json_array_get(json_object_get(root.get(), "asks"), 0), "price"));
   auto askValue = quote ? std::stod(quote) : 0.0;
 
-  return std::make_pair(bidValue, askValue);
+  co_return std::make_pair(bidValue, askValue);
 }
 
-double getAvail(Parameters &params, std::string const &currency) {
-  unique_json root{authRequest(params, "https://api.gemini.com/v1/balances",
-                               "balances", "")};
-  while (json_object_get(root.get(), "message") != NULL) {
-    std::this_thread::sleep_for(std::chrono::seconds(1));
+task<double> getAvail(Parameters &params, std::string currency) {
+  unique_json root{co_await authRequest(params, "balances", "")};
+  // An error reply, the ledger reads the balances again later
+  if (json_object_get(root.get(), "message") != NULL) {
     auto dump = json_dumps(root.get(), 0);
-    *params.logFile << "<Gemini> Error with JSON: " << dump << ". Retrying..."
-                    << std::endl;
+    *params.logFile << "<Gemini> Error with JSON: " << dump << std::endl;
     free(dump);
-    root.reset(authRequest(params, "https://api.gemini.com/v1/balances",
-                           "balances", ""));
+    co_return unknownBalance();
   }
+  if (!json_is_array(root.get()))
+    co_return unknownBalance();
   // go through the list
   size_t arraySize = json_array_size(root.get());
   double availability = 0.0;
@@ -76,11 +82,11 @@ double getAvail(Parameters &params, std::string const &currency) {
     }
   }
 
-  return availability;
+  co_return availability;
 }
 
-std::string sendLongOrder(Parameters &params, std::string const &direction,
-                          double const quantity, double const price) {
+task<std::string> sendLongOrder(Parameters &params, std::string direction,
+                                double quantity, double price) {
   *params.logFile << "<Gemini> Trying to send a \"" << direction
                   << "\" limit order: " << std::setprecision(6) << quantity
                   << "@$" << std::setprecision(2) << price << "...\n";
@@ -89,31 +95,71 @@ std::string sendLongOrder(Parameters &params, std::string const &direction,
       << "\", \"price\":\"" << price << "\", \"side\":\"" << direction
       << "\", \"type\":\"exchange limit\"";
   std::string options = oss.str();
-  unique_json root{authRequest(params, "https://api.gemini.com/v1/order/new",
-                               "order/new", options)};
+  unique_json root{co_await authRequest(params, "order/new", options)};
   std::string orderId =
       json_string_value(json_object_get(root.get(), "order_id"));
   *params.logFile << "<Gemini> Done (order ID: " << orderId << ")\n"
                   << std::endl;
-  return orderId;
+  co_return orderId;
+}
+
+task<bool> isOrderComplete(Parameters &params, std::string orderId) {
+  if (orderId == "0")
+    co_return true;
+
+  auto options = "\"order_id\":" + orderId;
+  unique_json root{co_await authRequest(params, "order/status", options)};
+  co_return json_is_false(json_object_get(root.get(), "is_live"));
+}
+
+task<OrderStatus> getOrderStatus(Parameters &params, std::string orderId) {
+  OrderStatus status;
+  // "0" for an order that could not be sent
+  if (orderId == "0") {
+    status.known = true;
+    co_return status;
+  }
+
+  auto options = "\"order_id\":" + orderId;
+  unique_json root{co_await authRequest(params, "order/status", options)};
+  auto live = json_object_get(root.get(), "is_live");
+  if (!live) {
+    auto reason = json_string_value(json_object_get(root.get(), "reason"));
+    status.known = reason && std::string(reason) == "OrderNotFound";
+    *params.logFile << "<Gemini> Order " << orderId
+                    << (status.known ? " not found" : " unknown, ")
+                    << (status.known || !reason ? "" : reason) << std::endl;
+    co_return status;
+  }
+  status.known = true;
+  auto executed =
+      json_string_value(json_object_get(root.get(), "executed_amount"));
+  auto average =
+      json_string_value(json_object_get(root.get(), "avg_execution_price"));
+  status.open = json_is_true(live);
+  status.filled = executed ? atof(executed) : 0.0;
+  status.avgPrice = average ? atof(average) : 0.0;
+  co_return status;
 }
 
-bool isOrderComplete(Parameters &params, std::string const &orderId) {
+task<bool> cancelOrder(Parameters &params, std::string orderId) {
   if (orderId == "0")
-    return true;
+    co_return false;
 
   auto options = "\"order_id\":" + orderId;
-  unique_json root{authRequest(params, "https://api.gemini.com/v1/order/status",
-                               "order/status", options)};
-  return json_is_false(json_object_get(root.get(), "is_live"));
+  unique_json root{co_await authRequest(params, "order/cancel", options)};
+  co_return json_is_true(json_object_get(root.get(), "is_cancelled"));
 }
 
-double getActivePos(Parameters &params) { return getAvail(params, "btc"); }
+task<double> getActivePos(Parameters &params) {
+  co_return co_await getAvail(params, "btc");
+}
 
-double getLimitPrice(Parameters &params, double const volume,
-                     bool const isBid) {
+task<double> getLimitPrice(Parameters &params, double const volume,
+                           bool const isBid) {
   auto &exchange = queryHandle(params);
-  unique_json root{exchange.getRequest("/v1/book/btcusd")};
+  unique_json root{co_await exchange.cachedGetAsync("/v1/book/btcusd",
+                                                    params.orderBookTtl())};
   auto bidask = json_object_get(root.get(), isBid ? "bids" : "asks");
 
   // loop on volume
@@ -128,19 +174,21 @@ double getLimitPrice(Parameters &params, double const volume,
         json_string_value(json_object_get(json_array_get(bidask, i), "price")));
     v = atof(json_string_value(
         json_object_get(json_array_get(bidask, i), "amount")));
-    *params.logFile << "<Gemini> order book: " << std::setprecision(6) << v
-                    << "@$" << std::setprecision(2) << p << std::endl;
+    params.log->log(LogLevel::debug, "<Gemini> order book: {.6}@${.2}",
+                    v, p);
     tmpVol += v;
     i++;
   }
 
-  return p;
+  co_return p;
 }
 
-json_t *authRequest(Parameters &params, std::string const &url,
-                    std::string const &request, std::string const &options) {
-  static uint64_t nonce = time(nullptr) * 4;
-  ++nonce;
+task<json_t *> authRequest(Parameters &params, std::string request,
+                           std::string options) {
+  // Held until the request is sent
+  auto sending = co_await NonceLock::async("Gemini:" + params.geminiApi,
+                                           time(nullptr) * 4);
+  auto nonce = sending.nonce();
   // check if options parameter is empty
   std::ostringstream oss;
   if (options.empty()) {
@@ -153,77 +201,14 @@ json_t *authRequest(Parameters &params, std::string const &url,
   std::string tmpPayload =
       base64_encode(reinterpret_cast<const unsigned char *>(oss.str().c_str()),
                     oss.str().length());
-  oss.clear();
-  oss.str("");
-  oss << "X-GEMINI-PAYLOAD:" << tmpPayload;
-  std::string payload;
-  payload = oss.str();
-  oss.clear();
-  oss.str("");
   // build the signature
-  uint8_t *digest = HMAC(
-      EVP_sha384(), params.geminiSecret.c_str(), params.geminiSecret.size(),
-      (uint8_t *)tmpPayload.c_str(), tmpPayload.size(), NULL, NULL);
-  char mdString[SHA384_DIGEST_LENGTH + 100]; // FIXME +100
-  for (int i = 0; i < SHA384_DIGEST_LENGTH; ++i) {
-    sprintf(&mdString[i * 2], "%02x", (unsigned int)digest[i]);
-  }
-  oss.clear();
-  oss.str("");
-  oss << "X-GEMINI-SIGNATURE:" << mdString;
-  struct curl_slist *headers = NULL;
-  std::string api = "X-GEMINI-APIKEY:" + std::string(params.geminiApi);
-  headers = curl_slist_append(headers, api.c_str());
-  headers = curl_slist_append(headers, payload.c_str());
-  headers = curl_slist_append(headers, oss.str().c_str());
-  CURLcode resCurl;
-  if (params.curl) {
-    std::string readBuffer;
-    curl_easy_setopt(params.curl, CURLOPT_POST, 1L);
-    curl_easy_setopt(params.curl, CURLOPT_HTTPHEADER, headers);
-    curl_easy_setopt(params.curl, CURLOPT_POSTFIELDS, "");
-    curl_easy_setopt(params.curl, CURLOPT_SSL_VERIFYPEER, 0L);
-    curl_easy_setopt(params.curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-    curl_easy_setopt(params.curl, CURLOPT_WRITEDATA, &readBuffer);
-    curl_easy_setopt(params.curl, CURLOPT_URL, url.c_str());
-    curl_easy_setopt(params.curl, CURLOPT_CONNECTTIMEOUT, 10L);
-    resCurl = curl_easy_perform(params.curl);
-    json_t *root;
-    json_error_t error;
-
-    while (resCurl != CURLE_OK) {
-      *params.logFile << "<Gemini> Error with cURL. Retry in 2 sec..."
-                      << std::endl;
-      std::this_thread::sleep_for(std::chrono::seconds(2));
-      readBuffer = "";
-      resCurl = curl_easy_perform(params.curl);
-    }
-    root = json_loads(readBuffer.c_str(), 0, &error);
-    while (!root) {
-      *params.logFile << "<Gemini> Error with JSON:\n"
-                      << error.text << std::endl;
-      *params.logFile << "<Gemini> Buffer:\n"
-                      << readBuffer.c_str() << std::endl;
-      *params.logFile << "<Gemini> Retrying..." << std::endl;
-      std::this_thread::sleep_for(std::chrono::seconds(2));
-      readBuffer = "";
-      resCurl = curl_easy_perform(params.curl);
-      while (resCurl != CURLE_OK) {
-        *params.logFile << "<Gemini> Error with cURL. Retry in 2 sec..."
-                        << std::endl;
-        std::this_thread::sleep_for(std::chrono::seconds(2));
-        readBuffer = "";
-        resCurl = curl_easy_perform(params.curl);
-      }
-      root = json_loads(readBuffer.c_str(), 0, &error);
-    }
-    curl_slist_free_all(headers);
-    curl_easy_reset(params.curl);
-    return root;
-  } else {
-    *params.logFile << "<Gemini> Error with cURL init." << std::endl;
-    return NULL;
-  }
+  std::array<std::string, 3> headers = {
+      "X-GEMINI-APIKEY:" + params.geminiApi,
+      "X-GEMINI-PAYLOAD:" + tmpPayload,
+      "X-GEMINI-SIGNATURE:" + signer(params).sign(tmpPayload).hex()};
+  co_return co_await queryHandle(params).postAsync(
+      "/v1/" + request, make_slist(std::begin(headers), std::end(headers)),
+      "");
 }
 
 } // namespace Gemini
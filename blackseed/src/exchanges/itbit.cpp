@@ -10,14 +10,15 @@ namespace ItBit {
 static RestApi& queryHandle(Parameters &params)
 {
   static RestApi query ("https://api.itbit.com",
-                        params.cacert.c_str(), *params.logFile);
+                        params.cacert.c_str(), params.logFile);
   return query;
 }
 
-quote_t getQuote(Parameters &params)
+task<quote_t> getQuote(Parameters &params)
 {
   auto &exchange = queryHandle(params);
-  unique_json root { exchange.getRequest("/v1/markets/XBTUSD/ticker") };
+  unique_json root { co_await exchange.cachedGetAsync(
+      "/v1/markets/XBTUSD/ticker", params.tickerTtl()) };
 
   const char *quote = json_string_value(json_object_get(root.get(), "bid"));
   auto bidValue = quote ? std::stod(quote) : 0.0;
@@ -25,7 +26,7 @@ quote_t getQuote(Parameters &params)
   quote = json_string_value(json_object_get(root.get(), "ask"));
   auto askValue = quote ? std::stod(quote) : 0.0;
 
-  return std::make_pair(bidValue, askValue);
+  co_return std::make_pair(bidValue, askValue);
 }
 
 double getAvail(Parameters& params, std::string const& currency) {
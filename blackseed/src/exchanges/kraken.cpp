@@ -2,9 +2,12 @@
 #include "parameters.h"
 #include "unique_json.hpp"
 #include "utils/base64.h"
+#include "utils/hmac_signer.h"
+#include "utils/latency.h"
+#include "utils/nonce.h"
 #include "utils/restapi.h"
+#include "utils/ticker_snapshot.h"
 
-#include "openssl/hmac.h"
 #include "openssl/sha.h"
 #include <array>
 #include <ctime>
@@ -13,45 +16,49 @@
 
 namespace Kraken {
 
-// Initialise internal variables
-static unique_json krakenTicker = nullptr;
-static bool krakenGotTicker = false;
-
 static RestApi &queryHandle(Parameters &params) {
   static RestApi query("https://api.kraken.com", params.cacert.c_str(),
-                       *params.logFile);
+                       params.logFile);
   return query;
 }
 
-quote_t getQuote(Parameters &params) {
-  if (krakenGotTicker) {
-    krakenGotTicker = false;
-  } else {
-    auto &exchange = queryHandle(params);
-    krakenTicker.reset(exchange.getRequest("/0/public/Ticker?pair=XXBTZUSD"));
-    krakenGotTicker = true;
+static HmacSigner &signer(Parameters &params) {
+  static HmacSigner signer(EVP_sha512(), base64_decode(params.krakenSecret),
+                           &latency().histogram("Kraken", "hmac", "sign"));
+  return signer;
+}
+
+// "b" and "a" hold [price, whole lot volume, lot volume]
+static void parseTickers(json_t *root, std::map<std::string, quote_t> &quotes) {
+  const char *pair;
+  json_t *ticker;
+  json_object_foreach(json_object_get(root, "result"), pair, ticker) {
+    auto bid = json_string_value(json_array_get(json_object_get(ticker, "b"), 0));
+    auto ask = json_string_value(json_array_get(json_object_get(ticker, "a"), 0));
+    quotes.emplace(pair, quote_t(bid ? std::stod(bid) : 0.0,
+                                 ask ? std::stod(ask) : 0.0));
   }
-  json_t *root = krakenTicker.get();
-  const char *quote = json_string_value(json_array_get(
-      json_object_get(
-          json_object_get(json_object_get(root, "result"), "XXBTZUSD"), "b"),
-      0));
-  auto bidValue = quote ? std::stod(quote) : 0.0;
+}
 
-  quote = json_string_value(json_array_get(
-      json_object_get(
-          json_object_get(json_object_get(root, "result"), "XXBTZUSD"), "a"),
-      0));
-  auto askValue = quote ? std::stod(quote) : 0.0;
+// Without a 'pair' argument the ticker covers every tradable pair
+static TickerSnapshot &tickers(Parameters &params) {
+  static TickerSnapshot tickers(queryHandle(params), "/0/public/Ticker",
+                                parseTickers, params.tickerTtl());
+  return tickers;
+}
 
-  return std::make_pair(bidValue, askValue);
+task<quote_t> getQuote(Parameters &params) {
+  co_return co_await tickers(params).quoteAsync("XXBTZUSD");
 }
 
-double getAvail(Parameters &params, std::string const &currency) {
-  unique_json root{authRequest(params, "/0/private/Balance")};
+task<double> getAvail(Parameters &params, std::string currency) {
+  unique_json root{co_await authRequest(params, "/0/private/Balance")};
   json_t *result = json_object_get(root.get(), "result");
+  // An error reply has no result
+  if (!json_is_object(result))
+    co_return unknownBalance();
   if (json_object_size(result) == 0) {
-    return 0.0;
+    co_return 0.0;
   }
   double available = 0.0;
   if (currency.compare("usd") == 0) {
@@ -63,23 +70,35 @@ double getAvail(Parameters &params, std::string const &currency) {
   } else {
     *params.logFile << "<Kraken> Currency not supported" << std::endl;
   }
-  return available;
+  co_return available;
+}
+
+// Kraken has no fill-or-kill order
+static std::string orderFlags(OrderType type) {
+  if (type == OrderType::ioc)
+    return "&timeinforce=IOC";
+  if (type == OrderType::postOnly)
+    return "&oflags=post";
+  return "";
 }
 
-std::string sendLongOrder(Parameters &params, std::string const &direction,
-                          double const quantity, double const price) {
-  return sendOrder(params, direction, quantity, price);
+task<std::string> sendLongOrder(Parameters &params, std::string direction,
+                                double const quantity, double const price,
+                                OrderType type) {
+  co_return co_await sendOrder(params, direction, quantity, price, type);
 }
 
-std::string sendOrder(Parameters &params, std::string const &direction,
-                      double const quantity, double const price) {
+task<std::string> sendOrder(Parameters &params, std::string direction,
+                            double const quantity, double const price,
+                            OrderType orderType) {
   if (direction.compare("buy") != 0 && direction.compare("sell") != 0) {
     *params.logFile << "<Kraken> Error: Neither \"buy\" nor \"sell\" selected"
                     << std::endl;
-    return "0";
+    co_return "0";
   }
-  *params.logFile << "<Kraken> Trying to send a \"" << direction
-                  << "\" limit order: " << std::setprecision(6) << quantity
+  *params.logFile << "<Kraken> Trying to send a \"" << direction << "\" "
+                  << orderTypeName(orderType)
+                  << " limit order: " << std::setprecision(6) << quantity
                   << " @ $" << std::setprecision(2) << price << "...\n";
   std::string pair = "XXBTZUSD";
   std::string type = direction;
@@ -88,8 +107,10 @@ std::string sendOrder(Parameters &params, std::string const &direction,
   std::string volume = std::to_string(quantity);
   std::string options = "pair=" + pair + "&type=" + type +
                         "&ordertype=" + ordertype + "&price=" + pricelimit +
-                        "&volume=" + volume + "&trading_agreement=agree";
-  unique_json root{authRequest(params, "/0/private/AddOrder", options)};
+                        "&volume=" + volume + orderFlags(orderType) +
+                        "&trading_agreement=agree";
+  unique_json root{
+      co_await authRequest(params, "/0/private/AddOrder", options)};
   json_t *res = json_object_get(root.get(), "result");
   if (json_is_object(res) == 0) {
     *params.logFile << json_dumps(root.get(), 0) << std::endl;
@@ -99,18 +120,20 @@ std::string sendOrder(Parameters &params, std::string const &direction,
       json_string_value(json_array_get(json_object_get(res, "txid"), 0));
   *params.logFile << "<Kraken> Done (transaction ID: " << txid << ")\n"
                   << std::endl;
-  return txid;
+  co_return txid;
 }
 
-std::string sendShortOrder(Parameters &params, std::string const &direction,
-                           double const quantity, double const price) {
+task<std::string> sendShortOrder(Parameters &params, std::string direction,
+                                 double const quantity, double const price,
+                                 OrderType orderType) {
   if (direction.compare("buy") != 0 && direction.compare("sell") != 0) {
     *params.logFile << "<Kraken> Error: Neither \"buy\" nor \"sell\" selected"
                     << std::endl;
-    return "0";
+    co_return "0";
   }
   *params.logFile << "<Kraken> Trying to send a short \"" << direction
-                  << "\" limit order: " << std::setprecision(6) << quantity
+                  << "\" " << orderTypeName(orderType)
+                  << " limit order: " << std::setprecision(6) << quantity
                   << " @ $" << std::setprecision(2) << price << "...\n";
   std::string pair = "XXBTZUSD";
   std::string type = direction;
@@ -122,8 +145,10 @@ std::string sendShortOrder(Parameters &params, std::string const &direction,
   ordertype = "limit";
   options = "pair=" + pair + "&type=" + type + "&ordertype=" + ordertype +
             "&price=" + pricelimit + "&volume=" + volume +
-            "&leverage=" + leverage + "&trading_agreement=agree";
-  unique_json root{authRequest(params, "/0/private/AddOrder", options)};
+            "&leverage=" + leverage + orderFlags(orderType) +
+            "&trading_agreement=agree";
+  unique_json root{
+      co_await authRequest(params, "/0/private/AddOrder", options)};
   json_t *res = json_object_get(root.get(), "result");
   if (json_is_object(res) == 0) {
     *params.logFile << json_dumps(root.get(), 0) << std::endl;
@@ -133,37 +158,79 @@ std::string sendShortOrder(Parameters &params, std::string const &direction,
       json_string_value(json_array_get(json_object_get(res, "txid"), 0));
   *params.logFile << "<Kraken> Done (transaction ID: " << txid << ")\n"
                   << std::endl;
-  return txid;
+  co_return txid;
+}
+
+task<bool> isOrderComplete(Parameters &params, std::string orderId) {
+  // The order alone is looked up, not the list of all the open ones
+  auto status = co_await getOrderStatus(params, orderId);
+  // A failed lookup is logged, and done again the next time
+  if (!status.known)
+    co_return false;
+  if (!status.open)
+    co_return true;
+  *params.logFile << "<Kraken> Order " << orderId << " still open" << std::endl;
+  co_return false;
 }
 
-bool isOrderComplete(Parameters &params, std::string const & orderId) {
-  unique_json root{authRequest(params, "/0/private/OpenOrders")};
-  // no open order: return true
-  auto res = json_object_get(json_object_get(root.get(), "result"), "open");
-  if (json_object_size(res) == 0) {
-    *params.logFile << "<Kraken> No order exists" << std::endl;
-    return true;
+task<OrderStatus> getOrderStatus(Parameters &params, std::string orderId) {
+  OrderStatus status;
+  // "0" for an order that could not be sent
+  if (orderId == "0") {
+    status.known = true;
+    co_return status;
   }
-  res = json_object_get(res, orderId.c_str());
-  // open orders exist but specific order not found: return true
-  if (json_object_size(res) == 0) {
-    *params.logFile << "<Kraken> Order " << orderId << " does not exist"
-                    << std::endl;
-    return true;
-    // open orders exist and specific order was found: return false
-  } else {
-    *params.logFile << "<Kraken> Order " << orderId << " still exists!"
-                    << std::endl;
-    return false;
+
+  unique_json root{co_await authRequest(params, "/0/private/QueryOrders",
+                                        "txid=" + orderId)};
+  auto order = json_object_get(json_object_get(root.get(), "result"),
+                               orderId.c_str());
+  auto state = json_string_value(json_object_get(order, "status"));
+  if (!state) {
+    auto error = json_string_value(
+        json_array_get(json_object_get(root.get(), "error"), 0));
+    std::string reason = error ? error : "";
+    // A rejected order
+    status.known = reason.size() > 13 &&
+                   (reason.compare(reason.size() - 13, 13, "Invalid order") ==
+                        0 ||
+                    reason.compare(reason.size() - 13, 13, "Unknown order") ==
+                        0);
+    *params.logFile << "<Kraken> Order " << orderId
+                    << (status.known ? " does not exist" : " unknown, ")
+                    << (status.known ? "" : reason) << std::endl;
+    co_return status;
   }
+  status.known = true;
+  status.open = std::string(state) == "pending" || std::string(state) == "open";
+  auto executed = json_string_value(json_object_get(order, "vol_exec"));
+  auto average = json_string_value(json_object_get(order, "price"));
+  status.filled = executed ? atof(executed) : 0.0;
+  status.avgPrice = average ? atof(average) : 0.0;
+  co_return status;
+}
+
+task<bool> cancelOrder(Parameters &params, std::string orderId) {
+  if (orderId == "0")
+    co_return false;
+  unique_json root{co_await authRequest(params, "/0/private/CancelOrder",
+                                        "txid=" + orderId)};
+  auto count = json_integer_value(
+      json_object_get(json_object_get(root.get(), "result"), "count"));
+  *params.logFile << "<Kraken> Order " << orderId
+                  << (count > 0 ? " canceled" : " not canceled") << std::endl;
+  co_return count > 0;
 }
 
-double getActivePos(Parameters &params) { return getAvail(params, "btc"); }
+task<double> getActivePos(Parameters &params) {
+  co_return co_await getAvail(params, "btc");
+}
 
-double getLimitPrice(Parameters &params, double const volume,
-                     bool const isBid) {
+task<double> getLimitPrice(Parameters &params, double const volume,
+                           bool const isBid) {
   auto &exchange = queryHandle(params);
-  unique_json root{exchange.getRequest("/0/public/Depth?pair=XXBTZUSD")};
+  unique_json root{co_await exchange.cachedGetAsync(
+      "/0/public/Depth?pair=XXBTZUSD", params.orderBookTtl())};
   auto branch =
       json_object_get(json_object_get(root.get(), "result"), "XXBTZUSD");
   branch = json_object_get(branch, isBid ? "bids" : "asks");
@@ -185,33 +252,31 @@ double getLimitPrice(Parameters &params, double const volume,
       break;
   }
 
-  return currPrice;
+  co_return currPrice;
 }
 
-json_t *authRequest(Parameters &params, std::string const &request,
-                    std::string const &options) {
+task<json_t *> authRequest(Parameters &params, std::string request,
+                           std::string options) {
   // create nonce and POST data
-  static uint64_t nonce = time(nullptr) * 4;
-  std::string post_data = "nonce=" + std::to_string(++nonce);
+  // Held until the request is sent
+  auto sending = co_await NonceLock::async("Kraken:" + params.krakenApi,
+                                           time(nullptr) * 4);
+  auto nonce = sending.nonce();
+  std::string post_data = "nonce=" + std::to_string(nonce);
   if (!options.empty())
     post_data += "&" + options;
 
   // Message signature using HMAC-SHA512 of (URI path + SHA256(nonce + POST
   // data)) and base64 decoded secret API key
-  auto sig_size = request.size() + SHA256_DIGEST_LENGTH;
-  std::vector<uint8_t> sig_data(sig_size);
-  copy(std::begin(request), std::end(request), std::begin(sig_data));
-
   std::string payload_for_signature = std::to_string(nonce) + post_data;
+  char post_digest[SHA256_DIGEST_LENGTH];
   SHA256((uint8_t *)payload_for_signature.c_str(), payload_for_signature.size(),
-         &sig_data[sig_size - SHA256_DIGEST_LENGTH]);
+         reinterpret_cast<uint8_t *>(post_digest));
 
-  std::string decoded_key = base64_decode(params.krakenSecret);
-  uint8_t *hmac_digest =
-      HMAC(EVP_sha512(), decoded_key.c_str(), decoded_key.length(),
-           sig_data.data(), sig_data.size(), NULL, NULL);
   std::string api_sign_header =
-      base64_encode(hmac_digest, SHA512_DIGEST_LENGTH);
+      signer(params)
+          .sign({request, std::string_view(post_digest, sizeof(post_digest))})
+          .base64();
   // cURL header
   std::array<std::string, 2> headers{
       "API-KEY:" + params.krakenApi,
@@ -220,7 +285,7 @@ json_t *authRequest(Parameters &params, std::string const &request,
 
   // cURL request
   auto &exchange = queryHandle(params);
-  return exchange.postRequest(
+  co_return co_await exchange.postAsync(
       request, make_slist(std::begin(headers), std::end(headers)), post_data);
 }
 
@@ -231,18 +296,22 @@ void testKraken() {
 
   std::string orderId;
 
-  std::cout << "Current value LEG1_LEG2 bid: " << getQuote(params).bid()
+  std::cout << "Current value LEG1_LEG2 bid: "
+            << syncWait(getQuote(params)).bid() << std::endl;
+  std::cout << "Current value LEG1_LEG2 ask: "
+            << syncWait(getQuote(params)).ask() << std::endl;
+  std::cout << "Current balance BTC: " << syncWait(getAvail(params, "btc"))
+            << std::endl;
+  std::cout << "Current balance USD: " << syncWait(getAvail(params, "usd"))
+            << std::endl;
+  std::cout << "Current balance ETH: " << syncWait(getAvail(params, "eth"))
             << std::endl;
-  std::cout << "Current value LEG1_LEG2 ask: " << getQuote(params).ask()
+  std::cout << "Current balance XMR: " << syncWait(getAvail(params, "xmr"))
             << std::endl;
-  std::cout << "Current balance BTC: " << getAvail(params, "btc") << std::endl;
-  std::cout << "Current balance USD: " << getAvail(params, "usd") << std::endl;
-  std::cout << "Current balance ETH: " << getAvail(params, "eth") << std::endl;
-  std::cout << "Current balance XMR: " << getAvail(params, "xmr") << std::endl;
   std::cout << "current bid limit price for .09 units: "
-            << getLimitPrice(params, 0.09, true) << std::endl;
+            << syncWait(getLimitPrice(params, 0.09, true)) << std::endl;
   std::cout << "Current ask limit price for .09 units: "
-            << getLimitPrice(params, 0.09, false) << std::endl;
+            << syncWait(getLimitPrice(params, 0.09, false)) << std::endl;
   // std::cout << "Sending buy order for 0.01 XMR @ $100 USD - TXID: " <<
   // std::endl; orderId = sendLongOrder(params, "buy", 0.01, 100); std::cout <<
   // orderId << std::endl;
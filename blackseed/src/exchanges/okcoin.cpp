@@ -1,5 +1,4 @@
 #include "okcoin.h"
-#include "curl_fun.h"
 #include "hex_str.hpp"
 #include "parameters.h"
 #include "unique_json.hpp"
@@ -10,20 +9,19 @@
 #include <cmath> // fabs
 #include <iomanip>
 #include <sstream>
-#include <thread> // sleep_for
 
 namespace OKCoin {
 
 static RestApi &queryHandle(Parameters &params) {
   static RestApi query("https://www.okcoin.com", params.cacert.c_str(),
-                       *params.logFile);
+                       params.logFile);
   return query;
 }
 
-quote_t getQuote(Parameters &params) {
+task<quote_t> getQuote(Parameters &params) {
   auto &exchange = queryHandle(params);
-  unique_json root{
-      exchange.getRequest("/api/spot/v3/instruments/BTC-USDT/ticker")};
+  unique_json root{co_await exchange.cachedGetAsync(
+      "/api/spot/v3/instruments/BTC-USDT/ticker", params.tickerTtl())};
   const char *quote =
       json_string_value(json_object_get(root.get(), "best_bid"));
   auto bidValue = quote ? std::stod(quote) : 0.0;
@@ -31,10 +29,10 @@ quote_t getQuote(Parameters &params) {
   quote = json_string_value(json_object_get(root.get(), "best_ask"));
   auto askValue = quote ? std::stod(quote) : 0.0;
 
-  return std::make_pair(bidValue, askValue);
+  co_return std::make_pair(bidValue, askValue);
 }
 
-double getAvail(Parameters &params, std::string const &currency) {
+task<double> getAvail(Parameters &params, std::string currency) {
   std::ostringstream oss;
   oss << "api_key=" << params.okcoinApi
       << "&secret_key=" << params.okcoinSecret;
@@ -43,8 +41,8 @@ double getAvail(Parameters &params, std::string const &currency) {
   oss.str("");
   oss << "api_key=" << params.okcoinApi;
   std::string content(oss.str());
-  unique_json root{authRequest(
-      params, "https://www.okcoin.com/api/v1/userinfo.do", signature, content)};
+  unique_json root{co_await authRequest(params, "/api/v1/userinfo.do",
+                                        signature, content)};
   double availability = 0.0;
   const char *returnedText;
   if (currency == "usd") {
@@ -66,13 +64,13 @@ double getAvail(Parameters &params, std::string const &currency) {
     availability = atof(returnedText);
   } else {
     *params.logFile << "<OKCoin> Error with the credentials." << std::endl;
-    availability = 0.0;
+    availability = unknownBalance();
   }
-  return availability;
+  co_return availability;
 }
 
-std::string sendLongOrder(Parameters &params, std::string const &direction,
-                          double const quantity, double const price) {
+task<std::string> sendLongOrder(Parameters &params, std::string direction,
+                                double quantity, double price) {
   // signature
   std::ostringstream oss;
   oss << "amount=" << quantity << "&api_key=" << params.okcoinApi
@@ -88,17 +86,17 @@ std::string sendLongOrder(Parameters &params, std::string const &direction,
   *params.logFile << "<OKCoin> Trying to send a \"" << direction
                   << "\" limit order: " << std::setprecision(6) << quantity
                   << "@$" << std::setprecision(2) << price << "...\n";
-  unique_json root{authRequest(params, "https://www.okcoin.com/api/v1/trade.do",
-                               signature, content)};
+  unique_json root{co_await authRequest(params, "/api/v1/trade.do",
+                                        signature, content)};
   auto orderId = std::to_string(
       json_integer_value(json_object_get(root.get(), "order_id")));
   *params.logFile << "<OKCoin> Done (order ID: " << orderId << ")\n"
                   << std::endl;
-  return orderId;
+  co_return orderId;
 }
 
-std::string sendShortOrder(Parameters &params, std::string const &direction,
-                           double const quantity, double const price) {
+task<std::string> sendShortOrder(Parameters &params, std::string direction,
+                                 double const quantity, double const price) {
   // TODO
   // Unlike Bitfinex and Poloniex, on OKCoin the borrowing phase has to be done
   // as a separated step before being able to short sell.
@@ -111,12 +109,12 @@ std::string sendShortOrder(Parameters &params, std::string const &direction,
   //  3. <wait for the spread to close>       |
   //  4. buy back the bitcoins on the market  | sendShortOrder("buy")
   //  5. repay the bitcoins to the lender     | repayBtc(borrowId)
-  return "0";
+  co_return "0";
 }
 
-bool isOrderComplete(Parameters &params, std::string const &orderId) {
+task<bool> isOrderComplete(Parameters &params, std::string orderId) {
   if (orderId == "0")
-    return true;
+    co_return true;
 
   // signature
   std::ostringstream oss;
@@ -130,21 +128,81 @@ bool isOrderComplete(Parameters &params, std::string const &orderId) {
   oss << "api_key=" << params.okcoinApi << "&order_id=" << orderId
       << "&symbol=btc_usd";
   std::string content = oss.str();
-  unique_json root{authRequest(params,
-                               "https://www.okcoin.com/api/v1/order_info.do",
-                               signature, content)};
+  unique_json root{co_await authRequest(params, "/api/v1/order_info.do",
+                                        signature, content)};
   auto status = json_integer_value(json_object_get(
       json_array_get(json_object_get(root.get(), "orders"), 0), "status"));
 
-  return status == 2;
+  co_return status == 2;
 }
 
-double getActivePos(Parameters &params) { return getAvail(params, "btc"); }
+task<OrderStatus> getOrderStatus(Parameters &params, std::string orderId) {
+  OrderStatus status;
+  // "0" for an order that could not be sent
+  if (orderId == "0") {
+    status.known = true;
+    co_return status;
+  }
 
-double getLimitPrice(Parameters &params, double const volume,
-                     bool const isBid) {
+  std::ostringstream oss;
+  oss << "api_key=" << params.okcoinApi << "&order_id=" << orderId
+      << "&symbol=btc_usd"
+      << "&secret_key=" << params.okcoinSecret;
+  std::string signature = oss.str();
+  oss.clear();
+  oss.str("");
+  oss << "api_key=" << params.okcoinApi << "&order_id=" << orderId
+      << "&symbol=btc_usd";
+  std::string content = oss.str();
+  unique_json root{co_await authRequest(params, "/api/v1/order_info.do",
+                                        signature, content)};
+  auto order = json_array_get(json_object_get(root.get(), "orders"), 0);
+  if (!json_is_integer(json_object_get(order, "status"))) {
+    // 10009: the order does not exist
+    auto code = json_integer_value(json_object_get(root.get(), "error_code"));
+    status.known = code == 10009;
+    *params.logFile << "<OKCoin> Order " << orderId
+                    << (status.known ? " not found" : " unknown, error ")
+                    << (status.known ? "" : std::to_string(code)) << std::endl;
+    co_return status;
+  }
+  status.known = true;
+  // -1 canceled, 0 unfilled, 1 partially filled, 2 filled, 4 being canceled
+  auto state = json_integer_value(json_object_get(order, "status"));
+  status.open = state == 0 || state == 1 || state == 4;
+  status.filled = json_number_value(json_object_get(order, "deal_amount"));
+  status.avgPrice = json_number_value(json_object_get(order, "avg_price"));
+  co_return status;
+}
+
+task<bool> cancelOrder(Parameters &params, std::string orderId) {
+  if (orderId == "0")
+    co_return false;
+
+  std::ostringstream oss;
+  oss << "api_key=" << params.okcoinApi << "&order_id=" << orderId
+      << "&symbol=btc_usd"
+      << "&secret_key=" << params.okcoinSecret;
+  std::string signature = oss.str();
+  oss.clear();
+  oss.str("");
+  oss << "api_key=" << params.okcoinApi << "&order_id=" << orderId
+      << "&symbol=btc_usd";
+  std::string content = oss.str();
+  unique_json root{co_await authRequest(params, "/api/v1/cancel_order.do",
+                                        signature, content)};
+  co_return json_is_true(json_object_get(root.get(), "result"));
+}
+
+task<double> getActivePos(Parameters &params) {
+  co_return co_await getAvail(params, "btc");
+}
+
+task<double> getLimitPrice(Parameters &params, double const volume,
+                           bool const isBid) {
   auto &exchange = queryHandle(params);
-  unique_json root{exchange.getRequest("/api/v1/depth.do?symbol=btc_usd")};
+  unique_json root{co_await exchange.cachedGetAsync(
+      "/api/v1/depth.do?symbol=btc_usd", params.orderBookTtl())};
   auto bidask = json_object_get(root.get(), isBid ? "bids" : "asks");
 
   // loop on volume
@@ -158,77 +216,30 @@ double getLimitPrice(Parameters &params, double const volume,
   while (tmpVol < fabs(volume) * params.orderBookFactor) {
     p = json_number_value(json_array_get(json_array_get(bidask, i), 0));
     v = json_number_value(json_array_get(json_array_get(bidask, i), 1));
-    *params.logFile << "<OKCoin> order book: " << std::setprecision(6) << v
-                    << "@$" << std::setprecision(2) << p << std::endl;
+    params.log->log(LogLevel::debug, "<OKCoin> order book: {.6}@${.2}",
+                    v, p);
     tmpVol += v;
     i += step;
   }
 
-  return p;
+  co_return p;
 }
 
-json_t *authRequest(Parameters &params, std::string const &url,
-                    std::string const &signature, std::string const &content) {
+task<json_t *> authRequest(Parameters &params, std::string uri,
+                           std::string signature, std::string content) {
   uint8_t digest[MD5_DIGEST_LENGTH];
   MD5((uint8_t *)signature.data(), signature.length(), (uint8_t *)&digest);
 
   std::ostringstream oss;
   oss << content
       << "&sign=" << hex_str<upperhex>(digest, digest + MD5_DIGEST_LENGTH);
-  std::string postParameters = oss.str().c_str();
-  curl_slist *headers = curl_slist_append(
-      nullptr, "contentType: application/x-www-form-urlencoded");
-  CURLcode resCurl;
-  if (params.curl) {
-    curl_easy_setopt(params.curl, CURLOPT_POST, 1L);
-    curl_easy_setopt(params.curl, CURLOPT_HTTPHEADER, headers);
-    curl_easy_setopt(params.curl, CURLOPT_POSTFIELDS, postParameters.c_str());
-    curl_easy_setopt(params.curl, CURLOPT_SSL_VERIFYPEER, 0L);
-    curl_easy_setopt(params.curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-    std::string readBuffer;
-    curl_easy_setopt(params.curl, CURLOPT_WRITEDATA, &readBuffer);
-    curl_easy_setopt(params.curl, CURLOPT_URL, url.c_str());
-    curl_easy_setopt(params.curl, CURLOPT_CONNECTTIMEOUT, 10L);
-    resCurl = curl_easy_perform(params.curl);
-
-    using std::this_thread::sleep_for;
-    using secs = std::chrono::seconds;
-    while (resCurl != CURLE_OK) {
-      *params.logFile << "<OKCoin> Error with cURL. Retry in 2 sec..."
-                      << std::endl;
-      sleep_for(secs(4));
-      resCurl = curl_easy_perform(params.curl);
-    }
-    json_error_t error;
-    json_t *root = json_loads(readBuffer.c_str(), 0, &error);
-    while (!root) {
-      *params.logFile << "<OKCoin> Error with JSON:\n"
-                      << error.text << std::endl;
-      *params.logFile << "<OKCoin> Buffer:\n"
-                      << readBuffer.c_str() << std::endl;
-      *params.logFile << "<OKCoin> Retrying..." << std::endl;
-      sleep_for(secs(4));
-      readBuffer = "";
-      resCurl = curl_easy_perform(params.curl);
-      while (resCurl != CURLE_OK) {
-        *params.logFile << "<OKCoin> Error with cURL. Retry in 2 sec..."
-                        << std::endl;
-        sleep_for(secs(4));
-        readBuffer = "";
-        resCurl = curl_easy_perform(params.curl);
-      }
-      root = json_loads(readBuffer.c_str(), 0, &error);
-    }
-    curl_slist_free_all(headers);
-    curl_easy_reset(params.curl);
-    return root;
-  } else {
-    *params.logFile << "<OKCoin> Error with cURL init." << std::endl;
-    return NULL;
-  }
+  RestApi::unique_slist headers(curl_slist_append(
+      nullptr, "contentType: application/x-www-form-urlencoded"));
+  co_return co_await queryHandle(params).postAsync(uri, std::move(headers),
+                                                   oss.str());
 }
 
-void getBorrowInfo(Parameters &params) {
+task<void> getBorrowInfo(Parameters &params) {
   std::ostringstream oss;
   oss << "api_key=" << params.okcoinApi
       << "&symbol=btc_usd&secret_key=" << params.okcoinSecret;
@@ -237,15 +248,14 @@ void getBorrowInfo(Parameters &params) {
   oss.str("");
   oss << "api_key=" << params.okcoinApi << "&symbol=btc_usd";
   std::string content = oss.str();
-  unique_json root{authRequest(params,
-                               "https://www.okcoin.com/api/v1/borrows_info.do",
-                               signature, content)};
+  unique_json root{co_await authRequest(params, "/api/v1/borrows_info.do",
+                                        signature, content)};
   auto dump = json_dumps(root.get(), 0);
   *params.logFile << "<OKCoin> Borrow info:\n" << dump << std::endl;
   free(dump);
 }
 
-int borrowBtc(Parameters &params, double const amount) {
+task<int> borrowBtc(Parameters &params, double amount) {
   std::ostringstream oss;
   oss << "api_key=" << params.okcoinApi
       << "&symbol=btc_usd&days=fifteen&amount=" << 1
@@ -256,21 +266,20 @@ int borrowBtc(Parameters &params, double const amount) {
   oss << "api_key=" << params.okcoinApi
       << "&symbol=btc_usd&days=fifteen&amount=" << 1 << "&rate=0.0001";
   std::string content = oss.str();
-  unique_json root{authRequest(params,
-                               "https://www.okcoin.com/api/v1/borrow_money.do",
-                               signature, content)};
+  unique_json root{co_await authRequest(params, "/api/v1/borrow_money.do",
+                                        signature, content)};
   auto dump = json_dumps(root.get(), 0);
   *params.logFile << "<OKCoin> Borrow " << std::setprecision(6) << amount
                   << " BTC:\n"
                   << dump << std::endl;
   free(dump);
   bool isBorrowAccepted = json_is_true(json_object_get(root.get(), "result"));
-  return isBorrowAccepted
-             ? json_integer_value(json_object_get(root.get(), "borrow_id"))
-             : 0;
+  co_return isBorrowAccepted
+      ? json_integer_value(json_object_get(root.get(), "borrow_id"))
+      : 0;
 }
 
-void repayBtc(Parameters &params, int const borrowId) {
+task<void> repayBtc(Parameters &params, int borrowId) {
   std::ostringstream oss;
   oss << "api_key=" << params.okcoinApi << "&borrow_id=" << borrowId
       << "&secret_key=" << params.okcoinSecret;
@@ -279,9 +288,8 @@ void repayBtc(Parameters &params, int const borrowId) {
   oss.str("");
   oss << "api_key=" << params.okcoinApi << "&borrow_id=" << borrowId;
   std::string content = oss.str();
-  unique_json root{authRequest(params,
-                               "https://www.okcoin.com/api/v1/repayment.do",
-                               signature, content)};
+  unique_json root{co_await authRequest(params, "/api/v1/repayment.do",
+                                        signature, content)};
   auto dump = json_dumps(root.get(), 0);
   *params.logFile << "<OKCoin> Repay borrowed BTC:\n" << dump << std::endl;
   free(dump);
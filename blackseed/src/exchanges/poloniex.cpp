@@ -1,11 +1,12 @@
 #include "poloniex.h"
-#include "hex_str.hpp"
 #include "parameters.h"
 #include "unique_json.hpp"
+#include "utils/hmac_signer.h"
+#include "utils/latency.h"
+#include "utils/nonce.h"
 #include "utils/restapi.h"
+#include "utils/ticker_snapshot.h"
 
-#include "openssl/hmac.h"
-#include "openssl/sha.h"
 #include <algorithm>
 #include <array>
 #include <cctype>
@@ -14,15 +15,39 @@
 
 namespace Poloniex {
 
-static json_t *authRequest(Parameters &, const char *,
-                           const std::string & = "");
+static task<json_t *> authRequest(Parameters &, std::string, std::string = "");
 
 static RestApi &queryHandle(Parameters &params) {
   static RestApi query("https://poloniex.com", params.cacert.c_str(),
-                       *params.logFile);
+                       params.logFile);
   return query;
 }
 
+static HmacSigner &signer(Parameters &params) {
+  static HmacSigner signer(EVP_sha512(), params.poloniexSecret,
+                           &latency().histogram("Poloniex", "hmac", "sign"));
+  return signer;
+}
+
+static void parseTickers(json_t *root, std::map<std::string, quote_t> &quotes) {
+  const char *market;
+  json_t *ticker;
+  json_object_foreach(root, market, ticker) {
+    auto bid = json_string_value(json_object_get(ticker, "highestBid"));
+    auto ask = json_string_value(json_object_get(ticker, "lowestAsk"));
+    quotes.emplace(market, quote_t(bid ? std::stod(bid) : 0.0,
+                                   ask ? std::stod(ask) : 0.0));
+  }
+}
+
+// returnTicker lists every market
+static TickerSnapshot &tickers(Parameters &params) {
+  static TickerSnapshot tickers(queryHandle(params),
+                                "/public?command=returnTicker", parseTickers,
+                                params.tickerTtl());
+  return tickers;
+}
+
 static json_t *checkResponse(std::ostream &logFile, json_t *root) {
   auto errmsg = json_object_get(root, "error");
   if (errmsg)
@@ -34,22 +59,11 @@ static json_t *checkResponse(std::ostream &logFile, json_t *root) {
 
 // We use ETH/BTC as there is no USD on Poloniex
 // TODO We could show BTC/USDT
-quote_t getQuote(Parameters &params) {
-  auto &exchange = queryHandle(params);
-  unique_json root{exchange.getRequest("/public?command=returnTicker")};
-
-  const char *quote = json_string_value(
-      json_object_get(json_object_get(root.get(), "USDT_BTC"), "highestBid"));
-  auto bidValue = quote ? std::stod(quote) : 0.0;
-
-  quote = json_string_value(
-      json_object_get(json_object_get(root.get(), "USDT_BTC"), "lowestAsk"));
-  auto askValue = quote ? std::stod(quote) : 0.0;
-
-  return std::make_pair(bidValue, askValue);
+task<quote_t> getQuote(Parameters &params) {
+  co_return co_await tickers(params).quoteAsync("USDT_BTC");
 }
 
-double getAvail(Parameters &params, std::string const &currency) {
+task<double> getAvail(Parameters &params, std::string currency) {
   std::string tempCurrency = currency;
   std::transform(begin(tempCurrency), end(tempCurrency), begin(tempCurrency), ::toupper);
   std::string options = "account=exchange";
@@ -57,49 +71,111 @@ double getAvail(Parameters &params, std::string const &currency) {
     tempCurrency += "T";
   }
   unique_json root{
-      authRequest(params, "returnAvailableAccountBalances", options)};
+      co_await authRequest(params, "returnAvailableAccountBalances", options)};
+  // Without any balance the reply is an empty array, not an error
+  if (json_object_get(root.get(), "error"))
+    co_return unknownBalance();
   auto funds = json_string_value(json_object_get(
       json_object_get(root.get(), "exchange"), tempCurrency.c_str()));
-  return funds ? std::stod(funds) : 0.0;
+  co_return funds ? std::stod(funds) : 0.0;
 }
 
-std::string sendLongOrder(Parameters &params, std::string const &direction,
-                          double const quantity, double const price) {
+task<std::string> sendLongOrder(Parameters &params, std::string direction,
+                                double const quantity, double const price) {
   if (direction.compare("buy") != 0 && direction.compare("sell") != 0) {
     *params.logFile << "<Poloniex> Error: Neither \"buy\" nor \"sell\" selected"
                     << std::endl;
-    return "0";
+    co_return "0";
   }
   // TODO: Real currency string
   std::string options = "currencyPair=USDT_BTC&rate=";
   std::string volume = std::to_string(quantity);
   std::string pricelimit = std::to_string(price);
   options += pricelimit + "&amount=" + volume;
-  unique_json root{authRequest(params, direction.c_str(), options)};
+  unique_json root{co_await authRequest(params, direction, options)};
   std::string txid =
       json_string_value(json_object_get(root.get(), "orderNumber"));
-  return txid;
+  co_return txid;
 }
 
-std::string sendShortOrder(Parameters &params, std::string const &direction,
-                           double const quantity, double const price) {
+task<std::string> sendShortOrder(Parameters &params, std::string direction,
+                                 double const quantity, double const price) {
   // TODO
-  return "0";
+  co_return "0";
 }
 
-bool isOrderComplete(Parameters &params, std::string const &orderId) {
-  unique_json root{
-      authRequest(params, "returnOpenOrders", "currencyPair=USDT_BTC")};
-  auto n = json_array_size(root.get());
-  while (n-- > 0) {
-    auto item = json_object_get(json_array_get(root.get(), n), "orderNumber");
-    if (orderId == json_string_value(item))
-      return false;
+task<bool> isOrderComplete(Parameters &params, std::string orderId) {
+  auto status = co_await getOrderStatus(params, orderId);
+  co_return status.known && !status.open;
+}
+
+// "Order not found, or you are not the person who placed it."
+static bool notFound(json_t *error) {
+  auto message = json_string_value(error);
+  return message && std::string(message).starts_with("Order not found");
+}
+
+task<OrderStatus> getOrderStatus(Parameters &params, std::string orderId) {
+  OrderStatus status;
+  // "0" for an order that could not be sent
+  if (orderId == "0") {
+    status.known = true;
+    co_return status;
   }
-  return true;
+  auto options = "orderNumber=" + orderId;
+  unique_json root{co_await authRequest(params, "returnOrderStatus", options)};
+  // Only an open order has a status, a closed one is "not found"
+  auto result = json_object_get(root.get(), "result");
+  auto order = json_object_get(result, orderId.c_str());
+  if (!order && !notFound(json_object_get(result, "error"))) {
+    *params.logFile << "<Poloniex> Order " << orderId << " unknown"
+                    << std::endl;
+    co_return status;
+  }
+  if (order) {
+    status.open = true;
+    auto starting =
+        json_string_value(json_object_get(order, "startingAmount"));
+    auto left = json_string_value(json_object_get(order, "amount"));
+    // Untouched, there is no trade to look up
+    if (starting && left && atof(starting) == atof(left)) {
+      status.known = true;
+      co_return status;
+    }
+  }
+
+  unique_json trades{
+      co_await authRequest(params, "returnOrderTrades", options)};
+  // An order without any trade is "not found" too
+  if (!json_is_array(trades.get()) &&
+      !notFound(json_object_get(trades.get(), "error"))) {
+    *params.logFile << "<Poloniex> Trades of order " << orderId << " unknown"
+                    << std::endl;
+    co_return status;
+  }
+  status.known = true;
+  double value = 0.0;
+  for (size_t i = 0; i < json_array_size(trades.get()); ++i) {
+    auto trade = json_array_get(trades.get(), i);
+    auto amount = json_string_value(json_object_get(trade, "amount"));
+    auto total = json_string_value(json_object_get(trade, "total"));
+    status.filled += amount ? atof(amount) : 0.0;
+    value += total ? atof(total) : 0.0;
+  }
+  if (status.filled > 0.0)
+    status.avgPrice = value / status.filled;
+  co_return status;
+}
+
+task<bool> cancelOrder(Parameters &params, std::string orderId) {
+  if (orderId == "0")
+    co_return false;
+  unique_json root{
+      co_await authRequest(params, "cancelOrder", "orderNumber=" + orderId)};
+  co_return json_integer_value(json_object_get(root.get(), "success")) == 1;
 }
 
-double getActivePos(Parameters &params) {
+task<double> getActivePos(Parameters &params) {
   // TODO: When we add the new getActivePos style uncomment this
   // double activeSize = 0.0;
   // if (!orderId.empty()){
@@ -122,16 +198,17 @@ double getActivePos(Parameters &params) {
   // }
   // return activeSize;
 
-  return getAvail(params, "BTC");
+  co_return co_await getAvail(params, "BTC");
 }
 
-double getLimitPrice(Parameters &params, double const volume,
-                     bool const isBid) {
+task<double> getLimitPrice(Parameters &params, double const volume,
+                           bool const isBid) {
   auto &exchange = queryHandle(params);
   // TODO: build real curr string
   // std::string uri = "/public?command=returnOrderBook&currencyPair=";
-  unique_json root{exchange.getRequest(
-      "/public?command=returnOrderBook&currencyPair=USDT_BTC")};
+  unique_json root{co_await exchange.cachedGetAsync(
+      "/public?command=returnOrderBook&currencyPair=USDT_BTC",
+      params.orderBookTtl())};
   auto bidask = json_object_get(root.get(), isBid ? "bids" : "asks");
   *params.logFile << "<Poloniex> Looking for a limit price to fill "
                   << std::setprecision(8) << fabs(volume) << " Legx...\n";
@@ -142,37 +219,35 @@ double getLimitPrice(Parameters &params, double const volume,
   while (tmpVol < fabs(volume) * params.orderBookFactor) {
     p = atof(json_string_value(json_array_get(json_array_get(bidask, i), 0)));
     v = json_number_value(json_array_get(json_array_get(bidask, i), 1));
-    *params.logFile << "<Poloniex> order book: " << std::setprecision(8) << v
-                    << " @$" << std::setprecision(8) << p << std::endl;
+    params.log->log(LogLevel::debug, "<Poloniex> order book: {.8} @${.8}",
+                    v, p);
     tmpVol += v;
     i++;
   }
-  return p;
+  co_return p;
 }
 
-json_t *authRequest(Parameters &params, const char *request,
-                    std::string const &options) {
+task<json_t *> authRequest(Parameters &params, std::string request,
+                           std::string options) {
   using namespace std;
-  static uint64_t nonce = time(nullptr) * 4;
-  string post_body = "nonce=" + to_string(++nonce) + "&command=" + request;
+  // Held until the request is sent
+  auto sending = co_await NonceLock::async("Poloniex:" + params.poloniexApi,
+                                           time(nullptr) * 4);
+  auto nonce = sending.nonce();
+  string post_body = "nonce=" + to_string(nonce) + "&command=" + request;
   if (!options.empty()) {
     post_body += '&';
     post_body += options;
   }
 
-  uint8_t *sign = HMAC(EVP_sha512(), params.poloniexSecret.data(),
-                       params.poloniexSecret.size(),
-                       reinterpret_cast<const uint8_t *>(post_body.data()),
-                       post_body.size(), nullptr, nullptr);
   auto &exchange = queryHandle(params);
   array<string, 2> headers{
       "Key:" + params.poloniexApi,
-      "Sign:" + hex_str(sign, sign + SHA512_DIGEST_LENGTH),
+      "Sign:" + signer(params).sign(post_body).hex(),
   };
-  return checkResponse(
-      *params.logFile,
-      exchange.postRequest(
-          "/tradingApi", make_slist(begin(headers), end(headers)), post_body));
+  auto result = co_await exchange.postAsync(
+      "/tradingApi", make_slist(begin(headers), end(headers)), post_body);
+  co_return checkResponse(*params.logFile, result);
 }
 
 } // namespace Poloniex
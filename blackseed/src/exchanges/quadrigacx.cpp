@@ -2,11 +2,10 @@
 #include "parameters.h"
 #include "utils/restapi.h"
 #include "utils/base64.h"
+#include "utils/hmac_signer.h"
+#include "utils/nonce.h"
 #include "unique_json.hpp"
-#include "hex_str.hpp"
 
-#include "openssl/sha.h"
-#include "openssl/hmac.h"
 #include <vector>
 #include <iomanip>
 #include <array>
@@ -21,11 +20,17 @@ static json_t* authRequest(Parameters& params, std::string request, json_t * opt
 static RestApi& queryHandle(Parameters &params)
 {
   static RestApi query ("https://api.quadrigacx.com",
-                        params.cacert.c_str(), *params.logFile);
+                        params.cacert.c_str(), params.logFile);
   return query;
 }
 
-quote_t getQuote(Parameters &params)
+static HmacSigner& signer(Parameters &params)
+{
+  static HmacSigner signer (EVP_sha256(), params.quadrigaSecret);
+  return signer;
+}
+
+task<quote_t> getQuote(Parameters &params)
 {
   /*
   auto &exchange = queryHandle(params); 
@@ -37,7 +42,7 @@ quote_t getQuote(Parameters &params)
   quote = json_string_value(json_object_get(root.get(), "ask"));
   auto askValue = quote ? std::stod(quote) : 0.0;
   */
-  return std::make_pair(0.0, 0.0);
+  co_return std::make_pair(0.0, 0.0);
 }
 
 
@@ -134,7 +139,8 @@ double getActivePos(Parameters& params) {
 double getLimitPrice(Parameters &params, double volume, bool isBid)
 {
   auto &exchange = queryHandle(params);
-  auto root = unique_json(exchange.getRequest("/v2/order_book?book=btc_usd"));
+  auto root = unique_json(exchange.cachedGet("/v2/order_book?book=btc_usd",
+                                             params.orderBookTtl()));
   auto branch = json_object_get(root.get(), isBid ? "bids" : "asks");
 
   // loop on volume
@@ -160,7 +166,10 @@ double getLimitPrice(Parameters &params, double volume, bool isBid)
 
 static json_t* authRequest(Parameters& params, std::string request, json_t * options)
 {
-  json_int_t nonce = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+  json_int_t millis = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+  // Held until the request is sent
+  NonceLock sending("QuadrigaCX:" + params.quadrigaApi, millis);
+  json_int_t nonce = sending.nonce();
 
   //post data is json
   unique_json payload {json_object()};
@@ -198,19 +207,7 @@ static json_t* authRequest(Parameters& params, std::string request, json_t * opt
 static std::string getSignature(Parameters& params, const uint64_t nonce)
 {
   std::string sig_data_str = std::to_string(nonce) + params.quadrigaClientId + params.quadrigaApi;
-  auto data_len = sig_data_str.length();
-  std::vector<uint8_t> sig_data(data_len);
-
-  copy(sig_data_str.begin(), sig_data_str.end(), sig_data.begin());
-
-  uint8_t * hmac_digest = HMAC(EVP_sha256(),
-                               params.quadrigaSecret.c_str(),
-                               params.quadrigaSecret.length(),
-                               sig_data.data(),
-                               data_len,
-                               NULL, NULL);
-
-  return hex_str(hmac_digest, hmac_digest + SHA256_DIGEST_LENGTH);
+  return signer(params).sign(sig_data_str).hex();
 }
 
 void testQuadriga(){
@@ -223,8 +220,8 @@ void testQuadriga(){
 
     std::string orderId;
 
-    std::cout << "Current value BTC_USD bid: " << getQuote(params).bid() << std::endl;
-    std::cout << "Current value BTC_USD ask: " << getQuote(params).ask() << std::endl;
+    std::cout << "Current value BTC_USD bid: " << syncWait(getQuote(params)).bid() << std::endl;
+    std::cout << "Current value BTC_USD ask: " << syncWait(getQuote(params)).ask() << std::endl;
     std::cout << "Current balance BTC: " << getAvail(params, "btc") << std::endl;
     std::cout << "Current balance USD: " << getAvail(params, "usd")<< std::endl;
     std::cout << "Current balance ETH: " << getAvail(params, "eth")<< std::endl;
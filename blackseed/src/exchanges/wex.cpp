@@ -1,11 +1,11 @@
 #include "wex.h"
-#include "hex_str.hpp"
 #include "parameters.h"
 #include "unique_json.hpp"
+#include "utils/hmac_signer.h"
+#include "utils/latency.h"
+#include "utils/nonce.h"
 #include "utils/restapi.h"
 
-#include "openssl/hmac.h"
-#include "openssl/sha.h"
 #include <array>
 #include <cassert>
 #include <cmath> // fabs
@@ -15,16 +15,21 @@
 
 namespace WEX {
 
-static json_t *authRequest(Parameters &, const char *,
-                           const std::string & = "");
+static task<json_t *> authRequest(Parameters &, std::string, std::string = "");
 static json_t *adjustResponse(json_t *);
 
 static RestApi &queryHandle(Parameters &params) {
   static RestApi query("https://wex.nz", params.cacert.c_str(),
-                       *params.logFile);
+                       params.logFile);
   return query;
 }
 
+static HmacSigner &signer(Parameters &params) {
+  static HmacSigner signer(EVP_sha512(), params.wexSecret,
+                           &latency().histogram("WEX", "hmac", "sign"));
+  return signer;
+}
+
 static json_t *checkResponse(std::ostream &logFile, json_t *root) {
   unique_json own{root};
   auto success = json_object_get(root, "success");
@@ -32,6 +37,9 @@ static json_t *checkResponse(std::ostream &logFile, json_t *root) {
     auto errmsg = json_object_get(root, "error");
     logFile << "<WEX> Error with response: " << json_string_value(errmsg)
             << '\n';
+    // The error itself, none of the fields asked for are in it
+    json_incref(root);
+    return root;
   }
 
   auto result = json_object_get(root, "return");
@@ -39,27 +47,29 @@ static json_t *checkResponse(std::ostream &logFile, json_t *root) {
   return result;
 }
 
-quote_t getQuote(Parameters &params) {
+task<quote_t> getQuote(Parameters &params) {
   auto &exchange = queryHandle(params);
-  unique_json root{exchange.getRequest("/api/3/ticker/btc_usd")};
+  unique_json root{co_await exchange.cachedGetAsync("/api/3/ticker/btc_usd",
+                                                    params.tickerTtl())};
 
   double bidValue = json_number_value(
       json_object_get(json_object_get(root.get(), "btc_usd"), "sell"));
   double askValue = json_number_value(
       json_object_get(json_object_get(root.get(), "btc_usd"), "buy"));
 
-  return std::make_pair(bidValue, askValue);
+  co_return std::make_pair(bidValue, askValue);
 }
 
-double getAvail(Parameters &params, std::string const &currency) {
-  unique_json root{authRequest(params, "getInfo")};
-  auto funds =
-      json_object_get(json_object_get(root.get(), "funds"), currency.c_str());
-  return json_number_value(funds);
+task<double> getAvail(Parameters &params, std::string currency) {
+  unique_json root{co_await authRequest(params, "getInfo")};
+  auto all = json_object_get(root.get(), "funds");
+  if (!all)
+    co_return unknownBalance();
+  co_return json_number_value(json_object_get(all, currency.c_str()));
 }
 
-std::string sendLongOrder(Parameters &params, std::string const &direction,
-                          double const quantity, double const price) {
+task<std::string> sendLongOrder(Parameters &params, std::string direction,
+                                double const quantity, double const price) {
   *params.logFile << "<WEX> Trying to send a \"" << direction
                   << "\" limit order: " << std::fixed << std::setprecision(6)
                   << quantity << "@$" << std::setprecision(2) << price
@@ -70,32 +80,68 @@ std::string sendLongOrder(Parameters &params, std::string const &direction,
   // WEX's 'Trade' method requires rate to be limited to 3 decimals
   // otherwise it'll barf an error message about incorrect fields
   options << "&rate=" << std::setprecision(3) << price;
-  unique_json root{authRequest(params, "Trade", options.str())};
+  unique_json root{co_await authRequest(params, "Trade", options.str())};
 
   auto orderid = json_integer_value(json_object_get(root.get(), "order_id"));
   *params.logFile << "<WEX> Done (order ID: " << orderid << ")\n" << std::endl;
-  return std::to_string(orderid);
+  co_return std::to_string(orderid);
 }
 
-bool isOrderComplete(Parameters &params, std::string const &orderId) {
-  if (orderId == "0")
-    return true;
-  unique_json root{authRequest(params, "ActiveOrders", "pair=btc_usd")};
+task<bool> isOrderComplete(Parameters &params, std::string orderId) {
+  auto status = co_await getOrderStatus(params, orderId);
+  co_return status.known && !status.open;
+}
 
-  return json_object_get(root.get(), orderId.c_str()) == nullptr;
+task<OrderStatus> getOrderStatus(Parameters &params, std::string orderId) {
+  OrderStatus status;
+  // "0" for an order that could not be sent
+  if (orderId == "0") {
+    status.known = true;
+    co_return status;
+  }
+  unique_json root{
+      co_await authRequest(params, "OrderInfo", "order_id=" + orderId)};
+  auto order = json_object_get(root.get(), orderId.c_str());
+  if (!order) {
+    auto error = json_string_value(json_object_get(root.get(), "error"));
+    status.known = error && std::string(error) == "invalid order";
+    *params.logFile << "<WEX> Order " << orderId
+                    << (status.known ? " not found" : " unknown")
+                    << std::endl;
+    co_return status;
+  }
+  status.known = true;
+
+  // 0 active, 1 filled, 2 canceled, 3 canceled after a partial fill
+  status.open = json_integer_value(json_object_get(order, "status")) == 0;
+  status.filled = json_number_value(json_object_get(order, "start_amount")) -
+                  json_number_value(json_object_get(order, "amount"));
+  // WEX does not tell the fill prices; they are the rate or better
+  if (status.filled > 0.0)
+    status.avgPrice = json_number_value(json_object_get(order, "rate"));
+  co_return status;
+}
+
+task<bool> cancelOrder(Parameters &params, std::string orderId) {
+  if (orderId == "0")
+    co_return false;
+  unique_json root{
+      co_await authRequest(params, "CancelOrder", "order_id=" + orderId)};
+  co_return json_object_get(root.get(), "order_id") != nullptr;
 }
 
-double getActivePos(Parameters &params) {
+task<double> getActivePos(Parameters &params) {
   // TODO:
   // this implementation is more of a placeholder copied from other exchanges;
   // may not be reliable.
-  return getAvail(params, "btc");
+  co_return co_await getAvail(params, "btc");
 }
 
-double getLimitPrice(Parameters &params, double const volume,
-                     bool const isBid) {
+task<double> getLimitPrice(Parameters &params, double const volume,
+                           bool const isBid) {
   auto &exchange = queryHandle(params);
-  unique_json root{exchange.getRequest("/api/3/depth/btc_usd")};
+  unique_json root{co_await exchange.cachedGetAsync("/api/3/depth/btc_usd",
+                                                    params.orderBookTtl())};
   auto bidask = json_object_get(json_object_get(root.get(), "btc_usd"),
                                 isBid ? "bids" : "asks");
   double price = 0.0, sumvol = 0.0;
@@ -103,12 +149,12 @@ double getLimitPrice(Parameters &params, double const volume,
     auto currnode = json_array_get(bidask, i);
     price = json_number_value(json_array_get(currnode, 0));
     sumvol += json_number_value(json_array_get(currnode, 1));
-    *params.logFile << "<WEX> order book: " << std::setprecision(6) << sumvol
-                    << "@$" << std::setprecision(2) << price << std::endl;
+    params.log->log(LogLevel::debug, "<WEX> order book: {.6}@${.2}",
+                    sumvol, price);
     if (sumvol >= std::fabs(volume) * params.orderBookFactor)
       break;
   }
-  return price;
+  co_return price;
 }
 
 /*
@@ -134,30 +180,29 @@ json_t *adjustResponse(json_t *root) {
   return root;
 }
 
-json_t *authRequest(Parameters &params, const char *request,
-                    const std::string &options) {
+task<json_t *> authRequest(Parameters &params, std::string request,
+                           std::string options) {
   using namespace std;
   // WEX requires nonce to be [1, 2^32 - 1)
   constexpr auto MAXCALLS_PER_SEC = 3ull;
-  static auto nonce = static_cast<uint32_t>(time(nullptr) * MAXCALLS_PER_SEC);
-  string post_body = "nonce=" + to_string(++nonce) + "&method=" + request;
+  auto floor = static_cast<uint32_t>(time(nullptr) * MAXCALLS_PER_SEC);
+  // Held until the request is sent
+  auto sending = co_await NonceLock::async("WEX:" + params.wexApi, floor);
+  auto nonce = sending.nonce();
+  string post_body = "nonce=" + to_string(nonce) + "&method=" + request;
   if (!options.empty()) {
     post_body += '&';
     post_body += options;
   }
 
-  uint8_t *sign =
-      HMAC(EVP_sha512(), params.wexSecret.data(), params.wexSecret.size(),
-           reinterpret_cast<const uint8_t *>(post_body.data()),
-           post_body.size(), nullptr, nullptr);
   auto &exchange = queryHandle(params);
   array<string, 2> headers{
       "Key:" + params.wexApi,
-      "Sign:" + hex_str(sign, sign + SHA512_DIGEST_LENGTH),
+      "Sign:" + signer(params).sign(post_body).hex(),
   };
-  auto result = exchange.postRequest(
+  auto result = co_await exchange.postAsync(
       "/tapi", make_slist(begin(headers), end(headers)), post_body);
-  return checkResponse(*params.logFile, adjustResponse(result));
+  co_return checkResponse(*params.logFile, adjustResponse(result));
 }
 
 } // namespace WEX
@@ -0,0 +1,339 @@
+#include "execution_engine.h"
+#include "exchange_registry.h"
+#include "parameters.h"
+#include "utils/latency.h"
+#include "utils/thread_affinity.h"
+
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <limits>
+
+namespace {
+// Leg1 a leg may leave unfilled, below the smallest order the exchanges
+// take and the rounding of the quantities they are sent
+const double dust = 1e-5;
+}
+
+ExecutionEngine::ExecutionEngine(Parameters &params,
+                                 std::vector<ExchangeApi> const &exchanges,
+                                 SentHook onSent)
+    : params(params), exchanges(exchanges), onSent(std::move(onSent)),
+      worker(&ExecutionEngine::run, this) {}
+
+ExecutionEngine::~ExecutionEngine() {
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    stopping = true;
+  }
+  wake.notify_all();
+  worker.join();
+}
+
+bool ExecutionEngine::submit(Job job) {
+  if (!jobs.push(std::move(job)))
+    return false;
+  // Taking the lock orders the push before the worker's emptiness check
+  { std::lock_guard<std::mutex> lock(mtx); }
+  wake.notify_one();
+  return true;
+}
+
+void ExecutionEngine::run() {
+  if (!pinThisThread(params.executionCpu))
+    *params.logFile << "WARNING: cannot pin the execution thread to CPU "
+                    << params.executionCpu << std::endl;
+  Job job;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(mtx);
+      wake.wait(lock, [this] { return stopping || !jobs.empty(); });
+    }
+    // Jobs already queued are carried out even when stopping, their
+    // position is open
+    if (!jobs.pop(job)) {
+      if (stopping)
+        return;
+      continue;
+    }
+    execute(job);
+  }
+}
+
+void ExecutionEngine::execute(Job &job) {
+  using std::this_thread::sleep_for;
+  using millisecs = std::chrono::milliseconds;
+  static auto &decisionToSent =
+      latency().histogram("blackbird", "order", "decision_to_sent");
+  for (auto &leg : job.legs) {
+    leg.type = exchanges[leg.exch].supports(params.orderType)
+                   ? params.orderType
+                   : OrderType::gtc;
+    leg.orderQuantity = leg.quantity;
+    leg.orderId = send(leg);
+    leg.sent = leg.lastSent = Clock::monoNs();
+    if (job.decided.mono)
+      decisionToSent.record(
+          std::chrono::nanoseconds(leg.sent - job.decided.mono));
+    onSent(job, leg);
+  }
+  job.stage = Job::sent;
+  report(job);
+
+  auto &logFile = *params.logFile;
+  logFile << "Waiting for the two orders to be filled..." << std::endl;
+  int64_t deadlines[2];
+  for (unsigned i = 0; i < 2; ++i)
+    deadlines[i] = job.legs[i].sent + hedgeTime();
+  bool isComplete[2] = {false, false};
+  // Loops until both legs are done. Orders that can be canceled are looked
+  // at as often as they are re-priced, the others every few seconds.
+  for (bool first = true; !isComplete[0] || !isComplete[1]; first = false) {
+    bool supervised = false;
+    for (unsigned i = 0; i < 2; ++i)
+      supervised |= !isComplete[i] && exchanges[job.legs[i].exch].canCancel();
+    sleep_for(supervised ? millisecs(params.repriceInterval)
+                         : millisecs(first ? 5000 : 3000));
+    for (unsigned i = 0; i < 2; ++i)
+      if (!isComplete[i])
+        isComplete[i] = follow(job, i, deadlines[i]);
+  }
+  if (!job.isExit)
+    unwind(job);
+  logFile << (job.isExit ? "Done\n" : "Done") << std::endl;
+  job.stage = Job::filled;
+  report(job);
+}
+
+bool ExecutionEngine::follow(Job &job, unsigned index, int64_t &deadline) {
+  auto &leg = job.leg(index);
+  auto &exchange = exchanges[leg.exch];
+  auto const &name = params.exchangeNames[leg.exch];
+  auto &logFile = *params.logFile;
+  auto stillOpen = [&] {
+    logFile << (leg.isShort ? "Short" : "Long") << " order on " << name
+            << " still open..." << std::endl;
+  };
+  // MaxHedgeTime past its deadline, an entry leg or its unwind is given up
+  // on even if its order could not be canceled or read, so that an
+  // exchange that keeps failing does not hold the execution thread
+  if (!job.isExit && Clock::monoNs() >= deadline + hedgeTime()) {
+    logFile << (index < 2 ? (leg.isShort ? "Short" : "Long") : "Unwind")
+            << " order " << leg.orderId << " on " << name << " left open"
+            << std::endl;
+    unhedged(leg, leg.quantity - leg.executed);
+    done(leg);
+    return true;
+  }
+  // "0" is no order, one that could not be sent or that was rejected
+  bool sent = leg.orderId != "0";
+  if (!exchange.canCancel()) {
+    if (sent && !exchange.isOrderComplete(params, leg.orderId)) {
+      stillOpen();
+      return false;
+    }
+    if (sent) {
+      leg.executed = leg.quantity;
+      leg.executedValue = leg.quantity * leg.price;
+    }
+    done(leg);
+    return true;
+  }
+
+  // Only an order the exchange says is closed is sent again, one it did not
+  // answer about may still be live
+  auto unknown = [&] {
+    logFile << "WARNING: cannot read the " << (leg.isShort ? "short" : "long")
+            << " order on " << name << ", looking again" << std::endl;
+  };
+  OrderStatus status;
+  status.known = true;
+  if (sent)
+    status = exchange.getOrderStatus(params, leg.orderId);
+  if (!status.known) {
+    unknown();
+    return false;
+  }
+  // An entry leg, or its unwind, is given up on at its deadline; its order
+  // is canceled first so that nothing is left open
+  bool givingUp = !job.isExit && Clock::monoNs() >= deadline;
+  if (status.open) {
+    double open = leg.quantity - leg.executed - status.filled;
+    auto reason = givingUp ? "not filled in time" : overdue(leg, open);
+    if (!reason) {
+      stillOpen();
+      return false;
+    }
+    // Not canceled when it filled meanwhile, which the next look sees
+    if (!exchange.cancelOrder(params, leg.orderId))
+      return false;
+    logFile << (leg.isShort ? "Short" : "Long") << " order on " << name
+            << " canceled, " << reason << std::endl;
+    // Canceled, the next look reads its fills if this one cannot
+    status = exchange.getOrderStatus(params, leg.orderId);
+    if (!status.known) {
+      unknown();
+      return false;
+    }
+    if (status.open)
+      return false;
+  }
+  leg.executed += status.filled;
+  leg.executedValue += status.filled * status.avgPrice;
+  double left = leg.quantity - leg.executed;
+  if (left < dust) {
+    done(leg);
+    return true;
+  }
+  if (Clock::monoNs() >= deadline) {
+    logFile.precision(6);
+    if (!job.isExit) {
+      logFile << "WARNING: " << left << " " << params.leg1
+              << (index < 2 ? " not filled on " : " not unwound on ") << name
+              << " after " << params.maxHedgeTime << " ms, giving up on it"
+              << std::endl;
+      if (index == 2)
+        unhedged(leg, left);
+      done(leg);
+      return true;
+    }
+    logFile << "WARNING: " << left << " " << params.leg1 << " still to "
+            << leg.direction << " on " << name << " after "
+            << params.maxHedgeTime << " ms" << std::endl;
+    deadline = std::numeric_limits<int64_t>::max();
+  }
+  if (!resend(job, index, left) && sent) {
+    // Its fills are counted, the next look prices the rest again
+    leg.replaced.push_back(leg.orderId);
+    leg.orderId = "0";
+  }
+  return false;
+}
+
+const char *ExecutionEngine::overdue(Leg const &leg, double left) const {
+  auto age = Clock::monoNs() - leg.lastSent;
+  if (params.maxOrderWait > 0 &&
+      age >= static_cast<int64_t>(params.maxOrderWait) * 1000000)
+    return "open for too long";
+  if (params.maxPriceDrift <= 0.0)
+    return nullptr;
+  bool isBuy = leg.direction == "buy";
+  double book =
+      exchanges[leg.exch].getLimitPrice(params, left, !isBuy);
+  double drift = isBuy ? book - leg.price : leg.price - book;
+  if (book > 0.0 && drift > params.maxPriceDrift * leg.price)
+    return "the book moved away from it";
+  return nullptr;
+}
+
+bool ExecutionEngine::resend(Job &job, unsigned index, double left) {
+  auto &leg = job.leg(index);
+  auto const &name = params.exchangeNames[leg.exch];
+  auto &logFile = *params.logFile;
+  double price =
+      exchanges[leg.exch].getLimitPrice(params, left, leg.direction == "sell");
+  logFile.precision(6);
+  if (price <= 0.0) {
+    logFile << "WARNING: cannot price the " << left << " " << params.leg1
+            << " left on " << name << ", order book empty" << std::endl;
+    return false;
+  }
+  logFile << "Sending " << left << " " << params.leg1 << " to "
+          << leg.direction << " on " << name << " @ $" << std::setprecision(2)
+          << price << std::endl;
+  if (!leg.orderId.empty() && leg.orderId != "0")
+    leg.replaced.push_back(leg.orderId);
+  leg.orderQuantity = left;
+  leg.price = price;
+  leg.orderId = send(leg);
+  leg.lastSent = Clock::monoNs();
+  onSent(job, leg);
+  job.stage = Job::resent;
+  job.resentLeg = index;
+  report(job);
+  return true;
+}
+
+// An entry leg given up on leaves the other one with more than it hedges.
+// The legs are of different quantities, the part of each that is hedged is
+// the smaller of their filled fractions; the surplus of the other leg is
+// traded back on its exchange, for up to MaxHedgeTime
+void ExecutionEngine::unwind(Job &job) {
+  auto const &legs = job.legs;
+  if (legs[0].quantity <= 0.0 || legs[1].quantity <= 0.0)
+    return;
+  double hedged = (std::min)(legs[0].executed / legs[0].quantity,
+                             legs[1].executed / legs[1].quantity);
+  double surplus[2];
+  for (unsigned i = 0; i < 2; ++i)
+    surplus[i] = legs[i].executed - hedged * legs[i].quantity;
+  unsigned over = surplus[0] >= surplus[1] ? 0 : 1;
+  if (surplus[over] < dust)
+    return;
+  auto &leg = job.unwind;
+  leg.exch = legs[over].exch;
+  leg.isShort = legs[over].isShort;
+  leg.direction = legs[over].direction == "buy" ? "sell" : "buy";
+  leg.quantity = surplus[over];
+  leg.type = legs[over].type;
+  leg.sent = Clock::monoNs();
+  auto &logFile = *params.logFile;
+  logFile.precision(6);
+  logFile << "WARNING: unwinding " << leg.quantity << " " << params.leg1
+          << " on " << params.exchangeNames[leg.exch]
+          << ", the other leg fell short" << std::endl;
+  auto pause = std::chrono::milliseconds(params.repriceInterval);
+  auto deadline = leg.sent + hedgeTime();
+  while (!resend(job, 2, leg.quantity)) {
+    if (Clock::monoNs() >= deadline) {
+      unhedged(leg, leg.quantity);
+      return;
+    }
+    std::this_thread::sleep_for(pause);
+  }
+  // follow() cancels the order at the deadline, and leaves it as it is a
+  // while later if it cannot be canceled or its status cannot be read
+  do
+    std::this_thread::sleep_for(pause);
+  while (!follow(job, 2, deadline));
+}
+
+int64_t ExecutionEngine::hedgeTime() const {
+  return static_cast<int64_t>(params.maxHedgeTime) * 1000000;
+}
+
+void ExecutionEngine::unhedged(Leg const &leg, double left) {
+  auto &logFile = *params.logFile;
+  logFile.precision(6);
+  logFile << "WARNING: up to " << left << " " << params.leg1
+          << " left unhedged on " << params.exchangeNames[leg.exch]
+          << std::endl;
+}
+
+// Stamps the leg when it is seen done, which is up to a polling period
+// after its last fill
+void ExecutionEngine::done(Leg &leg) {
+  leg.filled = Clock::monoNs();
+  latency()
+      .histogram(params.exchangeNames[leg.exch], "order", "sent_to_filled")
+      .record(std::chrono::nanoseconds(leg.filled - leg.sent));
+}
+
+// Sends an order and records how long the exchange took to accept it
+std::string ExecutionEngine::send(Leg const &leg) {
+  auto &exchange = exchanges[leg.exch];
+  LatencyTimer timer(latency().histogram(params.exchangeNames[leg.exch],
+                                         "order", "order_ack"));
+  if (leg.isShort)
+    return exchange.sendShortOrder(params, leg.direction, leg.orderQuantity,
+                                   leg.price, leg.type);
+  return exchange.sendLongOrder(params, leg.direction, leg.orderQuantity,
+                                leg.price, leg.type);
+}
+
+void ExecutionEngine::report(Job const &job) {
+  // The strategy thread drains the reports every iteration, a full queue
+  // only happens if it is stuck
+  while (!reports.push(job))
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
@@ -0,0 +1,203 @@
+#include "hex_str.hpp"
+#include "cpu_features.h"
+
+#include <chrono>
+#include <cstdio>
+#include <iomanip>
+#include <ostream>
+#include <random>
+
+#ifdef BLACKBIRD_X86
+#include <immintrin.h>
+#endif
+
+namespace {
+
+#ifdef BLACKBIRD_X86
+
+// Every byte becomes its high and low nibble digit, looked up with pshufb
+TARGET_SSSE3 std::size_t blocks_ssse3(const unsigned char *first,
+                                      std::size_t len, char *out, bool lower) {
+  const __m128i digits = lower ?
+      _mm_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7',
+                    '8', '9', 'a', 'b', 'c', 'd', 'e', 'f') :
+      _mm_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7',
+                    '8', '9', 'A', 'B', 'C', 'D', 'E', 'F');
+  const __m128i nibble = _mm_set1_epi8(0x0f);
+  std::size_t i = 0;
+  for (; len - i >= 16; i += 16, out += 32) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(first + i));
+    __m128i hi = _mm_shuffle_epi8(digits, _mm_and_si128(_mm_srli_epi16(v, 4), nibble));
+    __m128i lo = _mm_shuffle_epi8(digits, _mm_and_si128(v, nibble));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out), _mm_unpacklo_epi8(hi, lo));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 16), _mm_unpackhi_epi8(hi, lo));
+  }
+  return i;
+}
+
+TARGET_AVX2 std::size_t blocks_avx2(const unsigned char *first,
+                                    std::size_t len, char *out, bool lower) {
+  const __m256i digits = lower ?
+      _mm256_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7',
+                       '8', '9', 'a', 'b', 'c', 'd', 'e', 'f',
+                       '0', '1', '2', '3', '4', '5', '6', '7',
+                       '8', '9', 'a', 'b', 'c', 'd', 'e', 'f') :
+      _mm256_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7',
+                       '8', '9', 'A', 'B', 'C', 'D', 'E', 'F',
+                       '0', '1', '2', '3', '4', '5', '6', '7',
+                       '8', '9', 'A', 'B', 'C', 'D', 'E', 'F');
+  const __m256i nibble = _mm256_set1_epi8(0x0f);
+  std::size_t i = 0;
+  for (; len - i >= 32; i += 32, out += 64) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(first + i));
+    __m256i hi = _mm256_shuffle_epi8(digits, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+    __m256i lo = _mm256_shuffle_epi8(digits, _mm256_and_si256(v, nibble));
+    // unpack works per 128-bit lane, put the halves back in order
+    __m256i a = _mm256_unpacklo_epi8(hi, lo);
+    __m256i b = _mm256_unpackhi_epi8(hi, lo);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out),
+                        _mm256_permute2x128_si256(a, b, 0x20));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + 32),
+                        _mm256_permute2x128_si256(a, b, 0x31));
+  }
+  return i;
+}
+
+#endif
+
+enum class Path { scalar, ssse3, avx2 };
+
+Path best_path() {
+  static const Path path = cpuHasAVX2()  ? Path::avx2 :
+                           cpuHasSSSE3() ? Path::ssse3 :
+                                           Path::scalar;
+  return path;
+}
+
+std::size_t blocks_with(Path path, const unsigned char *first,
+                        std::size_t len, char *out, bool lower) {
+  std::size_t done = 0;
+#ifdef BLACKBIRD_X86
+  if (path == Path::avx2)
+    done += blocks_avx2(first, len, out, lower);
+  if (path >= Path::ssse3)
+    done += blocks_ssse3(first + done, len - done, out + 2 * done, lower);
+#endif
+  return done;
+}
+
+// hex_encode with the given path for the blocks
+template <bool Caps>
+std::string encode_with(Path path, std::string const &raw) {
+  auto bytes = reinterpret_cast<const unsigned char *>(raw.data());
+  std::string res(raw.size() * 2, '\0');
+  std::size_t done = blocks_with(path, bytes, raw.size(), &res[0], Caps);
+  const char *digits = hex_table<Caps>::digits.data();
+  for (std::size_t i = done; i < raw.size(); ++i) {
+    res[2 * i]     = digits[2 * bytes[i]];
+    res[2 * i + 1] = digits[2 * bytes[i] + 1];
+  }
+  return res;
+}
+
+// The encoding of the original hex_str, a byte at a time
+std::string reference_encode(std::string const &raw, bool lower) {
+  std::string res;
+  char digits[3];
+  for (unsigned char c : raw) {
+    std::snprintf(digits, sizeof(digits), lower ? "%02x" : "%02X", c);
+    res += digits;
+  }
+  return res;
+}
+
+const char *path_name(Path path) {
+  switch (path) {
+    case Path::avx2:  return "avx2";
+    case Path::ssse3: return "ssse3";
+    default:          return "scalar";
+  }
+}
+
+}
+
+std::size_t hex_encode_blocks(const unsigned char *first, std::size_t len,
+                              char *out, bool lower) {
+  return blocks_with(best_path(), first, len, out, lower);
+}
+
+bool testHexEncode(std::ostream &out) {
+  const struct {
+    std::string raw;
+    const char *lower;
+    const char *upper;
+  } known[] = {
+      {"", "", ""},
+      {std::string("\x00\x01\x7f\x80\xfe\xff", 6), "00017f80feff",
+       "00017F80FEFF"},
+      {"Blackbird", "426c61636b62697264", "426C61636B62697264"},
+  };
+  // Every byte value, in a buffer long enough for all the paths
+  std::string allBytes(256, '\0');
+  for (int i = 0; i < 256; ++i)
+    allBytes[i] = static_cast<char>(i);
+
+  std::mt19937 rng(2018);
+  int failures = 0;
+  for (int p = 0; p <= static_cast<int>(best_path()); ++p) {
+    auto path = static_cast<Path>(p);
+    int checked = 0, failed = 0;
+    for (auto const &k : known) {
+      failed += encode_with<lowerhex>(path, k.raw) != k.lower;
+      failed += encode_with<upperhex>(path, k.raw) != k.upper;
+      checked += 2;
+    }
+    failed += encode_with<lowerhex>(path, allBytes) !=
+              reference_encode(allBytes, true);
+    failed += encode_with<upperhex>(path, allBytes) !=
+              reference_encode(allBytes, false);
+    checked += 2;
+    for (std::size_t len = 0; len < 200; ++len) {
+      std::string raw(len, '\0');
+      for (auto &c : raw)
+        c = static_cast<char>(rng());
+      failed += encode_with<lowerhex>(path, raw) != reference_encode(raw, true);
+      failed +=
+          encode_with<upperhex>(path, raw) != reference_encode(raw, false);
+      checked += 2;
+    }
+    out << "   hex " << path_name(path) << ": " << checked - failed << "/"
+        << checked << " ok\n";
+    failures += failed;
+  }
+  return failures == 0;
+}
+
+void benchHexEncode(std::ostream &out) {
+  using clock = std::chrono::steady_clock;
+  std::mt19937 rng(2018);
+  // SHA-256/512 digests and a larger buffer
+  const std::size_t sizes[] = {32, 64, 4096};
+
+  out << "[ hex encode throughput, MB/s ]\n";
+  for (auto size : sizes) {
+    std::string raw(size, '\0');
+    for (auto &c : raw)
+      c = static_cast<char>(rng());
+    const int rounds = static_cast<int>((64 << 20) / size);
+    double mb = double(size) * rounds / (1 << 20);
+
+    out << "   " << std::setw(6) << size << " bytes:";
+    std::size_t check = 0;
+    for (int p = 0; p <= static_cast<int>(best_path()); ++p) {
+      auto path = static_cast<Path>(p);
+      auto start = clock::now();
+      for (int i = 0; i < rounds; ++i)
+        check += encode_with<lowerhex>(path, raw).size();
+      std::chrono::duration<double> t = clock::now() - start;
+      out << (p ? ", " : " ") << path_name(path) << " " << std::fixed
+          << std::setprecision(0) << mb / t.count();
+    }
+    out << (check == 0 ? " (no output)" : "") << '\n';
+  }
+}
@@ -0,0 +1,384 @@
+#include "journal.h"
+#include "durable_file.h"
+#include "time_fun.h"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <iomanip>
+#include <map>
+
+namespace {
+
+const char magic[8] = {'B', 'B', 'J', 'R', 'N', 'L', '\0', '\1'};
+// Header after the size field: event and time
+constexpr size_t headerSize = sizeof(uint16_t) + sizeof(int64_t);
+constexpr size_t maxRecordSize = 1 << 16;
+// Quotes are written out once this much is buffered
+constexpr size_t bufferLimit = 1 << 16;
+
+std::array<uint32_t, 256> makeCrcTable() {
+  std::array<uint32_t, 256> table;
+  for (uint32_t i = 0; i < 256; ++i) {
+    uint32_t c = i;
+    for (int k = 0; k < 8; ++k)
+      c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+    table[i] = c;
+  }
+  return table;
+}
+
+// CRC-32 as in zlib
+uint32_t crc32(const char *data, size_t n) {
+  static const auto table = makeCrcTable();
+  uint32_t c = 0xFFFFFFFFu;
+  for (size_t i = 0; i < n; ++i)
+    c = table[(c ^ static_cast<uint8_t>(data[i])) & 0xFF] ^ (c >> 8);
+  return c ^ 0xFFFFFFFFu;
+}
+
+// Reads the payload fields in the order Journal wrote them
+class Payload {
+  const char *pos;
+  const char *end;
+
+public:
+  Payload(const char *data, size_t n) : pos(data), end(data + n) {}
+
+  bool ok = true;
+
+  template <typename T> T get() {
+    T value{};
+    if (end - pos < static_cast<ptrdiff_t>(sizeof(T))) {
+      ok = false;
+      return value;
+    }
+    std::memcpy(&value, pos, sizeof(T));
+    pos += sizeof(T);
+    return value;
+  }
+
+  std::string getString() {
+    auto n = get<uint16_t>();
+    if (end - pos < n) {
+      ok = false;
+      return std::string();
+    }
+    std::string s(pos, n);
+    pos += n;
+    return s;
+  }
+};
+}
+
+Journal::Journal(std::string const &fileName) {
+  buffer.reserve(bufferLimit + maxRecordSize);
+  // The records appended after one cut by a crash could not be replayed
+  {
+    JournalReader reader(fileName);
+    JournalEntry entry;
+    while (reader.next(entry)) {
+    }
+    if (reader.damaged())
+      truncateFile(fileName, reader.wholeSize());
+  }
+  file = std::fopen(fileName.c_str(), "ab");
+  if (file && std::fseek(file, 0, SEEK_END) == 0 && std::ftell(file) == 0) {
+    std::fwrite(magic, 1, sizeof(magic), file);
+    std::fflush(file);
+  }
+}
+
+Journal::~Journal() {
+  if (file) {
+    sync();
+    std::fclose(file);
+  }
+}
+
+template <typename T> void Journal::put(T value) {
+  auto size = buffer.size();
+  buffer.resize(size + sizeof(T));
+  std::memcpy(buffer.data() + size, &value, sizeof(T));
+}
+
+void Journal::put(std::string const &s) {
+  auto n = static_cast<uint16_t>((std::min)(s.size(), size_t(1024)));
+  put(n);
+  buffer.insert(buffer.end(), s.data(), s.data() + n);
+}
+
+// Called with 'mtx' held, 'end' closes the record
+void Journal::begin(JournalEvent event, int64_t time) {
+  recordStart = buffer.size();
+  put(uint32_t(0));
+  put(static_cast<uint16_t>(event));
+  put(time);
+}
+
+void Journal::end(bool flush) {
+  auto body = recordStart + sizeof(uint32_t);
+  auto size = static_cast<uint32_t>(buffer.size() - body);
+  std::memcpy(buffer.data() + recordStart, &size, sizeof(size));
+  put(crc32(buffer.data() + body, size));
+  if (flush) {
+    write();
+    std::fflush(file);
+  } else if (buffer.size() >= bufferLimit) {
+    write();
+  }
+}
+
+void Journal::write() {
+  if (!buffer.empty())
+    std::fwrite(buffer.data(), 1, buffer.size(), file);
+  buffer.clear();
+}
+
+void Journal::sync() {
+  if (!file)
+    return;
+  std::lock_guard<std::mutex> lock(mtx);
+  write();
+  std::fflush(file);
+}
+
+void Journal::venue(unsigned exch, std::string const &name, double fees) {
+  if (!file)
+    return;
+  std::lock_guard<std::mutex> lock(mtx);
+  begin(JournalEvent::venue);
+  put(uint32_t(exch));
+  put(fees);
+  put(name);
+  end(false);
+}
+
+void Journal::quote(unsigned exch, double bid, double ask, int64_t time) {
+  if (!file)
+    return;
+  std::lock_guard<std::mutex> lock(mtx);
+  begin(JournalEvent::quote, time);
+  put(uint32_t(exch));
+  put(bid);
+  put(ask);
+  end(false);
+}
+
+void Journal::decision(JournalDecision kind, unsigned exchLong,
+                       unsigned exchShort, double spread, double exposure,
+                       std::string const &reason) {
+  if (!file)
+    return;
+  std::lock_guard<std::mutex> lock(mtx);
+  begin(JournalEvent::decision);
+  put(static_cast<uint8_t>(kind));
+  put(uint32_t(exchLong));
+  put(uint32_t(exchShort));
+  put(spread);
+  put(exposure);
+  put(reason);
+  end(kind != JournalDecision::canceled);
+}
+
+void Journal::order(unsigned exch, std::string const &direction, bool isShort,
+                    double quantity, double price,
+                    std::string const &orderId) {
+  if (!file)
+    return;
+  std::lock_guard<std::mutex> lock(mtx);
+  begin(JournalEvent::order);
+  put(uint32_t(exch));
+  put(uint8_t(direction == "buy"));
+  put(uint8_t(isShort));
+  put(quantity);
+  put(price);
+  put(orderId);
+  end(true);
+}
+
+void Journal::fill(unsigned exch, std::string const &orderId, double quantity,
+                   double price) {
+  if (!file)
+    return;
+  std::lock_guard<std::mutex> lock(mtx);
+  begin(JournalEvent::fill);
+  put(uint32_t(exch));
+  put(quantity);
+  put(price);
+  put(orderId);
+  end(true);
+}
+
+void Journal::balance(unsigned exch, double leg1, double leg2) {
+  if (!file)
+    return;
+  std::lock_guard<std::mutex> lock(mtx);
+  begin(JournalEvent::balance);
+  put(uint32_t(exch));
+  put(leg1);
+  put(leg2);
+  end(true);
+}
+
+JournalReader::JournalReader(std::string const &fileName)
+    : file(std::fopen(fileName.c_str(), "rb")) {
+  char head[sizeof(magic)];
+  if (file && (std::fread(head, 1, sizeof(head), file) != sizeof(head) ||
+               std::memcmp(head, magic, sizeof(magic)) != 0))
+    bad = true;
+  else if (file)
+    whole = sizeof(magic);
+}
+
+JournalReader::~JournalReader() {
+  if (file)
+    std::fclose(file);
+}
+
+bool JournalReader::next(JournalEntry &entry) {
+  if (!file || bad)
+    return false;
+  uint32_t size;
+  auto got = std::fread(&size, 1, sizeof(size), file);
+  if (got == 0)
+    return false;
+  if (got != sizeof(size) || size < headerSize || size > maxRecordSize) {
+    bad = true;
+    return false;
+  }
+  // A record cut short by a crash ends here
+  record.resize(size + sizeof(uint32_t));
+  if (std::fread(record.data(), 1, record.size(), file) != record.size()) {
+    bad = true;
+    return false;
+  }
+  uint32_t crc;
+  std::memcpy(&crc, record.data() + size, sizeof(crc));
+  if (crc != crc32(record.data(), size)) {
+    bad = true;
+    return false;
+  }
+
+  Payload in(record.data(), size);
+  entry = JournalEntry();
+  entry.event = static_cast<JournalEvent>(in.get<uint16_t>());
+  entry.time = in.get<int64_t>();
+  switch (entry.event) {
+  case JournalEvent::venue:
+    entry.exch = in.get<uint32_t>();
+    entry.fees = in.get<double>();
+    entry.text = in.getString();
+    break;
+  case JournalEvent::quote:
+    entry.exch = in.get<uint32_t>();
+    entry.bid = in.get<double>();
+    entry.ask = in.get<double>();
+    break;
+  case JournalEvent::decision:
+    entry.kind = in.get<uint8_t>();
+    entry.exch = in.get<uint32_t>();
+    entry.exchShort = in.get<uint32_t>();
+    entry.spread = in.get<double>();
+    entry.exposure = in.get<double>();
+    entry.text = in.getString();
+    break;
+  case JournalEvent::order:
+    entry.exch = in.get<uint32_t>();
+    entry.kind = in.get<uint8_t>();
+    entry.isShort = in.get<uint8_t>() != 0;
+    entry.quantity = in.get<double>();
+    entry.price = in.get<double>();
+    entry.text = in.getString();
+    break;
+  case JournalEvent::fill:
+    entry.exch = in.get<uint32_t>();
+    entry.quantity = in.get<double>();
+    entry.price = in.get<double>();
+    entry.text = in.getString();
+    break;
+  case JournalEvent::balance:
+    entry.exch = in.get<uint32_t>();
+    entry.leg1 = in.get<double>();
+    entry.leg2 = in.get<double>();
+    break;
+  default:
+    // Unknown event from a newer version, its CRC was fine so skip it
+    break;
+  }
+  if (!in.ok)
+    bad = true;
+  else
+    whole += static_cast<long>(sizeof(size) + record.size());
+  return in.ok;
+}
+
+int replayJournal(std::string const &fileName, std::ostream &out) {
+  JournalReader reader(fileName);
+  if (!reader.isOpen()) {
+    out << "ERROR: cannot open " << fileName << std::endl;
+    return 1;
+  }
+  std::map<unsigned, std::string> names;
+  auto name = [&names](unsigned exch) {
+    auto it = names.find(exch);
+    return it != names.end() ? it->second : "#" + std::to_string(exch);
+  };
+
+  out << std::fixed;
+  JournalEntry e;
+  size_t count = 0;
+  while (reader.next(e)) {
+    ++count;
+    char stamp[maxDateTimeSize];
+    out.write(stamp, formatDateTime(stamp, Clock::wallTime(e.time),
+                                    SubSecond::millis))
+        << "  ";
+    switch (e.event) {
+    case JournalEvent::venue:
+      names[e.exch] = e.text;
+      out << "venue     " << e.exch << " = " << e.text << ", fees "
+          << std::setprecision(4) << e.fees * 100.0 << "%";
+      break;
+    case JournalEvent::quote:
+      out << "quote     " << name(e.exch) << "  " << std::setprecision(2)
+          << e.bid << " / " << e.ask;
+      break;
+    case JournalEvent::decision: {
+      static const char *kinds[] = {"entry", "exit", "canceled"};
+      out << "decision  " << (e.kind < 3 ? kinds[e.kind] : "?") << " long "
+          << name(e.exch) << " / short " << name(e.exchShort) << "  spread "
+          << std::setprecision(4) << e.spread * 100.0 << "%, exposure "
+          << std::setprecision(2) << e.exposure;
+      if (!e.text.empty())
+        out << "  (" << e.text << ")";
+      break;
+    }
+    case JournalEvent::order:
+      out << "order     " << name(e.exch) << "  " << (e.kind ? "buy" : "sell")
+          << (e.isShort ? " short " : " ") << std::setprecision(6)
+          << e.quantity << " @ " << std::setprecision(2) << e.price
+          << "  id " << e.text;
+      break;
+    case JournalEvent::fill:
+      out << "fill      " << name(e.exch) << "  " << std::setprecision(6)
+          << e.quantity << " @ " << std::setprecision(2) << e.price
+          << "  id " << e.text;
+      break;
+    case JournalEvent::balance:
+      out << "balance   " << name(e.exch) << "  " << std::setprecision(6)
+          << e.leg1 << " / " << std::setprecision(2) << e.leg2;
+      break;
+    default:
+      out << "event " << static_cast<unsigned>(e.event) << " (unknown)";
+      break;
+    }
+    out << '\n';
+  }
+  if (reader.damaged()) {
+    out << "WARNING: journal damaged after " << count << " record(s)"
+        << std::endl;
+    return 1;
+  }
+  out << count << " record(s)" << std::endl;
+  return 0;
+}
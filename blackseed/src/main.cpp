@@ -1,26 +1,30 @@
+#include "balance_ledger.h"
 #include "bitcoin.h"
 #include "result.h"
+#include "state_store.h"
 #include "time_fun.h"
 #include "curl_fun.h"
 #include "db_fun.h"
+#include "exchange_registry.h"
+#include "execution_engine.h"
+#include "market_feed.h"
 #include "parameters.h"
 #include "check_entry_exit.h"
-#include "exchanges/bitfinex.h"
-#include "exchanges/okcoin.h"
-#include "exchanges/bitstamp.h"
-#include "exchanges/gemini.h"
-#include "exchanges/kraken.h"
-#include "exchanges/quadrigacx.h"
-#include "exchanges/itbit.h"
-#include "exchanges/wex.h"
-#include "exchanges/poloniex.h"
-#include "exchanges/coinbase.h"
-#include "exchanges/exmo.h"
-#include "exchanges/cexio.h"
-#include "exchanges/bittrex.h"
-#include "exchanges/binance.h"
+#include "config_watcher.h"
+#include "journal.h"
+#include "paper_trading.h"
+#include "tick_to_trade.h"
+#include "venue_health.h"
+#include "warmup.h"
+#include "utils/base64.h"
+#include "utils/hmac_signer.h"
+#include "utils/latency.h"
+#include "utils/metrics.h"
 #include "utils/send_email.h"
+#include "utils/thread_affinity.h"
+#include "simulator/exchange_simulator.h"
 #include "getpid.h"
+#include "hex_str.hpp"
 
 #include <algorithm>
 #include <chrono>
@@ -29,24 +33,11 @@
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <set>
 #include <thread>
 
-// The 'typedef' declarations needed for the function arrays
-// These functions contain everything needed to communicate with
-// the exchanges, like getting the quotes or the active positions.
-// Each function is implemented in the files located in the 'exchanges' folder.
-
-using getQuoteType = quote_t (*)(Parameters &);
-using getAvailType = double (*)(Parameters &, std::string const &currency);
-using sendOrderType = std::string (*)(Parameters &params,
-                                      std::string const &direction,
-                                      double const quantity,
-                                      double const price);
-using isOrderCompleteType = bool (*)(Parameters &, std::string const &orderId);
-using getActivePosType = double (*)(Parameters &);
-using getLimitPriceType = double (*)(Parameters &, double const volume,
-                                     bool const isBid);
-
 // This structure contains the balance of both exchanges,
 // *before* and *after* an arbitrage trade.
 // This is used to compute the performance of the trade,
@@ -59,26 +50,61 @@ struct Balance {
   double leg2After = 0.0;
 };
 
-struct callback_t {
-  getQuoteType getQuote = nullptr;
-  getAvailType getAvail = nullptr;
-  sendOrderType sendLongOrder = nullptr;
-  sendOrderType sendShortOrder = nullptr;
-  isOrderCompleteType isOrderComplete = nullptr;
-  getActivePosType getActivePos = nullptr;
-  getLimitPriceType getLimitPrice = nullptr;
-  std::string dbTableName = nullptr;
-};
+// Reads blackbird.conf, exits with a message if it is not valid
+static std::unique_ptr<Parameters> loadParameters() {
+  try {
+    return std::unique_ptr<Parameters>(new Parameters("blackbird.conf"));
+  } catch (ConfigError const &e) {
+    std::cout << "ERROR: " << e.what() << "\n" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+}
+
+// Checks the vectorized encoders against the plain ones and, with 'bench',
+// prints their throughput and the signing rate of HmacSigner. Returns
+// EXIT_FAILURE on a mismatch.
+static int runSelfTest(bool bench, std::ostream &out) {
+  out << "[ Encoders against the plain code paths ]\n";
+  bool ok = testBase64(out);
+  ok = testHexEncode(out) && ok;
+  if (bench) {
+    out << '\n';
+    benchBase64(out);
+    benchHexEncode(out);
+    benchHmacSigner(out);
+  }
+  out << (ok ? "\nSelf-test passed" : "\nERROR: self-test failed") << std::endl;
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
 
 // 'main' function.
-// Blackbird doesn't require any arguments for now.
+// Blackbird doesn't require any arguments, except to print a journal
+// written by a previous run: blackbird --replay <journal file>
+// or to measure the hot path on recorded exchange responses:
+// blackbird --bench [fixture directory] [rounds]
+// or to serve the local exchange simulator: blackbird --simulator
+// or to check the encoders, and time them: blackbird --selftest [--bench]
 int main(int argc, char **argv) {
+  if (argc == 3 && std::string(argv[1]) == "--replay")
+    return replayJournal(argv[2], std::cout);
+  if (argc >= 2 && argc <= 4 && std::string(argv[1]) == "--bench")
+    return benchTickToTrade(argc > 2 ? argv[2] : "fixtures",
+                            argc > 3 ? std::stoul(argv[3]) : 10000, std::cout);
+  if (argc == 2 && std::string(argv[1]) == "--simulator")
+    return runSimulator(*loadParameters(), std::cout);
+  if ((argc == 2 || (argc == 3 && std::string(argv[2]) == "--bench")) &&
+      std::string(argv[1]) == "--selftest")
+    return runSelfTest(argc == 3, std::cout);
   std::cout << "Blackbird Bitcoin Arbitrage" << std::endl;
   std::cout << "DISCLAIMER: USE THE SOFTWARE AT YOUR OWN RISK\n" << std::endl;
   // Replaces the C++ global locale with the user-preferred locale
   std::locale mylocale("");
   // Loads all the parameters
-  Parameters params("blackbird.conf");
+  auto loaded = loadParameters();
+  Parameters &params = *loaded;
+  // Paper trading goes through the whole trading path
+  if (params.paperTrading)
+    params.isDemoMode = false;
   // Does some verifications about the parameters
   if (!params.isDemoMode) {
     if (!params.useFullExposure) {
@@ -106,6 +132,17 @@ int main(int argc, char **argv) {
       params.cacert.clear();
   }
 
+  // On the simulator only the simulated exchanges are kept, the other
+  // ones would still trade for real
+  if (params.useSimulator) {
+    useSimulator(params.simulatorPort);
+    params.okcoinEnable = params.geminiEnable = params.itbitEnable = false;
+    params.wexEnable = params.poloniexEnable = params.exmoEnable = false;
+    params.cexioEnable = params.bittrexEnable = false;
+    std::cout << "Trading on the exchange simulator from port "
+              << params.simulatorPort << "\n" << std::endl;
+  }
+
   // Connects to the SQLite3 database.
   // This database is used to collect bid and ask information
   // from the exchanges. Not really used for the moment, but
@@ -124,243 +161,10 @@ int main(int argc, char **argv) {
     exit(EXIT_FAILURE);
   }
 
-  // Function arrays containing all the exchanges functions
-  // using the 'typedef' declarations from above.
-  std::vector<callback_t> callbacks;
-
-  // Adds the exchange functions to the arrays for all the defined exchanges
-  if (params.bitfinexEnable &&
-      (params.bitfinexApi.empty() == false || params.isDemoMode)) {
-    params.addExchange("Bitfinex", params.bitfinexFees, true, true);
-    callback_t bitfinexApiCallback;
-
-    bitfinexApiCallback.getQuote = Bitfinex::getQuote;
-    bitfinexApiCallback.getAvail = Bitfinex::getAvail;
-    bitfinexApiCallback.sendLongOrder = Bitfinex::sendLongOrder;
-    bitfinexApiCallback.sendShortOrder = Bitfinex::sendShortOrder;
-    bitfinexApiCallback.isOrderComplete = Bitfinex::isOrderComplete;
-    bitfinexApiCallback.getActivePos = Bitfinex::getActivePos;
-    bitfinexApiCallback.getLimitPrice = Bitfinex::getLimitPrice;
-
-    bitfinexApiCallback.dbTableName = "bitfinex";
-    createTable(bitfinexApiCallback.dbTableName, params);
-    callbacks.push_back(std::move(bitfinexApiCallback));
-  }
-
-  if (params.okcoinEnable &&
-      (params.okcoinApi.empty() == false || params.isDemoMode)) {
-    params.addExchange("OKCoin", params.okcoinFees, false, true);
-    callback_t okcoinApiCallback;
-    okcoinApiCallback.getQuote = OKCoin::getQuote;
-    okcoinApiCallback.getAvail = OKCoin::getAvail;
-    okcoinApiCallback.sendLongOrder = OKCoin::sendLongOrder;
-    okcoinApiCallback.sendShortOrder = OKCoin::sendShortOrder;
-    okcoinApiCallback.isOrderComplete = OKCoin::isOrderComplete;
-    okcoinApiCallback.getActivePos = OKCoin::getActivePos;
-    okcoinApiCallback.getLimitPrice = OKCoin::getLimitPrice;
-
-    okcoinApiCallback.dbTableName = "okcoin";
-    createTable(okcoinApiCallback.dbTableName, params);
-    callbacks.push_back(std::move(okcoinApiCallback));
-  }
-
-  if (params.bitstampEnable &&
-      (params.bitstampClientId.empty() == false || params.isDemoMode)) {
-    params.addExchange("Bitstamp", params.bitstampFees, false, true);
-
-    callback_t bitstampApiCallback;
-    bitstampApiCallback.getQuote = Bitstamp::getQuote;
-    bitstampApiCallback.getAvail = Bitstamp::getAvail;
-    bitstampApiCallback.sendLongOrder = Bitstamp::sendLongOrder;
-    bitstampApiCallback.isOrderComplete = Bitstamp::isOrderComplete;
-    bitstampApiCallback.getActivePos = Bitstamp::getActivePos;
-    bitstampApiCallback.getLimitPrice = Bitstamp::getLimitPrice;
-
-    bitstampApiCallback.dbTableName = "bitstamp";
-    createTable(bitstampApiCallback.dbTableName, params);
-    callbacks.push_back(std::move(bitstampApiCallback));
-  }
-
-  if (params.geminiEnable &&
-      (params.geminiApi.empty() == false || params.isDemoMode)) {
-    params.addExchange("Gemini", params.geminiFees, false, true);
-
-    callback_t geminiApiCallback;
-    geminiApiCallback.getQuote = Gemini::getQuote;
-    geminiApiCallback.getAvail = Gemini::getAvail;
-    geminiApiCallback.sendLongOrder = Gemini::sendLongOrder;
-    geminiApiCallback.isOrderComplete = Gemini::isOrderComplete;
-    geminiApiCallback.getActivePos = Gemini::getActivePos;
-    geminiApiCallback.getLimitPrice = Gemini::getLimitPrice;
-
-    geminiApiCallback.dbTableName = "gemini";
-    createTable(geminiApiCallback.dbTableName, params);
-    callbacks.push_back(std::move(geminiApiCallback));
-  }
-
-  if (params.krakenEnable &&
-      (params.krakenApi.empty() == false || params.isDemoMode)) {
-    params.addExchange("Kraken", params.krakenFees, false, true);
-
-    callback_t krakenApiCallback;
-    krakenApiCallback.getQuote = Kraken::getQuote;
-    krakenApiCallback.getAvail = Kraken::getAvail;
-    krakenApiCallback.sendLongOrder = Kraken::sendLongOrder;
-    krakenApiCallback.sendShortOrder = Kraken::sendShortOrder;
-    krakenApiCallback.isOrderComplete = Kraken::isOrderComplete;
-    krakenApiCallback.getActivePos = Kraken::getActivePos;
-    krakenApiCallback.getLimitPrice = Kraken::getLimitPrice;
-
-    krakenApiCallback.dbTableName = "kraken";
-    createTable(krakenApiCallback.dbTableName, params);
-    callbacks.push_back(std::move(krakenApiCallback));
-  }
-
-  if (params.itbitEnable &&
-      (params.itbitApi.empty() == false || params.isDemoMode)) {
-    params.addExchange("ItBit", params.itbitFees, false, false);
-    callback_t itbitApiCallback;
-    itbitApiCallback.getQuote = ItBit::getQuote;
-    itbitApiCallback.getAvail = ItBit::getAvail;
-    itbitApiCallback.getActivePos = ItBit::getActivePos;
-    itbitApiCallback.getLimitPrice = ItBit::getLimitPrice;
-
-    itbitApiCallback.dbTableName = "itbit";
-    createTable(itbitApiCallback.dbTableName, params);
-
-    callbacks.push_back(std::move(itbitApiCallback));
-  }
-
-  if (params.wexEnable &&
-      (params.wexApi.empty() == false || params.isDemoMode)) {
-    params.addExchange("WEX", params.wexFees, false, true);
-
-    callback_t wexApiCallback;
-    wexApiCallback.getQuote = WEX::getQuote;
-    wexApiCallback.getAvail = WEX::getAvail;
-    wexApiCallback.sendLongOrder = WEX::sendLongOrder;
-    wexApiCallback.isOrderComplete = WEX::isOrderComplete;
-    wexApiCallback.getActivePos = WEX::getActivePos;
-    wexApiCallback.getLimitPrice = WEX::getLimitPrice;
-
-    wexApiCallback.dbTableName = "wex";
-    createTable(wexApiCallback.dbTableName, params);
-
-    callbacks.push_back(std::move(wexApiCallback));
-  }
-
-  if (params.poloniexEnable &&
-      (params.poloniexApi.empty() == false || params.isDemoMode)) {
-    params.addExchange("Poloniex", params.poloniexFees, true, false);
-
-    callback_t poloniexApiCallback;
-
-    poloniexApiCallback.getQuote = Poloniex::getQuote;
-    poloniexApiCallback.getAvail = Poloniex::getAvail;
-    poloniexApiCallback.sendLongOrder = Poloniex::sendLongOrder;
-    poloniexApiCallback.sendShortOrder = Poloniex::sendShortOrder;
-    poloniexApiCallback.isOrderComplete = Poloniex::isOrderComplete;
-    poloniexApiCallback.getActivePos = Poloniex::getActivePos;
-    poloniexApiCallback.getLimitPrice = Poloniex::getLimitPrice;
-
-    poloniexApiCallback.dbTableName = "poloniex";
-    createTable(poloniexApiCallback.dbTableName, params);
-
-    callbacks.push_back(std::move(poloniexApiCallback));
-  }
-
-  if (params.coinbaseEnable &&
-      (params.coinbaseApi.empty() == false || params.isDemoMode)) {
-    params.addExchange("CoinBasePro", params.coinbaseFees, false, true);
-
-    callback_t coinbaseApiCallback;
-    coinbaseApiCallback.getQuote = coinbase::getQuote;
-    coinbaseApiCallback.getAvail = coinbase::getAvail;
-    coinbaseApiCallback.getActivePos = coinbase::getActivePos;
-    coinbaseApiCallback.getLimitPrice = coinbase::getLimitPrice;
-    coinbaseApiCallback.sendLongOrder = coinbase::sendLongOrder;
-    coinbaseApiCallback.isOrderComplete = coinbase::isOrderComplete;
-    coinbaseApiCallback.dbTableName = "CoinbasePro";
-    createTable(coinbaseApiCallback.dbTableName, params);
-
-    callbacks.push_back(std::move(coinbaseApiCallback));
-  }
-
-  // Quadriga no longer trade crypto, so it's been removed here.
-
-  if (params.exmoEnable &&
-      (params.exmoApi.empty() == false || params.isDemoMode)) {
-    params.addExchange("Exmo", params.exmoFees, false, true);
-
-    callback_t exmoApiCallback;
-    exmoApiCallback.getQuote = Exmo::getQuote;
-    exmoApiCallback.getAvail = Exmo::getAvail;
-    exmoApiCallback.sendLongOrder = Exmo::sendLongOrder;
-    exmoApiCallback.isOrderComplete = Exmo::isOrderComplete;
-    exmoApiCallback.getActivePos = Exmo::getActivePos;
-    exmoApiCallback.getLimitPrice = Exmo::getLimitPrice;
-
-    exmoApiCallback.dbTableName = "exmo";
-    createTable(exmoApiCallback.dbTableName, params);
-
-    callbacks.push_back(std::move(exmoApiCallback));
-  }
-
-  if (params.cexioEnable &&
-      (params.cexioApi.empty() == false || params.isDemoMode)) {
-    params.addExchange("Cexio", params.cexioFees, false, true);
-
-    callback_t cexiApiCallback;
-    cexiApiCallback.getQuote = Cexio::getQuote;
-    cexiApiCallback.getAvail = Cexio::getAvail;
-    cexiApiCallback.sendLongOrder = Cexio::sendLongOrder;
-    cexiApiCallback.sendShortOrder = Cexio::sendShortOrder;
-    cexiApiCallback.isOrderComplete = Cexio::isOrderComplete;
-    cexiApiCallback.getActivePos = Cexio::getActivePos;
-    cexiApiCallback.getLimitPrice = Cexio::getLimitPrice;
-
-    cexiApiCallback.dbTableName = "cexio";
-    createTable(cexiApiCallback.dbTableName, params);
-
-    callbacks.push_back(std::move(cexiApiCallback));
-  }
-
-  if (params.bittrexEnable &&
-      (params.bittrexApi.empty() == false || params.isDemoMode)) {
-    params.addExchange("Bittrex", params.bittrexFees, false, true);
-
-    callback_t bittrexApiCallback;
-
-    bittrexApiCallback.getQuote = Bittrex::getQuote;
-    bittrexApiCallback.getAvail = Bittrex::getAvail;
-    bittrexApiCallback.sendLongOrder = Bittrex::sendLongOrder;
-    bittrexApiCallback.sendShortOrder = Bittrex::sendShortOrder;
-    bittrexApiCallback.isOrderComplete = Bittrex::isOrderComplete;
-    bittrexApiCallback.getActivePos = Bittrex::getActivePos;
-    bittrexApiCallback.getLimitPrice = Bittrex::getLimitPrice;
-    bittrexApiCallback.dbTableName = "bittrex";
-    createTable(bittrexApiCallback.dbTableName, params);
-
-    callbacks.push_back(std::move(bittrexApiCallback));
-  }
-
-  if (params.binanceEnable &&
-      (params.binanceApi.empty() == false || params.isDemoMode)) {
-    params.addExchange("Binance", params.binanceFees, false, true);
-
-    callback_t binanceApiCallback;
-    binanceApiCallback.getQuote = Binance::getQuote;
-    binanceApiCallback.getAvail = Binance::getAvail;
-    binanceApiCallback.sendLongOrder = Binance::sendLongOrder;
-    binanceApiCallback.sendShortOrder = Binance::sendShortOrder;
-    binanceApiCallback.isOrderComplete = Binance::isOrderComplete;
-    binanceApiCallback.getActivePos = Binance::getActivePos;
-    binanceApiCallback.getLimitPrice = Binance::getLimitPrice;
-    binanceApiCallback.dbTableName = "binance";
-    createTable(binanceApiCallback.dbTableName, params);
-
-    callbacks.push_back(std::move(binanceApiCallback));
-  }
+  // The exchanges enabled in the configuration, see exchange_registry.h.
+  // API keys are only needed to send real orders.
+  std::vector<ExchangeApi> callbacks =
+      enabledExchanges(params, params.isDemoMode || params.paperTrading);
 
   // We need at least two exchanges to run Blackbird
   if (callbacks.size() < 2) {
@@ -369,6 +173,22 @@ int main(int argc, char **argv) {
               << std::endl;
     exit(EXIT_FAILURE);
   }
+  // In paper trading the orders and balances are the ones of PaperTrading,
+  // the quotes and order books still come from the exchanges
+  std::unique_ptr<PaperTrading> paper;
+  if (params.paperTrading) {
+    paper.reset(new PaperTrading(params));
+    for (auto &exchange : callbacks) {
+      auto exch = paper->addExchange(
+          [&exchange](Parameters &params) {
+            return syncWait(exchange.getQuote(params));
+          },
+          [&exchange](Parameters &params, double volume, bool isBid) {
+            return exchange.getLimitPrice(params, volume, isBid);
+          });
+      exchange.usePaperTrading(paper.get(), exch);
+    }
+  }
   // Creates the CSV file that will collect the trade results
   std::string currDateTime = printDateTimeFileName();
   std::string csvFileName = "output/blackbird_result_" + currDateTime + ".csv";
@@ -376,13 +196,21 @@ int main(int argc, char **argv) {
   csvFile
       << "TRADE_ID,EXCHANGE_LONG,EXHANGE_SHORT,ENTRY_TIME,EXIT_TIME,DURATION,"
       << "TOTAL_EXPOSURE,BALANCE_BEFORE,BALANCE_AFTER,RETURN" << std::endl;
+  // Binary journal of the quotes, decisions, orders, fills and balances.
+  // Print it with 'blackbird --replay <file>'.
+  Journal journal("output/blackbird_journal_" + currDateTime + ".bin");
   // Creates the log file where all events will be saved
   std::string logFileName = "output/blackbird_log_" + currDateTime + ".log";
-  std::ofstream logFile(logFileName, std::ofstream::trunc);
-  logFile.imbue(mylocale);
-  logFile.precision(2);
-  logFile << std::fixed;
-  params.logFile = &logFile;
+  std::ofstream logSink(logFileName, std::ofstream::trunc);
+  logSink.imbue(mylocale);
+  // Every thread's stream starts with the format of the file
+  logSink.precision(2);
+  logSink << std::fixed;
+  // Lines are written and flushed by the log's own thread
+  AsyncLog asyncLog(logSink, parseLogLevel(params.logLevel));
+  std::ostream &logFile = asyncLog.stream();
+  params.logFile = asyncLog;
+  params.log = &asyncLog;
   // Log file header
   logFile << "--------------------------------------------" << std::endl;
   logFile << "|   Blackbird Bitcoin Arbitrage Log File   |" << std::endl;
@@ -394,6 +222,11 @@ int main(int argc, char **argv) {
   if (params.isDemoMode) {
     logFile << "Demo mode: trades won't be generated\n" << std::endl;
   }
+  if (params.paperTrading) {
+    logFile << "Paper trading: orders are filled against the live order "
+               "books, balances are virtual\n"
+            << std::endl;
+  }
 
   // Shows which pair we are trading (BTC/USD only for the moment)
   logFile << "Pair traded: " << params.leg1 << "/" << params.leg2 << "\n"
@@ -412,6 +245,7 @@ int main(int argc, char **argv) {
   for (size_t i = 0; i < callbacks.size(); ++i) {
     btcVec.push_back(Bitcoin(i, params.exchangeNames[i], params.fees[i],
                              params.canShort[i], params.isImplemented[i]));
+    journal.venue(i, params.exchangeNames[i], params.fees[i]);
   }
 
   // Inits cURL connections
@@ -431,24 +265,167 @@ int main(int argc, char **argv) {
     logFile << "   WARNING: Spread Target should be positive" << std::endl;
   }
   logFile << std::endl;
-  logFile << "[ Current balances ]" << std::endl;
-  // Gets the the balances from every exchange
+  // Gets the the balances from every exchange, they are then kept up
+  // to date by the ledger.
   // This is only done when not in Demo mode.
+  std::vector<BalanceLedger::getAvailFn> getAvailFns;
+  for (auto const &exchange : callbacks)
+    getAvailFns.push_back(
+        [&exchange](Parameters &params, std::string const &currency) {
+          return exchange.getAvail(params, currency);
+        });
+  BalanceLedger ledger(params, std::move(getAvailFns),
+                       std::chrono::seconds(params.reconcileInterval));
   std::vector<Balance> balance(callbacks.size());
-  if (!params.isDemoMode)
-    std::transform(callbacks.begin(), callbacks.end(), begin(balance),
-                   [&params](auto &callbackData) {
-                     Balance tmp{};
-                     tmp.leg1 = callbackData.getAvail(params, "btc");
-                     tmp.leg2 = callbackData.getAvail(params, "usd");
-                     return tmp;
-                   });
+  // The quotes, order books and balances of all the exchanges are read at
+  // once, startup takes about the time of the slowest exchange
+  auto warmupStart = std::chrono::steady_clock::now();
+  auto readiness =
+      warmUp(params, callbacks, params.isDemoMode ? nullptr : &ledger);
+  logReadiness(logFile, params, readiness,
+               std::chrono::duration_cast<std::chrono::milliseconds>(
+                   std::chrono::steady_clock::now() - warmupStart));
+  logFile << "[ Current balances ]" << std::endl;
+  if (!params.isDemoMode) {
+    for (size_t i = 0; i < callbacks.size(); ++i) {
+      balance[i].leg1 = ledger.leg1(i);
+      balance[i].leg2 = ledger.leg2(i);
+      journal.balance(i, balance[i].leg1, balance[i].leg2);
+    }
+  }
 
-  // Checks for a restore.txt file, to see if
+  // Loads the positions and orders left by the previous run, to see if
   // the program exited with an open position.
+  // Paper positions are kept apart, a live run must not follow them
+  std::string const stateFile =
+      params.paperTrading ? "blackbird_paper.state" : "blackbird.state";
+  StateStore state(stateFile);
+  if (!state.load()) {
+    logFile << "ERROR: " << stateFile << " is damaged, Blackbird cannot know "
+            << "whether a position is open" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  auto &openPositions =
+      metrics().gauge("blackbird_open_positions", "Positions not closed yet");
+  auto commitState = [&] {
+    if (!state.commit())
+      logFile << "ERROR: cannot write " << stateFile << std::endl;
+    openPositions.set(static_cast<double>(state.positionIds().size()));
+  };
+  auto hasPendingOrders = [&state](unsigned id) {
+    auto const &orders = state.pendingOrders();
+    return std::any_of(orders.begin(), orders.end(),
+                       [id](auto const &o) { return o.positionId == id; });
+  };
+  // Positions with exit orders filled while Blackbird was stopped
+  std::set<unsigned> exited;
+  if (!params.isDemoMode && !state.pendingOrders().empty()) {
+    // Orders may have been filled while Blackbird was stopped. Their real
+    // fills are journaled and the ones still open are canceled, so that a
+    // position holds what was filled; its exit is sized on the exchanges'
+    // positions. An order that cannot be canceled, or whose status is not
+    // known, is kept and checked again at the next start.
+    // Position id -> leg1 bought or sold by its entry orders
+    std::map<unsigned, double> entered;
+    // A copy, the orders done are removed from the state on the way
+    auto orders = state.pendingOrders();
+    for (auto const &order : orders) {
+      if (order.exch >= callbacks.size())
+        continue;
+      auto const &exchange = callbacks[order.exch];
+      auto const &name = params.exchangeNames[order.exch];
+      bool isExit = order.isShort ? order.direction == "buy"
+                                  : order.direction == "sell";
+      auto status = exchange.getOrderStatus(params, order.orderId);
+      if (status.known && status.open && exchange.canCancel() &&
+          exchange.cancelOrder(params, order.orderId)) {
+        logFile << (isExit ? "Exit" : "Entry") << " order " << order.orderId
+                << " on " << name << " canceled" << std::endl;
+        status = exchange.getOrderStatus(params, order.orderId);
+      }
+      if (!status.known || status.open) {
+        logFile << "WARNING: " << (isExit ? "Exit" : "Entry") << " order "
+                << order.orderId << " on " << name
+                << (status.known ? " is still open" : " is unknown")
+                << std::endl;
+        continue;
+      }
+      // Without getOrderStatus only the completion is known
+      double filled = exchange.canCancel() ? status.filled : order.quantity;
+      double price = status.avgPrice > 0.0 ? status.avgPrice : order.price;
+      if (filled > 0.0)
+        journal.fill(order.exch, order.orderId, filled, price);
+      state.removeOrder(order.exch, order.orderId);
+      if (!isExit)
+        entered[order.positionId] += filled;
+      else if (filled > 0.0)
+        exited.insert(order.positionId);
+    }
+    for (auto const &entry : entered) {
+      if (entry.second <= 0.0 && !hasPendingOrders(entry.first)) {
+        logFile << "Trade " << entry.first << " was not entered, none of its "
+                << "entry orders was filled" << std::endl;
+        state.removePosition(entry.first);
+      }
+    }
+    commitState();
+  }
+  // The position followed is checked against the exchanges. One that is
+  // gone from both of them was closed, by its exit orders or by hand, and
+  // is dropped; one leg gone means the position is not hedged, which is
+  // reported. Filled exit orders alone do not tell, they may have been the
+  // trim of a leg.
   Result res;
   res.reset();
-  bool inMarket = res.loadPartialResult("restore.txt");
+  bool inMarket = false;
+  for (auto id : state.positionIds()) {
+    if (!state.restorePosition(id, res))
+      continue;
+    if (params.isDemoMode || hasPendingOrders(id)) {
+      inMarket = true;
+      break;
+    }
+    double posLong =
+        std::fabs(callbacks[res.idExchLong].getActivePos(params));
+    double posShort =
+        std::fabs(callbacks[res.idExchShort].getActivePos(params));
+    if (std::isnan(posLong) || std::isnan(posShort)) {
+      logFile << "WARNING: the positions of trade " << id
+              << " cannot be read, it is followed as it was" << std::endl;
+      inMarket = true;
+      break;
+    }
+    // A leg is held while at least half of what was entered is left
+    bool longHeld = posLong >= 0.5 * res.exposure / res.priceLongIn;
+    bool shortHeld = posShort >= 0.5 * res.exposure / res.priceShortIn;
+    if (longHeld || shortHeld) {
+      if (!longHeld || !shortHeld)
+        logFile << "WARNING: trade " << id << " is not hedged, "
+                << std::setprecision(6) << posLong << " " << params.leg1
+                << " long on " << res.exchNameLong << ", " << posShort << " "
+                << params.leg1 << " short on " << res.exchNameShort
+                << std::endl;
+      inMarket = true;
+      break;
+    }
+    if (exited.count(id))
+      logFile << "Trade " << id << " was closed while Blackbird was stopped"
+              << std::endl;
+    else
+      logFile << "WARNING: trade " << id << " has no " << params.leg1
+              << " left on " << res.exchNameLong << " nor on "
+              << res.exchNameShort << ", it was closed outside Blackbird"
+              << std::endl;
+    state.removePosition(id);
+    commitState();
+    res.reset();
+  }
+  auto positionIds = state.positionIds();
+  openPositions.set(static_cast<double>(positionIds.size()));
+  if (positionIds.size() > 1) {
+    logFile << "WARNING: " << positionIds.size() << " open positions, only "
+            << "trade " << positionIds.front() << " is followed" << std::endl;
+  }
 
   // Writes the current balances into the log file
   for (size_t i = 0; i < callbacks.size(); ++i) {
@@ -457,6 +434,12 @@ int main(int argc, char **argv) {
       logFile << "n/a (demo mode)" << std::endl;
     } else if (!params.isImplemented[i]) {
       logFile << "n/a (API not implemented)" << std::endl;
+    } else if (!ledger.known(i)) {
+      // Without them, the accounts cannot be checked
+      logFile << "unknown" << std::endl;
+      logFile << "ERROR: the balances of " << params.exchangeNames[i]
+              << " cannot be read" << std::endl;
+      exit(EXIT_FAILURE);
     } else {
       logFile << std::setprecision(2) << balance[i].leg2 << " " << params.leg2
               << "\t" << std::setprecision(6) << balance[i].leg1 << " "
@@ -482,6 +465,33 @@ int main(int argc, char **argv) {
     }
   }
   logFile << std::endl;
+  if (!params.isDemoMode)
+    ledger.start();
+  // This thread runs the strategy. Quotes are read by one feed thread per
+  // exchange, and orders are sent and followed by the execution thread.
+  if (!pinThisThread(params.strategyCpu))
+    logFile << "WARNING: cannot pin the strategy thread to CPU "
+            << params.strategyCpu << std::endl;
+  MarketFeed feed(params, callbacks);
+  VenueHealth health(params);
+  // The strategy settings and exchange switches follow the file
+  std::unique_ptr<ConfigWatcher> configWatcher;
+  if (params.configReload)
+    configWatcher.reset(new ConfigWatcher(params));
+  // Each order is saved as soon as it is sent, so that a restart knows
+  // about every order actually sent. While orders are in flight only the
+  // execution thread changes the state.
+  ExecutionEngine execution(
+      params, callbacks,
+      [&](ExecutionEngine::Job const &job, ExecutionEngine::Leg const &leg) {
+        state.addOrder({leg.exch, leg.orderId, leg.direction, leg.isShort,
+                        leg.orderQuantity, leg.price, job.tradeId});
+        commitState();
+      });
+  bool executing = false;
+  // The trade exited, its booking waits for the balances of the short
+  // exchange
+  bool closing = false;
   // Code implementing the loop function, that runs
   // every 'Interval' seconds.
   time_t rawtime = time(nullptr);
@@ -489,22 +499,194 @@ int main(int argc, char **argv) {
   using std::this_thread::sleep_for;
   using millisecs = std::chrono::milliseconds;
   using secs = std::chrono::seconds;
-  // Waits for the next 'interval' seconds before starting the loop
-  while ((int)timeinfo.tm_sec % params.interval != 0) {
-    sleep_for(millisecs(100));
-    time(&rawtime);
-    timeinfo = *std::localtime(&rawtime);
-  }
+  // The first iteration starts at once, the next ones every 'interval'
+  // seconds from it
   if (!params.verbose) {
     logFile << "Running..." << std::endl;
   }
 
-  int resultId = 0;
+  int resultId = positionIds.empty() ? 0 : positionIds.back();
   unsigned currIteration = 0;
   bool stillRunning = true;
   time_t currTime;
   time_t diffTime;
 
+  // Latency percentiles are written to this file every
+  // 'LatencyDumpInterval' seconds
+  std::string latencyFileName =
+      "output/blackbird_latency_" + currDateTime + ".txt";
+  time_t lastLatencyDump = time(nullptr);
+
+  // Metrics of the loop, scraped from http://127.0.0.1:<MetricsPort>/
+  std::unique_ptr<MetricsServer> metricsServer;
+  if (params.metricsPort != 0) {
+    metricsServer.reset(new MetricsServer(
+        metrics(), static_cast<unsigned short>(params.metricsPort)));
+    if (!metricsServer->isRunning())
+      logFile << "WARNING: cannot serve the metrics on port "
+              << params.metricsPort << std::endl;
+  }
+  std::vector<Counter *> quotesReceived, quotesInvalid;
+  for (auto const &name : params.exchangeNames) {
+    quotesReceived.push_back(&metrics().counter(
+        "blackbird_quotes_total", "Quotes read", {{"exchange", name}}));
+    quotesInvalid.push_back(&metrics().counter(
+        "blackbird_invalid_quotes_total", "Quotes with a null bid or ask",
+        {{"exchange", name}}));
+  }
+  auto &iterations =
+      metrics().counter("blackbird_iterations_total", "Main loop iterations");
+  auto &lastIteration =
+      metrics().gauge("blackbird_last_iteration_timestamp_seconds",
+                      "Start of the last main loop iteration");
+  auto &trades = metrics().counter("blackbird_trades_total", "Closed trades");
+  auto &pnl = metrics().gauge("blackbird_pnl",
+                              "Sum of the closed trades' results in leg2");
+
+  // Latest quote of every exchange. Every quote from the feed is
+  // journaled, the strategy uses the latest one.
+  std::vector<QuoteEvent> latest(callbacks.size());
+  auto drainQuotes = [&] {
+    feed.drain([&](QuoteEvent const &event) {
+      latest[event.exch] = event;
+      health.onQuote(event);
+      journal.quote(event.exch, event.bid, event.ask, event.received.wall);
+      quotesReceived[event.exch]->inc();
+      if (event.bid == 0.0 || event.ask == 0.0)
+        quotesInvalid[event.exch]->inc();
+    });
+  };
+  // Waits until the next iteration. With StrategyBusyPoll the quotes are
+  // taken from the feed as they come instead of sleeping.
+  auto waitFor = [&](std::chrono::steady_clock::duration duration) {
+    if (!params.strategyBusyPoll) {
+      sleep_for(duration);
+      return;
+    }
+    auto until = std::chrono::steady_clock::now() + duration;
+    while (std::chrono::steady_clock::now() < until)
+      drainQuotes();
+  };
+  // Follows the orders sent by the execution thread
+  auto onExecution = [&](ExecutionEngine::Job const &job) {
+    auto const &longLeg = job.legs[0];
+    auto const &shortLeg = job.legs[1];
+    if (job.stage == ExecutionEngine::Job::sent) {
+      for (auto const &leg : job.legs)
+        journal.order(leg.exch, leg.direction, leg.isShort, leg.orderQuantity,
+                      leg.price, leg.orderId);
+      return;
+    }
+    if (job.stage == ExecutionEngine::Job::resent) {
+      auto const &leg = job.leg(job.resentLeg);
+      journal.order(leg.exch, leg.direction, leg.isShort, leg.orderQuantity,
+                    leg.price, leg.orderId);
+      return;
+    }
+    // Both legs are now done, filled or given up on
+    executing = false;
+    auto const &unwind = job.unwind;
+    for (auto const *leg : {&longLeg, &shortLeg, &unwind}) {
+      if (leg->orderId.empty())
+        continue;
+      journal.fill(leg->exch, leg->orderId, leg->executed,
+                   leg->averagePrice());
+      state.removeOrder(leg->exch, leg->orderId);
+      for (auto const &id : leg->replaced)
+        state.removeOrder(leg->exch, id);
+    }
+    if (!job.isExit) {
+      ledger.applyFill(longLeg.exch, "buy", longLeg.executed,
+                       longLeg.averagePrice());
+      if (!unwind.orderId.empty() && !unwind.isShort)
+        ledger.applyFill(unwind.exch, "sell", unwind.executed,
+                         unwind.averagePrice());
+      journal.balance(longLeg.exch, ledger.leg1(longLeg.exch),
+                      ledger.leg2(longLeg.exch));
+      // Short positions are on margin
+      ledger.requestReconcile(shortLeg.exch);
+      double hedged = (std::min)(longLeg.executed, shortLeg.executed);
+      if (hedged < 1e-5) {
+        // Nothing of the entry is left once unwound
+        journal.decision(JournalDecision::canceled, res.idExchLong,
+                         res.idExchShort, res.spreadIn, res.exposure,
+                         "legs not filled");
+        logFile << "WARNING: the entry did not fill, trade canceled\n"
+                << std::endl;
+        state.removePosition(res.id);
+        commitState();
+        inMarket = false;
+        res.reset();
+        return;
+      }
+      // Stores the partial result to file in case
+      // the program exits before closing the position.
+      state.savePosition(res);
+      commitState();
+      return;
+    }
+    // This trade is done. Only the short exchange is read back, closing a
+    // margin position changes its balance by the position's P&L; the trade
+    // is booked once the ledger has read it.
+    state.removePosition(res.id);
+    commitState();
+    ledger.applyFill(longLeg.exch, "sell", longLeg.executed,
+                     longLeg.averagePrice());
+    ledger.requestReconcile(shortLeg.exch);
+    closing = true;
+  };
+  // Books the trade just closed, with the balances the ledger has now
+  auto bookTrade = [&] {
+    size_t const numExch = callbacks.size();
+    for (size_t i = 0; i < numExch; ++i) {
+      balance[i].leg2After = ledger.leg2(i);
+      balance[i].leg1After = ledger.leg1(i);
+      journal.balance(i, balance[i].leg1After, balance[i].leg2After);
+    }
+    for (int i = 0; i < numExch; ++i) {
+      logFile << "New balance on " << params.exchangeNames[i] << ":  \t";
+      logFile.precision(2);
+      logFile << balance[i].leg2After << " " << params.leg2 << " (perf "
+              << balance[i].leg2After - balance[i].leg2 << "), ";
+      logFile << std::setprecision(6) << balance[i].leg1After << " "
+              << params.leg1 << "\n";
+    }
+    logFile << std::endl;
+    // Update total leg2 balance
+    for (int i = 0; i < numExch; ++i) {
+      res.leg2TotBalanceBefore += balance[i].leg2;
+      res.leg2TotBalanceAfter += balance[i].leg2After;
+    }
+    // Update current balances
+    for (int i = 0; i < numExch; ++i) {
+      balance[i].leg2 = balance[i].leg2After;
+      balance[i].leg1 = balance[i].leg1After;
+    }
+    trades.inc();
+    pnl.add(res.leg2TotBalanceAfter - res.leg2TotBalanceBefore);
+    // Prints the result in the result CSV file
+    logFile.precision(2);
+    logFile << "ACTUAL PERFORMANCE: "
+            << "$" << res.leg2TotBalanceAfter - res.leg2TotBalanceBefore
+            << " (" << res.actualPerf() * 100.0 << "%)\n"
+            << std::endl;
+    csvFile << res.id << "," << res.exchNameLong << ","
+            << res.exchNameShort << "," << printDateTimeCsv(res.entryTime)
+            << "," << printDateTimeCsv(res.exitTime) << ","
+            << res.getTradeLengthInMinute() << "," << res.exposure * 2.0
+            << "," << res.leg2TotBalanceBefore << ","
+            << res.leg2TotBalanceAfter << "," << res.actualPerf()
+            << std::endl;
+    // Sends an email with the result of the trade
+    if (params.sendEmail) {
+      sendEmail(res, params);
+      logFile << "Email sent" << std::endl;
+    }
+    res.reset();
+    inMarket = false;
+    closing = false;
+  };
+
   // Main analysis loop
   while (stillRunning) {
     currTime = mktime(&timeinfo);
@@ -519,10 +701,10 @@ int main(int argc, char **argv) {
       timeinfo.tm_sec +=
           (ceil(diffTime / params.interval) + 1) * params.interval;
       currTime = mktime(&timeinfo);
-      sleep_for(secs(params.interval - (diffTime % params.interval)));
+      waitFor(secs(params.interval - (diffTime % params.interval)));
       logFile << std::endl;
     } else if (diffTime < 0) {
-      sleep_for(secs(-diffTime));
+      waitFor(secs(-diffTime));
     }
     // Header for every iteration of the loop
     if (params.verbose) {
@@ -534,39 +716,52 @@ int main(int argc, char **argv) {
                 << std::endl;
       }
     }
+    iterations.inc();
+    lastIteration.set(static_cast<double>(time(nullptr)));
+    // Takes the quotes read since the last iteration, and the progress
+    // of the orders in flight
+    drainQuotes();
+    health.update();
+    ExecutionEngine::Job report;
+    while (execution.poll(report))
+      onExecution(report);
+    if (closing && ledger.reconciled(res.idExchShort))
+      bookTrade();
+    auto dbTime = printDateTimeDb(currTime);
     // Gets the bid and ask of all the exchanges
     for (int i = 0; i < callbacks.size(); ++i) {
       auto &callbackData = callbacks[i];
-      auto quote = callbackData.getQuote(params);
-      double bid = quote.bid();
-      double ask = quote.ask();
+      double bid = latest[i].bid;
+      double ask = latest[i].ask;
       std::cout << params.exchangeNames[i]
                 << " --> "
                    "Bid: "
-                << bid << ", Ask: " << ask << std::endl;
+                << bid << ", Ask: " << ask << '\n';
 
       // Saves the bid/ask into the SQLite database
-      addBidAskToDb(callbackData.dbTableName, printDateTimeDb(currTime), bid,
-                    ask, params);
+      addBidAskToDb(callbackData.dbTableName(), dbTime, bid, ask, params);
 
       // If there is an error with the bid or ask (i.e. value is null),
       // we show a warning but we don't stop the loop.
+      // A venue that stays down only gets a warning once a minute.
       if (bid == 0.0) {
-        logFile << "   WARNING: " << params.exchangeNames[i] << " bid is null"
-                << std::endl;
+        asyncLog.logEvery(std::chrono::minutes(1), i, LogLevel::warning,
+                          "   WARNING: {} bid is null",
+                          params.exchangeNames[i]);
       }
       if (ask == 0.0) {
-        logFile << "   WARNING: " << params.exchangeNames[i] << " ask is null"
-                << std::endl;
+        asyncLog.logEvery(std::chrono::minutes(1), i, LogLevel::warning,
+                          "   WARNING: {} ask is null",
+                          params.exchangeNames[i]);
       }
       // Shows the bid/ask information in the log file
       if (params.verbose) {
-        logFile << "   " << params.exchangeNames[i] << ": \t"
-                << std::setprecision(2) << bid << " / " << ask << std::endl;
+        asyncLog.log(LogLevel::info, "   {}: \t{} / {}",
+                     params.exchangeNames[i], bid, ask);
       }
       // Updates the Bitcoin vector with the latest bid/ask data
-      btcVec[i].updateData(quote);
-      curl_easy_reset(params.curl);
+      btcVec[i].updateData(quote_t(bid, ask), latest[i].received.mono);
+      btcVec[i].setHealth(health.score(i));
     }
     if (params.verbose) {
       logFile << "   ----------------------------" << std::endl;
@@ -593,49 +788,61 @@ int main(int argc, char **argv) {
         }
       }
     }
-    // Looks for arbitrage opportunities on all the exchange combinations
+    // The settings of this iteration, a reload publishes new ones
+    auto const &strategy = params.strategy();
+    // Looks for arbitrage opportunities on all the exchange combinations,
+    // but the disabled exchanges
     if (!inMarket) {
       for (int i = 0; i < callbacks.size(); ++i) {
         for (int j = 0; j < callbacks.size(); ++j) {
-          if (i != j) {
+          if (i != j && strategy.enabled[i] && strategy.enabled[j]) {
             if (checkEntry(&btcVec[i], &btcVec[j], res, params)) {
               // An entry opportunity has been found!
               res.exposure = (std::min)(balance[res.idExchLong].leg2,
                                         balance[res.idExchShort].leg2);
               if (params.isDemoMode) {
+                journal.decision(JournalDecision::canceled, res.idExchLong,
+                                 res.idExchShort, res.spreadIn, res.exposure,
+                                 "demo mode");
                 logFile << "INFO: Opportunity found but no trade will be "
                            "generated (Demo mode)"
                         << std::endl;
                 break;
               }
               if (res.exposure == 0.0) {
+                journal.decision(JournalDecision::canceled, res.idExchLong,
+                                 res.idExchShort, res.spreadIn, res.exposure,
+                                 "no cash");
                 logFile << "WARNING: Opportunity found but no cash available. "
                            "Trade canceled"
                         << std::endl;
                 break;
               }
-              if (params.useFullExposure == false &&
-                  res.exposure <= params.testedExposure) {
+              if (strategy.useFullExposure == false &&
+                  res.exposure <= strategy.testedExposure) {
+                journal.decision(JournalDecision::canceled, res.idExchLong,
+                                 res.idExchShort, res.spreadIn, res.exposure,
+                                 "not enough cash");
                 logFile << "WARNING: Opportunity found but no enough cash. "
                            "Need more than TEST cash (min. $"
-                        << std::setprecision(2) << params.testedExposure
+                        << std::setprecision(2) << strategy.testedExposure
                         << "). Trade canceled" << std::endl;
                 break;
               }
-              if (params.useFullExposure) {
+              if (strategy.useFullExposure) {
                 // Removes 1% of the exposure to have
                 // a little bit of margin.
                 res.exposure -= 0.01 * res.exposure;
-                if (res.exposure > params.maxExposure) {
+                if (res.exposure > strategy.maxExposure) {
                   logFile << "WARNING: Opportunity found but exposure ("
                           << std::setprecision(2) << res.exposure
                           << ") above the limit\n"
                           << "         Max exposure will be used instead ("
-                          << params.maxExposure << ")" << std::endl;
-                  res.exposure = params.maxExposure;
+                          << strategy.maxExposure << ")" << std::endl;
+                  res.exposure = strategy.maxExposure;
                 }
               } else {
-                res.exposure = params.testedExposure;
+                res.exposure = strategy.testedExposure;
               }
               // Checks the volumes and, based on that, computes the limit
               // prices that will be sent to the exchanges
@@ -648,6 +855,9 @@ int main(int argc, char **argv) {
               double limPriceShort = callbacks[res.idExchShort].getLimitPrice(
                   params, volumeShort, true);
               if (limPriceLong == 0.0 || limPriceShort == 0.0) {
+                journal.decision(JournalDecision::canceled, res.idExchLong,
+                                 res.idExchShort, res.spreadIn, res.exposure,
+                                 "limit price is null");
                 logFile
                     << "WARNING: Opportunity found but error with the order "
                        "books (limit price is null). Trade canceled\n";
@@ -659,8 +869,11 @@ int main(int argc, char **argv) {
                 res.trailing[res.idExchLong][res.idExchShort] = -1.0;
                 break;
               }
-              if (limPriceLong - res.priceLongIn > params.priceDeltaLim ||
-                  res.priceShortIn - limPriceShort > params.priceDeltaLim) {
+              if (limPriceLong - res.priceLongIn > strategy.priceDeltaLim ||
+                  res.priceShortIn - limPriceShort > strategy.priceDeltaLim) {
+                journal.decision(JournalDecision::canceled, res.idExchLong,
+                                 res.idExchShort, res.spreadIn, res.exposure,
+                                 "not enough liquidity");
                 logFile << "WARNING: Opportunity found but not enough "
                            "liquidity. Trade canceled\n";
                 logFile.precision(2);
@@ -674,6 +887,8 @@ int main(int argc, char **argv) {
               // We are in market now, meaning we have positions on leg1 (the
               // hedged on) We store the details of that first trade into the
               // Result structure.
+              journal.decision(JournalDecision::entry, res.idExchLong,
+                               res.idExchShort, res.spreadIn, res.exposure);
               inMarket = true;
               resultId++;
               res.id = resultId;
@@ -685,50 +900,19 @@ int main(int argc, char **argv) {
               res.minSpread[res.idExchLong][res.idExchShort] = 1.0;
               res.trailing[res.idExchLong][res.idExchShort] = 1.0;
 
-              // Send the orders to the two exchanges
-              auto longOrderId = callbacks[res.idExchLong].sendLongOrder(
-                  params, "buy", volumeLong, limPriceLong);
-              auto shortOrderId = callbacks[res.idExchShort].sendShortOrder(
-                  params, "sell", volumeShort, limPriceShort);
-              logFile << "Waiting for the two orders to be filled..."
-                      << std::endl;
-              sleep_for(millisecs(5000));
-              bool isLongOrderComplete =
-                  callbacks[res.idExchLong].isOrderComplete(params,
-                                                            longOrderId);
-              bool isShortOrderComplete =
-                  callbacks[res.idExchShort].isOrderComplete(params,
-                                                             shortOrderId);
-              // Loops until both orders are completed
-              while (!isLongOrderComplete || !isShortOrderComplete) {
-                sleep_for(millisecs(3000));
-                if (!isLongOrderComplete) {
-                  logFile << "Long order on "
-                          << params.exchangeNames[res.idExchLong]
-                          << " still open..." << std::endl;
-                  isLongOrderComplete =
-                      callbacks[res.idExchLong].isOrderComplete(params,
-                                                                longOrderId);
-                }
-                if (!isShortOrderComplete) {
-                  logFile << "Short order on "
-                          << params.exchangeNames[res.idExchShort]
-                          << " still open..." << std::endl;
-                  isShortOrderComplete =
-                      callbacks[res.idExchShort].isOrderComplete(params,
-                                                                 shortOrderId);
-                }
-              }
-              // Both orders are now fully executed
-              logFile << "Done" << std::endl;
-
-              // Stores the partial result to file in case
-              // the program exits before closing the position.
-              res.savePartialResult("restore.txt");
-
-              // Resets the order ids
-              longOrderId = "0";
-              shortOrderId = "0";
+              // The execution thread sends the two orders and waits for
+              // their fills, the position is saved before
+              state.savePosition(res);
+              commitState();
+              ExecutionEngine::Job job;
+              job.tradeId = res.id;
+              job.decided = res.decided;
+              job.legs[0] = {res.idExchLong, false, "buy", volumeLong,
+                             limPriceLong};
+              job.legs[1] = {res.idExchShort, true, "sell", volumeShort,
+                             limPriceShort};
+              execution.submit(std::move(job));
+              executing = true;
               break;
             }
           }
@@ -740,25 +924,40 @@ int main(int argc, char **argv) {
       if (params.verbose) {
         logFile << std::endl;
       }
-    } else if (inMarket) {
+    } else if (!executing && !closing) {
       // We are in market and looking for an exit opportunity
       if (checkExit(&btcVec[res.idExchLong], &btcVec[res.idExchShort], res,
                     params, currTime)) {
         // An exit opportunity has been found!
-        // We check the current leg1 exposure
+        // We check the current leg1 exposure of the two exchanges
         std::vector<double> btcUsed(callbacks.size());
-        for (int i = 0; i < callbacks.size(); ++i) {
+        for (auto i : {res.idExchLong, res.idExchShort}) {
           btcUsed[i] = callbacks[i].getActivePos(params);
         }
         // Checks the volumes and computes the limit prices that will be sent to
         // the exchanges
         double volumeLong = btcUsed[res.idExchLong];
         double volumeShort = btcUsed[res.idExchShort];
+        bool posKnown = !std::isnan(volumeLong) && !std::isnan(volumeShort);
         double limPriceLong =
-            callbacks[res.idExchLong].getLimitPrice(params, volumeLong, true);
-        double limPriceShort = callbacks[res.idExchShort].getLimitPrice(
-            params, volumeShort, false);
-        if (limPriceLong == 0.0 || limPriceShort == 0.0) {
+            posKnown ? callbacks[res.idExchLong].getLimitPrice(
+                           params, volumeLong, true)
+                     : 0.0;
+        double limPriceShort =
+            posKnown ? callbacks[res.idExchShort].getLimitPrice(
+                           params, volumeShort, false)
+                     : 0.0;
+        if (!posKnown) {
+          journal.decision(JournalDecision::canceled, res.idExchLong,
+                           res.idExchShort, res.spreadOut, res.exposure,
+                           "positions unknown");
+          logFile << "WARNING: Opportunity found but the positions could not "
+                     "be read. Trade canceled\n";
+          res.trailing[res.idExchLong][res.idExchShort] = 1.0;
+        } else if (limPriceLong == 0.0 || limPriceShort == 0.0) {
+          journal.decision(JournalDecision::canceled, res.idExchLong,
+                           res.idExchShort, res.spreadOut, res.exposure,
+                           "limit price is null");
           logFile << "WARNING: Opportunity found but error with the order "
                      "books (limit price is null). Trade canceled\n";
           logFile.precision(2);
@@ -767,8 +966,12 @@ int main(int argc, char **argv) {
           logFile << "         Short limit price: " << limPriceShort
                   << std::endl;
           res.trailing[res.idExchLong][res.idExchShort] = 1.0;
-        } else if (res.priceLongOut - limPriceLong > params.priceDeltaLim ||
-                   limPriceShort - res.priceShortOut > params.priceDeltaLim) {
+        } else if (res.priceLongOut - limPriceLong > strategy.priceDeltaLim ||
+                   limPriceShort - res.priceShortOut >
+                       strategy.priceDeltaLim) {
+          journal.decision(JournalDecision::canceled, res.idExchLong,
+                           res.idExchShort, res.spreadOut, res.exposure,
+                           "not enough liquidity");
           logFile << "WARNING: Opportunity found but not enough liquidity. "
                      "Trade canceled\n";
           logFile.precision(2);
@@ -778,6 +981,8 @@ int main(int argc, char **argv) {
                   << ", Real short price: " << limPriceShort << std::endl;
           res.trailing[res.idExchLong][res.idExchShort] = 1.0;
         } else {
+          journal.decision(JournalDecision::exit, res.idExchLong,
+                           res.idExchShort, res.spreadOut, res.exposure);
           res.exitTime = currTime;
           res.priceLongOut = limPriceLong;
           res.priceShortOut = limPriceShort;
@@ -791,93 +996,28 @@ int main(int argc, char **argv) {
                   << params.exchangeNames[res.idExchShort] << ": "
                   << volumeShort << '\n'
                   << std::endl;
-          auto longOrderId = callbacks[res.idExchLong].sendLongOrder(
-              params, "sell", fabs(btcUsed[res.idExchLong]), limPriceLong);
-          auto shortOrderId = callbacks[res.idExchShort].sendShortOrder(
-              params, "buy", fabs(btcUsed[res.idExchShort]), limPriceShort);
-          logFile << "Waiting for the two orders to be filled..." << std::endl;
-          sleep_for(millisecs(5000));
-          bool isLongOrderComplete = callbacks[res.idExchLong].
-              isOrderComplete(params, longOrderId);
-          bool isShortOrderComplete =
-              callbacks[res.idExchShort].isOrderComplete(params, shortOrderId);
-          // Loops until both orders are completed
-          while (!isLongOrderComplete || !isShortOrderComplete) {
-            sleep_for(millisecs(3000));
-            if (!isLongOrderComplete) {
-              logFile << "Long order on "
-                      << params.exchangeNames[res.idExchLong]
-                      << " still open..." << std::endl;
-              isLongOrderComplete = callbacks[res.idExchLong].isOrderComplete(
-                  params, longOrderId);
-            }
-            if (!isShortOrderComplete) {
-              logFile << "Short order on "
-                      << params.exchangeNames[res.idExchShort]
-                      << " still open..." << std::endl;
-              isShortOrderComplete = callbacks[res.idExchShort].isOrderComplete(
-                  params, shortOrderId);
-            }
-          }
-          logFile << "Done\n" << std::endl;
-          longOrderId = "0";
-          shortOrderId = "0";
-          inMarket = false;
-
-          size_t const numExch = callbacks.size();
-
-          for (size_t i = 0; i < numExch; ++i) {
-            balance[i].leg2After = callbacks[i].getAvail(
-                params, "usd"); // FIXME: currency hard-coded
-            balance[i].leg1After = callbacks[i].getAvail(
-                params, "btc"); // FIXME: currency hard-coded
-          }
-          for (int i = 0; i < numExch; ++i) {
-            logFile << "New balance on " << params.exchangeNames[i] << ":  \t";
-            logFile.precision(2);
-            logFile << balance[i].leg2After << " " << params.leg2 << " (perf "
-                    << balance[i].leg2After - balance[i].leg2 << "), ";
-            logFile << std::setprecision(6) << balance[i].leg1After << " "
-                    << params.leg1 << "\n";
-          }
-          logFile << std::endl;
-          // Update total leg2 balance
-          for (int i = 0; i < numExch; ++i) {
-            res.leg2TotBalanceBefore += balance[i].leg2;
-            res.leg2TotBalanceAfter += balance[i].leg2After;
-          }
-          // Update current balances
-          for (int i = 0; i < numExch; ++i) {
-            balance[i].leg2 = balance[i].leg2After;
-            balance[i].leg1 = balance[i].leg1After;
-          }
-          // Prints the result in the result CSV file
-          logFile.precision(2);
-          logFile << "ACTUAL PERFORMANCE: "
-                  << "$" << res.leg2TotBalanceAfter - res.leg2TotBalanceBefore
-                  << " (" << res.actualPerf() * 100.0 << "%)\n"
-                  << std::endl;
-          csvFile << res.id << "," << res.exchNameLong << ","
-                  << res.exchNameShort << "," << printDateTimeCsv(res.entryTime)
-                  << "," << printDateTimeCsv(res.exitTime) << ","
-                  << res.getTradeLengthInMinute() << "," << res.exposure * 2.0
-                  << "," << res.leg2TotBalanceBefore << ","
-                  << res.leg2TotBalanceAfter << "," << res.actualPerf()
-                  << std::endl;
-          // Sends an email with the result of the trade
-          if (params.sendEmail) {
-            sendEmail(res, params);
-            logFile << "Email sent" << std::endl;
-          }
-          res.reset();
-          // Removes restore.txt since this trade is done.
-          std::ofstream resFile("restore.txt", std::ofstream::trunc);
-          resFile.close();
+          ExecutionEngine::Job job;
+          job.tradeId = res.id;
+          job.isExit = true;
+          job.decided = res.decided;
+          job.legs[0] = {res.idExchLong, false, "sell",
+                         fabs(btcUsed[res.idExchLong]), limPriceLong};
+          job.legs[1] = {res.idExchShort, true, "buy",
+                         fabs(btcUsed[res.idExchShort]), limPriceShort};
+          execution.submit(std::move(job));
+          executing = true;
         }
       }
       if (params.verbose)
         logFile << '\n';
     }
+    // The quotes of this iteration
+    journal.sync();
+    if (params.latencyDumpInterval > 0 &&
+        time(nullptr) - lastLatencyDump >= params.latencyDumpInterval) {
+      latency().dumpToFile(latencyFileName);
+      lastLatencyDump = time(nullptr);
+    }
     // Moves to the next iteration, unless
     // the maxmum is reached.
     timeinfo.tm_sec += params.interval;
@@ -896,10 +1036,25 @@ int main(int argc, char **argv) {
       stillRunning = false;
     }
   }
+  // Orders in flight are followed to the end before leaving
+  while (executing) {
+    sleep_for(millisecs(100));
+    ExecutionEngine::Job report;
+    while (execution.poll(report))
+      onExecution(report);
+  }
+  // A trade closed last is booked now, the short exchange is read here if
+  // the ledger has not done it yet
+  if (closing) {
+    if (!ledger.reconciled(res.idExchShort))
+      ledger.reconcile(res.idExchShort);
+    bookTrade();
+  }
   // Analysis loop exited, does some cleanup
   curl_easy_cleanup(params.curl);
   csvFile.close();
-  logFile.close();
+  latency().dumpToFile(latencyFileName);
+  asyncLog.flush();
 
   return 0;
 }
@@ -0,0 +1,64 @@
+#include "market_feed.h"
+#include "exchange_registry.h"
+#include "parameters.h"
+#include "utils/event_loop.h"
+#include "utils/metrics.h"
+#include "utils/thread_affinity.h"
+
+MarketFeed::MarketFeed(Parameters &params,
+                       std::vector<ExchangeApi> const &exchanges)
+    : params(params), exchanges(exchanges),
+      interval(params.feedInterval) {
+  for (unsigned i = 0; i < exchanges.size(); ++i) {
+    venues.emplace_back(new Venue);
+    venues.back()->dropped = &metrics().counter(
+        "blackbird_feed_dropped_total",
+        "Quotes dropped because the strategy thread fell behind",
+        {{"exchange", params.exchangeNames[i]}});
+  }
+  auto &loop = eventLoop();
+  auto cpu = params.feedCpu;
+  // Dereferenced on the loop thread, the stream is the loop's own
+  loop.post([cpu, &logFile = params.logFile] {
+    if (!pinThisThread(cpu))
+      *logFile << "WARNING: cannot pin the event loop to CPU " << cpu
+              << std::endl;
+  });
+  // Started once every ring exists, drain() may run at once
+  running = exchanges.size();
+  for (unsigned i = 0; i < exchanges.size(); ++i)
+    loop.spawn(poll(i));
+}
+
+// Waits for the requests in flight, at most FeedInterval plus one request
+MarketFeed::~MarketFeed() {
+  stopping = true;
+  std::unique_lock<std::mutex> lock(mtx);
+  finished.wait(lock, [this] { return running == 0; });
+}
+
+task<void> MarketFeed::poll(unsigned exch) {
+  auto &loop = eventLoop();
+  auto &venue = *venues[exch];
+  auto next = std::chrono::steady_clock::now();
+  while (!stopping) {
+    auto sent = Clock::monoNs();
+    auto quote = co_await exchanges[exch].getQuote(params);
+    QuoteEvent event;
+    event.exch = exch;
+    event.bid = quote.bid();
+    event.ask = quote.ask();
+    event.received = Clock::Stamp::now();
+    event.latency = event.received.mono - sent;
+    if (!venue.ring.push(event))
+      venue.dropped->inc();
+    next += interval;
+    auto now = std::chrono::steady_clock::now();
+    if (next < now)
+      next = now;
+    co_await loop.sleepUntil(next);
+  }
+  std::lock_guard<std::mutex> lock(mtx);
+  --running;
+  finished.notify_all();
+}
@@ -0,0 +1,208 @@
+#include "paper_trading.h"
+#include "parameters.h"
+#include "utils/latency.h"
+
+#include <algorithm>
+#include <thread>
+
+namespace {
+// Leg1 left on an order that is considered filled
+const double dust = 1e-9;
+
+// True if an order at 'limit' can trade at 'price'
+bool reaches(bool isBuy, double limit, double price) {
+  return price > 0.0 && (isBuy ? price <= limit : price >= limit);
+}
+}
+
+PaperTrading::PaperTrading(Parameters &params)
+    : params(params), orderLatency(params.paperLatency),
+      queueAhead(params.paperQueueAhead), queueRate(params.paperQueueRate),
+      startBalance(params.paperBalanceUsd) {}
+
+size_t PaperTrading::addExchange(getQuoteFn getQuote,
+                                 getLimitPriceFn getLimitPrice) {
+  std::unique_ptr<Exchange> exchange(new Exchange);
+  exchange->getQuote = std::move(getQuote);
+  exchange->getLimitPrice = std::move(getLimitPrice);
+  exchange->leg2 = startBalance;
+  std::lock_guard<std::mutex> lock(mtx);
+  exchanges.push_back(std::move(exchange));
+  return exchanges.size() - 1;
+}
+
+std::string PaperTrading::sendOrder(size_t exch, std::string const &direction,
+                                    double quantity, double price,
+                                    OrderType type) {
+  Order order;
+  order.isBuy = direction == "buy";
+  order.quantity = quantity;
+  order.price = price;
+  order.sentAt = clock::now();
+  // The price we would have traded at without latency or depth
+  auto quote = exchanges[exch]->getQuote(params);
+  order.touch = order.isBuy ? quote.ask() : quote.bid();
+  std::string id = "paper-" + std::to_string(++lastId);
+  params.log->log(LogLevel::info, "<Paper> {}: {} {.8} at {} ({}) sent as {}",
+                  params.exchangeNames[exch], direction, quantity, price,
+                  orderTypeName(type), id);
+  // Like a real order, the call returns once the exchange has it
+  std::this_thread::sleep_for(orderLatency);
+  arrive(exch, order, type);
+  if (order.closed && order.remaining() > dust)
+    params.log->log(LogLevel::info, "<Paper> {}: {} canceled with {.8} unfilled",
+                    params.exchangeNames[exch], id, order.remaining());
+  exchanges[exch]->orders.emplace(id, order);
+  return id;
+}
+
+bool PaperTrading::isOrderComplete(size_t exch, std::string const &orderId) {
+  auto &orders = exchanges[exch]->orders;
+  auto it = orders.find(orderId);
+  if (it == orders.end())
+    return true;
+  if (!it->second.closed)
+    advance(exch, it->second);
+  if (!it->second.closed && it->second.remaining() > dust)
+    return false;
+  report(exch, it->second);
+  orders.erase(it);
+  return true;
+}
+
+OrderStatus PaperTrading::getOrderStatus(size_t exch,
+                                         std::string const &orderId) {
+  OrderStatus status;
+  status.known = true;
+  auto &orders = exchanges[exch]->orders;
+  auto it = orders.find(orderId);
+  if (it == orders.end())
+    return status;
+  auto &order = it->second;
+  if (!order.closed)
+    advance(exch, order);
+  status.open = !order.closed && order.remaining() > dust;
+  status.filled = order.filled;
+  if (order.filled > 0.0)
+    status.avgPrice = order.filledValue / order.filled;
+  if (!status.open) {
+    report(exch, order);
+    orders.erase(it);
+  }
+  return status;
+}
+
+bool PaperTrading::cancelOrder(size_t exch, std::string const &orderId) {
+  auto &orders = exchanges[exch]->orders;
+  auto it = orders.find(orderId);
+  if (it == orders.end() || it->second.closed)
+    return false;
+  // What traded until now stays
+  advance(exch, it->second);
+  if (it->second.remaining() <= dust)
+    return false;
+  it->second.closed = true;
+  params.log->log(LogLevel::info, "<Paper> {}: {} canceled with {.8} unfilled",
+                  params.exchangeNames[exch], orderId,
+                  it->second.remaining());
+  return true;
+}
+
+double PaperTrading::getAvail(size_t exch, std::string const &currency) const {
+  std::lock_guard<std::mutex> lock(mtx);
+  // Currencies are "btc" and "usd" like in the ledger
+  return currency == "btc" ? exchanges[exch]->leg1 : exchanges[exch]->leg2;
+}
+
+double PaperTrading::getActivePos(size_t exch) const {
+  std::lock_guard<std::mutex> lock(mtx);
+  return exchanges[exch]->leg1;
+}
+
+void PaperTrading::arrive(size_t exch, Order &order, OrderType type) {
+  auto &exchange = *exchanges[exch];
+  order.queueAhead = queueAhead;
+  order.lastSeen = clock::now();
+  // Only good-till-canceled and post-only orders rest
+  order.closed = type == OrderType::ioc || type == OrderType::fok;
+  auto quote = exchange.getQuote(params);
+  double opposite = order.isBuy ? quote.ask() : quote.bid();
+  if (!reaches(order.isBuy, order.price, opposite))
+    return;
+  if (type == OrderType::postOnly) {
+    order.closed = true;
+    return;
+  }
+  double worst =
+      exchange.getLimitPrice(params, order.remaining(), !order.isBuy);
+  if (worst <= 0.0 || reaches(order.isBuy, order.price, worst)) {
+    fill(exch, order, order.remaining(),
+         worst > 0.0 ? (opposite + worst) / 2.0 : opposite);
+  } else if (type != OrderType::fok) {
+    double share = (order.price - opposite) / (worst - opposite);
+    fill(exch, order, order.remaining() * share,
+         (opposite + order.price) / 2.0);
+  }
+}
+
+void PaperTrading::advance(size_t exch, Order &order) {
+  auto now = clock::now();
+  auto quote = exchanges[exch]->getQuote(params);
+  double opposite = order.isBuy ? quote.ask() : quote.bid();
+  double same = order.isBuy ? quote.bid() : quote.ask();
+  if (reaches(order.isBuy, order.price, opposite)) {
+    fill(exch, order, order.remaining(), order.price);
+  } else if (same > 0.0 &&
+             (order.isBuy ? order.price >= same : order.price <= same)) {
+    double traded =
+        queueRate * std::chrono::duration<double>(now - order.lastSeen).count();
+    double reached = traded - order.queueAhead;
+    order.queueAhead = (std::max)(0.0, order.queueAhead - traded);
+    if (reached > 0.0)
+      fill(exch, order, (std::min)(reached, order.remaining()), order.price);
+  }
+  order.lastSeen = now;
+}
+
+void PaperTrading::fill(size_t exch, Order &order, double quantity,
+                        double price) {
+  if (quantity <= 0.0)
+    return;
+  order.filled += quantity;
+  order.filledValue += quantity * price;
+  double value = quantity * price;
+  double fee = value * params.strategy().fees[exch];
+  std::lock_guard<std::mutex> lock(mtx);
+  auto &exchange = *exchanges[exch];
+  if (order.isBuy) {
+    exchange.leg1 += quantity;
+    exchange.leg2 -= value + fee;
+  } else {
+    exchange.leg1 -= quantity;
+    exchange.leg2 += value - fee;
+  }
+}
+
+void PaperTrading::report(size_t exch, Order const &order) {
+  if (order.filled <= 0.0)
+    return;
+  auto elapsed = clock::now() - order.sentAt;
+  latency()
+      .histogram(params.exchangeNames[exch], "paper", "fill")
+      .record(elapsed);
+  double average = order.filledValue / order.filled;
+  // Cost against the touch when the order was sent, in basis points
+  double slippage = 0.0;
+  if (order.touch > 0.0)
+    slippage = (order.isBuy ? average - order.touch : order.touch - average) /
+               order.touch * 10000.0;
+  params.log->log(
+      LogLevel::info,
+      "<Paper> {}: {} {.8} filled at {} (limit {}, touch {}, slippage {} bps) "
+      "in {} ms",
+      params.exchangeNames[exch], order.isBuy ? "buy" : "sell", order.filled,
+      average, order.price, order.touch, slippage,
+      static_cast<int64_t>(
+          std::chrono::duration_cast<std::chrono::milliseconds>(elapsed)
+              .count()));
+}
@@ -70,35 +70,48 @@ void getParameter(std::string parameter,
                   Type &data) {
   auto iter = dataMap.find(parameter);
   if (iter == dataMap.cend())
-    std::exit(-1);
-  if constexpr (std::is_same_v<bool, Type>) {
-    data = iter->second == "true";
-  } else if constexpr (std::is_integral_v<Type>) {
-    data = 0;
-    if (!iter->second.empty())
-      data = std::stoi(iter->second);
-  } else if constexpr (std::is_same_v<double, Type>) {
-    data = 0.0;
-    if (!iter->second.empty())
-      data = std::stod(iter->second);
-  } else {
-    data = iter->second;
+    throw ConfigError("missing parameter " + parameter);
+  try {
+    if constexpr (std::is_same_v<bool, Type>) {
+      data = iter->second == "true";
+    } else if constexpr (std::is_integral_v<Type>) {
+      data = 0;
+      if (!iter->second.empty())
+        data = std::stoi(iter->second);
+    } else if constexpr (std::is_same_v<double, Type>) {
+      data = 0.0;
+      if (!iter->second.empty())
+        data = std::stod(iter->second);
+    } else {
+      data = iter->second;
+    }
+  } catch (std::logic_error const &) {
+    // std::stoi and std::stod's invalid_argument and out_of_range
+    throw ConfigError("invalid value '" + iter->second + "' for " + parameter);
   }
 }
 
-Parameters::Parameters(std::string fileName) {
-  std::map<std::string, std::string> dataMap;
-  {
-    std::ifstream configFile(findConfigFile(fileName));
-    if (!configFile.is_open()) {
-      std::cout << "ERROR: " << fileName << " cannot be open.\n";
-      exit(EXIT_FAILURE);
-    }
-    readAllParameters(configFile, dataMap);
-    if (dataMap.empty())
-      std::exit(-1);
-  }
+// Same as above, but keeps 'fallback' when the key is not in the file,
+// for parameters added after existing configuration files were written.
+template <typename Type>
+void getParameter(std::string parameter,
+                  std::map<std::string, std::string> const &dataMap,
+                  Type &data, Type const &fallback) {
+  data = fallback;
+  if (dataMap.count(parameter))
+    getParameter(parameter, dataMap, data);
+}
+
+Parameters::Parameters(std::string fileName)
+    : configFile(findConfigFile(fileName)) {
+  load(readConfigFile(configFile));
+}
+
+Parameters::Parameters(std::map<std::string, std::string> const &dataMap) {
+  load(dataMap);
+}
 
+void Parameters::load(std::map<std::string, std::string> const &dataMap) {
   getParameter("SpreadEntry", dataMap, spreadEntry);
   getParameter("SpreadTarget", dataMap, spreadTarget);
   getParameter("MaxLength", dataMap, maxLength);
@@ -111,14 +124,53 @@ Parameters::Parameters(std::string fileName) {
   getParameter("Leg2", dataMap, leg2);
 
   getParameter("Verbose", dataMap, verbose);
+  getParameter("LogLevel", dataMap, logLevel, std::string("info"));
   getParameter("Interval", dataMap, interval);
   getParameter("DebugMaxIteration", dataMap, debugMaxIteration);
   getParameter("UseFullExposure", dataMap, useFullExposure);
   getParameter("TestedExposure", dataMap, testedExposure);
   getParameter("MaxExposure", dataMap, maxExposure);
+  getParameter("MaxQuoteAge", dataMap, maxQuoteAge, 5000u);
+  getParameter("FrozenQuoteAge", dataMap, frozenQuoteAge, 30000u);
+  getParameter("MaxQuoteLatency", dataMap, maxQuoteLatency, 3000u);
+  getParameter("MaxQuoteErrorRate", dataMap, maxQuoteErrorRate, 0.5);
   getParameter("UseVolatility", dataMap, useVolatility);
   getParameter("VolatilityPeriod", dataMap, volatilityPeriod);
   getParameter("CACert", dataMap, cacert);
+  getParameter("TickerCacheTTL", dataMap, tickerCacheTtl, 500u);
+  getParameter("OrderBookCacheTTL", dataMap, orderBookCacheTtl, 250u);
+  getParameter("BalanceReconcileInterval", dataMap, reconcileInterval, 60u);
+  getParameter("LatencyDumpInterval", dataMap, latencyDumpInterval, 60u);
+  getParameter("MetricsPort", dataMap, metricsPort, 9464u);
+  getParameter("SimulatorPort", dataMap, simulatorPort, 18400u);
+  getParameter("UseSimulator", dataMap, useSimulator, false);
+  getParameter("SimLatency", dataMap, simLatency, 20u);
+  getParameter("SimJitter", dataMap, simJitter, 10u);
+  getParameter("SimErrorRate", dataMap, simErrorRate, 0.0);
+  getParameter("SimStallRate", dataMap, simStallRate, 0.0);
+  getParameter("SimStallTime", dataMap, simStallTime, 3000u);
+  getParameter("SimSeed", dataMap, simSeed, 1u);
+  getParameter("SimBalanceUsd", dataMap, simBalanceUsd, 10000.0);
+  getParameter("SimBalanceBtc", dataMap, simBalanceBtc, 0.0);
+  getParameter("PaperTrading", dataMap, paperTrading, false);
+  getParameter("PaperLatency", dataMap, paperLatency, 150u);
+  getParameter("PaperQueueAhead", dataMap, paperQueueAhead, 1.0);
+  getParameter("PaperQueueRate", dataMap, paperQueueRate, 0.05);
+  getParameter("PaperBalanceUsd", dataMap, paperBalanceUsd, 10000.0);
+  getParameter("FeedInterval", dataMap, feedInterval, 1000u);
+  getParameter("StrategyBusyPoll", dataMap, strategyBusyPoll, false);
+  getParameter("StrategyCpu", dataMap, strategyCpu, -1);
+  getParameter("FeedCpu", dataMap, feedCpu, -1);
+  getParameter("ExecutionCpu", dataMap, executionCpu, -1);
+  getParameter("ConfigReload", dataMap, configReload, true);
+  std::string type;
+  getParameter("OrderType", dataMap, type, std::string("ioc"));
+  if (!parseOrderType(type, orderType))
+    throw ConfigError("invalid value '" + type + "' for OrderType");
+  getParameter("RepriceInterval", dataMap, repriceInterval, 500u);
+  getParameter("MaxHedgeTime", dataMap, maxHedgeTime, 10000u);
+  getParameter("MaxOrderWait", dataMap, maxOrderWait, 5000u);
+  getParameter("MaxPriceDrift", dataMap, maxPriceDrift, 0.002);
   getParameter("BitfinexApiKey", dataMap, bitfinexApi);
   getParameter("BitfinexSecretKey", dataMap, bitfinexSecret);
   getParameter("BitfinexFees", dataMap, bitfinexFees);
@@ -187,6 +239,22 @@ Parameters::Parameters(std::string fileName) {
   getParameter("SmtpServerAddress", dataMap, smtpServerAddress);
   getParameter("ReceiverAddress", dataMap, receiverAddress);
   getParameter("DBFile", dataMap, dbFile);
+
+  StrategyParams strategy;
+  strategy.spreadEntry = spreadEntry;
+  strategy.spreadTarget = spreadTarget;
+  strategy.maxLength = maxLength;
+  strategy.priceDeltaLim = priceDeltaLim;
+  strategy.trailingLim = trailingLim;
+  strategy.trailingCount = trailingCount;
+  strategy.useFullExposure = useFullExposure;
+  strategy.testedExposure = testedExposure;
+  strategy.maxExposure = maxExposure;
+  strategy.maxQuoteAge = maxQuoteAge;
+  strategy.frozenQuoteAge = frozenQuoteAge;
+  strategy.maxQuoteLatency = maxQuoteLatency;
+  strategy.maxQuoteErrorRate = maxQuoteErrorRate;
+  publishStrategy(std::move(strategy));
 }
 
 void Parameters::addExchange(std::string const &exchangeName, double const fee,
@@ -196,6 +264,17 @@ void Parameters::addExchange(std::string const &exchangeName, double const fee,
   fees.push_back(fee);
   canShort.push_back(shorting);
   isImplemented.push_back(featureImplemented);
+
+  auto strategy = this->strategy();
+  strategy.fees.push_back(fee);
+  strategy.enabled.push_back(true);
+  publishStrategy(std::move(strategy));
+}
+
+void Parameters::publishStrategy(StrategyParams next) {
+  std::lock_guard<std::mutex> lock(strategyMtx);
+  strategies.emplace_back(new StrategyParams(std::move(next)));
+  currentStrategy.store(strategies.back().get(), std::memory_order_release);
 }
 
 void ltrim(std::string &s) {
@@ -239,3 +318,14 @@ void readAllParameters(std::ifstream &configFile,
     }
   }
 }
+
+std::map<std::string, std::string> readConfigFile(std::string const &path) {
+  std::ifstream configFile(path);
+  if (!configFile.is_open())
+    throw ConfigError(path + " cannot be open.");
+  std::map<std::string, std::string> dataMap;
+  readAllParameters(configFile, dataMap);
+  if (dataMap.empty())
+    throw ConfigError(path + " has no parameter.");
+  return dataMap;
+}
@@ -90,37 +90,41 @@ bool Result::loadPartialResult(std::string filename) {
     return false;
 
   resFile.seekg(0);
+  return loadPartialResult(resFile);
+}
+
+bool Result::loadPartialResult(std::istream &resFile) {
   resFile >> id >> idExchLong >> idExchShort >> exchNameLong >> exchNameShort >>
       exposure >> feesLong >> feesShort >> entryTime >> spreadIn >>
       priceLongIn >> priceShortIn >> leg2TotBalanceBefore >> exitTarget;
+  if (!resFile || idExchLong >= 13 || idExchShort >= 13)
+    return false;
 
   resFile >> maxSpread[idExchLong][idExchShort] >>
       minSpread[idExchLong][idExchShort] >> trailing[idExchLong][idExchShort] >>
       trailingWaitCount[idExchLong][idExchShort];
 
-  return true;
+  return !resFile.fail();
 }
 
-void Result::savePartialResult(std::string filename) {
-  std::ofstream resFile(filename, std::ofstream::trunc);
-
-  resFile << id << '\n'
-          << idExchLong << '\n'
-          << idExchShort << '\n'
-          << exchNameLong << '\n'
-          << exchNameShort << '\n'
-          << exposure << '\n'
-          << feesLong << '\n'
-          << feesShort << '\n'
-          << entryTime << '\n'
-          << spreadIn << '\n'
-          << priceLongIn << '\n'
-          << priceShortIn << '\n'
-          << leg2TotBalanceBefore << '\n'
-          << exitTarget << '\n';
+void Result::savePartialResult(std::ostream &resFile) const {
+  resFile << id << ' '
+          << idExchLong << ' '
+          << idExchShort << ' '
+          << exchNameLong << ' '
+          << exchNameShort << ' '
+          << exposure << ' '
+          << feesLong << ' '
+          << feesShort << ' '
+          << entryTime << ' '
+          << spreadIn << ' '
+          << priceLongIn << ' '
+          << priceShortIn << ' '
+          << leg2TotBalanceBefore << ' '
+          << exitTarget << ' ';
 
-  resFile << maxSpread[idExchLong][idExchShort] << '\n'
-          << minSpread[idExchLong][idExchShort] << '\n'
-          << trailing[idExchLong][idExchShort] << '\n'
-          << trailingWaitCount[idExchLong][idExchShort] << std::endl;
+  resFile << maxSpread[idExchLong][idExchShort] << ' '
+          << minSpread[idExchLong][idExchShort] << ' '
+          << trailing[idExchLong][idExchShort] << ' '
+          << trailingWaitCount[idExchLong][idExchShort];
 }
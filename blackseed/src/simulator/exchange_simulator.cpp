@@ -0,0 +1,207 @@
+#include "exchange_simulator.h"
+#include "parameters.h"
+#include "sim_venue.h"
+#include "utils/restapi.h"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdlib>
+#include <iomanip>
+#include <string>
+#include <thread>
+
+namespace {
+
+// The simulated exchanges, in port order
+const struct {
+  const char *name;
+  const char *host;
+  SimVenue::Handler handle;
+  SimVenue::ErrorBody error;
+  bool margin;
+  double Parameters::*fee;
+} dialects[] = {
+    {"Binance", "https://api.binance.com", SimDialect::binance,
+     SimDialect::binanceError, false, &Parameters::binanceFees},
+    {"Kraken", "https://api.kraken.com", SimDialect::kraken,
+     SimDialect::krakenError, true, &Parameters::krakenFees},
+    {"Bitfinex", "https://api.bitfinex.com", SimDialect::bitfinex,
+     SimDialect::bitfinexError, true, &Parameters::bitfinexFees},
+    {"CoinBasePro", "https://api.exchange.coinbase.com", SimDialect::coinbase,
+     SimDialect::coinbaseError, false, &Parameters::coinbaseFees},
+    {"Bitstamp", "https://www.bitstamp.net", SimDialect::bitstamp,
+     SimDialect::bitstampError, false, &Parameters::bitstampFees},
+};
+
+// The market moves by steps: the reference price by a log-normal one, each
+// venue's offset from it by a mean-reverting one. It takes 'stepsPerRequest'
+// steps per request served, enough for spreads to open and close from one
+// iteration of Blackbird to the next.
+const int stepsPerRequest = 10;
+const double startPrice = 10000.0;
+const double volatility = 0.0002;
+const double offsetVolatility = 0.0004;
+const double offsetReversion = 0.02;
+// Book kept by the market on each venue, as ratios of the mid price
+const int bookDepth = 25;
+const double halfSpread = 0.0002;
+const double levelStep = 0.0002;
+
+std::atomic<bool> interrupted{false};
+void onSignal(int) { interrupted = true; }
+
+double cents(double price) { return std::round(price * 100.0) / 100.0; }
+
+// SplitMix64, the draws of one request of a venue: the stream is a
+// function of the seed, the venue and the request's number on it
+struct RequestDraws {
+  using result_type = uint64_t;
+  uint64_t state;
+
+  RequestDraws(uint64_t seed, uint64_t venue, uint64_t request)
+      : state(mix(mix(seed ^ mix(venue)) ^ request)) {}
+
+  static constexpr uint64_t min() { return 0; }
+  static constexpr uint64_t max() { return ~uint64_t(0); }
+  uint64_t operator()() { return mix(state += 0x9e3779b97f4a7c15ull); }
+
+  static uint64_t mix(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+  }
+};
+
+// Replaces the market's orders by a fresh book around 'mid'; the new ones
+// trade with our resting orders they cross
+void refill(MatchingEngine &engine, double mid, std::mt19937_64 &rng) {
+  std::uniform_real_distribution<double> size(0.05, 2.0);
+  engine.clearMarket();
+  for (int level = 0; level < bookDepth; ++level) {
+    auto gap = halfSpread + level * levelStep;
+    engine.submit(false, cents(mid * (1 + gap)), size(rng), false);
+    engine.submit(true, cents(mid * (1 - gap)), size(rng), false);
+  }
+}
+}
+
+struct ExchangeSimulator::Venue : SimVenue {
+  Venue(size_t index, Parameters &params)
+      : SimVenue(dialects[index].name, dialects[index].handle,
+                 dialects[index].error, dialects[index].margin,
+                 params.*dialects[index].fee, params.simBalanceUsd,
+                 params.simBalanceBtc),
+        index(index) {}
+
+  const size_t index;
+  double offset = 0.0;  // of the mid from the reference price, marketMtx
+  std::atomic<uint64_t> requests{0};
+  std::unique_ptr<HttpServer> server;
+};
+
+ExchangeSimulator::ExchangeSimulator(Parameters &params)
+    : seed(params.simSeed), latency(params.simLatency),
+      jitter(params.simJitter), errorRate(params.simErrorRate),
+      stallRate(params.simStallRate), stallTime(params.simStallTime),
+      marketRng(params.simSeed), reference(startPrice) {
+  for (size_t i = 0; i < sizeof(dialects) / sizeof(dialects[0]); ++i)
+    venues.emplace_back(new Venue(i, params));
+  // The books are all there before the first request
+  for (auto &venue : venues)
+    refill(venue->engine, startPrice, marketRng);
+  for (size_t i = 0; i < venues.size(); ++i)
+    venues[i]->server.reset(serve(*venues[i], params.simulatorPort + i));
+}
+
+ExchangeSimulator::~ExchangeSimulator() = default;
+
+bool ExchangeSimulator::isRunning() const {
+  for (auto const &venue : venues)
+    if (!venue->server->isRunning())
+      return false;
+  return true;
+}
+
+HttpServer *ExchangeSimulator::serve(Venue &venue, unsigned short port) {
+  return new HttpServer(port, [this, &venue](HttpServer::Request const &req) {
+    RequestDraws draws(seed, venue.index, venue.requests++);
+    double draw = std::uniform_real_distribution<double>()(draws);
+    unsigned delay = latency + (jitter ? draws() % (jitter + 1) : 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+    // The request is served on the market it moved
+    step();
+    if (draw < errorRate) {
+      HttpServer::Response res;
+      res.status = 503;
+      res.body = venue.error("simulated failure");
+      return res;
+    }
+    if (draw < errorRate + stallRate)
+      std::this_thread::sleep_for(std::chrono::milliseconds(stallTime));
+    return venue.handle(venue, req);
+  });
+}
+
+void ExchangeSimulator::step() {
+  std::normal_distribution<double> normal;
+  std::lock_guard<std::mutex> market(marketMtx);
+  for (int i = 0; i < stepsPerRequest; ++i) {
+    reference *= std::exp(volatility * normal(marketRng));
+    for (auto &venue : venues)
+      venue->offset += -offsetReversion * venue->offset +
+                       offsetVolatility * normal(marketRng);
+  }
+  // Only the last book is seen, the ones in between are not refilled
+  for (auto &venue : venues) {
+    double mid = reference * (1.0 + venue->offset);
+    std::lock_guard<std::mutex> lock(venue->mtx);
+    refill(venue->engine, mid, marketRng);
+  }
+}
+
+void ExchangeSimulator::report(std::ostream &out) const {
+  out << std::fixed;
+  for (auto const &venue : venues) {
+    std::lock_guard<std::mutex> lock(venue->mtx);
+    out << "   " << std::setw(12) << std::left << venue->name << std::right
+        << venue->server->url() << "  " << std::setprecision(2)
+        << venue->engine.bestBid() << " / " << venue->engine.bestAsk()
+        << "  USD " << venue->engine.usd() << "  BTC " << std::setprecision(6)
+        << venue->engine.btc() << "  open orders "
+        << venue->engine.openOrders().size() << '\n';
+  }
+  out.flush();
+}
+
+void useSimulator(unsigned short basePort) {
+  for (size_t i = 0; i < sizeof(dialects) / sizeof(dialects[0]); ++i)
+    RestApi::overrideHost(dialects[i].host,
+                          "http://127.0.0.1:" + std::to_string(basePort + i));
+}
+
+int runSimulator(Parameters &params, std::ostream &out) {
+  ExchangeSimulator simulator(params);
+  if (!simulator.isRunning()) {
+    out << "ERROR: cannot open the simulator ports from "
+        << params.simulatorPort << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::signal(SIGINT, onSignal);
+  std::signal(SIGTERM, onSignal);
+  out << "Exchange simulator, Ctrl-C to stop\n";
+  simulator.report(out);
+  auto lastReport = std::chrono::steady_clock::now();
+  while (!interrupted) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    auto now = std::chrono::steady_clock::now();
+    if (now - lastReport >= std::chrono::seconds(10)) {
+      lastReport = now;
+      simulator.report(out << '\n');
+    }
+  }
+  out << "\nFinal state:\n";
+  simulator.report(out);
+  return EXIT_SUCCESS;
+}
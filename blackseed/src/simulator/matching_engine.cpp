@@ -0,0 +1,165 @@
+#include "matching_engine.h"
+
+#include <algorithm>
+#include <iterator>
+
+namespace {
+// Quantities below this are rounding leftovers
+const double dust = 1e-12;
+}
+
+MatchingEngine::MatchingEngine(double fee, double usd, double btc)
+    : fee(fee), usdBalance(usd), btcBalance(btc) {}
+
+void MatchingEngine::fill(Order &order, double price, double quantity) {
+  order.filled += quantity;
+  order.filledValue += price * quantity;
+  if (order.remaining() <= dust)
+    order.open = false;
+  if (!order.ours)
+    return;
+  if (order.isBuy) {
+    btcBalance += quantity;
+    usdBalance -= price * quantity * (1.0 + fee);
+  } else {
+    btcBalance -= quantity;
+    usdBalance += price * quantity * (1.0 - fee);
+  }
+}
+
+uint64_t MatchingEngine::submit(bool isBuy, double price, double quantity,
+                                bool ours, OrderType type) {
+  auto id = nextId++;
+  auto &order =
+      orders.emplace(id, Order{id, isBuy, price, quantity, 0.0, 0.0, ours})
+          .first->second;
+
+  auto &opposite = isBuy ? askSide : bidSide;
+  auto reaches = [&](double level) {
+    return isBuy ? level <= price : level >= price;
+  };
+  if (type == OrderType::postOnly && !opposite.empty() &&
+      reaches(opposite.begin()->first))
+    order.open = false;
+  if (type == OrderType::fok) {
+    double available = 0.0;
+    for (auto level = opposite.begin();
+         level != opposite.end() && reaches(level->first); ++level)
+      for (auto restingId : level->second)
+        available += orders.at(restingId).remaining();
+    if (available < quantity - dust)
+      order.open = false;
+  }
+
+  while (order.open && !opposite.empty()) {
+    auto level = opposite.begin();
+    if (isBuy ? level->first > price : level->first < price)
+      break;
+    auto &queue = level->second;
+    while (order.open && !queue.empty()) {
+      auto restingId = queue.front();
+      auto &resting = orders.at(restingId);
+      // Trades happen at the price of the resting order
+      auto traded = (std::min)(order.remaining(), resting.remaining());
+      fill(resting, level->first, traded);
+      fill(order, level->first, traded);
+      if (!resting.open) {
+        queue.pop_front();
+        if (!resting.ours)
+          orders.erase(restingId);
+      }
+    }
+    if (queue.empty())
+      opposite.erase(level);
+  }
+
+  if (type == OrderType::ioc || type == OrderType::fok)
+    order.open = false;
+  if (order.open)
+    (isBuy ? bidSide : askSide)[price].push_back(id);
+  else if (!ours)
+    orders.erase(id);
+  return id;
+}
+
+bool MatchingEngine::cancel(uint64_t id) {
+  auto it = orders.find(id);
+  if (it == orders.end() || !it->second.open)
+    return false;
+  auto &order = it->second;
+  order.open = false;
+  auto &side = order.isBuy ? bidSide : askSide;
+  auto level = side.find(order.price);
+  if (level != side.end()) {
+    auto &queue = level->second;
+    queue.erase(std::remove(queue.begin(), queue.end(), id), queue.end());
+    if (queue.empty())
+      side.erase(level);
+  }
+  if (!order.ours)
+    orders.erase(it);
+  return true;
+}
+
+void MatchingEngine::clearMarket() {
+  for (auto side : {&bidSide, &askSide}) {
+    for (auto level = side->begin(); level != side->end();) {
+      auto &queue = level->second;
+      queue.erase(std::remove_if(queue.begin(), queue.end(),
+                                 [this](uint64_t id) {
+                                   auto it = orders.find(id);
+                                   if (it->second.ours)
+                                     return false;
+                                   orders.erase(it);
+                                   return true;
+                                 }),
+                  queue.end());
+      level = queue.empty() ? side->erase(level) : std::next(level);
+    }
+  }
+}
+
+MatchingEngine::Order const *MatchingEngine::order(uint64_t id) const {
+  auto it = orders.find(id);
+  return it == orders.end() ? nullptr : &it->second;
+}
+
+std::vector<MatchingEngine::Order> MatchingEngine::openOrders() const {
+  std::vector<Order> res;
+  for (auto const &order : orders)
+    if (order.second.ours && order.second.open)
+      res.push_back(order.second);
+  std::sort(res.begin(), res.end(),
+            [](Order const &a, Order const &b) { return a.id < b.id; });
+  return res;
+}
+
+std::vector<MatchingEngine::Level>
+MatchingEngine::levels(Side const &side, size_t depth) const {
+  std::vector<Level> res;
+  for (auto const &level : side) {
+    if (res.size() == depth)
+      break;
+    double quantity = 0.0;
+    for (auto id : level.second)
+      quantity += orders.at(id).remaining();
+    res.emplace_back(level.first, quantity);
+  }
+  return res;
+}
+
+std::vector<MatchingEngine::Level> MatchingEngine::bids(size_t depth) const {
+  return levels(bidSide, depth);
+}
+
+std::vector<MatchingEngine::Level> MatchingEngine::asks(size_t depth) const {
+  return levels(askSide, depth);
+}
+
+double MatchingEngine::bestBid() const {
+  return bidSide.empty() ? 0.0 : bidSide.begin()->first;
+}
+
+double MatchingEngine::bestAsk() const {
+  return askSide.empty() ? 0.0 : askSide.begin()->first;
+}
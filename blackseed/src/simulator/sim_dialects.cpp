@@ -0,0 +1,676 @@
+#include "sim_venue.h"
+#include "unique_json.hpp"
+#include "utils/base64.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using Request = HttpServer::Request;
+using Response = HttpServer::Response;
+using Order = MatchingEngine::Order;
+using Level = MatchingEngine::Level;
+
+namespace {
+
+std::string decimal(double v, int digits = 8) {
+  char buf[64];
+  std::snprintf(buf, sizeof(buf), "%.*f", digits, v);
+  return buf;
+}
+
+long long nowMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+Response reply(json_t *root, int status = 200) {
+  unique_json owner{root};
+  Response res;
+  res.status = status;
+  char *text = json_dumps(root, JSON_COMPACT | JSON_ENCODE_ANY);
+  res.body = text ? text : "null";
+  std::free(text);
+  return res;
+}
+
+Response replyError(SimVenue &venue, std::string const &message,
+                    int status = 400) {
+  Response res;
+  res.status = status;
+  res.body = venue.error(message);
+  return res;
+}
+
+std::string query(Request const &req) {
+  auto mark = req.uri.find('?');
+  return mark == std::string::npos ? std::string() : req.uri.substr(mark + 1);
+}
+
+double number(std::map<std::string, std::string> const &args,
+              std::string const &name) {
+  auto it = args.find(name);
+  return it == args.end() ? 0.0 : std::atof(it->second.c_str());
+}
+
+uint64_t idFrom(std::string const &text) {
+  return std::strtoull(text.c_str(), nullptr, 10);
+}
+
+template <typename F> json_t *toArray(std::vector<Level> const &levels, F entry) {
+  json_t *array = json_array();
+  for (auto const &level : levels)
+    json_array_append_new(array, entry(level));
+  return array;
+}
+
+Level top(std::vector<Level> const &levels) {
+  return levels.empty() ? Level(0.0, 0.0) : levels.front();
+}
+
+// Copy of one of our orders, false if there is none with that id
+bool findOrder(SimVenue &venue, uint64_t id, Order &order) {
+  std::lock_guard<std::mutex> lock(venue.mtx);
+  auto found = venue.engine.order(id);
+  if (!found || !found->ours)
+    return false;
+  order = *found;
+  return true;
+}
+
+double averagePrice(Order const &order) {
+  return order.filled > 0.0 ? order.filledValue / order.filled : 0.0;
+}
+
+// Closed before all of it traded
+bool canceled(Order const &order) {
+  return !order.open && order.remaining() > 1e-12;
+}
+}
+
+std::map<std::string, std::string> parseForm(std::string const &form) {
+  auto decode = [](std::string const &s) {
+    std::string res;
+    for (size_t i = 0; i < s.size(); ++i) {
+      if (s[i] == '+') {
+        res += ' ';
+      } else if (s[i] == '%' && i + 2 < s.size()) {
+        res += static_cast<char>(std::strtol(s.substr(i + 1, 2).c_str(),
+                                             nullptr, 16));
+        i += 2;
+      } else {
+        res += s[i];
+      }
+    }
+    return res;
+  };
+  std::map<std::string, std::string> args;
+  size_t start = 0;
+  while (start < form.size()) {
+    auto end = form.find('&', start);
+    if (end == std::string::npos)
+      end = form.size();
+    auto pair = form.substr(start, end - start);
+    auto eq = pair.find('=');
+    if (eq != std::string::npos)
+      args[decode(pair.substr(0, eq))] = decode(pair.substr(eq + 1));
+    start = end + 1;
+  }
+  return args;
+}
+
+uint64_t SimVenue::placeOrder(bool isBuy, double price, double quantity,
+                              OrderType type, std::string &reason) {
+  if (!(price > 0.0) || !(quantity > 0.0)) {
+    reason = "invalid price or quantity";
+    return 0;
+  }
+  std::lock_guard<std::mutex> lock(mtx);
+  if (isBuy && price * quantity > engine.usd()) {
+    reason = "insufficient funds";
+    return 0;
+  }
+  if (!isBuy && !margin && quantity > engine.btc()) {
+    reason = "insufficient funds";
+    return 0;
+  }
+  return engine.submit(isBuy, price, quantity, true, type);
+}
+
+bool SimVenue::cancelOrder(uint64_t id) {
+  std::lock_guard<std::mutex> lock(mtx);
+  auto order = engine.order(id);
+  return order && order->ours && engine.cancel(id);
+}
+
+namespace SimDialect {
+
+// GET /api/v3/ticker/bookTicker, /api/v1/depth, /api/v1/time,
+// /api/v3/account, /api/v3/openOrders, /api/v3/order, POST and DELETE
+// /api/v3/order, all arguments in the query string
+std::string binanceError(std::string const &message) {
+  return "{\"code\":-1000,\"msg\":\"" + message + "\"}";
+}
+
+static json_t *binanceOrder(Order const &order) {
+  const char *status = canceled(order)     ? "EXPIRED"
+                       : !order.open        ? "FILLED"
+                       : order.filled > 0.0 ? "PARTIALLY_FILLED"
+                                            : "NEW";
+  return json_pack(
+      "{s:s, s:I, s:s, s:I, s:s, s:s, s:s, s:s, s:s, s:s, s:s, s:s}", "symbol",
+      "BTCUSDT", "orderId", (json_int_t)order.id, "clientOrderId",
+      ("sim" + std::to_string(order.id)).c_str(), "transactTime",
+      (json_int_t)nowMs(), "price", decimal(order.price).c_str(), "origQty",
+      decimal(order.quantity).c_str(), "executedQty",
+      decimal(order.filled).c_str(), "cummulativeQuoteQty",
+      decimal(order.filledValue).c_str(), "status", status, "timeInForce",
+      "GTC", "type", "LIMIT", "side", order.isBuy ? "BUY" : "SELL");
+}
+
+static OrderType binanceType(std::map<std::string, std::string> &args) {
+  if (args["type"] == "LIMIT_MAKER")
+    return OrderType::postOnly;
+  if (args["timeInForce"] == "IOC")
+    return OrderType::ioc;
+  if (args["timeInForce"] == "FOK")
+    return OrderType::fok;
+  return OrderType::gtc;
+}
+
+Response binance(SimVenue &venue, Request const &req) {
+  auto args = parseForm(query(req));
+  if (req.path == "/api/v1/time")
+    return reply(json_pack("{s:I}", "serverTime", (json_int_t)nowMs()));
+
+  if (req.path == "/api/v3/ticker/bookTicker") {
+    std::unique_lock<std::mutex> lock(venue.mtx);
+    auto bid = top(venue.engine.bids(1));
+    auto ask = top(venue.engine.asks(1));
+    lock.unlock();
+    return reply(json_pack("[{s:s, s:s, s:s, s:s, s:s}]", "symbol", "BTCUSDT",
+                           "bidPrice", decimal(bid.first).c_str(), "bidQty",
+                           decimal(bid.second).c_str(), "askPrice",
+                           decimal(ask.first).c_str(), "askQty",
+                           decimal(ask.second).c_str()));
+  }
+
+  if (req.path == "/api/v1/depth") {
+    auto limit = args.count("limit") ? number(args, "limit") : 100;
+    auto entry = [](Level const &level) {
+      return json_pack("[s, s, []]", decimal(level.first).c_str(),
+                       decimal(level.second).c_str());
+    };
+    std::lock_guard<std::mutex> lock(venue.mtx);
+    auto depth = static_cast<size_t>(limit);
+    return reply(json_pack("{s:I, s:o, s:o}", "lastUpdateId",
+                           (json_int_t)nowMs(), "bids",
+                           toArray(venue.engine.bids(depth), entry), "asks",
+                           toArray(venue.engine.asks(depth), entry)));
+  }
+
+  if (req.path == "/api/v3/account") {
+    std::lock_guard<std::mutex> lock(venue.mtx);
+    return reply(json_pack(
+        "{s:[{s:s, s:s, s:s}, {s:s, s:s, s:s}]}", "balances", "asset", "BTC",
+        "free", decimal(venue.engine.btc()).c_str(), "locked", "0.00000000",
+        "asset", "USDT", "free", decimal(venue.engine.usd()).c_str(), "locked",
+        "0.00000000"));
+  }
+
+  if (req.path == "/api/v3/order" && req.method == "POST") {
+    std::string reason;
+    auto id = venue.placeOrder(args["side"] == "BUY", number(args, "price"),
+                               number(args, "quantity"), binanceType(args),
+                               reason);
+    Order order;
+    if (id == 0 || !findOrder(venue, id, order))
+      return replyError(venue, reason);
+    return reply(binanceOrder(order));
+  }
+
+  if (req.path == "/api/v3/order" && req.method == "DELETE") {
+    auto id = idFrom(args["orderId"]);
+    Order order;
+    if (!venue.cancelOrder(id) || !findOrder(venue, id, order))
+      return replyError(venue, "Unknown order sent.");
+    json_t *canceled = binanceOrder(order);
+    json_object_set_new(canceled, "status", json_string("CANCELED"));
+    return reply(canceled);
+  }
+
+  if (req.path == "/api/v3/order") {
+    Order order;
+    if (!findOrder(venue, idFrom(args["orderId"]), order))
+      return replyError(venue, "Order does not exist.");
+    return reply(binanceOrder(order));
+  }
+
+  if (req.path == "/api/v3/openOrders") {
+    json_t *open = json_array();
+    std::lock_guard<std::mutex> lock(venue.mtx);
+    for (auto const &order : venue.engine.openOrders())
+      json_array_append_new(open, binanceOrder(order));
+    return reply(open);
+  }
+  return replyError(venue, "unknown endpoint", 404);
+}
+
+// GET /0/public/Ticker, /0/public/Depth and POST /0/private/Balance,
+// /0/private/AddOrder, /0/private/OpenOrders, /0/private/QueryOrders,
+// /0/private/CancelOrder with a form body
+std::string krakenError(std::string const &message) {
+  return "{\"error\":[\"EGeneral:" + message + "\"]}";
+}
+
+static std::string krakenTxid(uint64_t id) { return "OSIM-" + std::to_string(id); }
+
+static json_t *krakenOrder(Order const &order) {
+  const char *status = canceled(order) ? "canceled"
+                       : order.open    ? "open"
+                                       : "closed";
+  return json_pack("{s:s, s:s, s:s, s:s, s:{s:s, s:s, s:s, s:s}}", "status",
+                   status, "vol", decimal(order.quantity).c_str(), "vol_exec",
+                   decimal(order.filled).c_str(), "price",
+                   decimal(averagePrice(order), 1).c_str(), "descr", "pair",
+                   "XBTUSD", "type", order.isBuy ? "buy" : "sell", "ordertype",
+                   "limit", "price", decimal(order.price, 1).c_str());
+}
+
+Response kraken(SimVenue &venue, Request const &req) {
+  auto result = [](json_t *res) {
+    return reply(json_pack("{s:[], s:o}", "error", "result", res));
+  };
+  if (req.path == "/0/public/Ticker") {
+    std::unique_lock<std::mutex> lock(venue.mtx);
+    auto bid = top(venue.engine.bids(1));
+    auto ask = top(venue.engine.asks(1));
+    lock.unlock();
+    return result(json_pack(
+        "{s:{s:[s, s, s], s:[s, s, s], s:[s, s]}}", "XXBTZUSD", "a",
+        decimal(ask.first, 5).c_str(), "1", "1.000", "b",
+        decimal(bid.first, 5).c_str(), "1", "1.000", "c",
+        decimal((bid.first + ask.first) / 2, 5).c_str(), "0.01000000"));
+  }
+
+  if (req.path == "/0/public/Depth") {
+    auto args = parseForm(query(req));
+    auto depth = static_cast<size_t>(args.count("count") ? number(args, "count")
+                                                         : 100);
+    auto stamp = static_cast<json_int_t>(nowMs() / 1000);
+    auto entry = [stamp](Level const &level) {
+      return json_pack("[s, s, I]", decimal(level.first, 5).c_str(),
+                       decimal(level.second, 3).c_str(), stamp);
+    };
+    std::lock_guard<std::mutex> lock(venue.mtx);
+    return result(json_pack("{s:{s:o, s:o}}", "XXBTZUSD", "asks",
+                            toArray(venue.engine.asks(depth), entry), "bids",
+                            toArray(venue.engine.bids(depth), entry)));
+  }
+
+  auto args = parseForm(req.body);
+  if (req.path == "/0/private/Balance") {
+    std::lock_guard<std::mutex> lock(venue.mtx);
+    return result(json_pack("{s:s, s:s}", "ZUSD",
+                            decimal(venue.engine.usd(), 4).c_str(), "XXBT",
+                            decimal(venue.engine.btc(), 10).c_str()));
+  }
+
+  if (req.path == "/0/private/AddOrder") {
+    std::string reason;
+    bool isBuy = args["type"] == "buy";
+    auto price = number(args, "price");
+    auto volume = number(args, "volume");
+    auto type = args["timeinforce"] == "IOC" ? OrderType::ioc
+                : args["oflags"] == "post"     ? OrderType::postOnly
+                                               : OrderType::gtc;
+    auto id = venue.placeOrder(isBuy, price, volume, type, reason);
+    if (id == 0)
+      return replyError(venue, reason, 200);
+    auto descr = args["type"] + " " + decimal(volume) + " XBTUSD @ limit " +
+                 decimal(price, 1);
+    return result(json_pack("{s:{s:s}, s:[s]}", "descr", "order",
+                            descr.c_str(), "txid", krakenTxid(id).c_str()));
+  }
+
+  if (req.path == "/0/private/OpenOrders") {
+    json_t *open = json_object();
+    std::lock_guard<std::mutex> lock(venue.mtx);
+    for (auto const &order : venue.engine.openOrders())
+      json_object_set_new(open, krakenTxid(order.id).c_str(),
+                          krakenOrder(order));
+    return result(json_pack("{s:o}", "open", open));
+  }
+
+  if (req.path == "/0/private/QueryOrders") {
+    auto txid = args["txid"];
+    Order order;
+    if (txid.rfind("OSIM-", 0) != 0 ||
+        !findOrder(venue, idFrom(txid.substr(5)), order))
+      return replyError(venue, "Invalid order", 200);
+    json_t *orders = json_object();
+    json_object_set_new(orders, txid.c_str(), krakenOrder(order));
+    return result(orders);
+  }
+
+  if (req.path == "/0/private/CancelOrder") {
+    auto txid = args["txid"];
+    if (txid.rfind("OSIM-", 0) != 0 ||
+        !venue.cancelOrder(idFrom(txid.substr(5))))
+      return replyError(venue, "Unknown order", 200);
+    return result(json_pack("{s:i}", "count", 1));
+  }
+  return replyError(venue, "Unknown method", 404);
+}
+
+// GET /v1/ticker/btcusd, /v1/book/btcusd and POST /v1/balances,
+// /v1/order/new, /v1/order/status, /v1/order/cancel, /v1/positions. The
+// arguments come as base64 JSON in the X-BFX-PAYLOAD header.
+std::string bitfinexError(std::string const &message) {
+  return "{\"message\":\"" + message + "\"}";
+}
+
+static json_t *bitfinexOrder(Order const &order) {
+  return json_pack(
+      "{s:I, s:I, s:s, s:s, s:s, s:s, s:s, s:s, s:s, s:b, s:b, s:s, s:s, s:s}",
+      "id", (json_int_t)order.id, "order_id", (json_int_t)order.id, "symbol",
+      "btcusd", "exchange", "bitfinex", "price", decimal(order.price, 2).c_str(),
+      "avg_execution_price", decimal(averagePrice(order), 2).c_str(), "side",
+      order.isBuy ? "buy" : "sell", "type", "limit", "timestamp",
+      decimal(nowMs() / 1000.0, 3).c_str(), "is_live", order.open,
+      "is_cancelled", canceled(order), "original_amount",
+      decimal(order.quantity).c_str(), "remaining_amount",
+      decimal(order.remaining()).c_str(), "executed_amount",
+      decimal(order.filled).c_str());
+}
+
+Response bitfinex(SimVenue &venue, Request const &req) {
+  if (req.path == "/v1/ticker/btcusd") {
+    std::unique_lock<std::mutex> lock(venue.mtx);
+    auto bid = top(venue.engine.bids(1)).first;
+    auto ask = top(venue.engine.asks(1)).first;
+    lock.unlock();
+    return reply(json_pack("{s:s, s:s, s:s, s:s, s:s}", "mid",
+                           decimal((bid + ask) / 2, 2).c_str(), "bid",
+                           decimal(bid, 2).c_str(), "ask",
+                           decimal(ask, 2).c_str(), "last_price",
+                           decimal((bid + ask) / 2, 2).c_str(), "timestamp",
+                           decimal(nowMs() / 1000.0, 3).c_str()));
+  }
+
+  if (req.path == "/v1/book/btcusd") {
+    auto stamp = decimal(nowMs() / 1000.0, 1);
+    auto entry = [&stamp](Level const &level) {
+      return json_pack("{s:s, s:s, s:s}", "price",
+                       decimal(level.first, 2).c_str(), "amount",
+                       decimal(level.second).c_str(), "timestamp",
+                       stamp.c_str());
+    };
+    std::lock_guard<std::mutex> lock(venue.mtx);
+    return reply(json_pack("{s:o, s:o}", "bids",
+                           toArray(venue.engine.bids(50), entry), "asks",
+                           toArray(venue.engine.asks(50), entry)));
+  }
+
+  unique_json payload{json_loads(
+      base64_decode(req.header("X-BFX-PAYLOAD")).c_str(), 0, nullptr)};
+  if (!payload)
+    return replyError(venue, "Invalid payload");
+  auto text = [&payload](const char *key) {
+    auto value = json_string_value(json_object_get(payload.get(), key));
+    return std::string(value ? value : "");
+  };
+
+  if (req.path == "/v1/balances") {
+    std::lock_guard<std::mutex> lock(venue.mtx);
+    auto usd = decimal(venue.engine.usd());
+    auto btc = decimal(venue.engine.btc());
+    return reply(json_pack(
+        "[{s:s, s:s, s:s, s:s}, {s:s, s:s, s:s, s:s}]", "type", "trading",
+        "currency", "usd", "amount", usd.c_str(), "available", usd.c_str(),
+        "type", "trading", "currency", "btc", "amount", btc.c_str(),
+        "available", btc.c_str()));
+  }
+
+  if (req.path == "/v1/order/new") {
+    std::string reason;
+    auto type = text("type") == "fill-or-kill" ? OrderType::fok
+                : json_is_true(json_object_get(payload.get(), "is_postonly"))
+                    ? OrderType::postOnly
+                    : OrderType::gtc;
+    auto id = venue.placeOrder(text("side") == "buy",
+                               std::atof(text("price").c_str()),
+                               std::atof(text("amount").c_str()), type,
+                               reason);
+    Order order;
+    if (id == 0 || !findOrder(venue, id, order))
+      return replyError(venue, reason);
+    return reply(bitfinexOrder(order));
+  }
+
+  if (req.path == "/v1/order/status") {
+    auto id = json_integer_value(json_object_get(payload.get(), "order_id"));
+    Order order;
+    if (!findOrder(venue, static_cast<uint64_t>(id), order))
+      return replyError(venue, "No such order found.");
+    return reply(bitfinexOrder(order));
+  }
+
+  if (req.path == "/v1/order/cancel") {
+    auto id = static_cast<uint64_t>(
+        json_integer_value(json_object_get(payload.get(), "order_id")));
+    Order order;
+    if (!venue.cancelOrder(id) || !findOrder(venue, id, order))
+      return replyError(venue, "Order could not be cancelled.");
+    return reply(bitfinexOrder(order));
+  }
+
+  if (req.path == "/v1/positions") {
+    std::lock_guard<std::mutex> lock(venue.mtx);
+    if (venue.engine.btc() == 0.0)
+      return reply(json_array());
+    return reply(json_pack("[{s:I, s:s, s:s, s:s, s:s, s:s}]", "id",
+                           (json_int_t)1, "symbol", "btcusd", "status",
+                           "ACTIVE", "amount",
+                           decimal(venue.engine.btc()).c_str(), "swap", "0.0",
+                           "pl", "0.0"));
+  }
+  return replyError(venue, "Unknown request", 404);
+}
+
+// GET /products/BTC-USD/ticker, /products/BTC-USD/book, /accounts,
+// /orders, /orders/<id>, DELETE /orders/<id> and POST /orders with a JSON
+// body
+std::string coinbaseError(std::string const &message) {
+  return "{\"message\":\"" + message + "\"}";
+}
+
+static std::string coinbaseId(uint64_t id) {
+  char buf[40];
+  std::snprintf(buf, sizeof(buf), "00000000-0000-4000-8000-%012llu",
+                static_cast<unsigned long long>(id));
+  return buf;
+}
+
+static json_t *coinbaseOrder(Order const &order) {
+  return json_pack("{s:s, s:s, s:s, s:s, s:s, s:s, s:s, s:s, s:s}", "id",
+                   coinbaseId(order.id).c_str(), "price",
+                   decimal(order.price, 2).c_str(), "size",
+                   decimal(order.quantity).c_str(), "product_id", "BTC-USD",
+                   "side", order.isBuy ? "buy" : "sell", "type", "limit",
+                   "filled_size", decimal(order.filled).c_str(),
+                   "executed_value", decimal(order.filledValue).c_str(),
+                   "status", order.open ? "open" : "done");
+}
+
+Response coinbase(SimVenue &venue, Request const &req) {
+  if (req.path == "/products/BTC-USD/ticker") {
+    std::unique_lock<std::mutex> lock(venue.mtx);
+    auto bid = top(venue.engine.bids(1)).first;
+    auto ask = top(venue.engine.asks(1)).first;
+    lock.unlock();
+    return reply(json_pack("{s:I, s:s, s:s, s:s, s:s, s:s}", "trade_id",
+                           (json_int_t)nowMs(), "price",
+                           decimal((bid + ask) / 2, 2).c_str(), "size",
+                           "0.01000000", "bid", decimal(bid, 2).c_str(), "ask",
+                           decimal(ask, 2).c_str(), "volume", "0"));
+  }
+
+  if (req.path == "/products/BTC-USD/book") {
+    auto entry = [](Level const &level) {
+      return json_pack("[s, s, i]", decimal(level.first, 2).c_str(),
+                       decimal(level.second).c_str(), 1);
+    };
+    std::lock_guard<std::mutex> lock(venue.mtx);
+    return reply(json_pack("{s:I, s:o, s:o}", "sequence", (json_int_t)nowMs(),
+                           "bids", toArray(venue.engine.bids(50), entry),
+                           "asks", toArray(venue.engine.asks(50), entry)));
+  }
+
+  if (req.path == "/accounts") {
+    std::lock_guard<std::mutex> lock(venue.mtx);
+    auto usd = decimal(venue.engine.usd());
+    auto btc = decimal(venue.engine.btc());
+    return reply(json_pack(
+        "[{s:s, s:s, s:s, s:s, s:s}, {s:s, s:s, s:s, s:s, s:s}]", "id",
+        "sim-btc", "currency", "BTC", "balance", btc.c_str(), "available",
+        btc.c_str(), "hold", "0", "id", "sim-usd", "currency", "USD",
+        "balance", usd.c_str(), "available", usd.c_str(), "hold", "0"));
+  }
+
+  if (req.path == "/orders" && req.method == "POST") {
+    unique_json body{json_loads(req.body.c_str(), 0, nullptr)};
+    auto text = [&body](const char *key) {
+      auto value = json_string_value(json_object_get(body.get(), key));
+      return std::string(value ? value : "");
+    };
+    std::string reason = "Invalid order";
+    auto tif = text("time_in_force");
+    auto type = tif == "IOC"   ? OrderType::ioc
+                : tif == "FOK" ? OrderType::fok
+                : json_is_true(json_object_get(body.get(), "post_only"))
+                    ? OrderType::postOnly
+                    : OrderType::gtc;
+    auto id = body ? venue.placeOrder(text("side") == "buy",
+                                      std::atof(text("price").c_str()),
+                                      std::atof(text("size").c_str()), type,
+                                      reason)
+                   : 0;
+    Order order;
+    if (id == 0 || !findOrder(venue, id, order))
+      return replyError(venue, reason);
+    return reply(coinbaseOrder(order));
+  }
+
+  if (req.path == "/orders") {
+    json_t *open = json_array();
+    std::lock_guard<std::mutex> lock(venue.mtx);
+    for (auto const &order : venue.engine.openOrders())
+      json_array_append_new(open, coinbaseOrder(order));
+    return reply(open);
+  }
+
+  if (req.path.rfind("/orders/", 0) == 0) {
+    // The ids are coinbaseId()
+    auto id = idFrom(req.path.substr(req.path.rfind('-') + 1));
+    if (req.method == "DELETE") {
+      if (!venue.cancelOrder(id))
+        return replyError(venue, "order not found");
+      return reply(json_string(coinbaseId(id).c_str()));
+    }
+    Order order;
+    if (!findOrder(venue, id, order))
+      return replyError(venue, "NotFound", 404);
+    return reply(coinbaseOrder(order));
+  }
+  return replyError(venue, "NotFound", 404);
+}
+
+// GET /api/ticker, /api/order_book and POST /api/balance/, /api/buy/,
+// /api/sell/, /api/order_status/, /api/cancel_order/ with a form body
+std::string bitstampError(std::string const &message) {
+  return "{\"status\":\"error\",\"reason\":\"" + message + "\",\"error\":\"" +
+         message + "\"}";
+}
+
+Response bitstamp(SimVenue &venue, Request const &req) {
+  auto stamp = std::to_string(nowMs() / 1000);
+  if (req.path == "/api/ticker") {
+    std::unique_lock<std::mutex> lock(venue.mtx);
+    auto bid = top(venue.engine.bids(1)).first;
+    auto ask = top(venue.engine.asks(1)).first;
+    lock.unlock();
+    auto mid = decimal((bid + ask) / 2, 2);
+    return reply(json_pack("{s:s, s:s, s:s, s:s, s:s, s:s}", "last",
+                           mid.c_str(), "timestamp", stamp.c_str(), "bid",
+                           decimal(bid, 2).c_str(), "ask",
+                           decimal(ask, 2).c_str(), "vwap", mid.c_str(),
+                           "volume", "0.00000000"));
+  }
+
+  if (req.path == "/api/order_book") {
+    auto entry = [](Level const &level) {
+      return json_pack("[s, s]", decimal(level.first, 2).c_str(),
+                       decimal(level.second).c_str());
+    };
+    std::lock_guard<std::mutex> lock(venue.mtx);
+    return reply(json_pack("{s:s, s:o, s:o}", "timestamp", stamp.c_str(),
+                           "bids", toArray(venue.engine.bids(100), entry),
+                           "asks", toArray(venue.engine.asks(100), entry)));
+  }
+
+  auto args = parseForm(req.body);
+  if (req.path == "/api/balance/") {
+    std::lock_guard<std::mutex> lock(venue.mtx);
+    auto usd = decimal(venue.engine.usd(), 2);
+    auto btc = decimal(venue.engine.btc());
+    return reply(json_pack("{s:s, s:s, s:s, s:s, s:s, s:s, s:s}",
+                           "usd_balance", usd.c_str(), "btc_balance",
+                           btc.c_str(), "usd_available", usd.c_str(),
+                           "btc_available", btc.c_str(), "usd_reserved",
+                           "0.00", "btc_reserved", "0.00000000", "fee",
+                           "0.25"));
+  }
+
+  if (req.path == "/api/buy/" || req.path == "/api/sell/") {
+    bool isBuy = req.path == "/api/buy/";
+    std::string reason;
+    auto id = venue.placeOrder(isBuy, number(args, "price"),
+                               number(args, "amount"), OrderType::gtc, reason);
+    Order order;
+    if (id == 0 || !findOrder(venue, id, order))
+      return replyError(venue, reason);
+    return reply(json_pack("{s:I, s:s, s:s, s:s, s:s}", "id",
+                           (json_int_t)order.id, "datetime", stamp.c_str(),
+                           "type", isBuy ? "0" : "1", "price",
+                           decimal(order.price, 2).c_str(), "amount",
+                           decimal(order.quantity).c_str()));
+  }
+
+  if (req.path == "/api/order_status/") {
+    Order order;
+    if (!findOrder(venue, idFrom(args["id"]), order))
+      return replyError(venue, "Invalid order id");
+    json_t *transactions = json_array();
+    if (order.filled > 0.0)
+      json_array_append_new(
+          transactions,
+          json_pack("{s:s, s:s, s:s}", "price",
+                    decimal(averagePrice(order), 2).c_str(), "btc",
+                    decimal(order.filled).c_str(), "usd",
+                    decimal(order.filledValue, 2).c_str()));
+    return reply(json_pack("{s:s, s:o}", "status",
+                           order.open ? "Open" : "Finished", "transactions",
+                           transactions));
+  }
+
+  if (req.path == "/api/cancel_order/") {
+    if (!venue.cancelOrder(idFrom(args["id"])))
+      return replyError(venue, "Order not found");
+    return reply(json_true());
+  }
+  return replyError(venue, "Not found", 404);
+}
+} // namespace SimDialect
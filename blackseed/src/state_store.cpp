@@ -0,0 +1,131 @@
+#include "state_store.h"
+#include "durable_file.h"
+#include "result.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <sstream>
+
+namespace {
+
+const char header[] = "blackbird-state 1";
+}
+
+StateStore::StateStore(std::string fileName) : fileName(std::move(fileName)) {}
+
+bool StateStore::load() {
+  positions.clear();
+  orders.clear();
+
+  std::ifstream file(fileName);
+  if (!file) {
+    Result res;
+    res.reset();
+    bool imported = res.loadPartialResult("restore.txt");
+    if (imported)
+      savePosition(res);
+    if (!imported || commit())
+      std::remove("restore.txt");
+    return true;
+  }
+
+  // The file is only ever replaced as a whole, a bad one was edited or
+  // damaged on disk
+  std::string line;
+  if (!std::getline(file, line) || line != header)
+    return false;
+  decltype(positions) newPositions;
+  decltype(orders) newOrders;
+  bool complete = false;
+  while (std::getline(file, line)) {
+    std::istringstream in(line);
+    std::string kind;
+    in >> kind;
+    if (kind == "position") {
+      unsigned id;
+      in >> id >> std::ws;
+      std::string state;
+      std::getline(in, state);
+      if (!in.fail())
+        newPositions[id] = state;
+    } else if (kind == "order") {
+      PendingOrder order;
+      in >> order.exch >> order.orderId >> order.direction >> order.isShort >>
+          order.quantity >> order.price >> order.positionId;
+      if (order.orderId == "-")
+        order.orderId.clear();
+      if (!in.fail())
+        newOrders.push_back(order);
+    } else if (kind == "end") {
+      complete = true;
+      break;
+    }
+    if (in.fail())
+      return false;
+  }
+  if (!complete)
+    return false;
+  positions.swap(newPositions);
+  orders.swap(newOrders);
+  return true;
+}
+
+void StateStore::savePosition(Result const &res) {
+  std::ostringstream out;
+  out.precision(std::numeric_limits<double>::max_digits10);
+  res.savePartialResult(out);
+  positions[res.id] = out.str();
+}
+
+void StateStore::removePosition(unsigned id) { positions.erase(id); }
+
+std::vector<unsigned> StateStore::positionIds() const {
+  std::vector<unsigned> ids;
+  for (auto const &position : positions)
+    ids.push_back(position.first);
+  return ids;
+}
+
+bool StateStore::restorePosition(unsigned id, Result &res) const {
+  auto it = positions.find(id);
+  if (it == positions.end())
+    return false;
+  std::istringstream in(it->second);
+  return res.loadPartialResult(in);
+}
+
+void StateStore::addOrder(PendingOrder const &order) {
+  orders.push_back(order);
+}
+
+void StateStore::removeOrder(unsigned exch, std::string const &orderId) {
+  orders.erase(std::remove_if(orders.begin(), orders.end(),
+                              [&](PendingOrder const &order) {
+                                return order.exch == exch &&
+                                       order.orderId == orderId;
+                              }),
+               orders.end());
+}
+
+bool StateStore::commit() {
+  std::ostringstream out;
+  out.precision(std::numeric_limits<double>::max_digits10);
+  out << header << '\n';
+  for (auto const &position : positions)
+    out << "position " << position.first << ' ' << position.second << '\n';
+  for (auto const &order : orders)
+    out << "order " << order.exch << ' '
+        << (order.orderId.empty() ? "-" : order.orderId) << ' '
+        << order.direction << ' ' << order.isShort << ' ' << order.quantity
+        << ' ' << order.price << ' ' << order.positionId << '\n';
+  out << "end\n";
+
+  // If anything fails the previous state stays in place
+  auto tmpName = fileName + ".tmp";
+  if (!writeDurably(tmpName, out.str()) || !replaceFile(tmpName, fileName)) {
+    std::remove(tmpName.c_str());
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,202 @@
+#include "tick_to_trade.h"
+#include "bitcoin.h"
+#include "check_entry_exit.h"
+#include "parameters.h"
+#include "result.h"
+#include "exchanges/binance.h"
+#include "exchanges/bitfinex.h"
+#include "utils/http_server.h"
+#include "utils/latency.h"
+#include "utils/nonce.h"
+#include "utils/restapi.h"
+#include "jansson.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <vector>
+
+namespace {
+
+// JSON values allocated by any thread, the quotes are parsed on the event
+// loop. Only jansson's allocator is hooked, for the length of the bench:
+// the bot's own operator new is left alone.
+std::atomic<uint64_t> allocations{0};
+
+void *countedMalloc(size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  return std::malloc(size);
+}
+
+// The responses the bench needs, by host and path
+const struct {
+  const char *host;
+  const char *path;
+} endpoints[] = {
+    {"api.binance.com", "/api/v3/ticker/bookTicker"},
+    {"api.binance.com", "/api/v1/depth"},
+    {"api.binance.com", "/api/v1/time"},
+    {"api.binance.com", "/api/v3/order"},
+    {"api.bitfinex.com", "/v1/ticker/btcusd"},
+    {"api.bitfinex.com", "/v1/book/btcusd"},
+    {"api.bitfinex.com", "/v1/order/new"},
+};
+
+struct Stage {
+  Stage(const char *name) : name(name) {}
+
+  const char *name;
+  LatencyHistogram histogram;
+  uint64_t allocations = 0;
+};
+}
+
+int benchTickToTrade(std::string const &fixtureDir, unsigned rounds,
+                     std::ostream &out) {
+  // Fixtures are read once, the servers only copy them out
+  std::map<std::string, std::map<std::string, std::string>> fixtures;
+  for (auto const &endpoint : endpoints) {
+    auto fileName = fixtureDir + "/" + endpoint.host + endpoint.path + ".json";
+    std::ifstream file(fileName, std::ifstream::binary);
+    if (!file) {
+      out << "ERROR: missing fixture " << fileName << std::endl;
+      return EXIT_FAILURE;
+    }
+    std::ostringstream body;
+    body << file.rdbuf();
+    fixtures[endpoint.host][endpoint.path] = body.str();
+  }
+  std::vector<std::unique_ptr<HttpServer>> servers;
+  for (auto const &host : fixtures) {
+    auto const &responses = host.second;
+    servers.emplace_back(new HttpServer(0, [&](HttpServer::Request const &req) {
+      HttpServer::Response res;
+      auto it = responses.find(req.path);
+      if (it != responses.end()) {
+        res.body = it->second;
+      } else {
+        res.status = 404;
+        res.body = "{\"error\":\"no fixture for " + req.path + "\"}";
+      }
+      return res;
+    }));
+    if (!servers.back()->isRunning()) {
+      out << "ERROR: cannot start the local server for " << host.first
+          << std::endl;
+      return EXIT_FAILURE;
+    }
+    RestApi::overrideHost("https://" + host.first, servers.back()->url());
+  }
+
+  std::unique_ptr<Parameters> loaded;
+  try {
+    loaded.reset(new Parameters("blackbird.conf"));
+  } catch (ConfigError const &e) {
+    out << "ERROR: " << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+  Parameters &params = *loaded;
+  std::ostream nullSink(nullptr);
+  AsyncLog log(nullSink, parseLogLevel(params.logLevel));
+  params.logFile = log;
+  params.log = &log;
+  params.cacert.clear();
+  // The orders are signed with the configured keys, their nonces must not
+  // move those of the real exchanges
+  useNonceFile("nonce_bench.dat");
+  // Every round goes to the servers, like a trade on fresh quotes
+  params.tickerCacheTtl = 0;
+  params.orderBookCacheTtl = 0;
+
+  // checkEntry reads the fees of the exchanges added to params
+  params.addExchange("Binance", params.binanceFees, false, true);
+  params.addExchange("Bitfinex", params.bitfinexFees, true, true);
+  Bitcoin btcLong(0, "Binance", params.binanceFees, false, true);
+  Bitcoin btcShort(1, "Bitfinex", params.bitfinexFees, true, true);
+  Result res;
+  res.reset();
+  res.exposure = params.testedExposure;
+
+  Stage stages[] = {{"quote"},      {"update"}, {"checkEntry"},
+                    {"limit price"}, {"orders"}, {"tick-to-trade"}};
+  auto &total = stages[5];
+  auto measure = [](Stage &stage, bool record, auto f) {
+    uint64_t before = allocations;
+    auto start = std::chrono::steady_clock::now();
+    f();
+    if (!record)
+      return;
+    stage.histogram.record(std::chrono::steady_clock::now() - start);
+    stage.allocations += allocations - before;
+  };
+
+  json_malloc_t jsonMalloc;
+  json_free_t jsonFree;
+  json_get_alloc_funcs(&jsonMalloc, &jsonFree);
+  json_set_alloc_funcs(countedMalloc, std::free);
+
+  // The first rounds open the connections and fill the caches
+  unsigned warmup = (std::max)(rounds / 10, 100u);
+  for (unsigned i = 0; i < warmup + rounds; ++i) {
+    bool record = i >= warmup;
+    quote_t quoteLong(0.0, 0.0), quoteShort(0.0, 0.0);
+    double limPriceLong = 0.0, limPriceShort = 0.0;
+    measure(total, record, [&] {
+      measure(stages[0], record, [&] {
+        quoteLong = syncWait(Binance::getQuote(params));
+        quoteShort = syncWait(Bitfinex::getQuote(params));
+      });
+      measure(stages[1], record, [&] {
+        btcLong.updateData(quoteLong, Clock::monoNs());
+        btcShort.updateData(quoteShort, Clock::monoNs());
+      });
+      measure(stages[2], record,
+              [&] { checkEntry(&btcLong, &btcShort, res, params); });
+      double volumeLong = res.exposure / btcLong.getAsk();
+      double volumeShort = res.exposure / btcShort.getBid();
+      measure(stages[3], record, [&] {
+        limPriceLong =
+            syncWait(Binance::getLimitPrice(params, volumeLong, false));
+        limPriceShort =
+            syncWait(Bitfinex::getLimitPrice(params, volumeShort, true));
+      });
+      measure(stages[4], record, [&] {
+        syncWait(Binance::sendLongOrder(params, "buy", volumeLong,
+                                        limPriceLong, OrderType::gtc));
+        syncWait(Bitfinex::sendShortOrder(params, "sell", volumeShort,
+                                          limPriceShort, OrderType::gtc));
+      });
+    });
+    if (i == 0 && (limPriceLong == 0.0 || limPriceShort == 0.0)) {
+      json_set_alloc_funcs(jsonMalloc, jsonFree);
+      out << "ERROR: the fixtures in " << fixtureDir
+          << " do not give a quote and a limit price on both exchanges"
+          << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  json_set_alloc_funcs(jsonMalloc, jsonFree);
+
+  auto us = [](uint64_t ns) { return ns / 1000.0; };
+  out << "[ Tick-to-trade, " << rounds << " rounds after " << warmup
+      << " warm-up rounds ]\n";
+  out << std::left << std::setw(16) << "stage"
+      << "p50\tp99\tp99.9\tmax (us)\tJSON allocations/round\n";
+  out << std::fixed << std::setprecision(1);
+  for (auto const &stage : stages) {
+    auto const &h = stage.histogram;
+    out << std::setw(16) << stage.name << us(h.percentile(50.0)) << '\t'
+        << us(h.percentile(99.0)) << '\t' << us(h.percentile(99.9)) << '\t' << us(h.max()) << "\t\t"
+        << static_cast<double>(stage.allocations) / rounds << '\n';
+  }
+  out << std::right
+      << "\n[ Request stages, signatures and decisions, warm-up included ]\n";
+  latency().dump(out);
+  return EXIT_SUCCESS;
+}
@@ -1,4 +1,5 @@
 #include <iostream>
+#include <cstring>
 #include <ctime>
 #include "time_fun.h"
 
@@ -14,11 +15,41 @@ time_t getTime_t(int y, int m, int d, int h, int n, int s) {
   return mktime(&ttm);
 }
 
+// localtime() shares its result between threads
+static tm localTime(time_t t) {
+  tm local{};
+#if defined(_MSC_VER)
+  localtime_s(&local, &t);
+#else
+  localtime_r(&t, &local);
+#endif
+  return local;
+}
+
+// The last second formatted with one format on this thread
+struct FormattedSecond {
+  bool valid = false;
+  time_t t = 0;
+  size_t size = 0;
+  char text[maxDateTimeSize];
+};
+
+template <const char *fmt>
+static FormattedSecond const &formatSecond(time_t t) {
+  thread_local FormattedSecond cache;
+  if (!cache.valid || cache.t != t) {
+    auto local = localTime(t);
+    cache.size = strftime(cache.text, sizeof(cache.text), fmt, &local);
+    cache.t = t;
+    cache.valid = true;
+  }
+  return cache;
+}
+
 template <const char *fmt>
 std::string fmtDateTime(const time_t &t) {
-  std::string buff(20, '\0');
-  buff.resize(strftime(&buff[0], buff.size(), fmt, localtime(&t)));
-  return buff;
+  auto const &formatted = formatSecond<fmt>(t);
+  return std::string(formatted.text, formatted.size);
 }
 
 /*
@@ -50,3 +81,31 @@ std::string printDateTime(time_t t) {
 std::string printDateTime() {
   return printDateTime(time(NULL));
 }
+
+size_t formatDateTime(char *out, std::chrono::system_clock::time_point t,
+                      SubSecond precision) {
+  using namespace std::chrono;
+  auto secs = floor<seconds>(t);
+  auto const &formatted =
+      formatSecond<defaultfmt>(system_clock::to_time_t(secs));
+  memcpy(out, formatted.text, formatted.size);
+  auto size = formatted.size;
+  auto digits = static_cast<int>(precision);
+  if (digits == 0)
+    return size;
+  auto fraction = duration_cast<microseconds>(t - secs).count();
+  if (precision == SubSecond::millis)
+    fraction /= 1000;
+  out[size++] = '.';
+  for (int i = digits - 1; i >= 0; --i) {
+    out[size + i] = static_cast<char>('0' + fraction % 10);
+    fraction /= 10;
+  }
+  return size + digits;
+}
+
+std::string printDateTime(std::chrono::system_clock::time_point t,
+                          SubSecond precision) {
+  char text[maxDateTimeSize];
+  return std::string(text, formatDateTime(text, t, precision));
+}
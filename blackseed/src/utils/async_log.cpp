@@ -0,0 +1,336 @@
+#include "async_log.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <mutex>
+
+namespace {
+
+// The log std::exit() has to drain, see AsyncLog::AsyncLog
+std::atomic<AsyncLog *> exitLog{nullptr};
+
+// Text of the current line of the calling thread, per log
+struct PendingLine {
+  const void *owner = nullptr;
+  std::string text;
+};
+
+PendingLine &pending(const void *owner) {
+  thread_local PendingLine line;
+  if (line.owner != owner) {
+    line.owner = owner;
+    line.text.clear();
+  }
+  return line;
+}
+
+int64_t nowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+}
+
+LogLevel parseLogLevel(std::string const &name) {
+  if (name == "debug")
+    return LogLevel::debug;
+  if (name == "warning")
+    return LogLevel::warning;
+  if (name == "error")
+    return LogLevel::error;
+  return LogLevel::info;
+}
+
+LogLine::LogLine(AsyncLog *log, LogLevel level, uint32_t suppressed)
+    : log(log) {
+  rec.longText = nullptr;
+  rec.suppressed = suppressed;
+  rec.textLen = 0;
+  rec.level = level;
+  rec.nPieces = 0;
+  rec.nArgs = 0;
+}
+
+LogLine::~LogLine() {
+  if (log && rec.nPieces > 0)
+    log->push(rec);
+}
+
+void LogLine::add(double v) {
+  if (rec.nArgs == LogRecord::maxArgs)
+    return;
+  rec.types[rec.nArgs] = LogRecord::f64;
+  rec.values[rec.nArgs++].f = v;
+}
+
+void LogLine::add(int64_t v) {
+  if (rec.nArgs == LogRecord::maxArgs)
+    return;
+  rec.types[rec.nArgs] = LogRecord::i64;
+  rec.values[rec.nArgs++].i = v;
+}
+
+void LogLine::add(uint64_t v) {
+  if (rec.nArgs == LogRecord::maxArgs)
+    return;
+  rec.types[rec.nArgs] = LogRecord::u64;
+  rec.values[rec.nArgs++].u = v;
+}
+
+// Strings are copied into the record, truncated when 'text' is full
+void LogLine::add(std::string_view v) {
+  if (rec.nArgs == LogRecord::maxArgs)
+    return;
+  size_t room = LogRecord::textSize - rec.textLen - 1;
+  size_t n = (std::min)(v.size(), room);
+  rec.types[rec.nArgs] = LogRecord::str;
+  rec.values[rec.nArgs++].str = rec.textLen;
+  std::memcpy(rec.text + rec.textLen, v.data(), n);
+  rec.textLen += static_cast<uint16_t>(n);
+  rec.text[rec.textLen++] = '\0';
+}
+
+AsyncLog::AsyncLog(std::ostream &sink, LogLevel level, size_t capacity)
+    : sink(sink), minLevel(level), mask(capacity - 1),
+      cells(new Cell[capacity]), buf(*this) {
+  // The ring index is masked, so the capacity must be a power of 2
+  if (capacity == 0 || (capacity & mask) != 0)
+    std::abort();
+  for (size_t i = 0; i < capacity; ++i)
+    cells[i].seq.store(i, std::memory_order_relaxed);
+
+  number.imbue(sink.getloc());
+  number << std::fixed;
+  writer = std::thread(&AsyncLog::run, this);
+
+  // std::exit() skips the destructors of main's locals, the last lines
+  // before an exit would be lost without this
+  static std::once_flag registered;
+  std::call_once(registered, [] {
+    std::atexit([] {
+      if (auto log = exitLog.load())
+        log->stop();
+    });
+  });
+  exitLog = this;
+}
+
+AsyncLog::~AsyncLog() {
+  AsyncLog *self = this;
+  exitLog.compare_exchange_strong(self, nullptr);
+  stop();
+}
+
+void AsyncLog::stop() {
+  buf.pubsync();
+  stopping = true;
+  if (writer.joinable())
+    writer.join();
+}
+
+// Bounded MPMC queue from D. Vyukov: each cell's sequence number tells
+// whether it is free for the producer at 'pos' or ready for the consumer.
+void AsyncLog::push(LogRecord const &rec) {
+  size_t pos = enqueuePos.load(std::memory_order_relaxed);
+  for (;;) {
+    Cell &cell = cells[pos & mask];
+    size_t seq = cell.seq.load(std::memory_order_acquire);
+    auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+    if (diff == 0) {
+      if (enqueuePos.compare_exchange_weak(pos, pos + 1,
+                                           std::memory_order_relaxed)) {
+        cell.rec = rec;
+        cell.seq.store(pos + 1, std::memory_order_release);
+        return;
+      }
+    } else if (diff < 0) {
+      // Full, wait for the writer
+      std::this_thread::yield();
+      pos = enqueuePos.load(std::memory_order_relaxed);
+    } else {
+      pos = enqueuePos.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+void AsyncLog::pushText(const char *s, size_t n) {
+  LogRecord rec;
+  rec.nPieces = 0;
+  rec.nArgs = 0;
+  rec.suppressed = 0;
+  rec.level = LogLevel::info;
+  rec.longText = nullptr;
+  rec.textLen = 0;
+  if (n <= LogRecord::textSize) {
+    std::memcpy(rec.text, s, n);
+    rec.textLen = static_cast<uint16_t>(n);
+  } else {
+    rec.longText = new std::string(s, n);
+  }
+  push(rec);
+}
+
+bool AsyncLog::admit(const char *fmt, unsigned id,
+                     std::chrono::milliseconds period, uint32_t &suppressed) {
+  auto key = reinterpret_cast<uintptr_t>(fmt) ^ (uintptr_t(id) * 0x9E3779B9u);
+  RateSlot &slot = rates[(key ^ (key >> 7)) % (sizeof(rates) / sizeof(rates[0]))];
+  int64_t now = nowNs();
+  int64_t next = slot.next.load(std::memory_order_relaxed);
+  int64_t periodNs =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(period).count();
+  if (now < next || !slot.next.compare_exchange_strong(next, now + periodNs)) {
+    slot.suppressed.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  suppressed = slot.suppressed.exchange(0, std::memory_order_relaxed);
+  return true;
+}
+
+void AsyncLog::flush() {
+  buf.pubsync();
+  size_t target = enqueuePos.load(std::memory_order_acquire);
+  while (flushedPos.load(std::memory_order_acquire) < target &&
+         writer.joinable())
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+void AsyncLog::run() {
+  size_t pos = 0;
+  bool dirty = false;
+  int idle = 0;
+  for (;;) {
+    Cell &cell = cells[pos & mask];
+    if (cell.seq.load(std::memory_order_acquire) == pos + 1) {
+      write(cell.rec);
+      cell.seq.store(pos + mask + 1, std::memory_order_release);
+      ++pos;
+      dirty = true;
+      idle = 0;
+      continue;
+    }
+    // Out of records: this is when the file gets flushed
+    if (dirty) {
+      sink.flush();
+      dirty = false;
+    }
+    flushedPos.store(pos, std::memory_order_release);
+    if (stopping && pos == enqueuePos.load(std::memory_order_acquire))
+      break;
+    // Back off up to 5 ms while nothing is logged
+    if (idle < 5)
+      ++idle;
+    std::this_thread::sleep_for(std::chrono::milliseconds(idle));
+  }
+}
+
+void AsyncLog::write(LogRecord const &rec) {
+  if (rec.nPieces == 0) {
+    if (rec.longText) {
+      sink << *rec.longText;
+      delete rec.longText;
+    } else {
+      sink.write(rec.text, rec.textLen);
+    }
+    return;
+  }
+
+  formatted.clear();
+  int arg = 0;
+  for (int p = 0; p < rec.nPieces; ++p) {
+    for (const char *c = rec.pieces[p]; *c; ++c) {
+      if (*c != '{') {
+        formatted += *c;
+        continue;
+      }
+      const char *close = std::strchr(c, '}');
+      if (!close) {
+        formatted += c;
+        break;
+      }
+      std::string_view spec(c + 1, close - c - 1);
+      c = close;
+      if (arg >= rec.nArgs) {
+        formatted += "{?}";
+        continue;
+      }
+      auto const &v = rec.values[arg];
+      switch (rec.types[arg++]) {
+      case LogRecord::str:
+        formatted += rec.text + v.str;
+        continue;
+      case LogRecord::i64:
+        formatted += std::to_string(v.i);
+        continue;
+      case LogRecord::u64:
+        formatted += std::to_string(v.u);
+        continue;
+      case LogRecord::f64:
+        break;
+      }
+      number.str("");
+      if (spec == "%") {
+        if (v.f >= 0.0)
+          number << ' ';
+        number << std::setprecision(2) << v.f * 100.0 << '%';
+      } else {
+        int decimals = 2;
+        if (spec.size() > 1 && spec[0] == '.')
+          decimals = std::atoi(spec.data() + 1);
+        number << std::setprecision(decimals) << v.f;
+      }
+      formatted += number.str();
+    }
+  }
+  if (rec.suppressed)
+    formatted += " (" + std::to_string(rec.suppressed) + " more since last)";
+  formatted += '\n';
+  sink.write(formatted.data(), formatted.size());
+}
+
+AsyncLog::LineBuf::int_type AsyncLog::LineBuf::overflow(int_type c) {
+  if (c != traits_type::eof()) {
+    char ch = traits_type::to_char_type(c);
+    xsputn(&ch, 1);
+  }
+  return traits_type::not_eof(c);
+}
+
+std::ostream &AsyncLog::stream() {
+  thread_local struct {
+    const AsyncLog *owner = nullptr;
+    std::unique_ptr<std::ostream> out;
+  } local;
+  if (local.owner != this) {
+    local.owner = this;
+    local.out.reset(new std::ostream(&buf));
+    // The writer thread does not format through the sink, its format
+    // is only read
+    local.out->imbue(sink.getloc());
+    local.out->flags(sink.flags());
+    local.out->precision(sink.precision());
+  }
+  return *local.out;
+}
+
+// Hands over everything up to the last newline
+std::streamsize AsyncLog::LineBuf::xsputn(const char *s, std::streamsize n) {
+  auto &line = pending(this);
+  line.text.append(s, static_cast<size_t>(n));
+  auto end = line.text.rfind('\n');
+  if (end != std::string::npos) {
+    log.pushText(line.text.data(), end + 1);
+    line.text.erase(0, end + 1);
+  }
+  return n;
+}
+
+int AsyncLog::LineBuf::sync() {
+  auto &line = pending(this);
+  if (!line.text.empty()) {
+    log.pushText(line.text.data(), line.text.size());
+    line.text.clear();
+  }
+  return 0;
+}
@@ -25,21 +25,42 @@
 
 */
 
+/*
+   Altered for blackbird: base64_encode and base64_decode are table driven
+   and use SSSE3/AVX2 when the CPU supports it. The original implementation
+   is kept below as the reference for testBase64().
+*/
+
 #include "base64.h"
+#include "cpu_features.h"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <random>
+
+#ifdef BLACKBIRD_X86
+#include <immintrin.h>
+#endif
+
+namespace {
 
+// ---- original implementation ----
 
-static const std::string base64_chars =
+const std::string base64_chars =
              "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
              "abcdefghijklmnopqrstuvwxyz"
              "0123456789+/";
 
 
-static bool is_base64(unsigned char c)
+bool is_base64(unsigned char c)
 {
   return (isalnum(c) || (c == '+') || (c == '/'));
 }
 
-std::string base64_encode(unsigned char const* bytes_to_encode, unsigned int in_len)
+std::string reference_encode(unsigned char const* bytes_to_encode, unsigned int in_len)
 {
   std::string ret;
   int i = 0;
@@ -83,7 +104,7 @@ std::string base64_encode(unsigned char const* bytes_to_encode, unsigned int in_
   return ret;
 }
 
-std::string base64_decode(std::string const& encoded_string)
+std::string reference_decode(std::string const& encoded_string)
 {
   int in_len = encoded_string.size();
   int i = 0;
@@ -127,3 +148,392 @@ std::string base64_decode(std::string const& encoded_string)
 
   return ret;
 }
+
+// ---- scalar ----
+
+const char encode_table[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+    "abcdefghijklmnopqrstuvwxyz"
+    "0123456789+/";
+
+// 6-bit value of every alphabet character, 0x80 for everything else ('=' too)
+constexpr std::array<unsigned char, 256> make_decode_table() {
+  std::array<unsigned char, 256> t{};
+  for (auto &v : t)
+    v = 0x80;
+  for (int i = 0; i < 64; ++i)
+    t[static_cast<unsigned char>(encode_table[i])] = static_cast<unsigned char>(i);
+  return t;
+}
+
+constexpr std::array<unsigned char, 256> decode_table = make_decode_table();
+
+// Encodes [in, in + len) including the padded last group
+char *encode_scalar(const unsigned char *in, std::size_t len, char *out) {
+  std::size_t i = 0;
+  for (; i + 3 <= len; i += 3) {
+    uint32_t v = uint32_t(in[i]) << 16 | uint32_t(in[i + 1]) << 8 | in[i + 2];
+    *out++ = encode_table[v >> 18];
+    *out++ = encode_table[v >> 12 & 0x3f];
+    *out++ = encode_table[v >> 6 & 0x3f];
+    *out++ = encode_table[v & 0x3f];
+  }
+  if (len - i == 1) {
+    uint32_t v = uint32_t(in[i]) << 16;
+    *out++ = encode_table[v >> 18];
+    *out++ = encode_table[v >> 12 & 0x3f];
+    *out++ = '=';
+    *out++ = '=';
+  } else if (len - i == 2) {
+    uint32_t v = uint32_t(in[i]) << 16 | uint32_t(in[i + 1]) << 8;
+    *out++ = encode_table[v >> 18];
+    *out++ = encode_table[v >> 12 & 0x3f];
+    *out++ = encode_table[v >> 6 & 0x3f];
+    *out++ = '=';
+  }
+  return out;
+}
+
+// Decodes up to the first character outside the alphabet, a trailing
+// group of 2 or 3 characters gives 1 or 2 bytes, like the original.
+char *decode_scalar(const unsigned char *in, std::size_t len, char *out) {
+  std::size_t i = 0;
+  for (; i + 4 <= len; i += 4) {
+    uint32_t a = decode_table[in[i]], b = decode_table[in[i + 1]],
+             c = decode_table[in[i + 2]], d = decode_table[in[i + 3]];
+    if ((a | b | c | d) & 0x80)
+      break;
+    uint32_t v = a << 18 | b << 12 | c << 6 | d;
+    *out++ = static_cast<char>(v >> 16);
+    *out++ = static_cast<char>(v >> 8);
+    *out++ = static_cast<char>(v);
+  }
+  unsigned char q[4] = {};
+  std::size_t n = 0;
+  while (n < 3 && i + n < len && !(decode_table[in[i + n]] & 0x80)) {
+    q[n] = decode_table[in[i + n]];
+    ++n;
+  }
+  if (n >= 2)
+    *out++ = static_cast<char>(q[0] << 2 | q[1] >> 4);
+  if (n == 3)
+    *out++ = static_cast<char>(q[1] << 4 | q[2] >> 2);
+  return out;
+}
+
+// ---- SSSE3 / AVX2 ----
+// The block functions only handle whole blocks of valid input and return
+// the number of input bytes they consumed; the scalar code does the rest.
+
+#ifdef BLACKBIRD_X86
+
+// 16 6-bit indices (one per byte) to their ASCII characters
+TARGET_SSSE3 __m128i enc_translate(__m128i idx) {
+  __m128i res = _mm_subs_epu8(idx, _mm_set1_epi8(51));
+  __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), idx);
+  res = _mm_or_si128(res, _mm_and_si128(less, _mm_set1_epi8(13)));
+  const __m128i shift = _mm_setr_epi8(
+      'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+      '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+  return _mm_add_epi8(_mm_shuffle_epi8(shift, res), idx);
+}
+
+// Spreads the first 12 bytes of 'in' into 16 6-bit indices
+TARGET_SSSE3 __m128i enc_reshuffle(__m128i in) {
+  in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7,
+                                         4, 5, 3, 4, 1, 2, 0, 1));
+  __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+  __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+  __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+  __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+  return _mm_or_si128(t1, t3);
+}
+
+TARGET_SSSE3 std::size_t encode_blocks_ssse3(const unsigned char *in,
+                                             std::size_t len, char *out) {
+  std::size_t i = 0;
+  // Loads 16 bytes and uses 12
+  for (; len - i >= 16; i += 12, out += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out),
+                     enc_translate(enc_reshuffle(v)));
+  }
+  return i;
+}
+
+// Character class of each byte by its high and low nibble; a byte is in
+// the alphabet when the two lookups share no bit.
+TARGET_SSSE3 bool dec_translate(__m128i &v) {
+  const __m128i lut_lo = _mm_setr_epi8(
+      0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+      0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+  const __m128i lut_hi = _mm_setr_epi8(
+      0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+      0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  const __m128i lut_roll = _mm_setr_epi8(
+      0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+  const __m128i mask_2f = _mm_set1_epi8(0x2f);
+
+  __m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(v, 4), mask_2f);
+  __m128i lo_nibbles = _mm_and_si128(v, mask_2f);
+  __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+  __m128i lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+  __m128i bad = _mm_cmpeq_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128());
+  if (_mm_movemask_epi8(bad) != 0xFFFF)
+    return false;
+  __m128i eq_2f = _mm_cmpeq_epi8(v, mask_2f);
+  __m128i roll = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(eq_2f, hi_nibbles));
+  v = _mm_add_epi8(v, roll);
+  return true;
+}
+
+// Packs 16 6-bit values into the first 12 bytes
+TARGET_SSSE3 __m128i dec_reshuffle(__m128i v) {
+  __m128i ab_bc = _mm_maddubs_epi16(v, _mm_set1_epi32(0x01400140));
+  __m128i out = _mm_madd_epi16(ab_bc, _mm_set1_epi32(0x00011000));
+  return _mm_shuffle_epi8(out, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9,
+                                             8, 14, 13, 12, -1, -1, -1, -1));
+}
+
+// Writes 16 bytes per 12 decoded, 'out' needs 4 bytes of slack
+TARGET_SSSE3 std::size_t decode_blocks_ssse3(const unsigned char *in,
+                                             std::size_t len, char *out) {
+  std::size_t i = 0;
+  for (; len - i >= 16; i += 16, out += 12) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+    if (!dec_translate(v))
+      break;
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out), dec_reshuffle(v));
+  }
+  return i;
+}
+
+TARGET_AVX2 __m256i enc_translate_avx2(__m256i idx) {
+  __m256i res = _mm256_subs_epu8(idx, _mm256_set1_epi8(51));
+  __m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), idx);
+  res = _mm256_or_si256(res, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+  const __m256i shift = _mm256_setr_epi8(
+      'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+      '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+      'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+      '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+  return _mm256_add_epi8(_mm256_shuffle_epi8(shift, res), idx);
+}
+
+TARGET_AVX2 __m256i enc_reshuffle_avx2(__m256i in) {
+  in = _mm256_shuffle_epi8(in, _mm256_set_epi8(
+      10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+      10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+  __m256i t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+  __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+  __m256i t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+  __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+  return _mm256_or_si256(t1, t3);
+}
+
+TARGET_AVX2 std::size_t encode_blocks_avx2(const unsigned char *in,
+                                           std::size_t len, char *out) {
+  std::size_t i = 0;
+  // Each lane takes 12 of the 16 bytes loaded into it
+  for (; len - i >= 28; i += 24, out += 32) {
+    __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+    __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i + 12));
+    __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out),
+                        enc_translate_avx2(enc_reshuffle_avx2(v)));
+  }
+  return i;
+}
+
+TARGET_AVX2 bool dec_translate_avx2(__m256i &v) {
+  const __m256i lut_lo = _mm256_setr_epi8(
+      0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+      0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+      0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+      0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+  const __m256i lut_hi = _mm256_setr_epi8(
+      0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+      0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+      0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+      0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  const __m256i lut_roll = _mm256_setr_epi8(
+      0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+      0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+  const __m256i mask_2f = _mm256_set1_epi8(0x2f);
+
+  __m256i hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(v, 4), mask_2f);
+  __m256i lo_nibbles = _mm256_and_si256(v, mask_2f);
+  __m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+  __m256i lo = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+  if (!_mm256_testz_si256(lo, hi))
+    return false;
+  __m256i eq_2f = _mm256_cmpeq_epi8(v, mask_2f);
+  __m256i roll = _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(eq_2f, hi_nibbles));
+  v = _mm256_add_epi8(v, roll);
+  return true;
+}
+
+TARGET_AVX2 __m256i dec_reshuffle_avx2(__m256i v) {
+  __m256i ab_bc = _mm256_maddubs_epi16(v, _mm256_set1_epi32(0x01400140));
+  __m256i out = _mm256_madd_epi16(ab_bc, _mm256_set1_epi32(0x00011000));
+  out = _mm256_shuffle_epi8(out, _mm256_setr_epi8(
+      2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+      2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+  return _mm256_permutevar8x32_epi32(out, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, -1, -1));
+}
+
+// Writes 32 bytes per 24 decoded, 'out' needs 8 bytes of slack
+TARGET_AVX2 std::size_t decode_blocks_avx2(const unsigned char *in,
+                                           std::size_t len, char *out) {
+  std::size_t i = 0;
+  for (; len - i >= 32; i += 32, out += 24) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + i));
+    if (!dec_translate_avx2(v))
+      break;
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out), dec_reshuffle_avx2(v));
+  }
+  return i;
+}
+
+#endif
+
+enum class Path { scalar, ssse3, avx2 };
+
+Path best_path() {
+  static const Path path = cpuHasAVX2()  ? Path::avx2 :
+                           cpuHasSSSE3() ? Path::ssse3 :
+                                           Path::scalar;
+  return path;
+}
+
+std::string encode_with(Path path, const unsigned char *in, std::size_t len) {
+  std::string ret((len + 2) / 3 * 4, '\0');
+  char *out = &ret[0];
+  std::size_t done = 0;
+#ifdef BLACKBIRD_X86
+  if (path == Path::avx2)
+    done += encode_blocks_avx2(in, len, out);
+  if (path >= Path::ssse3)
+    done += encode_blocks_ssse3(in + done, len - done, out + done / 3 * 4);
+#endif
+  encode_scalar(in + done, len - done, out + done / 3 * 4);
+  return ret;
+}
+
+std::string decode_with(Path path, std::string const &s) {
+  auto in = reinterpret_cast<const unsigned char *>(s.data());
+  std::size_t len = s.size();
+  // Room for the full groups, a partial one and the vector stores' slack
+  std::string ret(len / 4 * 3 + 2 + 8, '\0');
+  char *out = &ret[0];
+  std::size_t done = 0;
+#ifdef BLACKBIRD_X86
+  if (path == Path::avx2)
+    done += decode_blocks_avx2(in, len, out);
+  // A block stopped by an invalid character is left to the scalar code
+  if (path >= Path::ssse3)
+    done += decode_blocks_ssse3(in + done, len - done, out + done / 4 * 3);
+#endif
+  char *end = decode_scalar(in + done, len - done, out + done / 4 * 3);
+  ret.resize(end - out);
+  return ret;
+}
+
+const char *path_name(Path path) {
+  switch (path) {
+    case Path::avx2:  return "avx2";
+    case Path::ssse3: return "ssse3";
+    default:          return "scalar";
+  }
+}
+
+}
+
+std::string base64_encode(unsigned char const* bytes_to_encode, unsigned int in_len) {
+  return encode_with(best_path(), bytes_to_encode, in_len);
+}
+
+std::string base64_decode(std::string const& encoded_string) {
+  return decode_with(best_path(), encoded_string);
+}
+
+bool testBase64(std::ostream &out) {
+  std::mt19937 rng(2018);
+  std::uniform_int_distribution<int> byte(0, 255);
+  const char garbage[] = "=\n \r-_.%\x80\xff";
+  int failures = 0;
+
+  for (int p = 0; p <= static_cast<int>(best_path()); ++p) {
+    auto path = static_cast<Path>(p);
+    int checked = 0, failed = 0;
+    for (std::size_t len = 0; len < 400; ++len) {
+      std::string raw(len, '\0');
+      for (auto &c : raw)
+        c = static_cast<char>(byte(rng));
+      auto bytes = reinterpret_cast<const unsigned char *>(raw.data());
+
+      std::string enc = encode_with(path, bytes, len);
+      failed += enc != reference_encode(bytes, len);
+      failed += decode_with(path, enc) != raw;
+
+      // Padding stripped, and a stray character somewhere in the input
+      std::string bare = enc.substr(0, enc.find('='));
+      failed += decode_with(path, bare) != reference_decode(bare);
+      if (!bare.empty()) {
+        std::string bad = bare;
+        bad[rng() % bad.size()] = garbage[rng() % (sizeof(garbage) - 1)];
+        failed += decode_with(path, bad) != reference_decode(bad);
+      }
+      checked += 4;
+    }
+    out << "   base64 " << path_name(path) << ": " << checked - failed << "/"
+        << checked << " ok\n";
+    failures += failed;
+  }
+  return failures == 0;
+}
+
+void benchBase64(std::ostream &out) {
+  using clock = std::chrono::steady_clock;
+  std::mt19937 rng(2018);
+  const std::size_t sizes[] = {32, 64, 1024, 65536};
+
+  out << "[ base64 throughput, MB/s (encode / decode) ]\n";
+  for (auto size : sizes) {
+    std::string raw(size, '\0');
+    for (auto &c : raw)
+      c = static_cast<char>(rng());
+    auto bytes = reinterpret_cast<const unsigned char *>(raw.data());
+    std::string enc = reference_encode(bytes, size);
+    const int rounds = static_cast<int>((64 << 20) / size);
+
+    out << "   " << std::setw(6) << size << " bytes:";
+    std::size_t check = 0;
+    auto start = clock::now();
+    for (int i = 0; i < rounds; ++i)
+      check += reference_encode(bytes, size).size();
+    std::chrono::duration<double> encTime = clock::now() - start;
+    start = clock::now();
+    for (int i = 0; i < rounds; ++i)
+      check += reference_decode(enc).size();
+    std::chrono::duration<double> decTime = clock::now() - start;
+    double mb = double(size) * rounds / (1 << 20);
+    out << "  original " << std::fixed << std::setprecision(0)
+        << mb / encTime.count() << " / " << mb / decTime.count();
+
+    for (int p = 0; p <= static_cast<int>(best_path()); ++p) {
+      auto path = static_cast<Path>(p);
+      start = clock::now();
+      for (int i = 0; i < rounds; ++i)
+        check += encode_with(path, bytes, size).size();
+      encTime = clock::now() - start;
+      start = clock::now();
+      for (int i = 0; i < rounds; ++i)
+        check += decode_with(path, enc).size();
+      decTime = clock::now() - start;
+      out << ", " << path_name(path) << " " << mb / encTime.count() << " / "
+          << mb / decTime.count();
+    }
+    out << (check == 0 ? " (no output)" : "") << '\n';
+  }
+}
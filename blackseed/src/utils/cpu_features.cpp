@@ -0,0 +1,72 @@
+#include "cpu_features.h"
+
+#ifdef BLACKBIRD_X86
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+namespace {
+struct CpuFeatures {
+  bool ssse3 = false;
+  bool avx2 = false;
+
+  CpuFeatures() {
+    unsigned regs[4] = {};
+    cpuid(regs, 0);
+    unsigned maxLeaf = regs[0];
+    if (maxLeaf < 1)
+      return;
+
+    cpuid(regs, 1);
+    ssse3 = (regs[2] & (1u << 9)) != 0;
+    bool osxsave = (regs[2] & (1u << 27)) != 0;
+    bool avx = (regs[2] & (1u << 28)) != 0;
+    if (maxLeaf < 7 || !osxsave || !avx)
+      return;
+
+    // The OS has to save the upper halves of the ymm registers
+    if ((xgetbv0() & 0x6) != 0x6)
+      return;
+    cpuid(regs, 7);
+    avx2 = (regs[1] & (1u << 5)) != 0;
+  }
+
+  static void cpuid(unsigned regs[4], unsigned leaf) {
+#if defined(_MSC_VER)
+    int r[4];
+    __cpuidex(r, static_cast<int>(leaf), 0);
+    for (int i = 0; i < 4; ++i)
+      regs[i] = static_cast<unsigned>(r[i]);
+#else
+    __cpuid_count(leaf, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif
+  }
+
+  static unsigned long long xgetbv0() {
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    unsigned lo, hi;
+    __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return (static_cast<unsigned long long>(hi) << 32) | lo;
+#endif
+  }
+};
+
+CpuFeatures const &features() {
+  static const CpuFeatures cpu;
+  return cpu;
+}
+}
+
+bool cpuHasSSSE3() { return features().ssse3; }
+bool cpuHasAVX2()  { return features().avx2; }
+
+#else
+
+bool cpuHasSSSE3() { return false; }
+bool cpuHasAVX2()  { return false; }
+
+#endif
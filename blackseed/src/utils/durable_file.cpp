@@ -0,0 +1,77 @@
+#include "durable_file.h"
+
+#include <cstdio>
+
+#if defined(_MSC_VER)
+#include <fcntl.h>
+#include <io.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool writeDurably(std::string const &fileName, std::string const &data,
+                  bool secret) {
+#if defined(_MSC_VER)
+  std::FILE *f = std::fopen(fileName.c_str(), "wb");
+  if (!f)
+    return false;
+  bool ok = std::fwrite(data.data(), 1, data.size(), f) == data.size() &&
+            std::fflush(f) == 0 && _commit(_fileno(f)) == 0;
+  return std::fclose(f) == 0 && ok;
+#else
+  int fd = ::open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+                  secret ? 0600 : 0644);
+  if (fd < 0)
+    return false;
+  // The mode of a file that existed is left as it was by open()
+  if (secret && ::fchmod(fd, 0600) != 0) {
+    ::close(fd);
+    return false;
+  }
+  size_t done = 0;
+  while (done < data.size()) {
+    auto n = ::write(fd, data.data() + done, data.size() - done);
+    if (n <= 0) {
+      ::close(fd);
+      return false;
+    }
+    done += n;
+  }
+  bool ok = ::fsync(fd) == 0;
+  return ::close(fd) == 0 && ok;
+#endif
+}
+
+bool replaceFile(std::string const &from, std::string const &to) {
+#if defined(_MSC_VER)
+  return MoveFileExA(from.c_str(), to.c_str(),
+                     MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+  if (std::rename(from.c_str(), to.c_str()) != 0)
+    return false;
+  // The rename itself is only durable once the directory is synced
+  auto slash = to.rfind('/');
+  auto dir = slash == std::string::npos ? std::string(".") : to.substr(0, slash);
+  int fd = ::open(dir.c_str(), O_RDONLY);
+  if (fd >= 0) {
+    ::fsync(fd);
+    ::close(fd);
+  }
+  return true;
+#endif
+}
+
+bool truncateFile(std::string const &fileName, long size) {
+#if defined(_MSC_VER)
+  int fd = _open(fileName.c_str(), _O_WRONLY | _O_BINARY);
+  if (fd < 0)
+    return false;
+  bool ok = _chsize_s(fd, size) == 0;
+  return _close(fd) == 0 && ok;
+#else
+  return ::truncate(fileName.c_str(), size) == 0;
+#endif
+}
@@ -0,0 +1,231 @@
+#include "event_loop.h"
+
+#include <algorithm>
+#include <cassert>
+#include <climits>
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+detail::Detached startDetached(EventLoop &loop, task<void> t) {
+  co_await loop.schedule();
+  co_await t;
+}
+}
+
+void EventLoop::TransferAwaiter::await_suspend(std::coroutine_handle<> h) {
+  waiter = h;
+  curl_easy_setopt(easy, CURLOPT_PRIVATE, this);
+  // Nothing of *this is touched after post(), the transfer may already be
+  // done and the coroutine resumed on the loop thread
+  auto *self = this;
+  loop.post([self] { curl_multi_add_handle(self->loop.multi, self->easy); });
+}
+
+void EventLoop::SleepAwaiter::await_suspend(std::coroutine_handle<> h) {
+  auto *target = &loop;
+  auto deadline = until;
+  loop.post([target, deadline, h] { target->timers.emplace(deadline, h); });
+}
+
+void EventLoop::ScheduleAwaiter::await_suspend(std::coroutine_handle<> h) {
+  loop.post([h] { h.resume(); });
+}
+
+EventLoop::EventLoop() : multi(curl_multi_init()) {
+  assert(multi != nullptr);
+#if defined(__linux__)
+  epollFd = epoll_create1(EPOLL_CLOEXEC);
+  wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  assert(epollFd >= 0 && wakeFd >= 0);
+  epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.fd = wakeFd;
+  epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &event);
+  curl_multi_setopt(multi, CURLMOPT_SOCKETFUNCTION, onSocket);
+  curl_multi_setopt(multi, CURLMOPT_SOCKETDATA, this);
+  curl_multi_setopt(multi, CURLMOPT_TIMERFUNCTION, onTimer);
+  curl_multi_setopt(multi, CURLMOPT_TIMERDATA, this);
+#endif
+  worker = std::thread(&EventLoop::run, this);
+}
+
+// Coroutines still waiting are never resumed, their transfers are dropped
+EventLoop::~EventLoop() {
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    stopping = true;
+  }
+  wakeup();
+  worker.join();
+  curl_multi_cleanup(multi);
+#if defined(__linux__)
+  close(wakeFd);
+  close(epollFd);
+#endif
+}
+
+void EventLoop::post(std::function<void()> work) {
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    posted.push_back(std::move(work));
+  }
+  wakeup();
+}
+
+void EventLoop::spawn(task<void> t) { startDetached(*this, std::move(t)); }
+
+bool EventLoop::runPosted() {
+  std::vector<std::function<void()>> work;
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (stopping)
+      return false;
+    work.swap(posted);
+  }
+  for (auto &w : work)
+    w();
+  return true;
+}
+
+void EventLoop::finishTransfers() {
+  int queued;
+  while (CURLMsg *msg = curl_multi_info_read(multi, &queued)) {
+    if (msg->msg != CURLMSG_DONE)
+      continue;
+    char *awaiter = nullptr;
+    curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &awaiter);
+    auto *transfer = reinterpret_cast<TransferAwaiter *>(awaiter);
+    transfer->result = msg->data.result;
+    curl_multi_remove_handle(multi, msg->easy_handle);
+    transfer->waiter.resume();
+  }
+}
+
+void EventLoop::fireTimers() {
+  auto now = clock::now();
+  while (!timers.empty() && timers.begin()->first <= now) {
+    auto waiter = timers.begin()->second;
+    timers.erase(timers.begin());
+    waiter.resume();
+  }
+}
+
+// Until the next timer or curl timeout, -1 for none. Rounded up, waking
+// up a little early would only spin.
+int EventLoop::waitTimeoutMs() const {
+  auto next = clock::time_point::max();
+#if defined(__linux__)
+  next = curlDeadline;
+#endif
+  if (!timers.empty())
+    next = (std::min)(next, timers.begin()->first);
+  if (next == clock::time_point::max())
+    return -1;
+  auto ms =
+      std::chrono::ceil<std::chrono::milliseconds>(next - clock::now()).count();
+  if (ms < 0)
+    return 0;
+  return ms > INT_MAX ? INT_MAX : static_cast<int>(ms);
+}
+
+#if defined(__linux__)
+
+void EventLoop::wakeup() {
+  uint64_t one = 1;
+  (void)!write(wakeFd, &one, sizeof(one));
+}
+
+int EventLoop::onSocket(CURL *, curl_socket_t s, int what, void *loop,
+                        void *socketp) {
+  auto &self = *static_cast<EventLoop *>(loop);
+  if (what == CURL_POLL_REMOVE) {
+    epoll_ctl(self.epollFd, EPOLL_CTL_DEL, s, nullptr);
+    curl_multi_assign(self.multi, s, nullptr);
+    return 0;
+  }
+  epoll_event event = {};
+  event.data.fd = s;
+  if (what & CURL_POLL_IN)
+    event.events |= EPOLLIN;
+  if (what & CURL_POLL_OUT)
+    event.events |= EPOLLOUT;
+  if (socketp) {
+    epoll_ctl(self.epollFd, EPOLL_CTL_MOD, s, &event);
+  } else {
+    // Marks the socket as watched
+    epoll_ctl(self.epollFd, EPOLL_CTL_ADD, s, &event);
+    curl_multi_assign(self.multi, s, &self);
+  }
+  return 0;
+}
+
+int EventLoop::onTimer(CURLM *, long timeoutMs, void *loop) {
+  auto &self = *static_cast<EventLoop *>(loop);
+  self.curlDeadline = timeoutMs < 0
+                          ? clock::time_point::max()
+                          : clock::now() + std::chrono::milliseconds(timeoutMs);
+  return 0;
+}
+
+void EventLoop::run() {
+  epoll_event events[64];
+  for (;;) {
+    int n = epoll_wait(epollFd, events, 64, waitTimeoutMs());
+    int running;
+    for (int i = 0; i < n; ++i) {
+      int fd = events[i].data.fd;
+      if (fd == wakeFd) {
+        uint64_t count;
+        (void)!read(wakeFd, &count, sizeof(count));
+        continue;
+      }
+      int flags = 0;
+      if (events[i].events & EPOLLIN)
+        flags |= CURL_CSELECT_IN;
+      if (events[i].events & EPOLLOUT)
+        flags |= CURL_CSELECT_OUT;
+      if (events[i].events & (EPOLLERR | EPOLLHUP))
+        flags |= CURL_CSELECT_ERR;
+      curl_multi_socket_action(multi, fd, flags, &running);
+    }
+    if (clock::now() >= curlDeadline) {
+      curlDeadline = clock::time_point::max();
+      curl_multi_socket_action(multi, CURL_SOCKET_TIMEOUT, 0, &running);
+    }
+    finishTransfers();
+    if (!runPosted())
+      return;
+    fireTimers();
+  }
+}
+
+#else
+
+void EventLoop::wakeup() { curl_multi_wakeup(multi); }
+
+void EventLoop::run() {
+  for (;;) {
+    int running;
+    curl_multi_perform(multi, &running);
+    finishTransfers();
+    if (!runPosted())
+      return;
+    fireTimers();
+    // curl shortens the wait to its own timeouts
+    int timeout = waitTimeoutMs();
+    curl_multi_poll(multi, nullptr, 0, timeout < 0 ? 1000 : timeout, nullptr);
+  }
+}
+
+#endif
+
+EventLoop &eventLoop() {
+  static EventLoop loop;
+  return loop;
+}
@@ -0,0 +1,153 @@
+#include "hmac_signer.h"
+#include "base64.h"
+#include "hex_str.hpp"
+#include "latency.h"
+
+#include <cassert>
+#include <chrono>
+#include <iomanip>
+#include <memory>
+#include <ostream>
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#include <openssl/params.h>
+#endif
+
+namespace {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+struct EVP_MAC_CTX_deleter {
+  void operator () (EVP_MAC_CTX *ctx) { EVP_MAC_CTX_free(ctx); }
+};
+#else
+struct HMAC_CTX_deleter {
+  void operator () (HMAC_CTX *ctx) { HMAC_CTX_free(ctx); }
+};
+
+// Scratch context of the calling thread, the keyed state is copied into it
+HMAC_CTX *workContext() {
+  thread_local std::unique_ptr<HMAC_CTX, HMAC_CTX_deleter> ctx(HMAC_CTX_new());
+  return ctx.get();
+}
+#endif
+}
+
+std::string Signature::hex() const {
+  std::string res(size * 2, '0');
+  hex_encode<lowerhex>(bytes, size, &res[0]);
+  return res;
+}
+
+std::string Signature::upperHex() const {
+  std::string res(size * 2, '0');
+  hex_encode<upperhex>(bytes, size, &res[0]);
+  return res;
+}
+
+std::string Signature::base64() const {
+  return base64_encode(bytes, size);
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+HmacSigner::HmacSigner(EVP_MD const *md, std::string const &key,
+                       LatencyHistogram *timing)
+    : timing(timing) {
+  // The context keeps its own reference to the algorithm
+  EVP_MAC *mac = EVP_MAC_fetch(nullptr, "HMAC", nullptr);
+  keyed = EVP_MAC_CTX_new(mac);
+  EVP_MAC_free(mac);
+  assert(keyed != nullptr);
+  OSSL_PARAM params[] = {
+      OSSL_PARAM_construct_utf8_string(
+          OSSL_MAC_PARAM_DIGEST, const_cast<char *>(EVP_MD_get0_name(md)), 0),
+      OSSL_PARAM_construct_end()};
+  EVP_MAC_init(keyed, reinterpret_cast<const unsigned char *>(key.data()),
+               key.size(), params);
+}
+
+HmacSigner::~HmacSigner() {
+  EVP_MAC_CTX_free(keyed);
+}
+
+Signature HmacSigner::sign(std::initializer_list<std::string_view> parts) const {
+  auto start = std::chrono::steady_clock::now();
+  Signature sig;
+  std::unique_ptr<EVP_MAC_CTX, EVP_MAC_CTX_deleter> ctx(
+      EVP_MAC_CTX_dup(keyed));
+  for (auto part : parts)
+    EVP_MAC_update(ctx.get(),
+                   reinterpret_cast<const unsigned char *>(part.data()),
+                   part.size());
+  size_t size = 0;
+  EVP_MAC_final(ctx.get(), sig.bytes, &size, sizeof(sig.bytes));
+  sig.size = static_cast<unsigned int>(size);
+  if (timing)
+    timing->record(std::chrono::steady_clock::now() - start);
+  return sig;
+}
+#else
+HmacSigner::HmacSigner(EVP_MD const *md, std::string const &key,
+                       LatencyHistogram *timing)
+    : keyed(HMAC_CTX_new()), timing(timing) {
+  assert(keyed != nullptr);
+  HMAC_Init_ex(keyed, key.data(), static_cast<int>(key.size()), md, nullptr);
+}
+
+HmacSigner::~HmacSigner() {
+  HMAC_CTX_free(keyed);
+}
+
+Signature HmacSigner::sign(std::initializer_list<std::string_view> parts) const {
+  auto start = std::chrono::steady_clock::now();
+  Signature sig;
+  HMAC_CTX *ctx = workContext();
+  HMAC_CTX_copy(ctx, keyed);
+  for (auto part : parts)
+    HMAC_Update(ctx, reinterpret_cast<const unsigned char *>(part.data()),
+                part.size());
+  HMAC_Final(ctx, sig.bytes, &sig.size);
+  if (timing)
+    timing->record(std::chrono::steady_clock::now() - start);
+  return sig;
+}
+#endif
+
+void benchHmacSigner(std::ostream &out) {
+  using clock = std::chrono::steady_clock;
+  const std::string key(64, 'k');
+  // Roughly the size of an order payload
+  const std::string msg =
+      "nonce=1554907632000&command=buy&currencyPair=USDT_BTC&rate=5123.45"
+      "&amount=0.00512000&fillOrKill=0&immediateOrCancel=0&postOnly=0";
+  const int rounds = 200000;
+
+  struct { const char *name; EVP_MD const *md; } digests[] = {
+    {"sha256", EVP_sha256()}, {"sha384", EVP_sha384()}, {"sha512", EVP_sha512()},
+  };
+
+  out << "[ HMAC signatures per second, " << msg.size() << " byte message ]\n";
+  for (auto const &d : digests) {
+    size_t check = 0;
+    auto start = clock::now();
+    for (int i = 0; i < rounds; ++i) {
+      unsigned char digest[EVP_MAX_MD_SIZE];
+      unsigned int len = 0;
+      HMAC(d.md, key.data(), static_cast<int>(key.size()),
+           reinterpret_cast<const unsigned char *>(msg.data()), msg.size(),
+           digest, &len);
+      check += hex_str(digest, digest + len).size();
+    }
+    std::chrono::duration<double> oneShot = clock::now() - start;
+
+    HmacSigner signer(d.md, key);
+    start = clock::now();
+    for (int i = 0; i < rounds; ++i)
+      check += signer.sign(msg).hex().size();
+    std::chrono::duration<double> cached = clock::now() - start;
+
+    out << "   " << d.name << ":\tone-shot " << std::fixed << std::setprecision(0)
+        << rounds / oneShot.count() << "/s, cached "
+        << rounds / cached.count() << "/s"
+        << (check == 0 ? " (no output)" : "") << '\n';
+  }
+}
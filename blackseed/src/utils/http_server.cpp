@@ -0,0 +1,240 @@
+#include "http_server.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <ctime>
+
+#if defined(_MSC_VER)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+#define poll WSAPoll
+#define closeSocket closesocket
+using socklen_t = int;
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#define closeSocket ::close
+#endif
+
+#if !defined(MSG_NOSIGNAL)
+#define MSG_NOSIGNAL 0
+#endif
+
+namespace {
+
+const char *reason(int status) {
+  switch (status) {
+  case 100: return "Continue";
+  case 200: return "OK";
+  case 400: return "Bad Request";
+  case 404: return "Not Found";
+  case 405: return "Method Not Allowed";
+  case 429: return "Too Many Requests";
+  case 500: return "Internal Server Error";
+  case 502: return "Bad Gateway";
+  case 503: return "Service Unavailable";
+  default: return "Unknown";
+  }
+}
+
+std::string toLower(std::string s) {
+  std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c) {
+    return static_cast<char>(std::tolower(c));
+  });
+  return s;
+}
+
+// The current time as in an HTTP Date header
+std::string httpDate() {
+  time_t now = time(nullptr);
+  tm utc;
+#if defined(_MSC_VER)
+  gmtime_s(&utc, &now);
+#else
+  gmtime_r(&now, &utc);
+#endif
+  char buffer[32];
+  strftime(buffer, sizeof(buffer), "%a, %d %b %Y %H:%M:%S GMT", &utc);
+  return buffer;
+}
+
+bool sendAll(intptr_t s, std::string const &data) {
+  size_t sent = 0;
+  while (sent < data.size()) {
+    auto n = ::send(s, data.data() + sent, static_cast<int>(data.size() - sent),
+                    MSG_NOSIGNAL);
+    if (n <= 0)
+      return false;
+    sent += n;
+  }
+  return true;
+}
+}
+
+std::string HttpServer::Request::header(std::string const &name) const {
+  auto pos = toLower(headers).find("\n" + toLower(name) + ":");
+  if (pos == std::string::npos)
+    return std::string();
+  pos += name.size() + 2;
+  auto end = headers.find('\r', pos);
+  auto value = headers.substr(pos, end - pos);
+  value.erase(0, value.find_first_not_of(' '));
+  return value;
+}
+
+HttpServer::HttpServer(unsigned short port, Handler handler)
+    : handler(std::move(handler)), listener(-1) {
+#if defined(_MSC_VER)
+  static bool started = [] {
+    WSADATA data;
+    return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+  }();
+  if (!started)
+    return;
+#endif
+  auto s = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  listener = static_cast<intptr_t>(s);
+  if (listener == -1)
+    return;
+  int yes = 1;
+  setsockopt(s, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<char *>(&yes),
+             sizeof(yes));
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len = sizeof(addr);
+  if (::bind(s, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+      ::listen(s, 64) != 0 ||
+      ::getsockname(s, reinterpret_cast<sockaddr *>(&addr), &len) != 0) {
+    closeSocket(s);
+    listener = -1;
+    return;
+  }
+  boundPort = ntohs(addr.sin_port);
+  acceptor = std::thread(&HttpServer::accept, this);
+}
+
+HttpServer::~HttpServer() {
+  stopping = true;
+  if (acceptor.joinable())
+    acceptor.join();
+  for (auto &connection : connections)
+    connection.thread.join();
+  if (listener != -1)
+    closeSocket(listener);
+}
+
+std::string HttpServer::url() const {
+  return "http://127.0.0.1:" + std::to_string(boundPort);
+}
+
+void HttpServer::accept() {
+  while (!stopping) {
+    pollfd waiting{};
+    waiting.fd = static_cast<decltype(waiting.fd)>(listener);
+    waiting.events = POLLIN;
+    reap();
+    if (poll(&waiting, 1, 200) <= 0)
+      continue;
+    auto client = ::accept(listener, nullptr, nullptr);
+    if (static_cast<intptr_t>(client) == -1)
+      continue;
+    // Responses are small, they must not wait for Nagle
+    int yes = 1;
+    setsockopt(client, IPPROTO_TCP, TCP_NODELAY,
+               reinterpret_cast<char *>(&yes), sizeof(yes));
+    auto &connection = connections.emplace_back();
+    connection.thread = std::thread(&HttpServer::serve, this,
+                                    std::ref(connection),
+                                    static_cast<intptr_t>(client));
+  }
+}
+
+void HttpServer::reap() {
+  for (auto it = connections.begin(); it != connections.end();) {
+    if (it->done) {
+      it->thread.join();
+      it = connections.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+// Serves the requests of one connection until the client closes it or
+// the server stops
+void HttpServer::serve(Connection &connection, intptr_t client) {
+  std::string buffer;
+  char chunk[4096];
+  // Reads until 'buffer' holds 'size' bytes; false if the connection ended
+  auto fill = [&](size_t size) {
+    while (buffer.size() < size && !stopping) {
+      pollfd reading{};
+      reading.fd = static_cast<decltype(reading.fd)>(client);
+      reading.events = POLLIN;
+      if (poll(&reading, 1, 200) <= 0)
+        continue;
+      auto n = ::recv(client, chunk, sizeof(chunk), 0);
+      if (n <= 0)
+        return false;
+      buffer.append(chunk, n);
+    }
+    return buffer.size() >= size;
+  };
+
+  while (!stopping) {
+    size_t headerEnd;
+    bool received = true;
+    while (received &&
+           (headerEnd = buffer.find("\r\n\r\n")) == std::string::npos)
+      received = buffer.size() <= 65536 && fill(buffer.size() + 1);
+    if (!received)
+      break;
+
+    Request request;
+    request.headers = buffer.substr(0, headerEnd + 2);
+    auto lineEnd = request.headers.find("\r\n");
+    auto methodEnd = request.headers.find(' ');
+    auto uriEnd = request.headers.find(' ', methodEnd + 1);
+    if (methodEnd >= lineEnd || uriEnd > lineEnd) {
+      sendAll(client, "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\n\r\n");
+      break;
+    }
+    request.method = request.headers.substr(0, methodEnd);
+    request.uri = request.headers.substr(methodEnd + 1, uriEnd - methodEnd - 1);
+    request.path = request.uri.substr(0, request.uri.find('?'));
+
+    // curl waits a moment for this before sending a large body
+    if (toLower(request.header("expect")) == "100-continue" &&
+        !sendAll(client, "HTTP/1.1 100 Continue\r\n\r\n"))
+      break;
+    size_t bodySize = std::strtoul(
+        request.header("content-length").c_str(), nullptr, 10);
+    if (!fill(headerEnd + 4 + bodySize))
+      break;
+    request.body = buffer.substr(headerEnd + 4, bodySize);
+    buffer.erase(0, headerEnd + 4 + bodySize);
+
+    auto response = handler(request);
+    bool close = toLower(request.header("connection")) == "close";
+    std::string out = "HTTP/1.1 " + std::to_string(response.status) + " " +
+                      reason(response.status) +
+                      "\r\nDate: " + httpDate() +
+                      "\r\nContent-Type: " + response.contentType +
+                      "\r\nContent-Length: " +
+                      std::to_string(response.body.size()) +
+                      (close ? "\r\nConnection: close" : "") + "\r\n\r\n" +
+                      response.body;
+    if (!sendAll(client, out) || close)
+      break;
+  }
+  closeSocket(client);
+  connection.done = true;
+}
@@ -0,0 +1,136 @@
+#include "latency.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace {
+
+int highestBit(uint64_t v) {
+#if defined(_MSC_VER)
+  unsigned long index;
+  _BitScanReverse64(&index, v);
+  return static_cast<int>(index);
+#else
+  return 63 - __builtin_clzll(v);
+#endif
+}
+}
+
+LatencyHistogram::LatencyHistogram()
+    : counts(new std::atomic<uint64_t>[bucketCount]) {
+  for (int i = 0; i < bucketCount; ++i)
+    counts[i].store(0, std::memory_order_relaxed);
+}
+
+// The first 128 buckets hold one value each, then every power of 2 is
+// split in 64 buckets.
+int LatencyHistogram::bucketOf(uint64_t ns) {
+  constexpr int half = 1 << (subBucketBits - 1);
+  if (ns < (1u << subBucketBits))
+    return static_cast<int>(ns);
+  int msb = highestBit(ns);
+  if (msb >= maxBits)
+    return bucketCount - 1;
+  int shift = msb - (subBucketBits - 1);
+  int sub = static_cast<int>(ns >> shift) - half;
+  return (1 << subBucketBits) + (shift - 1) * half + sub;
+}
+
+uint64_t LatencyHistogram::bucketLimit(int bucket) {
+  constexpr int half = 1 << (subBucketBits - 1);
+  if (bucket < (1 << subBucketBits))
+    return static_cast<uint64_t>(bucket);
+  int rest = bucket - (1 << subBucketBits);
+  int shift = rest / half + 1;
+  uint64_t sub = rest % half + half;
+  return ((sub + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t ns) {
+  counts[bucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+  total.fetch_add(1, std::memory_order_relaxed);
+  sumNs.fetch_add(ns, std::memory_order_relaxed);
+  auto prev = maxNs.load(std::memory_order_relaxed);
+  while (ns > prev &&
+         !maxNs.compare_exchange_weak(prev, ns, std::memory_order_relaxed))
+    ;
+}
+
+uint64_t LatencyHistogram::percentile(double p) const {
+  auto n = count();
+  if (n == 0)
+    return 0;
+  auto target = static_cast<uint64_t>(std::ceil(p / 100.0 * n));
+  if (target == 0)
+    target = 1;
+  uint64_t seen = 0;
+  for (int i = 0; i < bucketCount; ++i) {
+    seen += counts[i].load(std::memory_order_relaxed);
+    if (seen >= target)
+      return (std::min)(bucketLimit(i), max());
+  }
+  return max();
+}
+
+uint64_t LatencyHistogram::countUpTo(uint64_t ns) const {
+  uint64_t seen = 0;
+  int last = bucketOf(ns);
+  for (int i = 0; i <= last; ++i)
+    seen += counts[i].load(std::memory_order_relaxed);
+  return seen;
+}
+
+LatencyHistogram &LatencyRegistry::histogram(std::string const &source,
+                                             std::string const &endpoint,
+                                             std::string const &stage) {
+  std::lock_guard<std::mutex> lock(mtx);
+  auto &slot = table[Key(source, endpoint, stage)];
+  if (!slot)
+    slot.reset(new LatencyHistogram);
+  return *slot;
+}
+
+void LatencyRegistry::dump(std::ostream &out) const {
+  auto us = [](uint64_t ns) { return ns / 1000.0; };
+  out << std::fixed << std::setprecision(1);
+  out << "source\tendpoint\tstage\tcount\tmean\tp50\tp90\tp99\tp99.9\tmax"
+         " (us)\n";
+  forEach([&](Key const &key, LatencyHistogram const &h) {
+    auto n = h.count();
+    if (n == 0)
+      return;
+    out << std::get<0>(key) << '\t' << std::get<1>(key) << '\t'
+        << std::get<2>(key) << '\t' << n << '\t'
+        << us(h.sum()) / n << '\t' << us(h.percentile(50.0)) << '\t'
+        << us(h.percentile(90.0)) << '\t' << us(h.percentile(99.0)) << '\t'
+        << us(h.percentile(99.9)) << '\t' << us(h.max()) << '\n';
+  });
+}
+
+void LatencyRegistry::dumpToFile(std::string const &fileName) const {
+  auto tmpName = fileName + ".tmp";
+  {
+    std::ofstream file(tmpName, std::ofstream::trunc);
+    dump(file);
+    if (!file)
+      return;
+  }
+  // Readers of the file never see a half-written table, except on
+  // Windows where rename() does not replace an existing file
+  if (std::rename(tmpName.c_str(), fileName.c_str()) != 0) {
+    std::remove(fileName.c_str());
+    std::rename(tmpName.c_str(), fileName.c_str());
+  }
+}
+
+LatencyRegistry &latency() {
+  static LatencyRegistry registry;
+  return registry;
+}
@@ -0,0 +1,251 @@
+#include "metrics.h"
+#include "latency.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+namespace {
+
+// Cell of the calling thread in every Counter
+unsigned threadCell() {
+  static std::atomic<unsigned> next{0};
+  thread_local unsigned cell = next++;
+  return cell;
+}
+
+double fromBits(uint64_t bits) {
+  double v;
+  std::memcpy(&v, &bits, sizeof(v));
+  return v;
+}
+
+uint64_t toBits(double v) {
+  uint64_t bits;
+  std::memcpy(&bits, &v, sizeof(v));
+  return bits;
+}
+
+void appendNumber(std::string &out, double v) {
+  char buf[32];
+  if (v == std::numeric_limits<double>::infinity()) {
+    out += "+Inf";
+    return;
+  }
+  // 15 digits unless that does not read back as the same value
+  int n = std::snprintf(buf, sizeof(buf), "%.15g", v);
+  if (std::strtod(buf, nullptr) != v)
+    n = std::snprintf(buf, sizeof(buf), "%.17g", v);
+  out.append(buf, n);
+}
+
+void appendSample(std::string &out, std::string const &name,
+                  std::string const &labels, double v) {
+  out += name;
+  out += labels;
+  out += ' ';
+  appendNumber(out, v);
+  out += '\n';
+}
+
+// 'labels' is either empty or "{...}", 'extra' is added inside
+std::string withLabel(std::string const &labels, std::string const &extra) {
+  if (labels.empty())
+    return "{" + extra + "}";
+  return labels.substr(0, labels.size() - 1) + "," + extra + "}";
+}
+
+std::string formatLabels(MetricsRegistry::Labels labels) {
+  if (labels.size() == 0)
+    return std::string();
+  std::string res = "{";
+  for (auto const &label : labels) {
+    if (res.size() > 1)
+      res += ',';
+    res += label.first;
+    res += "=\"";
+    for (char c : label.second) {
+      if (c == '\\' || c == '"')
+        res += '\\';
+      if (c == '\n')
+        res += "\\n";
+      else
+        res += c;
+    }
+    res += '"';
+  }
+  return res + "}";
+}
+
+// Latency histograms as Prometheus histograms in seconds
+void renderLatency(std::string &out) {
+  static const double bounds[] = {50e-6, 100e-6, 250e-6, 500e-6, 1e-3,
+                                  2.5e-3, 5e-3,  10e-3,  25e-3,  50e-3,
+                                  100e-3, 250e-3, 500e-3, 1.0,   2.5,
+                                  5.0,    10.0};
+  const std::string name = "blackbird_latency_seconds";
+  bool first = true;
+  latency().forEach([&](LatencyRegistry::Key const &key,
+                        LatencyHistogram const &h) {
+    if (first) {
+      out += "# HELP " + name + " Time spent per source, endpoint and stage\n";
+      out += "# TYPE " + name + " histogram\n";
+      first = false;
+    }
+    auto labels = formatLabels({{"source", std::get<0>(key)},
+                                {"endpoint", std::get<1>(key)},
+                                {"stage", std::get<2>(key)}});
+    for (double bound : bounds) {
+      std::string le = "le=\"";
+      appendNumber(le, bound);
+      appendSample(out, name + "_bucket", withLabel(labels, le + "\""),
+                   static_cast<double>(
+                       h.countUpTo(static_cast<uint64_t>(bound * 1e9))));
+    }
+    appendSample(out, name + "_bucket", withLabel(labels, "le=\"+Inf\""),
+                 static_cast<double>(h.count()));
+    appendSample(out, name + "_sum", labels, h.sum() / 1e9);
+    appendSample(out, name + "_count", labels, static_cast<double>(h.count()));
+  });
+}
+}
+
+void Counter::inc(uint64_t n) {
+  cells[threadCell() % cellCount].value.fetch_add(n,
+                                                  std::memory_order_relaxed);
+}
+
+uint64_t Counter::value() const {
+  uint64_t sum = 0;
+  for (auto const &cell : cells)
+    sum += cell.value.load(std::memory_order_relaxed);
+  return sum;
+}
+
+void Counter::render(std::string &out, std::string const &name,
+                     std::string const &labels) const {
+  appendSample(out, name, labels, static_cast<double>(value()));
+}
+
+void Gauge::set(double v) { bits.store(toBits(v), std::memory_order_relaxed); }
+
+void Gauge::add(double v) {
+  auto old = bits.load(std::memory_order_relaxed);
+  while (!bits.compare_exchange_weak(old, toBits(fromBits(old) + v),
+                                     std::memory_order_relaxed))
+    ;
+}
+
+double Gauge::value() const {
+  return fromBits(bits.load(std::memory_order_relaxed));
+}
+
+void Gauge::render(std::string &out, std::string const &name,
+                   std::string const &labels) const {
+  appendSample(out, name, labels, value());
+}
+
+Histogram::Histogram(std::vector<double> bounds)
+    : bounds(std::move(bounds)),
+      counts(new std::atomic<uint64_t>[this->bounds.size() + 1]) {
+  for (size_t i = 0; i <= this->bounds.size(); ++i)
+    counts[i].store(0, std::memory_order_relaxed);
+}
+
+void Histogram::observe(double v) {
+  size_t i = 0;
+  while (i < bounds.size() && v > bounds[i])
+    ++i;
+  counts[i].fetch_add(1, std::memory_order_relaxed);
+  total.add(v);
+}
+
+void Histogram::render(std::string &out, std::string const &name,
+                       std::string const &labels) const {
+  uint64_t cumulative = 0;
+  for (size_t i = 0; i <= bounds.size(); ++i) {
+    cumulative += counts[i].load(std::memory_order_relaxed);
+    std::string le = "le=\"";
+    appendNumber(le, i < bounds.size()
+                         ? bounds[i]
+                         : std::numeric_limits<double>::infinity());
+    appendSample(out, name + "_bucket", withLabel(labels, le + "\""),
+                 static_cast<double>(cumulative));
+  }
+  appendSample(out, name + "_sum", labels, total.value());
+  appendSample(out, name + "_count", labels, static_cast<double>(cumulative));
+}
+
+template <typename T, typename... Args>
+T &MetricsRegistry::get(std::string const &name, std::string const &help,
+                        const char *type, Labels labels, Args &&... args) {
+  auto key = formatLabels(labels);
+  std::lock_guard<std::mutex> lock(mtx);
+  auto &family = families[name];
+  if (family.metrics.empty()) {
+    family.help = help;
+    family.type = type;
+  }
+  for (auto &metric : family.metrics)
+    if (metric.first == key)
+      return static_cast<T &>(*metric.second);
+  family.metrics.emplace_back(key, std::unique_ptr<Metric>(
+                                       new T(std::forward<Args>(args)...)));
+  return static_cast<T &>(*family.metrics.back().second);
+}
+
+Counter &MetricsRegistry::counter(std::string const &name,
+                                  std::string const &help, Labels labels) {
+  return get<Counter>(name, help, "counter", labels);
+}
+
+Gauge &MetricsRegistry::gauge(std::string const &name, std::string const &help,
+                              Labels labels) {
+  return get<Gauge>(name, help, "gauge", labels);
+}
+
+Histogram &MetricsRegistry::histogram(std::string const &name,
+                                      std::string const &help,
+                                      std::vector<double> const &bounds,
+                                      Labels labels) {
+  return get<Histogram>(name, help, "histogram", labels, bounds);
+}
+
+std::string MetricsRegistry::render() const {
+  std::string out;
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    for (auto const &family : families) {
+      out += "# HELP " + family.first + " " + family.second.help + "\n";
+      out += "# TYPE " + family.first + " " + family.second.type + "\n";
+      for (auto const &metric : family.second.metrics)
+        metric.second->render(out, family.first, metric.first);
+    }
+  }
+  renderLatency(out);
+  return out;
+}
+
+MetricsRegistry &metrics() {
+  static MetricsRegistry registry;
+  return registry;
+}
+
+MetricsServer::MetricsServer(MetricsRegistry &registry, unsigned short port)
+    : registry(registry),
+      server(port, [this](HttpServer::Request const &request) {
+        return serve(request);
+      }) {}
+
+HttpServer::Response
+MetricsServer::serve(HttpServer::Request const &request) const {
+  HttpServer::Response response;
+  if (request.method != "GET") {
+    response.status = 405;
+    return response;
+  }
+  response.body = registry.render();
+  response.contentType = "text/plain; version=0.0.4";
+  return response;
+}
@@ -0,0 +1,197 @@
+#include "nonce.h"
+#include "durable_file.h"
+#include "event_loop.h"
+#include "hex_str.hpp"
+
+#include <openssl/sha.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+
+struct NonceSlot {
+  // Name of the namespace in the file
+  std::string stored;
+  // Only touched by the holder of the namespace
+  uint64_t last = 0;
+  // Under the store's mutex
+  uint64_t reserved = 0;
+
+  std::mutex mtx;
+  std::condition_variable freed;
+  bool busy = false;
+  // Coroutines waiting for the namespace, handed it in turn
+  std::deque<std::coroutine_handle<>> waiters;
+
+  void lock() {
+    std::unique_lock<std::mutex> lock(mtx);
+    freed.wait(lock, [this] { return !busy; });
+    busy = true;
+  }
+
+  bool tryLock() {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (busy)
+      return false;
+    busy = true;
+    return true;
+  }
+
+  // Any thread may unlock, a coroutine rarely ends on the thread it
+  // started on
+  void unlock() {
+    std::coroutine_handle<> next;
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      if (waiters.empty()) {
+        busy = false;
+      } else {
+        next = waiters.front();
+        waiters.pop_front();
+      }
+    }
+    if (next)
+      eventLoop().post([next] { next.resume(); });
+    else
+      freed.notify_one();
+  }
+};
+
+namespace {
+
+std::string &nonceFile() {
+  static std::string fileName = "nonce.dat";
+  return fileName;
+}
+
+// What follows the first colon of a namespace, the API key, is stored as
+// the start of its SHA-256
+const char hashTag[] = "sha256:";
+
+std::string storedName(std::string const &ns) {
+  auto colon = ns.find(':');
+  if (colon == std::string::npos ||
+      ns.compare(colon + 1, sizeof(hashTag) - 1, hashTag) == 0)
+    return ns;
+  unsigned char digest[SHA256_DIGEST_LENGTH];
+  SHA256(reinterpret_cast<const unsigned char *>(ns.data()) + colon + 1,
+         ns.size() - colon - 1, digest);
+  return ns.substr(0, colon + 1) + hashTag + hex_str(digest, digest + 16);
+}
+
+// Number of nonces handed out between two writes of the high-water mark.
+// After a crash, a namespace restarts at most this far ahead of its last
+// used nonce.
+constexpr uint64_t reserveBlock = 1000;
+
+class NonceStore {
+  const std::string fileName;
+  std::mutex mtx;
+  std::map<std::string, std::unique_ptr<NonceSlot>> slots;
+  // High-water marks by stored name, those of the namespaces not used yet
+  // included
+  std::map<std::string, uint64_t> marks;
+
+  // Writes every high-water mark to a temporary file, synced to disk, then
+  // replaces the previous one with it: there always is a whole nonce.dat.
+  void persist() {
+    std::ostringstream out;
+    for (auto const &m : marks)
+      out << m.first << ' ' << m.second << '\n';
+    std::string tmpFile = fileName + ".tmp";
+    if (writeDurably(tmpFile, out.str(), true))
+      replaceFile(tmpFile, fileName);
+  }
+
+public:
+  NonceStore() : fileName(nonceFile()) {
+    std::ifstream in(fileName);
+    std::string ns;
+    uint64_t mark;
+    // Files written before the keys were hashed are rewritten at once
+    bool rawKeys = false;
+    while (in >> ns >> mark) {
+      auto stored = storedName(ns);
+      rawKeys |= stored != ns;
+      marks[stored] = (std::max)(marks[stored], mark);
+    }
+    in.close();
+    if (rawKeys)
+      persist();
+  }
+
+  NonceSlot &slot(std::string const &ns) {
+    std::lock_guard<std::mutex> lock(mtx);
+    auto &s = slots[ns];
+    if (!s) {
+      s.reset(new NonceSlot);
+      s->stored = storedName(ns);
+      auto it = marks.find(s->stored);
+      if (it != marks.end())
+        s->last = s->reserved = it->second;
+    }
+    return *s;
+  }
+
+  // The caller holds the namespace
+  uint64_t next(NonceSlot &s, uint64_t floor) {
+    s.last = (std::max)(s.last + 1, floor);
+    // The mark on disk must cover the nonce before it leaves this process
+    std::lock_guard<std::mutex> lock(mtx);
+    if (s.last >= s.reserved) {
+      s.reserved = s.last + reserveBlock;
+      marks[s.stored] = s.reserved;
+      persist();
+    }
+    return s.last;
+  }
+};
+
+NonceStore &store() {
+  static NonceStore nonces;
+  return nonces;
+}
+} // namespace
+
+void useNonceFile(std::string const &fileName) { nonceFile() = fileName; }
+
+NonceLock::NonceLock(std::string const &ns, uint64_t floor)
+    : slot(&store().slot(ns)) {
+  slot->lock();
+  value = store().next(*slot, floor);
+}
+
+NonceLock::NonceLock(NonceSlot &slot, uint64_t floor)
+    : slot(&slot), value(store().next(slot, floor)) {}
+
+NonceLock::NonceLock(NonceLock &&other) noexcept
+    : slot(other.slot), value(other.value) {
+  other.slot = nullptr;
+}
+
+NonceLock::~NonceLock() {
+  if (slot)
+    slot->unlock();
+}
+
+NonceLock::Awaiter NonceLock::async(std::string const &ns, uint64_t floor) {
+  return {store().slot(ns), floor};
+}
+
+bool NonceLock::Awaiter::await_ready() { return slot.tryLock(); }
+
+bool NonceLock::Awaiter::await_suspend(std::coroutine_handle<> h) {
+  std::lock_guard<std::mutex> lock(slot.mtx);
+  // Freed since await_ready
+  if (!slot.busy) {
+    slot.busy = true;
+    return false;
+  }
+  slot.waiters.push_back(h);
+  return true;
+}
@@ -1,9 +1,14 @@
 #include "restapi.h"
 
+#include "event_loop.h"
 #include "jansson.h"
+#include "metrics.h"
 #include <cassert>
+#include <cstring>
 #include <chrono>
+#include <future>
 #include <thread> // sleep
+#include <vector>
 
 
 namespace {
@@ -21,12 +26,131 @@ size_t recvCallback(void *contents, size_t size, size_t nmemb, void *userp) {
   return buffer.append((char*)contents, n), n;
 }
 
+// Keeps the server's Date header, in seconds since the epoch
+size_t headerCallback(char *line, size_t size, size_t nmemb, void *userp) {
+  auto n = size * nmemb;
+  if (n > 5 && curl_strnequal(line, "Date:", 5)) {
+    std::string value(line + 5, n - 5);
+    *static_cast<time_t *>(userp) = curl_getdate(value.c_str(), nullptr);
+  }
+  return n;
+}
+
+std::mutex clockMtx;
+std::map<std::string, std::chrono::milliseconds> &clockTable() {
+  static std::map<std::string, std::chrono::milliseconds> table;
+  return table;
+}
+
+// The server's clock minus ours, taking the Date header as the middle of
+// the request. Date only has seconds, half of one is added to it: the
+// offset is known within about half a second.
+void recordClock(CURL *C, time_t serverDate, const std::string &source) {
+  if (serverDate <= 0)
+    return;
+  using namespace std::chrono;
+  curl_off_t total = 0;
+  curl_easy_getinfo(C, CURLINFO_TOTAL_TIME_T, &total);
+  auto middle = system_clock::now() - microseconds(total / 2);
+  auto server = system_clock::from_time_t(serverDate) + milliseconds(500);
+  auto offset = duration_cast<milliseconds>(server - middle);
+  std::lock_guard<std::mutex> lock(clockMtx);
+  auto it = clockTable().find(source);
+  if (it == clockTable().end())
+    it = clockTable().emplace(source, offset).first;
+  // Smoothed, single responses are off by up to a second
+  it->second = (it->second * 3 + offset) / 4;
+}
+
+// "https://api.example.com" -> "api.example.com"
+std::string hostName(const std::string &host) {
+  auto scheme = host.find("://");
+  return scheme == std::string::npos ? host : host.substr(scheme + 3);
+}
+
+std::mutex overridesMtx;
+std::map<std::string, std::string> &overrides() {
+  static std::map<std::string, std::string> table;
+  return table;
+}
+
+std::string replacementOf(const std::string &host) {
+  std::lock_guard<std::mutex> lock(overridesMtx);
+  auto it = overrides().find(host);
+  return it == overrides().end() ? host : it->second;
+}
+
+// curl's times are all counted from the start of the request; a reused
+// connection has no DNS, connect or TLS stage.
+void recordTimings(CURL *C, RequestTimings &t) {
+  curl_off_t dns = 0, connect = 0, tls = 0, pretransfer = 0, start = 0,
+             total = 0;
+  curl_easy_getinfo(C, CURLINFO_NAMELOOKUP_TIME_T, &dns);
+  curl_easy_getinfo(C, CURLINFO_CONNECT_TIME_T, &connect);
+  curl_easy_getinfo(C, CURLINFO_APPCONNECT_TIME_T, &tls);
+  curl_easy_getinfo(C, CURLINFO_PRETRANSFER_TIME_T, &pretransfer);
+  curl_easy_getinfo(C, CURLINFO_STARTTRANSFER_TIME_T, &start);
+  curl_easy_getinfo(C, CURLINFO_TOTAL_TIME_T, &total);
+  auto record = [](LatencyHistogram *h, curl_off_t us) {
+    h->record(static_cast<uint64_t>(us) * 1000);
+  };
+  if (dns > 0)
+    record(t.dns, dns);
+  if (connect > dns)
+    record(t.connect, connect - dns);
+  if (tls > connect)
+    record(t.tls, tls - connect);
+  if (start >= pretransfer)
+    record(t.firstByte, start - pretransfer);
+  if (total >= start)
+    record(t.transfer, total - start);
+  record(t.total, total);
+}
+
+void curlFailed(CURLcode resCurl, const std::string &url, std::ostream &log,
+                RequestCounters const &counters) {
+  counters.curlErrors->inc();
+  log << "Error with cURL: " << curl_easy_strerror(resCurl) << '\n'
+      << "  URL: " << url << '\n';
+}
+
+// The JSON of a completed transfer, or null (logged) if it is not JSON
+json_t* parseResponse(CURL *C,
+                      const std::string &recvBuffer,
+                      const std::string &url,
+                      std::ostream &log,
+                      RequestTimings &timings,
+                      RequestCounters const &counters) {
+  recordTimings(C, timings);
+  json_error_t error;
+  json_t *root;
+  {
+    LatencyTimer parsing(*timings.parse);
+    // Some endpoints answer with a bare string or boolean
+    root = json_loads(recvBuffer.c_str(), JSON_DECODE_ANY, &error);
+  }
+  if (!root) {
+    counters.jsonErrors->inc();
+    long resp_code;
+    curl_easy_getinfo(C, CURLINFO_RESPONSE_CODE, &resp_code);
+    log << "Server Response: " << resp_code << " - " << url << '\n'
+        << "Error with JSON: " << error.text << '\n'
+        << "Buffer:\n"         << recvBuffer << '\n';
+  }
+  return root;
+}
+
 json_t* doRequest(CURL *C,
                   const std::string &url,
                   const curl_slist *headers,
-                  std::ostream &log) {
+                  std::ostream &log,
+                  RequestTimings &timings,
+                  RequestCounters const &counters,
+                  const std::string &source) {
   std::string recvBuffer;
+  time_t serverDate = 0;
   curl_easy_setopt(C, CURLOPT_WRITEDATA, &recvBuffer);
+  curl_easy_setopt(C, CURLOPT_HEADERDATA, &serverDate);
                     
   curl_easy_setopt(C, CURLOPT_URL, url.c_str());
   curl_easy_setopt(C, CURLOPT_HTTPHEADER, headers);
@@ -35,6 +159,7 @@ json_t* doRequest(CURL *C,
   goto curl_state;
 
 retry_state:
+  counters.retries->inc();
   log << "  Retry in 2 sec..." << std::endl;
   std::this_thread::sleep_for(std::chrono::seconds(2));
   recvBuffer.clear();
@@ -43,30 +168,56 @@ retry_state:
 curl_state:
   CURLcode resCurl = curl_easy_perform(C);
   if (resCurl != CURLE_OK) {
-    log << "Error with cURL: " << curl_easy_strerror(resCurl) << '\n'
-        << "  URL: " << url << '\n';
-
+    curlFailed(resCurl, url, log, counters);
     goto retry_state;
   }
 
 /* documentation label */
 // json_state:
-  json_error_t error;
-  json_t *root = json_loads(recvBuffer.c_str(), 0, &error);
-  if (!root) {
-    long resp_code;
-    curl_easy_getinfo(C, CURLINFO_RESPONSE_CODE, &resp_code);
-    log << "Server Response: " << resp_code << " - " << url << '\n'
-        << "Error with JSON: " << error.text << '\n'
-        << "Buffer:\n"         << recvBuffer << '\n';
-
+  json_t *root = parseResponse(C, recvBuffer, url, log, timings, counters);
+  if (!root)
     goto retry_state;
-  }
 
+  recordClock(C, serverDate, source);
   return root;
 }
 }
 
+struct RestApi::CacheEntry {
+  std::promise<json_t *> fetched;
+  std::shared_future<json_t *> response = fetched.get_future().share();
+  // Only set once the response arrived, an entry being fetched never expires
+  std::chrono::steady_clock::time_point expires =
+      std::chrono::steady_clock::time_point::max();
+  json_t *owned = nullptr;  // the entry's own reference to the response
+  // Under cacheMtx. Coroutines waiting for the response, resumed on the
+  // event loop once it is there.
+  bool done = false;
+  std::vector<std::coroutine_handle<>> waiters;
+
+  ~CacheEntry() { json_decref(owned); }
+};
+
+// co_await'ed by cachedGetAsync for a response another request is fetching
+struct RestApi::CacheWaiter {
+  RestApi &api;
+  std::shared_ptr<CacheEntry> entry;
+
+  bool await_ready() {
+    std::lock_guard<std::mutex> lock(api.cacheMtx);
+    return entry->done;
+  }
+  bool await_suspend(std::coroutine_handle<> h) {
+    std::lock_guard<std::mutex> lock(api.cacheMtx);
+    if (entry->done)
+      return false;
+    entry->waiters.push_back(h);
+    return true;
+  }
+  // Throws what the fetch threw
+  json_t *await_resume() { return json_incref(entry->response.get()); }
+};
+
 void RestApi::CURL_deleter::operator () (CURL *C) {
   curl_easy_cleanup(C);
 }
@@ -75,36 +226,226 @@ void RestApi::CURL_deleter::operator () (curl_slist *slist) {
   curl_slist_free_all(slist);
 }
 
-RestApi::RestApi(string host, const char *cacert, std::ostream &log)
-    : C(curl_easy_init()), host(std::move(host)), log(log) {
-  assert(C != nullptr);
+RestApi::RestApi(string host, const char *cacert, LogStream log)
+    : cacert(cacert ? cacert : ""), host(replacementOf(host)),
+      source(hostName(host)), log(log) {
+  C = newHandle();
+
+  auto &registry = metrics();
+  counters.curlErrors = &registry.counter(
+      "blackbird_request_errors_total", "Failed requests",
+      {{"host", source}, {"error", "curl"}});
+  counters.jsonErrors = &registry.counter(
+      "blackbird_request_errors_total", "Failed requests",
+      {{"host", source}, {"error", "json"}});
+  counters.retries = &registry.counter("blackbird_request_retries_total",
+                                       "Requests sent again", {{"host", source}});
+
+}
 
-  if (cacert && strlen(cacert) != 0)
-    curl_easy_setopt(C.get(), CURLOPT_CAINFO, cacert);
+RestApi::unique_curl RestApi::newHandle() const {
+  unique_curl handle(curl_easy_init());
+  assert(handle != nullptr);
+  auto *C = handle.get();
+  if (!cacert.empty())
+    curl_easy_setopt(C, CURLOPT_CAINFO, cacert.c_str());
   else
-    curl_easy_setopt(C.get(), CURLOPT_SSL_VERIFYPEER, false);
+    curl_easy_setopt(C, CURLOPT_SSL_VERIFYPEER, false);
 
-  curl_easy_setopt(C.get(), CURLOPT_CONNECTTIMEOUT, 10L);
-  curl_easy_setopt(C.get(), CURLOPT_TIMEOUT, 20L);
-  curl_easy_setopt(C.get(), CURLOPT_USERAGENT, "Blackbird");
-  curl_easy_setopt(C.get(), CURLOPT_ACCEPT_ENCODING, "gzip");
+  curl_easy_setopt(C, CURLOPT_CONNECTTIMEOUT, 10L);
+  curl_easy_setopt(C, CURLOPT_TIMEOUT, 20L);
+  curl_easy_setopt(C, CURLOPT_USERAGENT, "Blackbird");
+  curl_easy_setopt(C, CURLOPT_ACCEPT_ENCODING, "gzip");
 
-  curl_easy_setopt(C.get(), CURLOPT_WRITEFUNCTION, recvCallback);
+  curl_easy_setopt(C, CURLOPT_WRITEFUNCTION, recvCallback);
+  curl_easy_setopt(C, CURLOPT_HEADERFUNCTION, headerCallback);
+  return handle;
+}
+
+RequestTimings &RestApi::timingsOf(const string &uri) {
+  auto endpoint = uri.substr(0, uri.find('?'));
+  auto it = timings.find(endpoint);
+  if (it != timings.end())
+    return it->second;
+
+  auto &registry = latency();
+  auto stage = [&](const char *name) {
+    return &registry.histogram(source, endpoint, name);
+  };
+  RequestTimings t = {stage("dns"),        stage("connect"),
+                      stage("tls"),        stage("first_byte"),
+                      stage("transfer"),   stage("total"),
+                      stage("parse")};
+  return timings.emplace(endpoint, t).first->second;
 }
 
 json_t* RestApi::getRequest(const string &uri, unique_slist headers) {
+  std::lock_guard<std::mutex> lock(curlMtx);
   curl_easy_setopt(C.get(), CURLOPT_HTTPGET, true);
-  return doRequest(C.get(), host + uri, headers.get(), log);
+  return doRequest(C.get(), host + uri, headers.get(), *log, timingsOf(uri),
+                   counters, source);
 }
 
 json_t* RestApi::postRequest (const string &uri,
                               unique_slist headers,
                               const string &post_data) {
+  std::lock_guard<std::mutex> lock(curlMtx);
   curl_easy_setopt(C.get(), CURLOPT_POSTFIELDS,     post_data.data());
   curl_easy_setopt(C.get(), CURLOPT_POSTFIELDSIZE,  post_data.size());
-  return doRequest(C.get(), host + uri, headers.get(), log);
+  return doRequest(C.get(), host + uri, headers.get(), *log, timingsOf(uri),
+                   counters, source);
 }
 
 json_t* RestApi::postRequest (const string &uri, const string &post_data) {
   return postRequest(uri, nullptr, post_data);
 }
+
+json_t* RestApi::deleteRequest(const string &uri, unique_slist headers) {
+  std::lock_guard<std::mutex> lock(curlMtx);
+  curl_easy_setopt(C.get(), CURLOPT_HTTPGET, true);
+  curl_easy_setopt(C.get(), CURLOPT_CUSTOMREQUEST, "DELETE");
+  auto root = doRequest(C.get(), host + uri, headers.get(), *log,
+                        timingsOf(uri), counters, source);
+  // The handle goes on with the other requests
+  curl_easy_setopt(C.get(), CURLOPT_CUSTOMREQUEST, nullptr);
+  return root;
+}
+
+// Takes the entry of 'uri', unless a live one is there already
+std::shared_ptr<RestApi::CacheEntry> RestApi::cacheEntry(const string &uri,
+                                                         bool &fetching) {
+  std::lock_guard<std::mutex> lock(cacheMtx);
+  auto &slot = cache[uri];
+  fetching = !slot || std::chrono::steady_clock::now() >= slot->expires;
+  // Waiters of an expired entry keep it alive through their own copy
+  if (fetching)
+    slot = std::make_shared<CacheEntry>();
+  return slot;
+}
+
+void RestApi::publish(const string &uri, std::shared_ptr<CacheEntry> const &entry,
+                      json_t *root, std::exception_ptr error,
+                      std::chrono::milliseconds ttl) {
+  std::vector<std::coroutine_handle<>> waiters;
+  {
+    std::lock_guard<std::mutex> lock(cacheMtx);
+    if (error) {
+      entry->fetched.set_exception(error);
+      auto it = cache.find(uri);
+      if (it != cache.end() && it->second == entry)
+        cache.erase(it);
+    } else {
+      entry->owned = root;
+      entry->fetched.set_value(root);
+      entry->expires = std::chrono::steady_clock::now() + ttl;
+    }
+    entry->done = true;
+    waiters.swap(entry->waiters);
+  }
+  for (auto h : waiters)
+    eventLoop().post([h] { h.resume(); });
+}
+
+json_t* RestApi::cachedGet(const string &uri, std::chrono::milliseconds ttl) {
+  bool fetching;
+  auto entry = cacheEntry(uri, fetching);
+  if (fetching) {
+    json_t *root;
+    try {
+      root = getRequest(uri);
+    } catch (...) {
+      publish(uri, entry, nullptr, std::current_exception(), ttl);
+      throw;
+    }
+    publish(uri, entry, root, nullptr, ttl);
+  }
+  return json_incref(entry->response.get());
+}
+
+task<json_t*> RestApi::requestAsync(unique_curl C, string uri,
+                                    unique_slist headers) {
+  RequestTimings *t;
+  {
+    std::lock_guard<std::mutex> lock(curlMtx);
+    t = &timingsOf(uri);
+  }
+  auto url = host + uri;
+  std::string recvBuffer;
+  time_t serverDate = 0;
+  curl_easy_setopt(C.get(), CURLOPT_WRITEDATA, &recvBuffer);
+  curl_easy_setopt(C.get(), CURLOPT_HEADERDATA, &serverDate);
+  curl_easy_setopt(C.get(), CURLOPT_URL, url.c_str());
+  curl_easy_setopt(C.get(), CURLOPT_HTTPHEADER, headers.get());
+  curl_easy_setopt(C.get(), CURLOPT_DNS_CACHE_TIMEOUT, 3600);
+
+  auto &loop = eventLoop();
+  for (;;) {
+    CURLcode resCurl = co_await loop.transfer(C.get());
+    if (resCurl != CURLE_OK) {
+      curlFailed(resCurl, url, *log, counters);
+    } else if (json_t *root = parseResponse(C.get(), recvBuffer, url, *log, *t,
+                                            counters)) {
+      recordClock(C.get(), serverDate, source);
+      co_return root;
+    }
+    counters.retries->inc();
+    *log << "  Retry in 2 sec..." << std::endl;
+    co_await loop.sleep(std::chrono::seconds(2));
+    recvBuffer.clear();
+    curl_easy_setopt(C.get(), CURLOPT_DNS_CACHE_TIMEOUT, 0);
+  }
+}
+
+task<json_t*> RestApi::getAsync(string uri, unique_slist headers) {
+  auto C = newHandle();
+  curl_easy_setopt(C.get(), CURLOPT_HTTPGET, 1L);
+  co_return co_await requestAsync(std::move(C), std::move(uri),
+                                  std::move(headers));
+}
+
+task<json_t*> RestApi::postAsync(string uri, unique_slist headers,
+                                 string post_data) {
+  auto C = newHandle();
+  curl_easy_setopt(C.get(), CURLOPT_POSTFIELDSIZE, post_data.size());
+  curl_easy_setopt(C.get(), CURLOPT_COPYPOSTFIELDS, post_data.c_str());
+  co_return co_await requestAsync(std::move(C), std::move(uri),
+                                  std::move(headers));
+}
+
+task<json_t*> RestApi::deleteAsync(string uri, unique_slist headers) {
+  auto C = newHandle();
+  curl_easy_setopt(C.get(), CURLOPT_HTTPGET, 1L);
+  curl_easy_setopt(C.get(), CURLOPT_CUSTOMREQUEST, "DELETE");
+  co_return co_await requestAsync(std::move(C), std::move(uri),
+                                  std::move(headers));
+}
+
+task<json_t*> RestApi::cachedGetAsync(string uri,
+                                      std::chrono::milliseconds ttl) {
+  bool fetching;
+  auto entry = cacheEntry(uri, fetching);
+  if (!fetching) {
+    CacheWaiter waiter{*this, entry};
+    co_return co_await waiter;
+  }
+
+  json_t *root;
+  try {
+    root = co_await getAsync(uri);
+  } catch (...) {
+    publish(uri, entry, nullptr, std::current_exception(), ttl);
+    throw;
+  }
+  publish(uri, entry, root, nullptr, ttl);
+  co_return json_incref(root);
+}
+
+void RestApi::overrideHost(const string &host, const string &replacement) {
+  std::lock_guard<std::mutex> lock(overridesMtx);
+  overrides()[host] = replacement;
+}
+
+std::map<std::string, std::chrono::milliseconds> RestApi::clockOffsets() {
+  std::lock_guard<std::mutex> lock(clockMtx);
+  return clockTable();
+}
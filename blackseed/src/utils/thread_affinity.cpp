@@ -0,0 +1,28 @@
+#include "thread_affinity.h"
+
+#if defined(_MSC_VER)
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+bool pinThisThread(int cpu) {
+  if (cpu < 0)
+    return true;
+#if defined(_MSC_VER)
+  if (cpu >= 64)
+    return false;
+  return SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpu) != 0;
+#elif defined(__linux__)
+  if (cpu >= CPU_SETSIZE)
+    return false;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+  // No affinity API (e.g. macOS), threads stay where the system puts them
+  return false;
+#endif
+}
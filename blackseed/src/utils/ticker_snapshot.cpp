@@ -0,0 +1,61 @@
+#include "ticker_snapshot.h"
+#include "restapi.h"
+#include "unique_json.hpp"
+
+TickerSnapshot::TickerSnapshot(RestApi &api, std::string uri, Parser parse,
+                               std::chrono::milliseconds ttl)
+    : api(api), uri(std::move(uri)), parse(parse), ttl(ttl) {}
+
+// The functions below are called with 'mtx' held
+bool TickerSnapshot::isFresh() const {
+  return valid && std::chrono::steady_clock::now() - fetched < ttl;
+}
+
+// A failed request leaves an empty snapshot rather than stale quotes,
+// and is retried after the TTL like a successful one.
+void TickerSnapshot::store(json_t *root) {
+  table.clear();
+  if (root)
+    parse(root, table);
+  fetched = std::chrono::steady_clock::now();
+  valid = true;
+}
+
+void TickerSnapshot::refresh() {
+  if (isFresh())
+    return;
+  unique_json root{api.cachedGet(uri, ttl)};
+  store(root.get());
+}
+
+quote_t TickerSnapshot::find(std::string const &market) const {
+  auto it = table.find(market);
+  return it != table.end() ? it->second : quote_t(0.0, 0.0);
+}
+
+quote_t TickerSnapshot::quote(std::string const &market) {
+  std::lock_guard<std::mutex> lock(mtx);
+  refresh();
+  return find(market);
+}
+
+task<quote_t> TickerSnapshot::quoteAsync(std::string market) {
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (isFresh())
+      co_return find(market);
+  }
+  // No lock across the request, the coroutine may resume on another thread.
+  // RestApi sends one request for all the callers that get here meanwhile.
+  unique_json root{co_await api.cachedGetAsync(uri, ttl)};
+  std::lock_guard<std::mutex> lock(mtx);
+  if (!isFresh())
+    store(root.get());
+  co_return find(market);
+}
+
+std::map<std::string, quote_t> TickerSnapshot::quotes() {
+  std::lock_guard<std::mutex> lock(mtx);
+  refresh();
+  return table;
+}
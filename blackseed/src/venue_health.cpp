@@ -0,0 +1,139 @@
+#include "venue_health.h"
+#include "parameters.h"
+#include "utils/clock.h"
+#include "utils/metrics.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+namespace {
+
+// Requests the latency percentiles are taken from
+const size_t latencyWindow = 64;
+
+// How close 'value' is to 'limit': 1 at 0, 0 at the limit and above. No
+// limit (0) scores 1.
+double margin(double value, double limit) {
+  if (limit <= 0.0)
+    return 1.0;
+  return 1.0 - (std::min)(value / limit, 1.0);
+}
+
+int64_t percentile(std::vector<int64_t> values, double p) {
+  if (values.empty())
+    return 0;
+  auto nth = values.begin() + static_cast<size_t>(p * (values.size() - 1));
+  std::nth_element(values.begin(), nth, values.end());
+  return *nth;
+}
+}
+
+VenueHealth::VenueHealth(Parameters &params)
+    : params(params), venues(params.exchangeNames.size()),
+      lastUpdate(Clock::monoNs()) {
+  for (size_t i = 0; i < venues.size(); ++i) {
+    auto const &name = params.exchangeNames[i];
+    auto &venue = venues[i];
+    venue.latencies.reserve(latencyWindow);
+    venue.scoreGauge = &metrics().gauge(
+        "blackbird_venue_health",
+        "Health of the exchange's quotes, from 0 (no new position) to 1",
+        {{"exchange", name}});
+    venue.ageGauge = &metrics().gauge(
+        "blackbird_venue_quote_age_seconds",
+        "Time since the exchange's bid or ask last moved",
+        {{"exchange", name}});
+    venue.rateGauge =
+        &metrics().gauge("blackbird_venue_update_rate",
+                         "Quotes that moved per second", {{"exchange", name}});
+    venue.errorGauge = &metrics().gauge(
+        "blackbird_venue_error_rate",
+        "Share of the recent quotes that were null or crossed",
+        {{"exchange", name}});
+    venue.p50Gauge = &metrics().gauge(
+        "blackbird_venue_quote_latency_seconds",
+        "Latency of the recent quote requests",
+        {{"exchange", name}, {"quantile", "0.5"}});
+    venue.p99Gauge = &metrics().gauge(
+        "blackbird_venue_quote_latency_seconds",
+        "Latency of the recent quote requests",
+        {{"exchange", name}, {"quantile", "0.99"}});
+  }
+}
+
+void VenueHealth::onQuote(QuoteEvent const &event) {
+  auto &venue = venues[event.exch];
+  bool invalid =
+      event.bid <= 0.0 || event.ask <= 0.0 || event.bid > event.ask;
+  // About the last 16 quotes
+  venue.errorRate += ((invalid ? 1.0 : 0.0) - venue.errorRate) / 16.0;
+
+  if (venue.latencies.size() < latencyWindow)
+    venue.latencies.push_back(event.latency);
+  else
+    venue.latencies[venue.nextLatency] = event.latency;
+  venue.nextLatency = (venue.nextLatency + 1) % latencyWindow;
+
+  if (!invalid && (event.bid != venue.bid || event.ask != venue.ask)) {
+    venue.bid = event.bid;
+    venue.ask = event.ask;
+    venue.lastMove = event.received.mono;
+    ++venue.moves;
+  }
+}
+
+void VenueHealth::update() {
+  auto const &strategy = params.strategy();
+  auto now = Clock::monoNs();
+  // The rates are taken over a second at least
+  double elapsed = (now - lastUpdate) / 1e9;
+  bool newRate = elapsed >= 1.0;
+  if (newRate)
+    lastUpdate = now;
+
+  for (size_t i = 0; i < venues.size(); ++i) {
+    auto &venue = venues[i];
+    if (newRate) {
+      venue.updateRate = 0.7 * venue.updateRate + 0.3 * venue.moves / elapsed;
+      venue.moves = 0;
+    }
+    double age = venue.lastMove ? (now - venue.lastMove) / 1e9 : 0.0;
+    auto p50 = percentile(venue.latencies, 0.5);
+    auto p99 = percentile(venue.latencies, 0.99);
+
+    double fresh = venue.lastMove
+                       ? margin(age, strategy.frozenQuoteAge / 1000.0)
+                       : 0.0;
+    double reliable = margin(venue.errorRate, strategy.maxQuoteErrorRate);
+    double fast = margin(p99 / 1e6, strategy.maxQuoteLatency);
+    double score = (std::min)({fresh, reliable, fast});
+
+    // A venue that never quoted is already reported by the warm-up
+    auto &logFile = *params.logFile;
+    if (score == 0.0 && venue.lastMove && !venue.warned) {
+      std::ostringstream reason;
+      reason << std::fixed << std::setprecision(1);
+      if (fresh == 0.0)
+        reason << "quote unchanged for " << age << " s";
+      else if (reliable == 0.0)
+        reason << venue.errorRate * 100.0 << "% of its quotes invalid";
+      else
+        reason << "quote requests take " << p99 / 1e6 << " ms (p99)";
+      logFile << "WARNING: " << params.exchangeNames[i] << " unhealthy, "
+              << reason.str() << ", no new position on it" << std::endl;
+      venue.warned = true;
+    } else if (score > 0.0 && venue.warned) {
+      logFile << params.exchangeNames[i] << " healthy again" << std::endl;
+      venue.warned = false;
+    }
+    venue.score = score;
+
+    venue.scoreGauge->set(score);
+    venue.ageGauge->set(age);
+    venue.rateGauge->set(venue.updateRate);
+    venue.errorGauge->set(venue.errorRate);
+    venue.p50Gauge->set(p50 / 1e9);
+    venue.p99Gauge->set(p99 / 1e9);
+  }
+}
@@ -0,0 +1,86 @@
+#include "warmup.h"
+#include "balance_ledger.h"
+#include "exchange_registry.h"
+#include "parameters.h"
+#include "utils/event_loop.h"
+#include "utils/restapi.h"
+
+#include <cmath>
+#include <future>
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+
+namespace {
+
+using std::chrono::steady_clock;
+
+std::chrono::milliseconds since(steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(steady_clock::now() -
+                                                                start);
+}
+
+task<void> firstQuote(Parameters &params, ExchangeApi const &exchange,
+                      VenueReadiness &venue, std::promise<void> done) {
+  auto start = steady_clock::now();
+  auto quote = co_await exchange.getQuote(params);
+  venue.quote = quote.bid() > 0.0 && quote.ask() > 0.0;
+  venue.quoteTime = since(start);
+  done.set_value();
+}
+}
+
+std::vector<VenueReadiness> warmUp(Parameters &params,
+                                   std::vector<ExchangeApi> const &exchanges,
+                                   BalanceLedger *ledger) {
+  std::vector<VenueReadiness> venues(exchanges.size());
+  std::vector<std::future<void>> quotes;
+  for (size_t i = 0; i < exchanges.size(); ++i) {
+    std::promise<void> done;
+    quotes.push_back(done.get_future());
+    eventLoop().spawn(
+        firstQuote(params, exchanges[i], venues[i], std::move(done)));
+  }
+
+  std::vector<std::future<void>> books;
+  for (size_t i = 0; i < exchanges.size(); ++i)
+    books.push_back(std::async(std::launch::async, [&, i] {
+      auto start = steady_clock::now();
+      // A small order, priced from the top of the book
+      venues[i].book = exchanges[i].getLimitPrice(params, 0.001, true) > 0.0;
+      venues[i].bookTime = since(start);
+    }));
+  if (ledger)
+    ledger->reconcileAll();
+  for (auto &book : books)
+    book.get();
+  for (auto &quote : quotes)
+    quote.get();
+  return venues;
+}
+
+void logReadiness(std::ostream &log, Parameters const &params,
+                  std::vector<VenueReadiness> const &venues,
+                  std::chrono::milliseconds elapsed) {
+  log << "[ Exchanges ]" << std::endl;
+  for (size_t i = 0; i < venues.size(); ++i) {
+    auto const &venue = venues[i];
+    log << "   " << params.exchangeNames[i] << ":\tquote "
+        << (venue.quote ? "ok" : "null") << " (" << venue.quoteTime.count()
+        << " ms), order book " << (venue.book ? "ok" : "empty") << " ("
+        << venue.bookTime.count() << " ms)" << std::endl;
+  }
+  for (auto const &host : RestApi::clockOffsets()) {
+    auto seconds = host.second.count() / 1000.0;
+    std::ostringstream offset;
+    offset << std::showpos << std::fixed << std::setprecision(1) << seconds;
+    log << "   " << host.first << " clock: " << offset.str() << " s"
+        << std::endl;
+    if (std::abs(seconds) > 1.0)
+      log << "   WARNING: " << host.first
+          << " clock is more than a second off ours, check the system "
+             "clock"
+          << std::endl;
+  }
+  log << "   Ready in " << elapsed.count() << " ms\n" << std::endl;
+}